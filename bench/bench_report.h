@@ -0,0 +1,117 @@
+// Shared by logkv_bench and logkv_loadgen: latency percentiles and result
+// lines that are easy to read and easy to diff between releases.
+//
+// Every result is one line. By default it's key=value pairs; with --json
+// it's one JSON object per line, so a regression check can just parse the
+// file and compare fields by name.
+
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace bench {
+
+// Latency samples in nanoseconds. Keeps every sample, which is fine for
+// benchmark-sized runs and gives exact percentiles.
+class Latencies {
+public:
+    void record(uint64_t ns) {
+        samples_.push_back(ns);
+        sorted_ = false;
+    }
+
+    void merge(const Latencies& other) {
+        samples_.insert(samples_.end(), other.samples_.begin(), other.samples_.end());
+        sorted_ = false;
+    }
+
+    size_t count() const { return samples_.size(); }
+
+    // q in [0, 1]; 0 when there are no samples
+    uint64_t percentile(double q) {
+        if (samples_.empty()) return 0;
+        if (!sorted_) {
+            std::sort(samples_.begin(), samples_.end());
+            sorted_ = true;
+        }
+        size_t rank = static_cast<size_t>(q * static_cast<double>(samples_.size() - 1) + 0.5);
+        return samples_[std::min(rank, samples_.size() - 1)];
+    }
+
+    uint64_t max() { return percentile(1.0); }
+
+private:
+    std::vector<uint64_t> samples_;
+    bool sorted_ = true;
+};
+
+// One result line: fields print in the order they were added
+class Result {
+public:
+    explicit Result(std::string name) { add("bench", std::move(name)); }
+
+    Result& add(const std::string& key, const std::string& value) {
+        fields_.emplace_back(key, quote(value));
+        return *this;
+    }
+
+    Result& add(const std::string& key, const char* value) {
+        return add(key, std::string(value));
+    }
+
+    template <typename T>
+    Result& add(const std::string& key, T value) {
+        std::ostringstream oss;
+        oss << value;
+        fields_.emplace_back(key, oss.str());
+        return *this;
+    }
+
+    // ops, ops_per_sec and p50/p99/p999/max latency in microseconds
+    Result& throughput(uint64_t ops, double seconds, Latencies& latencies) {
+        add("ops", ops);
+        add("ops_per_sec", static_cast<uint64_t>(seconds > 0 ? ops / seconds : 0));
+        add("p50_us", latencies.percentile(0.50) / 1000.0);
+        add("p99_us", latencies.percentile(0.99) / 1000.0);
+        add("p999_us", latencies.percentile(0.999) / 1000.0);
+        add("max_us", latencies.max() / 1000.0);
+        return *this;
+    }
+
+    void print(bool json, std::ostream& os = std::cout) const {
+        std::ostringstream out;
+        if (json) out << "{";
+        for (size_t i = 0; i < fields_.size(); i++) {
+            const auto& [key, value] = fields_[i];
+            if (json) {
+                out << (i ? ", " : "") << '"' << key << "\": " << value;
+            } else {
+                bool quoted = value.size() >= 2 && value.front() == '"';
+                out << (i ? " " : "") << key << "="
+                    << (quoted ? value.substr(1, value.size() - 2) : value);
+            }
+        }
+        if (json) out << "}";
+        os << out.str() << std::endl;
+    }
+
+private:
+    std::vector<std::pair<std::string, std::string>> fields_;
+
+    static std::string quote(const std::string& s) {
+        std::string out = "\"";
+        for (char c : s) {
+            if (c == '"' || c == '\\') out += '\\';
+            out += c;
+        }
+        return out + "\"";
+    }
+};
+
+}  // namespace bench
@@ -0,0 +1,463 @@
+// In-process microbenchmarks for the pieces on the request path.
+//
+// Usage: logkv_bench [--only store,map,wal,queue,snapshot] [--json] [--seconds S]
+//                    [--keys N] [--entries N] [--value-bytes N] [--threads N]
+//                    [--wal-sync per_entry|batch|os] [--dir PATH]
+//
+//   store     KVStore GET and PUT as threads are added
+//   map       One shard's map: std::unordered_map against FlatStringMap, PUT
+//             (filling from empty), GET hits and misses, and heap bytes per
+//             entry; whichever one KVStore was built with (LOGKV_FLAT_MAP)
+//   wal       WriteAheadLog appendEntry / appendEntries, then replay()
+//   queue     EventQueue push-to-pop latency with 1..N producers
+//   snapshot  SnapshotManager create (from a frozen view) and load
+//
+// Prints one result line per case (see bench_report.h); --json makes them
+// JSON objects for regression tracking. The WAL defaults to --wal-sync os so
+// the numbers are about our code rather than the disk.
+
+#include "bench_report.h"
+#include "../src/event_queue.h"
+#include "../src/flat_map.h"
+#include "../src/snapshot.h"
+#include "../src/store.h"
+#include "../src/wal.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <malloc.h>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::set<std::string> only;
+    bool json = false;
+    double seconds = 1.0;
+    size_t keys = 100000;
+    int entries = 100000;
+    size_t value_bytes = 100;
+    unsigned threads = std::max(4u, std::thread::hardware_concurrency());
+    WalSyncMode wal_sync = WalSyncMode::OS;
+    std::string dir = "logkv_bench_data";
+    std::ostream* out = &std::cout;     // Results; the library's own logging is muted
+
+    bool enabled(const std::string& name) const { return only.empty() || only.count(name); }
+};
+
+uint64_t nanosSince(Clock::time_point start) {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+}
+
+double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+std::string keyFor(size_t i) {
+    return "key" + std::to_string(i);
+}
+
+// ============================================================================
+// KVStore
+// ============================================================================
+
+void benchStore(const Options& opts) {
+    KVStore store;
+    std::vector<std::string> keys;
+    keys.reserve(opts.keys);
+    std::string value(opts.value_bytes, 'v');
+    for (size_t i = 0; i < opts.keys; i++) {
+        keys.push_back(keyFor(i));
+        store.put(keys.back(), value);
+    }
+
+    // Timing every op would mostly measure the clock: sample one in 64
+    constexpr uint64_t kSampleEvery = 64;
+
+    for (bool writes : {false, true}) {
+        for (unsigned threads = 1; threads <= opts.threads; threads *= 2) {
+            std::atomic<bool> stop{false};
+            std::vector<uint64_t> ops(threads, 0);
+            std::vector<bench::Latencies> latencies(threads);
+            std::vector<std::thread> workers;
+
+            auto start = Clock::now();
+            for (unsigned t = 0; t < threads; t++) {
+                workers.emplace_back([&, t]() {
+                    std::mt19937_64 rng(t + 1);
+                    std::uniform_int_distribution<size_t> pick(0, keys.size() - 1);
+                    std::string out;
+                    uint64_t n = 0;
+                    while (!stop.load(std::memory_order_relaxed)) {
+                        const std::string& key = keys[pick(rng)];
+                        bool sample = n % kSampleEvery == 0;
+                        auto op_start = sample ? Clock::now() : Clock::time_point();
+                        if (writes) {
+                            store.put(key, value);
+                        } else {
+                            store.get(key, out);
+                        }
+                        if (sample) latencies[t].record(nanosSince(op_start));
+                        n++;
+                    }
+                    ops[t] = n;
+                });
+            }
+
+            std::this_thread::sleep_for(std::chrono::duration<double>(opts.seconds));
+            stop = true;
+            for (auto& w : workers) w.join();
+            double elapsed = secondsSince(start);
+
+            bench::Latencies all;
+            uint64_t total = 0;
+            for (unsigned t = 0; t < threads; t++) {
+                all.merge(latencies[t]);
+                total += ops[t];
+            }
+            bench::Result(writes ? "store.put" : "store.get")
+                .add("threads", threads)
+                .add("keys", opts.keys)
+                .throughput(total, elapsed, all)
+                .print(opts.json, *opts.out);
+        }
+    }
+}
+
+// ============================================================================
+// Shard map
+// ============================================================================
+
+// Heap bytes handed out and not yet freed
+size_t heapInUse() {
+#ifdef __GLIBC__
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;     // Large blocks are mmapped
+#else
+    return 0;
+#endif
+}
+
+template <typename Map>
+void benchMapImpl(const Options& opts, const char* impl) {
+    std::vector<std::string> keys;
+    keys.reserve(opts.keys);
+    for (size_t i = 0; i < opts.keys; i++) {
+        keys.push_back(keyFor(i));
+    }
+    std::shuffle(keys.begin(), keys.end(), std::mt19937_64(1));
+    std::string value(opts.value_bytes, 'v');
+
+    // Filling from empty, growth included. Values are built outside the
+    // timed part but inside the heap measurement, same as the keys' copies.
+    std::vector<KVStore::Value> values;
+    values.reserve(keys.size());
+    size_t heap_before = heapInUse();
+    for (size_t i = 0; i < keys.size(); i++) {
+        values.emplace_back(value, 0, 0);
+    }
+    auto map = std::make_unique<Map>();
+    auto start = Clock::now();
+    for (size_t i = 0; i < keys.size(); i++) {
+        map->try_emplace(keys[i], std::move(values[i]));
+    }
+    double elapsed = secondsSince(start);
+    size_t heap_used = heapInUse() - heap_before;
+    bench::Result("map.put")
+        .add("impl", impl)
+        .add("keys", opts.keys)
+        .add("ops", static_cast<uint64_t>(keys.size()))
+        .add("ops_per_sec", static_cast<uint64_t>(elapsed > 0 ? keys.size() / elapsed : 0))
+        .add("bytes_per_entry", static_cast<uint64_t>(heap_used / keys.size()))
+        .print(opts.json, *opts.out);
+
+    // Timing every op would mostly measure the clock: sample one in 64
+    constexpr uint64_t kSampleEvery = 64;
+    for (bool hits : {true, false}) {
+        std::vector<std::string> probes = keys;
+        if (!hits) {
+            for (auto& key : probes) key += "-absent";
+        }
+        std::mt19937_64 rng(2);
+        std::uniform_int_distribution<size_t> pick(0, probes.size() - 1);
+        bench::Latencies latencies;
+        uint64_t n = 0;
+        size_t found = 0;
+        auto run_start = Clock::now();
+        auto deadline = run_start + std::chrono::duration<double>(opts.seconds);
+        while ((n & 1023) != 0 || Clock::now() < deadline) {
+            const std::string& key = probes[pick(rng)];
+            bool sample = n % kSampleEvery == 0;
+            auto op_start = sample ? Clock::now() : Clock::time_point();
+            found += map->find(key) != map->end();
+            if (sample) latencies.record(nanosSince(op_start));
+            n++;
+        }
+        double run_elapsed = secondsSince(run_start);
+        bench::Result(hits ? "map.get" : "map.get_miss")
+            .add("impl", impl)
+            .add("keys", opts.keys)
+            .add("found", static_cast<uint64_t>(found))
+            .throughput(n, run_elapsed, latencies)
+            .print(opts.json, *opts.out);
+    }
+}
+
+void benchMap(const Options& opts) {
+    benchMapImpl<std::unordered_map<std::string, KVStore::Value>>(opts, "std");
+    benchMapImpl<FlatStringMap<KVStore::Value>>(opts, "flat");
+}
+
+// ============================================================================
+// WriteAheadLog
+// ============================================================================
+
+void benchWal(const Options& opts) {
+    std::string dir = opts.dir + "/wal";
+    std::filesystem::remove_all(dir);
+
+    WalOptions wal_options;
+    wal_options.sync_mode = opts.wal_sync;
+    std::string value(opts.value_bytes, 'v');
+    int half = opts.entries / 2;
+
+    {
+        WriteAheadLog wal(dir, wal_options);
+
+        // One entry per call, the way followers used to append
+        bench::Latencies latencies;
+        auto start = Clock::now();
+        for (int i = 1; i <= half; i++) {
+            auto op_start = Clock::now();
+            wal.appendEntry(LogEntry(i, 1, keyFor(i % opts.keys), value));
+            latencies.record(nanosSince(op_start));
+        }
+        bench::Result("wal.append")
+            .add("value_bytes", opts.value_bytes)
+            .throughput(half, secondsSince(start), latencies)
+            .print(opts.json, *opts.out);
+
+        // Batches, the way the leader appends queued PUTs
+        constexpr int kBatch = 256;
+        bench::Latencies batch_latencies;
+        std::vector<LogEntry> batch;
+        start = Clock::now();
+        for (int i = half + 1; i <= opts.entries; i += kBatch) {
+            batch.clear();
+            for (int j = i; j < i + kBatch && j <= opts.entries; j++) {
+                batch.emplace_back(j, 1, keyFor(j % opts.keys), value);
+            }
+            auto op_start = Clock::now();
+            wal.appendEntries(batch);
+            batch_latencies.record(nanosSince(op_start));
+        }
+        bench::Result("wal.append_batch")
+            .add("batch", kBatch)     // Latencies are per appendEntries() call
+            .add("value_bytes", opts.value_bytes)
+            .throughput(opts.entries - half, secondsSince(start), batch_latencies)
+            .print(opts.json, *opts.out);
+    }
+
+    // Reopen (scan + cache rebuild) and replay everything, as on startup
+    for (unsigned threads = 1; threads <= opts.threads; threads *= 2) {
+        auto start = Clock::now();
+        WriteAheadLog wal(dir, wal_options);
+        double open_seconds = secondsSince(start);
+
+        KVStore store;
+        auto replay_start = Clock::now();
+        WalReplayStats stats = wal.replay(store, 0, threads);
+        double replay_seconds = secondsSince(replay_start);
+
+        bench::Result("wal.replay")
+            .add("threads", stats.threads)
+            .add("entries", stats.entries)
+            .add("open_ms", open_seconds * 1000)
+            .add("replay_ms", replay_seconds * 1000)
+            .add("entries_per_sec",
+                 static_cast<uint64_t>(replay_seconds > 0 ? stats.entries / replay_seconds : 0))
+            .print(opts.json, *opts.out);
+    }
+    std::filesystem::remove_all(dir);
+}
+
+// ============================================================================
+// EventQueue
+// ============================================================================
+
+void benchQueue(const Options& opts) {
+    const size_t per_producer = static_cast<size_t>(std::max(1, opts.entries));
+
+    for (unsigned producers = 1; producers <= opts.threads; producers *= 2) {
+        EventQueue queue;
+        // Push times by (producer, sequence); events carry both in int fields
+        std::vector<std::vector<uint64_t>> pushed_at(producers,
+                                                     std::vector<uint64_t>(per_producer));
+        auto base = Clock::now();
+        bench::Latencies latencies;
+
+        std::thread consumer([&]() {
+            size_t remaining = per_producer * producers;
+            std::vector<Event> events;
+            while (remaining > 0 && queue.drain(events, EventQueue::kDefaultCapacity)) {
+                uint64_t now = nanosSince(base);
+                for (const auto& e : events) {
+                    latencies.record(now - pushed_at[e.candidate_id][e.index]);
+                }
+                remaining -= events.size();
+                events.clear();
+            }
+        });
+
+        auto start = Clock::now();
+        std::vector<std::thread> threads;
+        for (unsigned p = 0; p < producers; p++) {
+            threads.emplace_back([&, p]() {
+                for (size_t i = 0; i < per_producer; i++) {
+                    Event e;
+                    e.type = EventType::REPL_ACK;
+                    e.candidate_id = static_cast<int>(p);
+                    e.index = static_cast<int>(i);
+                    pushed_at[p][i] = nanosSince(base);
+                    queue.push(std::move(e));
+                }
+            });
+        }
+        for (auto& t : threads) t.join();
+        consumer.join();
+        double elapsed = secondsSince(start);
+
+        EventQueueStats stats = queue.stats();
+        bench::Result("queue.push_pop")
+            .add("producers", producers)
+            .throughput(per_producer * producers, elapsed, latencies)
+            .add("full_waits", stats.producer_full_waits)
+            .add("consumer_parks", stats.consumer_parks)
+            .print(opts.json, *opts.out);
+    }
+}
+
+// ============================================================================
+// Snapshots
+// ============================================================================
+
+void benchSnapshot(const Options& opts) {
+    std::string dir = opts.dir + "/snapshots";
+    std::filesystem::remove_all(dir);
+
+    KVStore store;
+    std::string value(opts.value_bytes, 'v');
+    for (size_t i = 0; i < opts.keys; i++) {
+        // Some variety so compression has something to do
+        std::string v = value;
+        std::string tag = std::to_string(i * 2654435761u);
+        v.replace(0, std::min(tag.size(), v.size()), tag.substr(0, v.size()));
+        store.put(keyFor(i), v);
+    }
+    size_t raw_bytes = 0;
+    for (size_t i = 0; i < opts.keys; i++) {
+        raw_bytes += keyFor(i).size() + opts.value_bytes;
+    }
+
+    for (SnapshotCompression codec : {SnapshotCompression::LZ4, SnapshotCompression::NONE}) {
+        const char* codec_name = codec == SnapshotCompression::LZ4 ? "lz4" : "none";
+        SnapshotOptions snapshot_options;
+        snapshot_options.compression = codec;
+        SnapshotManager manager(dir, 1, snapshot_options);
+
+        auto start = Clock::now();
+        bool created;
+        {
+            auto view = store.snapshot();
+            created = view && manager.createSnapshot(*view, static_cast<int>(opts.keys), 1);
+        }
+        double create_seconds = secondsSince(start);
+
+        SnapshotMetadata metadata;
+        uint64_t file_bytes = 0;
+        int fd = manager.openLatestSnapshot(metadata, file_bytes);
+        if (fd >= 0) close(fd);
+
+        KVStore loaded;
+        start = Clock::now();
+        bool ok = created && manager.loadSnapshot(loaded, metadata) &&
+                  loaded.size() == store.size();
+        double load_seconds = secondsSince(start);
+
+        bench::Result("snapshot")
+            .add("codec", codec_name)
+            .add("ok", ok ? "true" : "false")
+            .add("keys", opts.keys)
+            .add("raw_mb", raw_bytes / 1048576.0)
+            .add("file_mb", file_bytes / 1048576.0)
+            .add("create_ms", create_seconds * 1000)
+            .add("load_ms", load_seconds * 1000)
+            .add("load_records_per_sec",
+                 static_cast<uint64_t>(load_seconds > 0 ? loaded.size() / load_seconds : 0))
+            .print(opts.json, *opts.out);
+        std::filesystem::remove_all(dir);
+    }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    Options opts;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--only" && i + 1 < argc) {
+            std::istringstream names(argv[++i]);
+            std::string name;
+            while (std::getline(names, name, ',')) opts.only.insert(name);
+        } else if (arg == "--json") {
+            opts.json = true;
+        } else if (arg == "--seconds" && i + 1 < argc) {
+            opts.seconds = std::stod(argv[++i]);
+        } else if (arg == "--keys" && i + 1 < argc) {
+            opts.keys = std::max<size_t>(1, std::stoul(argv[++i]));
+        } else if (arg == "--entries" && i + 1 < argc) {
+            opts.entries = std::max(2, std::stoi(argv[++i]));
+        } else if (arg == "--value-bytes" && i + 1 < argc) {
+            opts.value_bytes = std::stoul(argv[++i]);
+        } else if (arg == "--threads" && i + 1 < argc) {
+            opts.threads = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--wal-sync" && i + 1 < argc) {
+            std::string mode = argv[++i];
+            opts.wal_sync = mode == "per_entry" ? WalSyncMode::PER_ENTRY
+                          : mode == "batch"     ? WalSyncMode::BATCH
+                                                : WalSyncMode::OS;
+        } else if (arg == "--dir" && i + 1 < argc) {
+            opts.dir = argv[++i];
+        }
+    }
+
+    // The library logs progress to stdout; keep it off the result stream
+    std::ostream results(std::cout.rdbuf());
+    opts.out = &results;
+    std::cout.rdbuf(nullptr);
+
+    std::filesystem::create_directories(opts.dir);
+    if (opts.enabled("store")) benchStore(opts);
+    if (opts.enabled("map")) benchMap(opts);
+    if (opts.enabled("wal")) benchWal(opts);
+    if (opts.enabled("queue")) benchQueue(opts);
+    if (opts.enabled("snapshot")) benchSnapshot(opts);
+    std::filesystem::remove_all(opts.dir);
+    
+    std::cout.rdbuf(results.rdbuf());
+    std::cout.clear();
+    return 0;
+}
@@ -0,0 +1,359 @@
+// Network load generator for a running cluster (binary client protocol).
+//
+// Usage: logkv_loadgen [--servers host:port,...] [--mode closed|open]
+//                      [--connections N] [--depth N] [--rate OPS]
+//                      [--seconds S] [--warmup S] [--read-pct P]
+//                      [--keys N] [--value-bytes N] [--json]
+//
+// closed: every connection keeps --depth requests in flight and sends the
+//         next one as soon as a response comes back. Measures what the
+//         cluster can sustain; latency grows with depth.
+// open:   requests go out on a fixed schedule (--rate in total, spread over
+//         the connections) whether or not earlier ones have been answered.
+//         Latency is measured from when a request was due, not when it was
+//         actually sent, so a stalled server shows up in the tail instead of
+//         quietly slowing the generator down (coordinated omission).
+//
+// Writes go to the leader, found by probing the servers at startup. Reads go
+// round-robin to all servers, which serve them through ReadIndex. Prints one
+// result line in the bench_report.h format.
+//
+// Example, against the default 3-node cluster:
+//   logkv_loadgen --servers 127.0.0.1:9001,127.0.0.1:9002,127.0.0.1:9003
+//                 --mode open --rate 20000 --seconds 10 --read-pct 50 --json
+// (one command line)
+
+#include "bench_report.h"
+#include "../src/protocol.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::vector<std::string> servers = {"127.0.0.1:9001", "127.0.0.1:9002", "127.0.0.1:9003"};
+    bool open_loop = false;
+    int connections = 8;
+    int depth = 16;
+    double rate = 10000;
+    double seconds = 10;
+    double warmup = 1;
+    int read_pct = 0;
+    size_t keys = 100000;
+    size_t value_bytes = 100;
+    bool json = false;
+};
+
+int connectTo(const std::string& addr) {
+    size_t colon = addr.rfind(':');
+    if (colon == std::string::npos) return -1;
+    std::string host = addr.substr(0, colon);
+    int port = std::stoi(addr.substr(colon + 1));
+
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) return -1;
+    sockaddr_in serv{};
+    serv.sin_family = AF_INET;
+    serv.sin_port = htons(port);
+    inet_pton(AF_INET, host.c_str(), &serv.sin_addr);
+    if (connect(sock, reinterpret_cast<sockaddr*>(&serv), sizeof(serv)) < 0) {
+        close(sock);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return sock;
+}
+
+bool sendAll(int sock, const std::string& data) {
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t n = send(sock, data.data() + written, data.size() - written, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        written += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// Reads one response frame; false on a dropped connection
+bool readResponse(int sock, std::string& buffer, proto::Status& status) {
+    char chunk[16384];
+    for (;;) {
+        proto::Frame frame;
+        size_t consumed;
+        proto::ParseResult result = proto::parseFrame(buffer, frame, consumed);
+        if (result == proto::ParseResult::FRAME) {
+            std::string_view body;
+            bool ok = proto::decodeResponse(frame.payload, status, body);
+            buffer.erase(0, consumed);
+            return ok;
+        }
+        if (result == proto::ParseResult::INVALID) return false;
+        ssize_t n = read(sock, chunk, sizeof(chunk));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        buffer.append(chunk, static_cast<size_t>(n));
+    }
+}
+
+std::string findLeader(const Options& opts) {
+    for (const auto& addr : opts.servers) {
+        int sock = connectTo(addr);
+        if (sock < 0) continue;
+        std::string frame, buffer;
+        proto::encodePut(frame, "loadgen_probe", "1");
+        proto::Status status = proto::Status::ERROR;
+        bool ok = sendAll(sock, frame) && readResponse(sock, buffer, status);
+        close(sock);
+        if (ok && status == proto::Status::OK) return addr;
+    }
+    return "";
+}
+
+struct Totals {
+    std::mutex mutex;
+    bench::Latencies latencies;
+    uint64_t ok = 0;
+    uint64_t not_found = 0;
+    uint64_t not_leader = 0;
+    uint64_t errors = 0;
+    uint64_t dropped = 0;       // Connections lost mid-run
+};
+
+// One connection: a sender that paces or fills the window, and a receiver
+// that matches responses to requests (they come back in order)
+void runConnection(const Options& opts, const std::string& write_addr,
+                   const std::string& read_addr, int id, double per_conn_rate,
+                   Clock::time_point measure_from, Clock::time_point stop_at,
+                   Totals& totals) {
+    int write_sock = connectTo(write_addr);
+    int read_sock = read_addr == write_addr ? -1 : connectTo(read_addr);
+    if (write_sock < 0 || (read_addr != write_addr && read_sock < 0)) {
+        std::lock_guard<std::mutex> lock(totals.mutex);
+        totals.dropped++;
+        if (write_sock >= 0) close(write_sock);
+        if (read_sock >= 0) close(read_sock);
+        return;
+    }
+
+    // Each socket gets its own in-flight queue and receiver; one lock covers
+    // both, and the closed-loop window counts requests on either
+    struct Lane {
+        int sock = -1;
+        std::deque<Clock::time_point> due;      // When each outstanding request was due
+        bool failed = false;
+        std::thread receiver;
+    };
+    Lane lanes[2];
+    lanes[0].sock = write_sock;
+    lanes[1].sock = read_sock;
+    int lane_count = read_sock >= 0 ? 2 : 1;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stopping = false;
+    size_t in_flight = 0;
+    bench::Latencies latencies;
+    uint64_t counts[4] = {0, 0, 0, 0};
+
+    for (int l = 0; l < lane_count; l++) {
+        lanes[l].receiver = std::thread([&, l]() {
+            Lane& lane = lanes[l];
+            std::string buffer;
+            for (;;) {
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cv.wait(lock, [&]{ return !lane.due.empty() || stopping; });
+                    if (lane.due.empty()) return;
+                }
+                proto::Status status;
+                bool ok = readResponse(lane.sock, buffer, status);
+                auto now = Clock::now();
+                
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!ok) {
+                    lane.failed = true;
+                    cv.notify_all();
+                    return;
+                }
+                Clock::time_point due = lane.due.front();
+                lane.due.pop_front();
+                in_flight--;
+                cv.notify_all();
+                if (due >= measure_from) {
+                    latencies.record(static_cast<uint64_t>(
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(now - due).count()));
+                    counts[static_cast<int>(status) & 3]++;
+                }
+            }
+        });
+    }
+
+    std::mt19937_64 rng(static_cast<uint64_t>(id) * 7919 + 1);
+    std::uniform_int_distribution<size_t> pick(0, opts.keys - 1);
+    std::uniform_int_distribution<int> pct(0, 99);
+    std::string value(opts.value_bytes, 'v');
+    std::string frame;
+    auto interval = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(per_conn_rate > 0 ? 1.0 / per_conn_rate : 0));
+    Clock::time_point next = Clock::now();
+
+    while (Clock::now() < stop_at) {
+        bool read = pct(rng) < opts.read_pct;
+        Lane& lane = lanes[read && lane_count == 2 ? 1 : 0];
+        std::string key = "key" + std::to_string(pick(rng));
+        frame.clear();
+        if (read) {
+            proto::encodeGet(frame, key);
+        } else {
+            proto::encodePut(frame, key, value);
+        }
+
+        Clock::time_point due;
+        if (opts.open_loop) {
+            next += interval;
+            std::this_thread::sleep_until(next);
+            due = next;
+        }
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (!opts.open_loop) {
+                // Closed loop: wait for a free slot in this connection's window
+                cv.wait_until(lock, stop_at, [&]{
+                    return in_flight < static_cast<size_t>(opts.depth) ||
+                           lanes[0].failed || lanes[1].failed;
+                });
+                if (in_flight >= static_cast<size_t>(opts.depth)) continue;
+                due = Clock::now();
+            }
+            if (lanes[0].failed || lanes[1].failed) break;
+            lane.due.push_back(due);
+            in_flight++;
+            cv.notify_all();
+        }
+        if (!sendAll(lane.sock, frame)) break;
+    }
+
+    // Let outstanding responses drain (bounded), then hang up
+    bool dropped;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait_for(lock, std::chrono::seconds(5), [&]{
+            return in_flight == 0 || lanes[0].failed || lanes[1].failed;
+        });
+        dropped = in_flight > 0;
+        stopping = true;
+        cv.notify_all();
+    }
+    for (int l = 0; l < lane_count; l++) {
+        shutdown(lanes[l].sock, SHUT_RDWR);
+        lanes[l].receiver.join();
+        close(lanes[l].sock);
+    }
+
+    std::lock_guard<std::mutex> lock(totals.mutex);
+    totals.latencies.merge(latencies);
+    totals.ok += counts[static_cast<int>(proto::Status::OK)];
+    totals.not_found += counts[static_cast<int>(proto::Status::NOT_FOUND)];
+    totals.not_leader += counts[static_cast<int>(proto::Status::NOT_LEADER)];
+    totals.errors += counts[static_cast<int>(proto::Status::ERROR)];
+    if (dropped) totals.dropped++;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    Options opts;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--servers" && i + 1 < argc) {
+            opts.servers.clear();
+            std::istringstream list(argv[++i]);
+            std::string addr;
+            while (std::getline(list, addr, ',')) opts.servers.push_back(addr);
+        } else if (arg == "--mode" && i + 1 < argc) {
+            opts.open_loop = std::string(argv[++i]) == "open";
+        } else if (arg == "--connections" && i + 1 < argc) {
+            opts.connections = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--depth" && i + 1 < argc) {
+            opts.depth = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--rate" && i + 1 < argc) {
+            opts.rate = std::stod(argv[++i]);
+        } else if (arg == "--seconds" && i + 1 < argc) {
+            opts.seconds = std::stod(argv[++i]);
+        } else if (arg == "--warmup" && i + 1 < argc) {
+            opts.warmup = std::stod(argv[++i]);
+        } else if (arg == "--read-pct" && i + 1 < argc) {
+            opts.read_pct = std::clamp(std::stoi(argv[++i]), 0, 100);
+        } else if (arg == "--keys" && i + 1 < argc) {
+            opts.keys = std::max<size_t>(1, std::stoul(argv[++i]));
+        } else if (arg == "--value-bytes" && i + 1 < argc) {
+            opts.value_bytes = std::stoul(argv[++i]);
+        } else if (arg == "--json") {
+            opts.json = true;
+        }
+    }
+
+    std::string leader = findLeader(opts);
+    if (leader.empty()) {
+        std::cerr << "No leader among the given servers\n";
+        return 1;
+    }
+
+    auto start = Clock::now();
+    auto measure_from = start + std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(opts.warmup));
+    auto stop_at = measure_from + std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(opts.seconds));
+
+    Totals totals;
+    std::vector<std::thread> threads;
+    for (int c = 0; c < opts.connections; c++) {
+        const std::string& reads = opts.servers[c % opts.servers.size()];
+        threads.emplace_back(runConnection, std::cref(opts), std::cref(leader),
+                             std::cref(reads), c, opts.rate / opts.connections,
+                             measure_from, stop_at, std::ref(totals));
+    }
+    for (auto& t : threads) t.join();
+
+    uint64_t completed = totals.latencies.count();
+    bench::Result result("loadgen");
+    result.add("mode", opts.open_loop ? "open" : "closed")
+        .add("connections", opts.connections);
+    if (opts.open_loop) {
+        result.add("target_rate", opts.rate);
+    } else {
+        result.add("depth", opts.depth);
+    }
+    result.add("read_pct", opts.read_pct)
+        .add("value_bytes", opts.value_bytes)
+        .throughput(completed, opts.seconds, totals.latencies)
+        .add("ok", totals.ok)
+        .add("not_found", totals.not_found)
+        .add("not_leader", totals.not_leader)
+        .add("errors", totals.errors)
+        .add("dropped_connections", totals.dropped)
+        .print(opts.json);
+    return totals.dropped > 0 ? 1 : 0;
+}
@@ -0,0 +1,130 @@
+// Snapshot write and load time, V2 format with and without compression.
+//
+// Usage: snapshot_bench [--keys N] [--value-bytes N] [--block-kb N]
+//                       [--load-threads N] [--dir PATH]
+//
+// Fills a store, writes it through SnapshotManager and loads it back into a
+// fresh store, once per codec. Every key is checked after each load, and a
+// hand-written V1 file must still load, so a format regression fails the
+// run (exit code 1) instead of just looking fast.
+
+#include "../src/snapshot.h"
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+namespace {
+
+std::string keyFor(size_t i) {
+    return "key" + std::to_string(i);
+}
+
+// Compressible but not trivially so: a counter in a repeated pattern
+std::string valueFor(size_t i, size_t bytes) {
+    std::string value = "value-" + std::to_string(i) + "-";
+    while (value.size() < bytes) value += "abcdefgh";
+    value.resize(bytes);
+    return value;
+}
+
+bool verify(KVStore& store, size_t keys, size_t value_bytes) {
+    if (store.size() != keys) {
+        std::cerr << "MISMATCH: loaded " << store.size() << " keys, expected " << keys << "\n";
+        return false;
+    }
+    std::string value;
+    for (size_t i = 0; i < keys; i++) {
+        if (!store.get(keyFor(i), value) || value != valueFor(i, value_bytes)) {
+            std::cerr << "MISMATCH: key " << keyFor(i) << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    size_t keys = 500000;
+    size_t value_bytes = 100;
+    SnapshotOptions options;
+    std::string dir = "snapshot_bench_data";
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--keys" && i + 1 < argc) {
+            keys = std::stoul(argv[++i]);
+        } else if (arg == "--value-bytes" && i + 1 < argc) {
+            value_bytes = std::stoul(argv[++i]);
+        } else if (arg == "--block-kb" && i + 1 < argc) {
+            options.block_bytes = std::stoul(argv[++i]) * 1024;
+        } else if (arg == "--load-threads" && i + 1 < argc) {
+            options.load_threads = std::stoi(argv[++i]);
+        } else if (arg == "--dir" && i + 1 < argc) {
+            dir = argv[++i];
+        }
+    }
+
+    KVStore source;
+    for (size_t i = 0; i < keys; i++) {
+        source.put(keyFor(i), valueFor(i, value_bytes));
+    }
+    bool ok = true;
+
+    for (SnapshotCompression codec : {SnapshotCompression::NONE, SnapshotCompression::LZ4}) {
+        std::filesystem::remove_all(dir);
+        options.compression = codec;
+        SnapshotManager manager(dir, 1, options);
+
+        auto start = std::chrono::steady_clock::now();
+        {
+            auto view = source.snapshot();
+            ok = manager.createSnapshot(*view, 1000, 3);
+        }
+        double write_s = secondsSince(start);
+        if (!ok) break;
+        auto file_bytes = std::filesystem::file_size(manager.getSnapshotPath());
+
+        KVStore loaded;
+        SnapshotMetadata metadata;
+        start = std::chrono::steady_clock::now();
+        ok = manager.loadSnapshot(loaded, metadata);
+        double load_s = secondsSince(start);
+        ok = ok && metadata.last_included_index == 1000 && metadata.last_included_term == 3 &&
+             verify(loaded, keys, value_bytes);
+
+        std::cout << "codec=" << (codec == SnapshotCompression::LZ4 ? "lz4" : "none")
+                  << " keys=" << keys << " file_mb=" << file_bytes / (1024.0 * 1024.0)
+                  << " write_s=" << write_s << " load_s=" << load_s
+                  << (ok ? " ok" : " FAILED") << "\n";
+        if (!ok) break;
+    }
+
+    if (ok) {
+        // V1 files written by older versions stay readable
+        std::filesystem::remove_all(dir);
+        SnapshotManager manager(dir, 1, options);
+        {
+            std::ofstream out(dir + "/snapshot_1_idx_7.snap", std::ios::binary);
+            out << "LOGKV_SNAPSHOT_V1\n7 2 2\n";
+            out << "1 11\na\nhello\nworld\n";
+            out << "1 0\nb\n\n";
+        }
+        KVStore loaded;
+        SnapshotMetadata metadata;
+        std::string value;
+        ok = manager.loadSnapshot(loaded, metadata) && metadata.last_included_index == 7 &&
+             loaded.size() == 2 && loaded.get("a", value) && value == "hello\nworld" &&
+             loaded.get("b", value) && value.empty();
+        std::cout << "v1 compat" << (ok ? " ok" : " FAILED") << "\n";
+    }
+
+    std::filesystem::remove_all(dir);
+    return ok ? 0 : 1;
+}
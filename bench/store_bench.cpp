@@ -0,0 +1,86 @@
+// GET throughput of KVStore as client threads are added.
+//
+// Usage: store_bench [--keys N] [--seconds S] [--shards N] [--write-pct P]
+//
+// Run once with the default shard count and once with --shards 1 to compare
+// against the old single-lock behaviour.
+
+#include "../src/store.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+int main(int argc, char* argv[]) {
+    size_t num_keys = 100000;
+    double seconds = 1.0;
+    size_t shards = KVStore::kDefaultShards;
+    int write_pct = 0;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--keys" && i + 1 < argc) {
+            num_keys = std::stoul(argv[++i]);
+        } else if (arg == "--seconds" && i + 1 < argc) {
+            seconds = std::stod(argv[++i]);
+        } else if (arg == "--shards" && i + 1 < argc) {
+            shards = std::stoul(argv[++i]);
+        } else if (arg == "--write-pct" && i + 1 < argc) {
+            write_pct = std::stoi(argv[++i]);
+        }
+    }
+
+    KVStore store(shards);
+    std::vector<std::string> keys;
+    keys.reserve(num_keys);
+    for (size_t i = 0; i < num_keys; i++) {
+        keys.push_back("key" + std::to_string(i));
+        store.put(keys.back(), "value" + std::to_string(i));
+    }
+
+    unsigned max_threads = std::max(4u, std::thread::hardware_concurrency());
+    std::cout << "shards=" << store.shardCount() << " keys=" << num_keys
+              << " write_pct=" << write_pct << "\n";
+
+    for (unsigned threads = 1; threads <= max_threads; threads *= 2) {
+        std::atomic<bool> stop{false};
+        std::atomic<uint64_t> total_ops{0};
+        std::vector<std::thread> workers;
+
+        for (unsigned t = 0; t < threads; t++) {
+            workers.emplace_back([&, t]() {
+                std::mt19937_64 rng(t + 1);
+                std::uniform_int_distribution<size_t> pick(0, num_keys - 1);
+                std::uniform_int_distribution<int> pct(0, 99);
+                std::string value;
+                uint64_t ops = 0;
+
+                while (!stop.load(std::memory_order_relaxed)) {
+                    const std::string& key = keys[pick(rng)];
+                    if (pct(rng) < write_pct) {
+                        store.put(key, "updated");
+                    } else {
+                        store.get(key, value);
+                    }
+                    ops++;
+                }
+                total_ops += ops;
+            });
+        }
+
+        std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+        stop = true;
+        for (auto& w : workers) w.join();
+
+        double ops_per_sec = total_ops.load() / seconds;
+        std::cout << "threads=" << threads << " ops/sec=" << static_cast<uint64_t>(ops_per_sec)
+                  << "\n";
+    }
+
+    return 0;
+}
@@ -0,0 +1,132 @@
+// WAL lookups by Raft index across repeated compactions.
+//
+// Usage: wal_bench [--entries N] [--compact-every N] [--keep N] [--lookups N]
+//                  [--cache-kb N] [--dir PATH]
+//
+// Appends entries, compacting every --compact-every entries down to the last
+// --keep, and after each round times getEntry()/getEntriesFrom() on random
+// indices still in the log. Every returned entry is checked against the
+// index it was asked for, so a lookup that drifts after compaction fails the
+// run (exit code 1) instead of just looking fast.
+
+#include "../src/wal.h"
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <string>
+
+namespace {
+
+std::string keyFor(int index) {
+    return "key" + std::to_string(index);
+}
+
+bool check(const LogEntry& entry, int index) {
+    if (entry.index != index || entry.key() != keyFor(index)) {
+        std::cerr << "MISMATCH: asked for index " << index << ", got index "
+                  << entry.index << " key " << entry.key() << "\n";
+        return false;
+    }
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    int entries = 50000;
+    int compact_every = 10000;
+    int keep = 2000;
+    int lookups = 20000;
+    std::string dir = "wal_bench_data";
+    WalOptions options;
+    options.sync_mode = WalSyncMode::OS;
+    options.segment_bytes = 256 * 1024;
+    options.cache_bytes = 256 * 1024;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--entries" && i + 1 < argc) {
+            entries = std::stoi(argv[++i]);
+        } else if (arg == "--compact-every" && i + 1 < argc) {
+            compact_every = std::stoi(argv[++i]);
+        } else if (arg == "--keep" && i + 1 < argc) {
+            keep = std::stoi(argv[++i]);
+        } else if (arg == "--lookups" && i + 1 < argc) {
+            lookups = std::stoi(argv[++i]);
+        } else if (arg == "--cache-kb" && i + 1 < argc) {
+            options.cache_bytes = std::stoul(argv[++i]) * 1024;
+        } else if (arg == "--dir" && i + 1 < argc) {
+            dir = argv[++i];
+        }
+    }
+
+    std::filesystem::remove_all(dir);
+    std::mt19937 rng(42);
+    bool ok = true;
+
+    {
+        WriteAheadLog wal(dir, options);
+        std::string value(100, 'v');
+
+        for (int round = 1; ok && round * compact_every <= entries; round++) {
+            int last = round * compact_every;
+            for (int i = last - compact_every + 1; i <= last; i++) {
+                wal.appendEntry(LogEntry(i, 1 + i / 7000, keyFor(i), value));
+            }
+
+            wal.discardEntriesBefore(last - keep);
+            int first = wal.getFirstLogIndex();
+
+            // Log matching at the snapshot boundary must still know the term
+            int boundary_term = -1;
+            if (!wal.getTerm(first - 1, boundary_term) || boundary_term != 1 + (first - 1) / 7000) {
+                std::cerr << "MISMATCH: boundary term at " << (first - 1) << " is "
+                          << boundary_term << "\n";
+                ok = false;
+                break;
+            }
+
+            std::uniform_int_distribution<int> pick(first, last);
+            auto start = std::chrono::steady_clock::now();
+            for (int n = 0; n < lookups && ok; n++) {
+                int index = pick(rng);
+                LogEntry entry;
+                ok = wal.getEntry(index, entry) && check(entry, index);
+            }
+            auto mid = std::chrono::steady_clock::now();
+
+            int suffixes = 20;
+            for (int n = 0; n < suffixes && ok; n++) {
+                int from = pick(rng);
+                std::vector<LogEntry> suffix = wal.getEntriesFrom(from);
+                ok = suffix.size() == static_cast<size_t>(last - from + 1) &&
+                     check(suffix.front(), from) && check(suffix.back(), last);
+            }
+            auto end = std::chrono::steady_clock::now();
+
+            double get_ns = std::chrono::duration<double, std::nano>(mid - start).count() / lookups;
+            double suffix_us = std::chrono::duration<double, std::micro>(end - mid).count() / suffixes;
+            std::cout << "round=" << round << " first=" << first << " last=" << last
+                      << " getEntry_ns=" << static_cast<long>(get_ns)
+                      << " getEntriesFrom_us=" << static_cast<long>(suffix_us) << "\n";
+        }
+    }
+
+    if (ok) {
+        // Reopening must land on the same first index and contents
+        WriteAheadLog wal(dir, options);
+        int first = wal.getFirstLogIndex();
+        int last_index, last_term;
+        wal.getLastLogInfo(last_index, last_term);
+        for (int index = first; index <= last_index && ok; index += 97) {
+            LogEntry entry;
+            ok = wal.getEntry(index, entry) && check(entry, index);
+        }
+        std::cout << "reopen first=" << first << " last=" << last_index
+                  << (ok ? " ok" : " FAILED") << "\n";
+    }
+
+    std::filesystem::remove_all(dir);
+    return ok ? 0 : 1;
+}
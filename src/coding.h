@@ -0,0 +1,32 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+// Fixed-width little-endian integer encoding shared by the on-disk formats.
+// Byte-at-a-time so the files are portable regardless of host endianness.
+
+inline void putFixed32(std::string& dst, uint32_t v) {
+    char buf[4];
+    for (int i = 0; i < 4; i++) buf[i] = static_cast<char>((v >> (8 * i)) & 0xFF);
+    dst.append(buf, 4);
+}
+
+inline void putFixed64(std::string& dst, uint64_t v) {
+    char buf[8];
+    for (int i = 0; i < 8; i++) buf[i] = static_cast<char>((v >> (8 * i)) & 0xFF);
+    dst.append(buf, 8);
+}
+
+inline uint32_t decodeFixed32(const char* p) {
+    const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++) v |= static_cast<uint32_t>(u[i]) << (8 * i);
+    return v;
+}
+
+inline uint64_t decodeFixed64(const char* p) {
+    const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) v |= static_cast<uint64_t>(u[i]) << (8 * i);
+    return v;
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// CRC-32 (IEEE 802.3, reflected polynomial 0xEDB88320), table driven.
+// Used to detect torn or corrupted records in the WAL and snapshots.
+namespace crc32 {
+
+struct Table {
+    uint32_t entries[256];
+
+    constexpr Table() : entries() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+            }
+            entries[i] = c;
+        }
+    }
+};
+
+inline constexpr Table kTable{};
+
+// Continue a running CRC over more bytes (pass the previous return value)
+inline uint32_t extend(uint32_t crc, const void* data, size_t len) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    uint32_t c = crc ^ 0xFFFFFFFFu;
+    for (size_t i = 0; i < len; i++) {
+        c = kTable.entries[(c ^ p[i]) & 0xFF] ^ (c >> 8);
+    }
+    return c ^ 0xFFFFFFFFu;
+}
+
+inline uint32_t value(const void* data, size_t len) {
+    return extend(0, data, len);
+}
+
+}  // namespace crc32
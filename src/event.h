@@ -1,6 +1,7 @@
 #pragma once
 #include <string>
 #include <functional>
+#include "log_entry.h"
 
 enum class EventType {
     CLIENT_PUT,
@@ -11,14 +12,25 @@ enum class EventType {
     APPEND_ENTRIES_REQUEST,
     APPEND_ENTRIES_RESPONSE,
     VOTE_REQUEST,
-    VOTE_RESPONSE
+    VOTE_RESPONSE,
+    CHECK_QUORUM            // Leader: step down if a majority went quiet (term)
 };
 
+// Move-only: events carry strings and a callback, and the queue moves them
+// in and out rather than copying
 struct Event {
-    EventType type;
+    Event() = default;
+    Event(Event&&) = default;
+    Event& operator=(Event&&) = default;
+    Event(const Event&) = delete;
+    Event& operator=(const Event&) = delete;
 
-    // For PUT/GET operations
+    EventType type = EventType::HEARTBEAT_TICK;
+
+    // For PUT/GET operations. CLIENT_PUT carries any client write: op says
+    // which, and a MULTI_PUT's pairs are encoded in value.
     int index = -1;
+    LogOp op = LogOp::PUT;
     std::string key;
     std::string value;
     
@@ -1,60 +1,301 @@
 #pragma once
-#include <queue>
+#include <atomic>
 #include <mutex>
 #include <condition_variable>
 #include <optional>
+#include <vector>
+#include <memory>
 #include <chrono>
+#include <thread>
+#include <cstdint>
 #include "event.h"
 
+struct EventQueueStats {
+    size_t depth = 0;                 // Events currently queued
+    uint64_t pushed = 0;              // Events accepted since start
+    uint64_t popped = 0;              // Events handed to the consumer
+    uint64_t queued_ns = 0;           // Sum over popped events of time spent queued
+    uint64_t producer_full_waits = 0; // Pushes that found the ring full
+    uint64_t consumer_parks = 0;      // Times the consumer went to sleep
+    uint64_t consumer_wait_ns = 0;    // Time the consumer spent waiting for events
+};
+
+/**
+ * EventQueue
+ *
+ * Bounded multi-producer/single-consumer ring of move-only Events.
+ *
+ * PRODUCERS:
+ * Any thread may push(). A producer claims a slot by CAS on the tail and
+ * publishes it through the slot's sequence number, so producers never take
+ * a lock. If the ring is full the producer backs off (spin, then yield,
+ * then short sleeps) until the consumer frees a slot.
+ *
+ * CONSUMER:
+ * Exactly one thread pops — the server's event loop. It waits adaptively:
+ * a short spin and a few yields catch bursts cheaply, and after that it
+ * parks on a condition variable. Producers only touch the mutex when the
+ * consumer is actually parked.
+ *
+ * Event ordering is FIFO by slot claim order.
+ */
 class EventQueue {
 public:
-    void push(const Event& e) {
-        std::lock_guard<std::mutex> lock(m_);
-        q_.push(e);
-        cv_.notify_one();
+    static constexpr size_t kDefaultCapacity = 1 << 14;
+
+    explicit EventQueue(size_t capacity = kDefaultCapacity)
+        : capacity_(roundUpPow2(capacity)),
+          mask_(capacity_ - 1),
+          cells_(new Cell[capacity_]) {
+        for (size_t i = 0; i < capacity_; i++) {
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    EventQueue(const EventQueue&) = delete;
+    EventQueue& operator=(const EventQueue&) = delete;
+
+    // Returns false (dropping the event) only once the queue is shut down
+    bool push(Event e) {
+        return push(std::move(e), []() { return false; });
+    }
+
+    // As above, but while the queue is full also drops the event, returning
+    // false, once give_up() says it's no longer wanted
+    template <typename GiveUp>
+    bool push(Event e, GiveUp give_up) {
+        size_t pos = tail_.load(std::memory_order_relaxed);
+        Cell* cell;
+        int backoff = 0;
+        bool counted = false;
+
+        for (;;) {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                // Full: the consumer hasn't freed this slot yet
+                if (shutdown_.load(std::memory_order_acquire) || give_up()) {
+                    return false;
+                }
+                if (!counted) {
+                    producer_full_waits_.fetch_add(1, std::memory_order_relaxed);
+                    counted = true;
+                }
+                backOff(backoff++);
+                pos = tail_.load(std::memory_order_relaxed);
+            } else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->event = std::move(e);
+        cell->enqueued_ns = nowNs();
+        cell->seq.store(pos + 1, std::memory_order_release);
+        pushed_.fetch_add(1, std::memory_order_relaxed);
+
+        // Pairs with the fence in waitForEvent(): either the consumer sees
+        // the new slot on its re-check, or we see it parked
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (consumer_parked_.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> lock(park_mutex_);
+            park_cv_.notify_one();
+        }
+        return true;
     }
 
+    // Blocks until an event arrives. Returns a HEARTBEAT_TICK on shutdown.
     Event pop() {
-        std::unique_lock<std::mutex> lock(m_);
-        cv_.wait(lock, [&]{ return !q_.empty() || shutdown_; });
-        if (shutdown_ && q_.empty()) {
+        waitForEvent(std::chrono::steady_clock::time_point::max());
+        if (!ready()) {
             // Return a dummy event on shutdown
             Event e;
             e.type = EventType::HEARTBEAT_TICK;
             return e;
         }
-        Event e = q_.front();
-        q_.pop();
-        return e;
+        return take();
     }
-    
+
     std::optional<Event> pop_with_timeout(std::chrono::milliseconds timeout) {
-        std::unique_lock<std::mutex> lock(m_);
-        if (cv_.wait_for(lock, timeout, [&]{ return !q_.empty() || shutdown_; })) {
-            if (shutdown_ && q_.empty()) {
-                return std::nullopt;
+        waitForEvent(std::chrono::steady_clock::now() + timeout);
+        if (!ready()) {
+            return std::nullopt;
+        }
+        return take();
+    }
+
+    // Block until at least one event is queued (or shutdown), then move up
+    // to max of them into out. Returns false once shut down and drained.
+    bool drain(std::vector<Event>& out, size_t max) {
+        waitForEvent(std::chrono::steady_clock::time_point::max());
+        while (out.size() < max && ready()) {
+            out.push_back(take());
+        }
+        return !out.empty() || !shutdown_.load(std::memory_order_acquire);
+    }
+
+    // Pop the run of `type` events at the front of the queue, up to max of
+    // them. While the run is shorter than max and nothing else is queued,
+    // wait up to linger for more to arrive. Stops at the first event of a
+    // different type so ordering with other events is preserved.
+    std::vector<Event> pop_run(EventType type, size_t max, std::chrono::microseconds linger) {
+        std::vector<Event> run;
+        auto deadline = std::chrono::steady_clock::now() + linger;
+        while (run.size() < max) {
+            if (!ready()) {
+                if (linger.count() <= 0 || shutdown_.load(std::memory_order_acquire) ||
+                    !waitForEvent(deadline)) {
+                    break;
+                }
+                continue;
             }
-            Event e = q_.front();
-            q_.pop();
-            return e;
+            if (cells_[head_.load(std::memory_order_relaxed) & mask_].event.type != type) {
+                break;
+            }
+            run.push_back(take());
         }
-        return std::nullopt;
+        return run;
     }
-    
+
     size_t size() const {
-        std::lock_guard<std::mutex> lock(m_);
-        return q_.size();
+        size_t tail = tail_.load(std::memory_order_acquire);
+        size_t head = head_.load(std::memory_order_acquire);
+        return tail > head ? tail - head : 0;
     }
-    
+
+    EventQueueStats stats() const {
+        EventQueueStats s;
+        s.depth = size();
+        s.pushed = pushed_.load(std::memory_order_relaxed);
+        s.popped = popped_.load(std::memory_order_relaxed);
+        s.queued_ns = queued_ns_.load(std::memory_order_relaxed);
+        s.producer_full_waits = producer_full_waits_.load(std::memory_order_relaxed);
+        s.consumer_parks = consumer_parks_.load(std::memory_order_relaxed);
+        s.consumer_wait_ns = consumer_wait_ns_.load(std::memory_order_relaxed);
+        return s;
+    }
+
     void shutdown() {
-        std::lock_guard<std::mutex> lock(m_);
-        shutdown_ = true;
-        cv_.notify_all();
+        shutdown_.store(true, std::memory_order_seq_cst);
+        std::lock_guard<std::mutex> lock(park_mutex_);
+        park_cv_.notify_all();
     }
 
 private:
-    std::queue<Event> q_;
-    mutable std::mutex m_;
-    std::condition_variable cv_;
-    bool shutdown_ = false;
+    struct Cell {
+        std::atomic<size_t> seq;
+        uint64_t enqueued_ns = 0;
+        Event event;
+    };
+
+    static constexpr int kSpinIterations = 64;
+    static constexpr int kYieldIterations = 8;
+
+    const size_t capacity_;
+    const size_t mask_;
+    std::unique_ptr<Cell[]> cells_;
+
+    alignas(64) std::atomic<size_t> tail_{0};   // Next slot producers claim
+    alignas(64) std::atomic<size_t> head_{0};   // Next slot the consumer reads
+    std::atomic<bool> consumer_parked_{false};
+    std::atomic<bool> shutdown_{false};
+    std::mutex park_mutex_;
+    std::condition_variable park_cv_;
+
+    // Counters (relaxed; read via stats())
+    alignas(64) std::atomic<uint64_t> pushed_{0};
+    std::atomic<uint64_t> producer_full_waits_{0};
+    alignas(64) std::atomic<uint64_t> popped_{0};
+    std::atomic<uint64_t> queued_ns_{0};
+    std::atomic<uint64_t> consumer_parks_{0};
+    std::atomic<uint64_t> consumer_wait_ns_{0};
+
+    static size_t roundUpPow2(size_t n) {
+        size_t cap = 2;
+        while (cap < n) cap <<= 1;
+        return cap;
+    }
+
+    static uint64_t nowNs() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#endif
+    }
+
+    static void backOff(int attempt) {
+        if (attempt < kSpinIterations) {
+            cpuRelax();
+        } else if (attempt < kSpinIterations + kYieldIterations) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    }
+
+    // Consumer only: is the slot at head published?
+    bool ready() const {
+        size_t head = head_.load(std::memory_order_relaxed);
+        return cells_[head & mask_].seq.load(std::memory_order_acquire) == head + 1;
+    }
+
+    // Consumer only; assumes ready()
+    Event take() {
+        size_t head = head_.load(std::memory_order_relaxed);
+        Cell& cell = cells_[head & mask_];
+        Event e = std::move(cell.event);
+        cell.event.client_callback = nullptr;  // Don't keep captures alive in the ring
+        uint64_t enqueued_ns = cell.enqueued_ns;
+        cell.seq.store(head + capacity_, std::memory_order_release);
+        head_.store(head + 1, std::memory_order_release);
+
+        popped_.fetch_add(1, std::memory_order_relaxed);
+        queued_ns_.fetch_add(nowNs() - enqueued_ns, std::memory_order_relaxed);
+        return e;
+    }
+
+    // Consumer only: spin, yield, then park until an event is ready, the
+    // deadline passes or the queue shuts down. Returns ready().
+    bool waitForEvent(std::chrono::steady_clock::time_point deadline) {
+        if (ready()) {
+            return true;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        for (int attempt = 0; attempt < kSpinIterations + kYieldIterations; attempt++) {
+            if (ready() || shutdown_.load(std::memory_order_acquire)) {
+                break;
+            }
+            backOff(attempt);
+        }
+
+        while (!ready() && !shutdown_.load(std::memory_order_acquire) &&
+               std::chrono::steady_clock::now() < deadline) {
+            std::unique_lock<std::mutex> lock(park_mutex_);
+            consumer_parked_.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            consumer_parks_.fetch_add(1, std::memory_order_relaxed);
+            auto wake = [&]{ return ready() || shutdown_.load(std::memory_order_acquire); };
+            if (deadline == std::chrono::steady_clock::time_point::max()) {
+                park_cv_.wait(lock, wake);
+            } else {
+                park_cv_.wait_until(lock, deadline, wake);
+            }
+            consumer_parked_.store(false, std::memory_order_relaxed);
+        }
+
+        consumer_wait_ns_.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count(), std::memory_order_relaxed);
+        return ready();
+    }
 };
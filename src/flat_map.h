@@ -0,0 +1,386 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/**
+ * FlatStringMap
+ *
+ * Open-addressing hash map from std::string keys, in the manner of
+ * Abseil's Swiss tables; KVStore's shards use it when built with
+ * LOGKV_FLAT_MAP. Entries live in one slot array rather than a node
+ * allocation each, so a lookup reads a group of control bytes and then
+ * the slot, where std::unordered_map chases a bucket, a node and the
+ * node's key.
+ *
+ * PROBING:
+ * Slots come in groups of 16 with one control byte each: kEmpty, kDeleted,
+ * or for a full slot 7 bits of its hash (the tag). A lookup compares the
+ * key's tag against a whole group's control bytes at once (one SSE2
+ * compare; a byte loop on other targets) and looks only at the slots that
+ * match, so a miss rarely compares a key at all. A group with an empty
+ * slot ends the search; otherwise it moves on to another group, in
+ * triangular steps that visit every group of the power-of-two table.
+ *
+ * SLOTS:
+ * Each slot keeps its key's full hash, so growing moves entries without
+ * hashing any key again, and tag matches are checked against it before
+ * the key bytes. Keys are std::strings held in the slot itself, so short
+ * keys (up to 15 bytes with libstdc++) need no allocation of their own.
+ *
+ * The table doubles past 7/8 load, counting tombstones. Erasing leaves a
+ * tombstone unless the slot's group still has an empty slot (then no
+ * search ever went past it); when tombstones rather than live entries
+ * fill the table it is rebuilt at the same size.
+ *
+ * Unlike std::unordered_map, an insert that grows or rebuilds the table
+ * invalidates every iterator and reference. Not thread safe.
+ */
+template <typename V>
+class FlatStringMap {
+public:
+    using key_type = std::string;
+    using mapped_type = V;
+    // Not pair<const std::string, V>: slots are moved when the table grows.
+    // Don't change a key through an iterator.
+    using value_type = std::pair<std::string, V>;
+
+    static constexpr size_t kGroupWidth = 16;
+
+    template <bool Const>
+    class Iterator;
+    using iterator = Iterator<false>;
+    using const_iterator = Iterator<true>;
+
+    // A slot: the entry and its key's hash
+    struct Slot {
+        size_t hash;
+        value_type kv;
+    };
+
+    FlatStringMap() = default;
+    ~FlatStringMap() { release(); }
+
+    FlatStringMap(const FlatStringMap&) = delete;
+    FlatStringMap& operator=(const FlatStringMap&) = delete;
+
+    FlatStringMap(FlatStringMap&& other) noexcept { swap(other); }
+    FlatStringMap& operator=(FlatStringMap&& other) noexcept {
+        if (this != &other) {
+            release();
+            swap(other);
+        }
+        return *this;
+    }
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    size_t capacity() const { return capacity_; }
+
+    iterator begin() { return iterator(this, nextFull(0)); }
+    iterator end() { return iterator(this, capacity_); }
+    const_iterator begin() const { return const_iterator(this, nextFull(0)); }
+    const_iterator end() const { return const_iterator(this, capacity_); }
+
+    iterator find(std::string_view key) { return iterator(this, findIndex(key, hashOf(key))); }
+    const_iterator find(std::string_view key) const {
+        return const_iterator(this, findIndex(key, hashOf(key)));
+    }
+    size_t count(std::string_view key) const { return findIndex(key, hashOf(key)) != capacity_; }
+
+    // Insert key with V(args...) unless it's there; args are left alone if it is
+    template <typename K, typename... Args>
+    std::pair<iterator, bool> try_emplace(K&& key, Args&&... args) {
+        size_t hash = hashOf(key);
+        size_t index = findIndex(key, hash);
+        if (index != capacity_) {
+            return {iterator(this, index), false};
+        }
+        index = prepareInsert(hash);
+        new (&slots_[index]) Slot{hash, value_type(std::piecewise_construct,
+                                                   std::forward_as_tuple(std::forward<K>(key)),
+                                                   std::forward_as_tuple(std::forward<Args>(args)...))};
+        return {iterator(this, index), true};
+    }
+
+    V& operator[](const std::string& key) { return try_emplace(key).first->second; }
+    V& operator[](std::string&& key) { return try_emplace(std::move(key)).first->second; }
+
+    // Entries never move on erase, so the iterator past it stays valid
+    iterator erase(iterator it) {
+        eraseIndex(it.index_);
+        return iterator(this, nextFull(it.index_ + 1));
+    }
+    size_t erase(std::string_view key) {
+        size_t index = findIndex(key, hashOf(key));
+        if (index == capacity_) {
+            return 0;
+        }
+        eraseIndex(index);
+        return 1;
+    }
+
+    // Empties the map and keeps its capacity
+    void clear() {
+        destroyAll();
+        if (capacity_ > 0) {
+            std::memset(ctrl_.get(), kEmpty, capacity_);
+        }
+        size_ = 0;
+        growth_left_ = maxLoad(capacity_);
+    }
+
+    void reserve(size_t entries) {
+        size_t capacity = kGroupWidth;
+        while (maxLoad(capacity) < entries) {
+            capacity *= 2;
+        }
+        if (capacity > capacity_) {
+            resize(capacity);
+        }
+    }
+
+    // An entry picked by random (any 64-bit value): the first one at or
+    // after a slot it selects. Cheap and nearly uniform at the loads the
+    // table runs at. end() if the map is empty.
+    const_iterator sample(uint64_t random) const {
+        if (size_ == 0) {
+            return end();
+        }
+        size_t index = nextFull(static_cast<size_t>(random) & (capacity_ - 1));
+        return const_iterator(this, index == capacity_ ? nextFull(0) : index);
+    }
+
+    template <bool Const>
+    class Iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = typename FlatStringMap::value_type;
+        using difference_type = std::ptrdiff_t;
+        using reference = std::conditional_t<Const, const value_type&, value_type&>;
+        using pointer = std::conditional_t<Const, const value_type*, value_type*>;
+
+        Iterator() = default;
+        // iterator -> const_iterator
+        template <bool C = Const, typename = std::enable_if_t<C>>
+        Iterator(const Iterator<false>& other) : map_(other.map_), index_(other.index_) {}
+
+        reference operator*() const { return map_->slots_[index_].kv; }
+        pointer operator->() const { return &map_->slots_[index_].kv; }
+        Iterator& operator++() {
+            index_ = map_->nextFull(index_ + 1);
+            return *this;
+        }
+        Iterator operator++(int) {
+            Iterator before = *this;
+            ++*this;
+            return before;
+        }
+        bool operator==(const Iterator& other) const { return index_ == other.index_; }
+        bool operator!=(const Iterator& other) const { return index_ != other.index_; }
+
+    private:
+        friend class FlatStringMap;
+        template <bool>
+        friend class Iterator;
+        using Map = std::conditional_t<Const, const FlatStringMap, FlatStringMap>;
+
+        Iterator(Map* map, size_t index) : map_(map), index_(index) {}
+
+        Map* map_ = nullptr;
+        size_t index_ = 0;
+    };
+
+private:
+    static constexpr int8_t kEmpty = -128;
+    static constexpr int8_t kDeleted = -2;
+    // Full slots hold a tag, 0..127; the free states have the top bit set
+
+    std::unique_ptr<int8_t[]> ctrl_;
+    Slot* slots_ = nullptr;
+    size_t capacity_ = 0;           // Slots; 0 or a power of two >= kGroupWidth
+    size_t group_mask_ = 0;         // Groups - 1
+    size_t size_ = 0;
+    size_t growth_left_ = 0;        // Empty slots that may still be filled before growing
+
+    static size_t hashOf(std::string_view key) { return std::hash<std::string_view>{}(key); }
+
+    // Spread the hash over the high bits: the store picks shards from the
+    // hash's low bits, so within a shard those are nearly all the same
+    static uint64_t mix(size_t hash) { return static_cast<uint64_t>(hash) * 0x9E3779B97F4A7C15ull; }
+    static int8_t tagOf(uint64_t mixed) { return static_cast<int8_t>(mixed >> 57); }
+    size_t firstGroup(uint64_t mixed) const { return static_cast<size_t>(mixed >> 32) & group_mask_; }
+
+    static size_t maxLoad(size_t capacity) { return capacity - capacity / 8; }
+
+    // Bit i set where control byte i of the group equals b
+    static uint32_t match(const int8_t* group, int8_t b) {
+#if defined(__SSE2__)
+        __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+        return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(b))));
+#else
+        uint32_t bits = 0;
+        for (size_t i = 0; i < kGroupWidth; i++) {
+            bits |= static_cast<uint32_t>(group[i] == b) << i;
+        }
+        return bits;
+#endif
+    }
+
+    // Bit i set where slot i of the group is empty or deleted
+    static uint32_t matchFree(const int8_t* group) {
+#if defined(__SSE2__)
+        return static_cast<uint32_t>(
+            _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(group))));
+#else
+        uint32_t bits = 0;
+        for (size_t i = 0; i < kGroupWidth; i++) {
+            bits |= static_cast<uint32_t>(group[i] < 0) << i;
+        }
+        return bits;
+#endif
+    }
+
+    static size_t lowestBit(uint32_t bits) { return static_cast<size_t>(__builtin_ctz(bits)); }
+
+    // Slot holding key, or capacity_
+    size_t findIndex(std::string_view key, size_t hash) const {
+        if (size_ == 0) {
+            return capacity_;
+        }
+        uint64_t mixed = mix(hash);
+        int8_t tag = tagOf(mixed);
+        size_t group = firstGroup(mixed);
+        // At least an eighth of the slots are empty, so this ends
+        for (size_t step = 1;; step++) {
+            const int8_t* ctrl = ctrl_.get() + group * kGroupWidth;
+            for (uint32_t bits = match(ctrl, tag); bits != 0; bits &= bits - 1) {
+                size_t index = group * kGroupWidth + lowestBit(bits);
+                const Slot& slot = slots_[index];
+                if (slot.hash == hash && slot.kv.first == key) {
+                    return index;
+                }
+            }
+            if (match(ctrl, kEmpty) != 0) {
+                return capacity_;
+            }
+            group = (group + step) & group_mask_;
+        }
+    }
+
+    // First empty or deleted slot on hash's probe sequence
+    size_t findFree(size_t hash) const {
+        size_t group = firstGroup(mix(hash));
+        for (size_t step = 1;; step++) {
+            uint32_t bits = matchFree(ctrl_.get() + group * kGroupWidth);
+            if (bits != 0) {
+                return group * kGroupWidth + lowestBit(bits);
+            }
+            group = (group + step) & group_mask_;
+        }
+    }
+
+    // Claim a slot for a new entry with this hash; the caller constructs it
+    size_t prepareInsert(size_t hash) {
+        size_t index = capacity_ == 0 ? 0 : findFree(hash);
+        if (capacity_ == 0 || (ctrl_[index] == kEmpty && growth_left_ == 0)) {
+            // Double if live entries are what fill it, else clear tombstones
+            resize(size_ + 1 > maxLoad(capacity_) / 2 ? std::max(kGroupWidth, capacity_ * 2)
+                                                      : capacity_);
+            index = findFree(hash);
+        }
+        if (ctrl_[index] == kEmpty) {
+            growth_left_--;
+        }
+        ctrl_[index] = tagOf(mix(hash));
+        size_++;
+        return index;
+    }
+
+    void eraseIndex(size_t index) {
+        slots_[index].~Slot();
+        size_--;
+        const int8_t* group = ctrl_.get() + index / kGroupWidth * kGroupWidth;
+        if (match(group, kEmpty) != 0) {
+            ctrl_[index] = kEmpty;
+            growth_left_++;
+        } else {
+            ctrl_[index] = kDeleted;
+        }
+    }
+
+    // Move every entry into a fresh table of capacity slots, by stored hash
+    void resize(size_t capacity) {
+        std::unique_ptr<int8_t[]> old_ctrl = std::move(ctrl_);
+        Slot* old_slots = slots_;
+        size_t old_capacity = capacity_;
+
+        ctrl_.reset(new int8_t[capacity]);
+        std::memset(ctrl_.get(), kEmpty, capacity);
+        slots_ = std::allocator<Slot>().allocate(capacity);
+        capacity_ = capacity;
+        group_mask_ = capacity / kGroupWidth - 1;
+        growth_left_ = maxLoad(capacity) - size_;
+
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (old_ctrl[i] < 0) {
+                continue;
+            }
+            size_t hash = old_slots[i].hash;
+            size_t index = findFree(hash);
+            ctrl_[index] = tagOf(mix(hash));
+            new (&slots_[index]) Slot(std::move(old_slots[i]));
+            old_slots[i].~Slot();
+        }
+        if (old_slots) {
+            std::allocator<Slot>().deallocate(old_slots, old_capacity);
+        }
+    }
+
+    size_t nextFull(size_t index) const {
+        while (index < capacity_ && ctrl_[index] < 0) {
+            index++;
+        }
+        return index;
+    }
+
+    void destroyAll() {
+        for (size_t i = 0; i < capacity_; i++) {
+            if (ctrl_[i] >= 0) {
+                slots_[i].~Slot();
+            }
+        }
+    }
+
+    void release() {
+        destroyAll();
+        if (slots_) {
+            std::allocator<Slot>().deallocate(slots_, capacity_);
+        }
+        ctrl_.reset();
+        slots_ = nullptr;
+        capacity_ = group_mask_ = size_ = growth_left_ = 0;
+    }
+
+    void swap(FlatStringMap& other) noexcept {
+        std::swap(ctrl_, other.ctrl_);
+        std::swap(slots_, other.slots_);
+        std::swap(capacity_, other.capacity_);
+        std::swap(group_mask_, other.group_mask_);
+        std::swap(size_, other.size_);
+        std::swap(growth_left_, other.growth_left_);
+    }
+};
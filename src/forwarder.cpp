@@ -0,0 +1,190 @@
+#include "forwarder.h"
+#include "log.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+
+Forwarder::~Forwarder() {
+    stop();
+}
+
+void Forwarder::forward(const std::string& addr, std::string request, Callback done) {
+    Channel* channel;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = channels_.find(addr);
+        if (stopping_) {
+            channel = nullptr;
+        } else if (it != channels_.end()) {
+            channel = it->second.get();
+        } else {
+            auto created = std::make_unique<Channel>();
+            created->addr = addr;
+            channel = created.get();
+            channels_.emplace(addr, std::move(created));
+            channel->thread = std::thread(&Forwarder::run, this, std::ref(*channel));
+        }
+        if (channel) {
+            std::lock_guard<std::mutex> channel_lock(channel->mutex);
+            channel->queue.push_back(Pending{next_tag_++, std::move(request), std::move(done)});
+            channel->cv.notify_one();
+            return;
+        }
+    }
+    done(false, proto::Status::ERROR, "SHUTTING_DOWN");
+}
+
+void Forwarder::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_) {
+            return;
+        }
+        stopping_ = true;
+    }
+    // Nothing adds channels once stopping_ is set
+    for (auto& [addr, channel] : channels_) {
+        {
+            std::lock_guard<std::mutex> lock(channel->mutex);
+            if (channel->sock >= 0) {
+                shutdown(channel->sock, SHUT_RDWR);
+            }
+            channel->cv.notify_all();
+        }
+        channel->thread.join();
+    }
+}
+
+void Forwarder::run(Channel& channel) {
+    int sock = -1;
+    while (true) {
+        std::vector<Pending> batch;
+        {
+            std::unique_lock<std::mutex> lock(channel.mutex);
+            channel.cv.wait(lock, [&]{ return stopping_ || !channel.queue.empty(); });
+            batch.swap(channel.queue);
+        }
+        if (stopping_) {
+            for (auto& pending : batch) {
+                pending.done(false, proto::Status::ERROR, "SHUTTING_DOWN");
+            }
+            break;
+        }
+
+        if (sock < 0) {
+            sock = connectTo(channel.addr);
+            std::lock_guard<std::mutex> lock(channel.mutex);
+            channel.sock = sock;
+        }
+
+        std::string out;
+        std::unordered_map<uint64_t, Callback> waiting;
+        for (auto& pending : batch) {
+            proto::encodeSession(out, 0, pending.tag, pending.request);
+            waiting.emplace(pending.tag, std::move(pending.done));
+        }
+        if (sock < 0 || !exchange(sock, waiting, out)) {
+            if (sock >= 0) {
+                LOG_WARN("Forwarding to " << channel.addr << " failed; reconnecting");
+                std::lock_guard<std::mutex> lock(channel.mutex);
+                close(sock);
+                channel.sock = sock = -1;
+            }
+            for (auto& [tag, done] : waiting) {
+                done(false, proto::Status::ERROR, "UNREACHABLE");
+            }
+        }
+    }
+    if (sock >= 0) {
+        std::lock_guard<std::mutex> lock(channel.mutex);
+        close(sock);
+        channel.sock = -1;
+    }
+}
+
+bool Forwarder::exchange(int sock, std::unordered_map<uint64_t, Callback>& waiting,
+                         const std::string& out) {
+    size_t sent = 0;
+    while (sent < out.size()) {
+        ssize_t n = send(sock, out.data() + sent, out.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        sent += static_cast<size_t>(n);
+    }
+
+    std::string in;
+    size_t pos = 0;
+    char buf[16384];
+    while (!waiting.empty()) {
+        proto::Frame frame;
+        size_t consumed;
+        proto::ParseResult result =
+            proto::parseFrame(std::string_view(in).substr(pos), frame, consumed);
+        if (result == proto::ParseResult::INVALID) {
+            return false;
+        }
+        if (result == proto::ParseResult::INCOMPLETE) {
+            in.erase(0, pos);
+            pos = 0;
+            ssize_t n = read(sock, buf, sizeof(buf));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;   // Closed, or SO_RCVTIMEO ran out
+            in.append(buf, static_cast<size_t>(n));
+            continue;
+        }
+        pos += consumed;
+
+        uint64_t tag;
+        std::string_view inner;
+        proto::Frame response;
+        size_t inner_size;
+        proto::Status status;
+        std::string_view body;
+        if (frame.type != proto::MsgType::SESSION ||
+            !proto::decodeSessionReply(frame.payload, tag, inner) ||
+            proto::parseFrame(inner, response, inner_size) != proto::ParseResult::FRAME ||
+            response.type != proto::MsgType::RESPONSE ||
+            !proto::decodeResponse(response.payload, status, body)) {
+            return false;
+        }
+        auto it = waiting.find(tag);
+        if (it != waiting.end()) {
+            it->second(true, status, body);
+            waiting.erase(it);
+        }
+    }
+    return true;
+}
+
+int Forwarder::connectTo(const std::string& addr) {
+    std::string ip = addr.substr(0, addr.find(':'));
+    int port = std::stoi(addr.substr(addr.find(':') + 1));
+
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {
+        return -1;
+    }
+
+    // Long enough for a commit, short enough that a dead leader fails the
+    // batch back to its clients rather than holding it
+    struct timeval timeout;
+    timeout.tv_sec = 2;
+    timeout.tv_usec = 0;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    sockaddr_in serv{};
+    serv.sin_family = AF_INET;
+    serv.sin_port = htons(port);
+    inet_pton(AF_INET, ip.c_str(), &serv.sin_addr);
+    if (connect(sock, (sockaddr*)&serv, sizeof(serv)) < 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
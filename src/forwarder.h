@@ -0,0 +1,78 @@
+#pragma once
+#include "protocol.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Forwarder
+ *
+ * Proxies client requests a follower can't serve to the node that can (the
+ * leader), for clients that would rather not chase NOT_LEADER hints. There
+ * is one pooled binary connection per destination, opened on demand and
+ * reopened after a failure, and one thread per connection.
+ *
+ * The thread sends everything queued for the destination in one write,
+ * each request tagged with a SESSION envelope (protocol.h), and matches the
+ * replies, which arrive in any order, by tag. Whatever queues up meanwhile
+ * goes out as the next batch. The destination node is an ordinary server:
+ * it routes and answers a forwarded request like any client's.
+ *
+ * Requests must be SESSION frames themselves, so what arrives is a SESSION
+ * inside a SESSION. That's how a server tells a forwarded request, which
+ * it never forwards again: a stale view of who leads can't bounce a write
+ * between two nodes.
+ */
+class Forwarder {
+public:
+    // answered is false if the destination couldn't be reached or didn't
+    // answer in time; the request may still have been carried out
+    using Callback = std::function<void(bool answered, proto::Status status, std::string_view body)>;
+
+    Forwarder() = default;
+    ~Forwarder();
+
+    Forwarder(const Forwarder&) = delete;
+    Forwarder& operator=(const Forwarder&) = delete;
+
+    // Send request (a complete SESSION frame) to addr (host:port); done runs
+    // on the connection's thread once it's answered
+    void forward(const std::string& addr, std::string request, Callback done);
+
+    // Fail whatever is queued or in flight and stop the threads
+    void stop();
+
+private:
+    struct Pending {
+        uint64_t tag;
+        std::string request;
+        Callback done;
+    };
+    struct Channel {
+        std::string addr;
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::vector<Pending> queue;
+        int sock = -1;              // Under mutex, so stop() can interrupt a read
+        std::thread thread;
+    };
+
+    std::mutex mutex_;
+    std::atomic<bool> stopping_{false};
+    std::unordered_map<std::string, std::unique_ptr<Channel>> channels_;
+    std::atomic<uint64_t> next_tag_{1};
+
+    void run(Channel& channel);
+    // One round: send the batch, collect its replies. False on a broken
+    // connection, with the unanswered requests left in waiting.
+    bool exchange(int sock, std::unordered_map<uint64_t, Callback>& waiting, const std::string& out);
+    static int connectTo(const std::string& addr);
+};
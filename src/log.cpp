@@ -0,0 +1,135 @@
+#include "log.h"
+#include "metrics.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace logging {
+
+namespace {
+
+constexpr size_t kMaxQueuedLines = 64 * 1024;
+
+std::atomic<int> current_level{static_cast<int>(Level::INFO)};
+
+const char* tag(Level level) {
+    switch (level) {
+        case Level::DEBUG: return "[DEBUG] ";
+        case Level::INFO:  return "[INFO] ";
+        case Level::WARN:  return "[WARN] ";
+        case Level::ERROR: return "[ERROR] ";
+    }
+    return "";
+}
+
+class AsyncWriter {
+public:
+    AsyncWriter()
+        : dropped_(metrics::registry().counter(
+              "logkv_log_dropped_total", "Log lines dropped because the log queue was full")),
+          thread_(&AsyncWriter::run, this) {}
+
+    void push(Level level, std::string message) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (queue_.size() >= kMaxQueuedLines) {
+            dropped_.add();
+            return;
+        }
+        queue_.push_back({level, std::move(message)});
+        pushed_++;
+        cv_.notify_one();
+    }
+
+    void flush() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        uint64_t target = pushed_;
+        done_cv_.wait(lock, [&]{ return written_ >= target; });
+    }
+
+private:
+    struct Line {
+        Level level;
+        std::string message;
+    };
+
+    metrics::Counter& dropped_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::condition_variable done_cv_;
+    std::vector<Line> queue_;
+    uint64_t pushed_ = 0;
+    uint64_t written_ = 0;
+    std::thread thread_;
+
+    void run() {
+        std::vector<Line> lines;
+        std::string out, err;
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            cv_.wait(lock, [&]{ return !queue_.empty(); });
+            lines.swap(queue_);
+            lock.unlock();
+
+            // One write per stream for the whole batch
+            out.clear();
+            err.clear();
+            for (const auto& line : lines) {
+                std::string& dest = line.level >= Level::WARN ? err : out;
+                dest += tag(line.level);
+                dest += line.message;
+                dest += '\n';
+            }
+            if (!out.empty()) {
+                fwrite(out.data(), 1, out.size(), stdout);
+                fflush(stdout);
+            }
+            if (!err.empty()) {
+                fwrite(err.data(), 1, err.size(), stderr);
+            }
+
+            lock.lock();
+            written_ += lines.size();
+            lines.clear();
+            done_cv_.notify_all();
+        }
+    }
+};
+
+AsyncWriter& writer() {
+    // Never destroyed: any thread may still log while the process exits.
+    // Whatever must reach the terminal before exit is flush()ed.
+    static AsyncWriter* instance = new AsyncWriter();
+    return *instance;
+}
+
+}  // namespace
+
+void setLevel(Level level) {
+    current_level.store(static_cast<int>(level), std::memory_order_relaxed);
+}
+
+bool enabled(Level level) {
+    return static_cast<int>(level) >= current_level.load(std::memory_order_relaxed);
+}
+
+bool parseLevel(const std::string& name, Level& level) {
+    if (name == "debug") level = Level::DEBUG;
+    else if (name == "info") level = Level::INFO;
+    else if (name == "warn") level = Level::WARN;
+    else if (name == "error") level = Level::ERROR;
+    else return false;
+    return true;
+}
+
+void write(Level level, std::string message) {
+    writer().push(level, std::move(message));
+}
+
+void flush() {
+    writer().flush();
+}
+
+}  // namespace logging
@@ -0,0 +1,51 @@
+#pragma once
+#include <sstream>
+#include <string>
+
+/**
+ * Logging
+ *
+ * Leveled logger that keeps terminal I/O off the calling thread. A log call
+ * below the current level costs one relaxed load: the message isn't even
+ * formatted. Enabled messages are formatted by the caller, queued, and
+ * written by a background thread, so a hot path never waits on the
+ * iostream lock or a slow terminal. If the queue backs up past a limit,
+ * new lines are dropped (and counted) rather than blocking.
+ *
+ * Lines keep the "[LEVEL] message" shape of the rest of the output.
+ * WARN and ERROR go to stderr, the rest to stdout.
+ *
+ *   LOG_DEBUG("Applied entry " << entry.index);
+ */
+namespace logging {
+
+enum class Level { DEBUG = 0, INFO = 1, WARN = 2, ERROR = 3 };
+
+void setLevel(Level level);
+bool enabled(Level level);
+
+// "debug", "info", "warn" or "error"
+bool parseLevel(const std::string& name, Level& level);
+
+// Queue a formatted line (without the level tag or newline)
+void write(Level level, std::string message);
+
+// Block until everything queued so far has been written. Call before
+// exiting: lines still queued at exit are lost.
+void flush();
+
+}  // namespace logging
+
+#define LOGKV_LOG(level, expr)                                   \
+    do {                                                         \
+        if (logging::enabled(level)) {                           \
+            std::ostringstream logkv_log_stream_;                \
+            logkv_log_stream_ << expr;                           \
+            logging::write(level, logkv_log_stream_.str());      \
+        }                                                        \
+    } while (0)
+
+#define LOG_DEBUG(expr) LOGKV_LOG(logging::Level::DEBUG, expr)
+#define LOG_INFO(expr) LOGKV_LOG(logging::Level::INFO, expr)
+#define LOG_WARN(expr) LOGKV_LOG(logging::Level::WARN, expr)
+#define LOG_ERROR(expr) LOGKV_LOG(logging::Level::ERROR, expr)
@@ -0,0 +1,208 @@
+#include "log_entry.h"
+#include "coding.h"
+#include <algorithm>
+
+static_assert(sizeof(LogEntry) <= 64, "LogEntry should stay within a cache line");
+
+LogOp opFromCode(uint8_t code) {
+    switch (code) {
+        case static_cast<uint8_t>(LogOp::PUT): return LogOp::PUT;
+        case static_cast<uint8_t>(LogOp::DELETE): return LogOp::DELETE;
+        case static_cast<uint8_t>(LogOp::MULTI_PUT): return LogOp::MULTI_PUT;
+        case static_cast<uint8_t>(LogOp::SESSION): return LogOp::SESSION;
+        case static_cast<uint8_t>(LogOp::PUT_TTL): return LogOp::PUT_TTL;
+        case static_cast<uint8_t>(LogOp::EXPIRE): return LogOp::EXPIRE;
+        default: return LogOp::NOOP;
+    }
+}
+
+const char* opName(LogOp op) {
+    switch (op) {
+        case LogOp::PUT: return "PUT";
+        case LogOp::DELETE: return "DELETE";
+        case LogOp::NOOP: return "NOOP";
+        case LogOp::MULTI_PUT: return "MPUT";
+        case LogOp::SESSION: return "SESSION";
+        case LogOp::PUT_TTL: return "PUT_TTL";
+        case LogOp::EXPIRE: return "EXPIRE";
+    }
+    return "NOOP";
+}
+
+bool parseOp(std::string_view name, LogOp& op) {
+    if (name == "PUT") op = LogOp::PUT;
+    else if (name == "DELETE") op = LogOp::DELETE;
+    else if (name == "NOOP") op = LogOp::NOOP;
+    else if (name == "MPUT") op = LogOp::MULTI_PUT;
+    else if (name == "SESSION") op = LogOp::SESSION;
+    else if (name == "PUT_TTL") op = LogOp::PUT_TTL;
+    else if (name == "EXPIRE") op = LogOp::EXPIRE;
+    else return false;
+    return true;
+}
+
+void encodeMultiPut(std::string& out, const KeyValueViews& pairs) {
+    putFixed32(out, static_cast<uint32_t>(pairs.size()));
+    for (const auto& [key, value] : pairs) {
+        putFixed32(out, static_cast<uint32_t>(key.size()));
+        out.append(key.data(), key.size());
+        putFixed32(out, static_cast<uint32_t>(value.size()));
+        out.append(value.data(), value.size());
+    }
+}
+
+bool decodeMultiPut(std::string_view payload, KeyValueViews& pairs) {
+    pairs.clear();
+    if (payload.size() < 4) {
+        return false;
+    }
+    uint32_t count = decodeFixed32(payload.data());
+    size_t pos = 4;
+    auto field = [&](std::string_view& out) {
+        if (payload.size() - pos < 4) return false;
+        uint32_t len = decodeFixed32(payload.data() + pos);
+        pos += 4;
+        if (payload.size() - pos < len) return false;
+        out = payload.substr(pos, len);
+        pos += len;
+        return true;
+    };
+    // Each pair takes at least 8 bytes, which bounds a hostile count
+    if (count > (payload.size() - pos) / 8) {
+        return false;
+    }
+    pairs.resize(count);
+    for (auto& [key, value] : pairs) {
+        if (!field(key) || !field(value)) {
+            return false;
+        }
+    }
+    return pos == payload.size();
+}
+
+void encodeExpiringPut(std::string& out, uint64_t deadline, std::string_view value) {
+    putFixed64(out, deadline);
+    out.append(value.data(), value.size());
+}
+
+bool decodeExpiringPut(std::string_view payload, uint64_t& deadline, std::string_view& value) {
+    if (payload.size() < 8) {
+        return false;
+    }
+    deadline = decodeFixed64(payload.data());
+    value = payload.substr(8);
+    return true;
+}
+
+void encodeExpire(std::string& out, uint64_t now, const std::vector<std::string>& keys) {
+    putFixed64(out, now);
+    putFixed32(out, static_cast<uint32_t>(keys.size()));
+    for (const auto& key : keys) {
+        putFixed32(out, static_cast<uint32_t>(key.size()));
+        out.append(key);
+    }
+}
+
+bool decodeExpire(std::string_view payload, uint64_t& now, std::vector<std::string_view>& keys) {
+    keys.clear();
+    if (payload.size() < 12) {
+        return false;
+    }
+    now = decodeFixed64(payload.data());
+    uint32_t count = decodeFixed32(payload.data() + 8);
+    size_t pos = 12;
+    // Each key takes at least 4 bytes, which bounds a hostile count
+    if (count > (payload.size() - pos) / 4) {
+        return false;
+    }
+    keys.resize(count);
+    for (auto& key : keys) {
+        if (payload.size() - pos < 4) return false;
+        uint32_t len = decodeFixed32(payload.data() + pos);
+        pos += 4;
+        if (payload.size() - pos < len) return false;
+        key = payload.substr(pos, len);
+        pos += len;
+    }
+    return pos == payload.size();
+}
+
+void encodeSessionWrite(std::string& out, uint64_t client_id, uint64_t seq, LogOp op,
+                        std::string_view value) {
+    putFixed64(out, client_id);
+    putFixed64(out, seq);
+    out.push_back(static_cast<char>(op));
+    out.append(value.data(), value.size());
+}
+
+bool decodeSessionWrite(std::string_view payload, uint64_t& client_id, uint64_t& seq,
+                        LogOp& op, std::string_view& value) {
+    if (payload.size() < 17) {
+        return false;
+    }
+    client_id = decodeFixed64(payload.data());
+    seq = decodeFixed64(payload.data() + 8);
+    op = static_cast<LogOp>(payload[16]);
+    value = payload.substr(17);
+    return op == LogOp::PUT || op == LogOp::PUT_TTL || op == LogOp::DELETE ||
+           op == LogOp::MULTI_PUT;
+}
+
+// ============================================================================
+// LogEntry
+// ============================================================================
+
+LogEntry::LogEntry(int index, int term, std::string_view key, std::string_view value, LogOp op) {
+    if (key.size() + value.size() <= kInlineBytes) {
+        assign(index, term, op, key, value);
+    } else {
+        LogArena arena(key.size() + value.size());
+        *this = arena.make(index, term, op, key, value);
+    }
+}
+
+void LogEntry::assign(int index, int term, LogOp op, std::string_view key,
+                      std::string_view value) {
+    // Inline form; the caller checked the size
+    this->index = index;
+    this->term = term;
+    this->op = op;
+    key_size_ = static_cast<uint32_t>(key.size());
+    value_size_ = static_cast<uint32_t>(value.size());
+    block_.reset();
+    if (!key.empty()) memcpy(inline_, key.data(), key.size());
+    if (!value.empty()) memcpy(inline_ + key.size(), value.data(), value.size());
+}
+
+// ============================================================================
+// LogArena
+// ============================================================================
+
+LogEntry LogArena::make(int index, int term, LogOp op, std::string_view key,
+                        std::string_view value) {
+    LogEntry entry;
+    size_t bytes = key.size() + value.size();
+    if (bytes <= LogEntry::kInlineBytes) {
+        entry.assign(index, term, op, key, value);
+        return entry;
+    }
+
+    if (capacity_ - used_ < bytes) {
+        capacity_ = std::max(block_bytes_, bytes);
+        block_.reset(new char[capacity_]);
+        used_ = 0;
+    }
+    char* dst = block_.get() + used_;
+    memcpy(dst, key.data(), key.size());
+    if (!value.empty()) memcpy(dst + key.size(), value.data(), value.size());
+    used_ += bytes;
+
+    entry.index = index;
+    entry.term = term;
+    entry.op = op;
+    entry.key_size_ = static_cast<uint32_t>(key.size());
+    entry.value_size_ = static_cast<uint32_t>(value.size());
+    entry.block_ = block_;
+    entry.external_ = dst;
+    return entry;
+}
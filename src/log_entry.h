@@ -0,0 +1,136 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/**
+ * Log entries
+ *
+ * LogEntry is what the WAL, replication and apply paths pass around, so it
+ * is built to be cheap to copy: 64 bytes, one cache line, and no heap
+ * allocation of its own.
+ *
+ * STORAGE:
+ * - The operation is an opcode, not a string.
+ * - Key and value sit back to back in one buffer and are read through
+ *   string_views.
+ * - If they fit in kInlineBytes, the buffer is inside the entry, so copying
+ *   the entry is a plain memcpy.
+ * - Otherwise they live in a block of a LogArena, shared by every entry
+ *   carved from it, so copying the entry is one reference count bump.
+ *   The block is freed when the last entry using it goes away.
+ *
+ * A batch of entries built together (a leader batch, an AppendEntries
+ * request, a segment scan) shares one arena, so a whole batch costs one
+ * allocation instead of three strings per entry.
+ */
+
+// Operation codes. Also the byte stored in WAL records and sent on the wire.
+enum class LogOp : uint8_t {
+    PUT = 1,
+    DELETE = 2,
+    NOOP = 3,           // Leader's first entry of a term; changes no keys
+    MULTI_PUT = 4,      // Several key/value pairs applied atomically (no key;
+                        // the value is the pairs, see encodeMultiPut)
+    SESSION = 5,        // A client write applied at most once (see session.h):
+                        // the write's key, the value is encodeSessionWrite
+    PUT_TTL = 6,        // A PUT that expires: the value is encodeExpiringPut
+    EXPIRE = 7          // Leader's expiry sweep: deletes keys past their
+                        // deadline (no key; the value is encodeExpire)
+};
+
+// Codes this build doesn't know decode as NOOP: they change no keys
+LogOp opFromCode(uint8_t code);
+const char* opName(LogOp op);
+bool parseOp(std::string_view name, LogOp& op);
+
+// MULTI_PUT payload: [u32 count] count x ([u32 len][key] [u32 len][value]).
+// The binary MULTI_PUT request carries the same bytes, so the leader logs
+// the request payload as is.
+using KeyValueViews = std::vector<std::pair<std::string_view, std::string_view>>;
+void encodeMultiPut(std::string& out, const KeyValueViews& pairs);
+// Views point into payload; false if it is malformed
+bool decodeMultiPut(std::string_view payload, KeyValueViews& pairs);
+
+// PUT_TTL payload: [u64 deadline][the value]. The deadline is absolute, in
+// Unix milliseconds (KVStore::nowMillis), fixed by the leader when it logs
+// the write, so every replica and every replay expires the key alike.
+void encodeExpiringPut(std::string& out, uint64_t deadline, std::string_view value);
+bool decodeExpiringPut(std::string_view payload, uint64_t& deadline, std::string_view& value);
+
+// EXPIRE payload: [u64 now][u32 count] count x ([u32 len][key]). Applying it
+// deletes each key whose deadline is at or before now, the leader's clock
+// when it proposed the batch; a key rewritten since is left alone.
+void encodeExpire(std::string& out, uint64_t now, const std::vector<std::string>& keys);
+// Views point into payload; false if it is malformed
+bool decodeExpire(std::string_view payload, uint64_t& now, std::vector<std::string_view>& keys);
+
+// SESSION payload: [u64 client_id][u64 seq][u8 op][the write's value], op
+// being PUT, PUT_TTL, DELETE or MULTI_PUT
+void encodeSessionWrite(std::string& out, uint64_t client_id, uint64_t seq, LogOp op,
+                        std::string_view value);
+bool decodeSessionWrite(std::string_view payload, uint64_t& client_id, uint64_t& seq,
+                        LogOp& op, std::string_view& value);
+
+class LogEntry {
+public:
+    static constexpr size_t kInlineBytes = 24;
+
+    int index = -1;
+    int term = -1;
+    LogOp op = LogOp::PUT;
+
+    LogEntry() = default;
+
+    // Standalone entry: inline if small, else in a block of its own
+    LogEntry(int index, int term, std::string_view key, std::string_view value,
+             LogOp op = LogOp::PUT);
+
+    std::string_view key() const { return {data(), key_size_}; }
+    std::string_view value() const { return {data() + key_size_, value_size_}; }
+
+    // Key and value bytes, for memory accounting
+    size_t payloadBytes() const { return size_t(key_size_) + value_size_; }
+
+private:
+    friend class LogArena;
+
+    uint32_t key_size_ = 0;
+    uint32_t value_size_ = 0;
+    std::shared_ptr<const char[]> block_;   // Null when the bytes are inline
+    union {
+        const char* external_;              // Into block_
+        char inline_[kInlineBytes] = {};
+    };
+
+    const char* data() const { return block_ ? external_ : inline_; }
+    void assign(int index, int term, LogOp op, std::string_view key, std::string_view value);
+};
+
+/**
+ * LogArena
+ *
+ * Bump allocator for entry bytes. Blocks are block_bytes (bigger only for
+ * an entry that doesn't fit one) and are handed out front to back; an
+ * entry keeps its block alive, the arena only keeps the one it is filling.
+ * Size the arena to the batch when that's known, so a short batch doesn't
+ * pin a mostly empty block.
+ */
+class LogArena {
+public:
+    static constexpr size_t kDefaultBlockBytes = 64 * 1024;
+
+    explicit LogArena(size_t block_bytes = kDefaultBlockBytes) : block_bytes_(block_bytes) {}
+
+    LogEntry make(int index, int term, LogOp op, std::string_view key, std::string_view value);
+
+private:
+    size_t block_bytes_;
+    std::shared_ptr<char[]> block_;
+    size_t used_ = 0;
+    size_t capacity_ = 0;
+};
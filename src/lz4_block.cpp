@@ -0,0 +1,143 @@
+#include "lz4_block.h"
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace lz4 {
+
+namespace {
+
+constexpr size_t kMinMatch = 4;
+constexpr size_t kLastLiterals = 5;     // The block always ends in literals
+constexpr size_t kMatchStartLimit = 12; // No match starts this close to the end
+constexpr size_t kMaxOffset = 65535;
+constexpr int kHashBits = 14;
+
+uint32_t read32(const char* p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint32_t hashOf(uint32_t v) {
+    return (v * 2654435761u) >> (32 - kHashBits);
+}
+
+// Length continuation bytes after a saturated (15) token nibble
+void putLength(std::string& out, size_t len) {
+    while (len >= 255) {
+        out.push_back(static_cast<char>(255));
+        len -= 255;
+    }
+    out.push_back(static_cast<char>(len));
+}
+
+// One sequence: literals, then a match (match_len == 0 for the last one)
+void emit(std::string& out, const char* literals, size_t literal_len,
+          size_t match_len, size_t offset) {
+    size_t match_code = match_len ? match_len - kMinMatch : 0;
+    uint8_t token = static_cast<uint8_t>((literal_len < 15 ? literal_len : 15) << 4);
+    if (match_len) {
+        token |= static_cast<uint8_t>(match_code < 15 ? match_code : 15);
+    }
+    out.push_back(static_cast<char>(token));
+    if (literal_len >= 15) {
+        putLength(out, literal_len - 15);
+    }
+    out.append(literals, literal_len);
+    if (match_len) {
+        out.push_back(static_cast<char>(offset & 0xFF));
+        out.push_back(static_cast<char>(offset >> 8));
+        if (match_code >= 15) {
+            putLength(out, match_code - 15);
+        }
+    }
+}
+
+bool readLength(const uint8_t*& ip, const uint8_t* end, size_t& len) {
+    uint8_t b;
+    do {
+        if (ip >= end) return false;
+        b = *ip++;
+        len += b;
+    } while (b == 255);
+    return true;
+}
+
+}  // namespace
+
+void compress(const char* src, size_t n, std::string& out) {
+    out.reserve(out.size() + maxCompressedSize(n));
+
+    // Last position (+1, so 0 means empty) each 4-byte hash was seen at
+    std::vector<uint32_t> table(size_t(1) << kHashBits, 0);
+    size_t anchor = 0;
+    size_t i = 0;
+    while (i + kMatchStartLimit <= n) {
+        uint32_t seq = read32(src + i);
+        uint32_t h = hashOf(seq);
+        size_t candidate = table[h];
+        table[h] = static_cast<uint32_t>(i + 1);
+
+        if (candidate == 0 || i - (candidate - 1) > kMaxOffset ||
+            read32(src + candidate - 1) != seq) {
+            i++;
+            continue;
+        }
+
+        size_t match = candidate - 1;
+        size_t len = kMinMatch;
+        size_t max_len = n - kLastLiterals - i;
+        while (len < max_len && src[match + len] == src[i + len]) {
+            len++;
+        }
+        emit(out, src + anchor, i - anchor, len, i - match);
+        i += len;
+        anchor = i;
+    }
+    emit(out, src + anchor, n - anchor, 0, 0);
+}
+
+bool decompress(const char* src, size_t n, char* dst, size_t dst_size) {
+    const uint8_t* ip = reinterpret_cast<const uint8_t*>(src);
+    const uint8_t* end = ip + n;
+    char* op = dst;
+    char* out_end = dst + dst_size;
+
+    while (ip < end) {
+        uint8_t token = *ip++;
+
+        size_t literal_len = token >> 4;
+        if (literal_len == 15 && !readLength(ip, end, literal_len)) return false;
+        if (literal_len > static_cast<size_t>(end - ip) ||
+            literal_len > static_cast<size_t>(out_end - op)) {
+            return false;
+        }
+        std::memcpy(op, ip, literal_len);
+        op += literal_len;
+        ip += literal_len;
+        if (ip == end) {
+            break;  // Last sequence: literals only
+        }
+
+        if (end - ip < 2) return false;
+        size_t offset = ip[0] | (static_cast<size_t>(ip[1]) << 8);
+        ip += 2;
+        if (offset == 0 || offset > static_cast<size_t>(op - dst)) return false;
+
+        size_t match_len = token & 15;
+        if (match_len == 15 && !readLength(ip, end, match_len)) return false;
+        match_len += kMinMatch;
+        if (match_len > static_cast<size_t>(out_end - op)) return false;
+
+        // Byte at a time: the match may overlap what it's producing
+        const char* match = op - offset;
+        for (size_t k = 0; k < match_len; k++) {
+            op[k] = match[k];
+        }
+        op += match_len;
+    }
+    return op == out_end;
+}
+
+}  // namespace lz4
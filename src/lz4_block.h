@@ -0,0 +1,23 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+// LZ4 block format (no frame header), enough for snapshot blocks. Any LZ4
+// block decoder reads the output, but there's no external dependency: the
+// compressor is a greedy single-probe matcher without the reference
+// implementation's speed tuning.
+namespace lz4 {
+
+// Upper bound on compress() output for n input bytes
+inline size_t maxCompressedSize(size_t n) {
+    return n + n / 255 + 16;
+}
+
+// Append the compressed form of src[0, n) to out
+void compress(const char* src, size_t n, std::string& out);
+
+// Decode src[0, n) into exactly dst_size bytes at dst. Bounds-checked:
+// returns false on malformed input or a size mismatch.
+bool decompress(const char* src, size_t n, char* dst, size_t dst_size);
+
+}  // namespace lz4
@@ -1,15 +1,18 @@
-#include "server.h"
+#include "node.h"
+#include "log.h"
 #include <iostream>
 #include <sstream>
 #include <csignal>
+#include <algorithm>
 
-Server* global_server = nullptr;
+Node* global_node = nullptr;
 
 void signalHandler(int signum) {
     std::cout << "\n[INFO] Received signal " << signum << ", shutting down...\n";
-    if (global_server) {
-        global_server->shutdown();
+    if (global_node) {
+        global_node->shutdown();
     }
+    logging::flush();
     exit(signum);
 }
 
@@ -22,6 +25,43 @@ void printUsage(const char* prog_name) {
               << "  --port <port>       Port to listen on\n"
               << "  --role <role>       Initial role (leader or follower, default: follower)\n"
               << "  --peers <peers>     Comma-separated list of peer ports (e.g., 9001,9002)\n"
+              << "  --groups <n>        Raft groups (hash partitions of the keys) per node (default 1);\n"
+              << "                      must be the same on every node\n"
+              << "  --wal-sync <mode>   WAL durability: per-entry (default), batch or os\n"
+              << "  --wal-batch-entries <n>  batch mode: fdatasync after n entries (default 64)\n"
+              << "  --wal-batch-us <us>      batch mode: ...or after this many microseconds (default 1000)\n"
+              << "  --wal-segment-mb <mb>    Size at which the WAL rolls to a new segment (default 64)\n"
+              << "  --wal-cache-mb <mb>      Memory for cached recent WAL entries (default 64)\n"
+              << "  --repl-in-flight <n>     AppendEntries batches in flight per follower (default 8)\n"
+              << "  --repl-batch-entries <n> Max entries per AppendEntries batch (default 1024)\n"
+              << "  --repl-batch-kb <kb>     Max key/value bytes per AppendEntries batch (default 1024)\n"
+              << "  --snapshot-compression <c> Snapshot blocks: lz4 (default) or none\n"
+              << "  --snapshot-block-kb <kb> Uncompressed bytes per snapshot block (default 256)\n"
+              << "  --snapshot-chunk-kb <kb> InstallSnapshot chunk size (default 1024)\n"
+              << "  --snapshot-rate-mb <mb>  Snapshot send rate per follower, MB/s (default 32, 0 = unpaced)\n"
+              << "  --io-threads <n>         Network worker threads (default 4)\n"
+              << "  --recovery-threads <n>   Snapshot decode / log replay threads at startup\n"
+              << "                           (default: one per core, max 8)\n"
+              << "  --text-rpc               Talk to peers in the text protocol (debugging)\n"
+              << "  --put-batch <n>          Queued PUTs the leader appends as one batch (default 256)\n"
+              << "  --put-linger-us <us>     Wait this long for a PUT batch to fill (default 0)\n"
+              << "  --heartbeat-ms <ms>      Leader heartbeat interval (default 1000)\n"
+              << "  --election-timeout-ms <min>[-<max>]\n"
+              << "                           Random election timeout range (default 3000-6000)\n"
+              << "  --read-mode <mode>       GET consistency: readindex (default), lease or stale\n"
+              << "  --lease-ms <ms>          Leader lease for --read-mode lease (default 2000)\n"
+              << "  --no-follower-reads      Followers answer GETs with NOT_LEADER\n"
+              << "  --forward-writes         Followers proxy client writes to the leader instead of\n"
+              << "                           answering NOT_LEADER <leader address>\n"
+              << "  --no-pre-vote            Time out straight into an election, without a pre-vote\n"
+              << "  --no-check-quorum        Leaders keep leading without majority contact, and\n"
+              << "                           vote requests are heeded even while a leader is alive\n"
+              << "  --max-memory-mb <mb>     Store memory budget, split over the groups (default 0 = none)\n"
+              << "  --memory-policy <p>      Over budget: reject (default), evict-lru or evict-random\n"
+              << "  --compress-values <bytes> LZ4-compress stored values at least this long (default 0 = off)\n"
+              << "  --expiry-interval-ms <ms> How often expired keys are looked for and deleted (default 500)\n"
+              << "  --log-level <level>      debug, info (default), warn or error\n"
+              << "  --metrics-port <port>    Serve Prometheus metrics over HTTP on this port\n"
               << "\n"
               << "Example:\n"
               << "  # Start a 3-node cluster\n"
@@ -45,6 +85,8 @@ int main(int argc, char* argv[]) {
     int port = -1;
     Role role = Role::FOLLOWER;
     std::vector<std::string> peers;
+    ServerConfig config;
+    int groups = 1;
 
     for (int i = 1; i < argc; i++) {
         std::string arg = argv[i];
@@ -62,6 +104,125 @@ int main(int argc, char* argv[]) {
             while (std::getline(ss, peer, ',')) {
                 peers.push_back("127.0.0.1:" + peer);
             }
+        } else if (arg == "--groups" && i + 1 < argc) {
+            groups = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--wal-sync" && i + 1 < argc) {
+            std::string mode = argv[++i];
+            if (mode == "per-entry") {
+                config.wal.sync_mode = WalSyncMode::PER_ENTRY;
+            } else if (mode == "batch") {
+                config.wal.sync_mode = WalSyncMode::BATCH;
+            } else if (mode == "os") {
+                config.wal.sync_mode = WalSyncMode::OS;
+            } else {
+                std::cerr << "[ERROR] Unknown --wal-sync mode: " << mode << "\n\n";
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--wal-batch-entries" && i + 1 < argc) {
+            config.wal.batch_entries = std::stoul(argv[++i]);
+        } else if (arg == "--wal-batch-us" && i + 1 < argc) {
+            config.wal.batch_interval = std::chrono::microseconds(std::stol(argv[++i]));
+        } else if (arg == "--wal-segment-mb" && i + 1 < argc) {
+            config.wal.segment_bytes = std::stoul(argv[++i]) * 1024 * 1024;
+        } else if (arg == "--wal-cache-mb" && i + 1 < argc) {
+            config.wal.cache_bytes = std::stoul(argv[++i]) * 1024 * 1024;
+        } else if (arg == "--repl-in-flight" && i + 1 < argc) {
+            config.replication.max_in_flight = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--repl-batch-kb" && i + 1 < argc) {
+            config.replication.max_batch_bytes = std::max(1, std::stoi(argv[++i])) * size_t(1024);
+        } else if (arg == "--repl-batch-entries" && i + 1 < argc) {
+            config.replication.max_batch_entries = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--snapshot-compression" && i + 1 < argc) {
+            std::string codec = argv[++i];
+            if (codec == "lz4") {
+                config.snapshot.compression = SnapshotCompression::LZ4;
+            } else if (codec == "none") {
+                config.snapshot.compression = SnapshotCompression::NONE;
+            } else {
+                std::cerr << "[ERROR] Unknown --snapshot-compression: " << codec << "\n\n";
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--snapshot-block-kb" && i + 1 < argc) {
+            config.snapshot.block_bytes = std::max(1, std::stoi(argv[++i])) * size_t(1024);
+        } else if (arg == "--snapshot-chunk-kb" && i + 1 < argc) {
+            config.replication.snapshot_chunk_bytes = std::max(1, std::stoi(argv[++i])) * size_t(1024);
+        } else if (arg == "--snapshot-rate-mb" && i + 1 < argc) {
+            config.replication.snapshot_rate_bytes = std::max(0, std::stoi(argv[++i])) * (uint64_t(1) << 20);
+        } else if (arg == "--text-rpc") {
+            config.text_rpc = true;
+        } else if (arg == "--recovery-threads" && i + 1 < argc) {
+            config.recovery_threads = std::max(1, std::stoi(argv[++i]));
+            config.snapshot.load_threads = config.recovery_threads;
+        } else if (arg == "--io-threads" && i + 1 < argc) {
+            config.io_threads = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--put-batch" && i + 1 < argc) {
+            config.put_batch_entries = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--put-linger-us" && i + 1 < argc) {
+            config.put_batch_linger = std::chrono::microseconds(std::stol(argv[++i]));
+        } else if (arg == "--heartbeat-ms" && i + 1 < argc) {
+            config.heartbeat_interval = std::chrono::milliseconds(std::max(1, std::stoi(argv[++i])));
+        } else if (arg == "--election-timeout-ms" && i + 1 < argc) {
+            std::string range = argv[++i];
+            size_t dash = range.find('-');
+            int min_ms = std::max(1, std::stoi(range.substr(0, dash)));
+            int max_ms = dash == std::string::npos ? 2 * min_ms : std::stoi(range.substr(dash + 1));
+            config.election_timeout_min = std::chrono::milliseconds(min_ms);
+            config.election_timeout_max = std::chrono::milliseconds(std::max(min_ms, max_ms));
+        } else if (arg == "--read-mode" && i + 1 < argc) {
+            std::string mode = argv[++i];
+            if (mode == "readindex") {
+                config.read_mode = ReadMode::READ_INDEX;
+            } else if (mode == "lease") {
+                config.read_mode = ReadMode::LEASE;
+            } else if (mode == "stale") {
+                config.read_mode = ReadMode::STALE;
+            } else {
+                std::cerr << "[ERROR] Unknown --read-mode: " << mode << "\n\n";
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--lease-ms" && i + 1 < argc) {
+            config.lease_ms = std::max(0, std::stoi(argv[++i]));
+        } else if (arg == "--no-follower-reads") {
+            config.follower_reads = false;
+        } else if (arg == "--no-pre-vote") {
+            config.pre_vote = false;
+        } else if (arg == "--no-check-quorum") {
+            config.check_quorum = false;
+        } else if (arg == "--forward-writes") {
+            config.forward_writes = true;
+        } else if (arg == "--max-memory-mb" && i + 1 < argc) {
+            config.max_memory = std::max(0, std::stoi(argv[++i])) * (size_t(1) << 20);
+        } else if (arg == "--memory-policy" && i + 1 < argc) {
+            std::string policy = argv[++i];
+            if (policy == "reject") {
+                config.memory_policy = MemoryPolicy::REJECT;
+            } else if (policy == "evict-lru") {
+                config.memory_policy = MemoryPolicy::EVICT_LRU;
+            } else if (policy == "evict-random") {
+                config.memory_policy = MemoryPolicy::EVICT_RANDOM;
+            } else {
+                std::cerr << "[ERROR] Unknown --memory-policy: " << policy << "\n\n";
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--compress-values" && i + 1 < argc) {
+            config.store.compress_min_bytes = std::max(0, std::stoi(argv[++i]));
+        } else if (arg == "--expiry-interval-ms" && i + 1 < argc) {
+            config.expiry_interval = std::chrono::milliseconds(std::max(10, std::stoi(argv[++i])));
+        } else if (arg == "--log-level" && i + 1 < argc) {
+            std::string name = argv[++i];
+            logging::Level level;
+            if (!logging::parseLevel(name, level)) {
+                std::cerr << "[ERROR] Unknown --log-level: " << name << "\n\n";
+                printUsage(argv[0]);
+                return 1;
+            }
+            logging::setLevel(level);
+        } else if (arg == "--metrics-port" && i + 1 < argc) {
+            config.metrics_port = std::stoi(argv[++i]);
         } else if (arg == "--help" || arg == "-h") {
             printUsage(argv[0]);
             return 0;
@@ -73,6 +234,17 @@ int main(int argc, char* argv[]) {
         printUsage(argv[0]);
         return 1;
     }
+    if (config.heartbeat_interval >= config.election_timeout_min) {
+        std::cerr << "[ERROR] --heartbeat-ms must be below the minimum election timeout\n\n";
+        printUsage(argv[0]);
+        return 1;
+    }
+    if (config.read_mode == ReadMode::LEASE &&
+        std::chrono::milliseconds(config.lease_ms) >= config.election_timeout_min) {
+        std::cerr << "[ERROR] --lease-ms must be below the minimum election timeout\n\n";
+        printUsage(argv[0]);
+        return 1;
+    }
 
     std::cout << "========================================\n";
     std::cout << "LogKV - Distributed Key-Value Store\n";
@@ -80,6 +252,7 @@ int main(int argc, char* argv[]) {
     std::cout << "Server ID:   " << id << "\n";
     std::cout << "Port:        " << port << "\n";
     std::cout << "Initial Role:" << (role == Role::LEADER ? "LEADER" : "FOLLOWER") << "\n";
+    std::cout << "Raft groups: " << groups << "\n";
     std::cout << "Peers:       ";
     if (peers.empty()) {
         std::cout << "(none - single node)\n";
@@ -92,10 +265,11 @@ int main(int argc, char* argv[]) {
     }
     std::cout << "========================================\n\n";
 
-    Server server(port, role, id, peers);
-    global_server = &server;
+    Node node(port, role, id, peers, config, groups);
+    global_node = &node;
     
-    server.start();
+    node.start();
     
+    logging::flush();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,289 @@
+#include "metrics.h"
+#include "log.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+
+namespace metrics {
+
+size_t threadStripe() {
+    static std::atomic<size_t> next{0};
+    thread_local size_t stripe = next.fetch_add(1, std::memory_order_relaxed) % kStripes;
+    return stripe;
+}
+
+uint64_t Counter::value() const {
+    uint64_t total = 0;
+    for (const auto& cell : cells_) {
+        total += cell.value.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+// ============================================================================
+// Histogram
+// ============================================================================
+
+size_t Histogram::bucketFor(uint64_t value) {
+    if (value < kSubBuckets) {
+        return static_cast<size_t>(value);
+    }
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - kSubBits;
+    return (static_cast<size_t>(shift + 1) << kSubBits) |
+           static_cast<size_t>((value >> shift) & (kSubBuckets - 1));
+}
+
+uint64_t Histogram::bucketUpperBound(size_t bucket) {
+    if (bucket < kSubBuckets) {
+        return bucket;
+    }
+    int shift = static_cast<int>(bucket >> kSubBits) - 1;
+    uint64_t low = (kSubBuckets | (bucket & (kSubBuckets - 1))) << shift;
+    return low + ((uint64_t(1) << shift) - 1);
+}
+
+Histogram::Summary Histogram::summary() const {
+    Summary s;
+    s.buckets.assign(kBuckets, 0);
+    for (const auto& stripe : stripes_) {
+        for (size_t b = 0; b < kBuckets; b++) {
+            uint64_t n = stripe.buckets[b].load(std::memory_order_relaxed);
+            s.buckets[b] += n;
+            s.count += n;
+        }
+        s.sum += stripe.sum.load(std::memory_order_relaxed);
+        s.max = std::max(s.max, stripe.max.load(std::memory_order_relaxed));
+    }
+    return s;
+}
+
+uint64_t Histogram::Summary::percentile(double q) const {
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(q * static_cast<double>(count - 1)) + 1;
+    uint64_t seen = 0;
+    for (size_t b = 0; b < buckets.size(); b++) {
+        seen += buckets[b];
+        if (seen >= rank) {
+            return std::min(bucketUpperBound(b), max);
+        }
+    }
+    return max;
+}
+
+// ============================================================================
+// Registry
+// ============================================================================
+
+namespace {
+
+std::string renderLabels(const Labels& labels) {
+    std::string out;
+    for (const auto& [key, value] : labels) {
+        if (!out.empty()) out += ',';
+        out += key + "=\"";
+        for (char c : value) {
+            if (c == '"' || c == '\\') out += '\\';
+            out += c;
+        }
+        out += '"';
+    }
+    return out;
+}
+
+std::string braced(const std::string& labels) {
+    return labels.empty() ? "" : "{" + labels + "}";
+}
+
+// Histogram values in the unit they're reported in: seconds (Prometheus)
+// or microseconds (STATS) for latencies, as-is otherwise
+double scaled(uint64_t value, Unit unit, double ns_scale) {
+    return unit == Unit::NANOSECONDS ? value * ns_scale : static_cast<double>(value);
+}
+
+}  // namespace
+
+Registry::Family& Registry::family(const std::string& name, Kind kind, const std::string& help) {
+    // Assumes mutex_ is held
+    auto it = families_.find(name);
+    if (it == families_.end()) {
+        it = families_.emplace(name, Family{kind, help, {}, {}, {}}).first;
+    }
+    return it->second;
+}
+
+Counter& Registry::counter(const std::string& name, const std::string& help,
+                           const Labels& labels) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& slot = family(name, Kind::COUNTER, help).counters[renderLabels(labels)];
+    if (!slot) slot = std::make_unique<Counter>();
+    return *slot;
+}
+
+Gauge& Registry::gauge(const std::string& name, const std::string& help,
+                       const Labels& labels) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& slot = family(name, Kind::GAUGE, help).gauges[renderLabels(labels)];
+    if (!slot) slot = std::make_unique<Gauge>();
+    return *slot;
+}
+
+Histogram& Registry::histogram(const std::string& name, const std::string& help,
+                               const Labels& labels, Unit unit) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& slot = family(name, Kind::HISTOGRAM, help).histograms[renderLabels(labels)];
+    if (!slot) slot = std::make_unique<Histogram>(unit);
+    return *slot;
+}
+
+std::string Registry::renderStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::ostringstream out;
+    for (const auto& [name, family] : families_) {
+        for (const auto& [labels, counter] : family.counters) {
+            out << "STAT " << name << braced(labels) << " " << counter->value() << "\n";
+        }
+        for (const auto& [labels, gauge] : family.gauges) {
+            out << "STAT " << name << braced(labels) << " " << gauge->value() << "\n";
+        }
+        for (const auto& [labels, histogram] : family.histograms) {
+            Histogram::Summary s = histogram->summary();
+            Unit unit = histogram->unit();
+            const char* suffix = unit == Unit::NANOSECONDS ? "_us" : "";
+            double mean = s.count ? static_cast<double>(s.sum) / s.count : 0;
+            out << "STAT " << name << braced(labels) << " count=" << s.count
+                << " mean" << suffix << "=" << (unit == Unit::NANOSECONDS ? mean / 1e3 : mean)
+                << " p50" << suffix << "=" << scaled(s.percentile(0.50), unit, 1e-3)
+                << " p99" << suffix << "=" << scaled(s.percentile(0.99), unit, 1e-3)
+                << " p999" << suffix << "=" << scaled(s.percentile(0.999), unit, 1e-3)
+                << " max" << suffix << "=" << scaled(s.max, unit, 1e-3) << "\n";
+        }
+    }
+    return out.str();
+}
+
+std::string Registry::renderPrometheus() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::ostringstream out;
+    for (const auto& [name, family] : families_) {
+        const char* type = family.kind == Kind::COUNTER ? "counter"
+                         : family.kind == Kind::GAUGE   ? "gauge"
+                                                        : "summary";
+        out << "# HELP " << name << " " << family.help << "\n";
+        out << "# TYPE " << name << " " << type << "\n";
+        for (const auto& [labels, counter] : family.counters) {
+            out << name << braced(labels) << " " << counter->value() << "\n";
+        }
+        for (const auto& [labels, gauge] : family.gauges) {
+            out << name << braced(labels) << " " << gauge->value() << "\n";
+        }
+        for (const auto& [labels, histogram] : family.histograms) {
+            Histogram::Summary s = histogram->summary();
+            Unit unit = histogram->unit();
+            std::string sep = labels.empty() ? "" : labels + ",";
+            for (double q : {0.5, 0.99, 0.999}) {
+                out << name << "{" << sep << "quantile=\"" << q << "\"} "
+                    << scaled(s.percentile(q), unit, 1e-9) << "\n";
+            }
+            out << name << "_sum" << braced(labels) << " " << scaled(s.sum, unit, 1e-9) << "\n";
+            out << name << "_count" << braced(labels) << " " << s.count << "\n";
+        }
+    }
+    return out.str();
+}
+
+Registry& registry() {
+    // Never destroyed: threads may still record while the process exits
+    static Registry* instance = new Registry();
+    return *instance;
+}
+
+// ============================================================================
+// HttpEndpoint
+// ============================================================================
+
+HttpEndpoint::~HttpEndpoint() {
+    stop();
+}
+
+bool HttpEndpoint::start(int port, std::function<std::string()> render) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return false;
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+        LOG_ERROR("Metrics endpoint can't listen on port " << port << ": " << strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    render_ = std::move(render);
+    listen_fd_ = fd;
+    running_ = true;
+    thread_ = std::thread(&HttpEndpoint::serve, this);
+    return true;
+}
+
+void HttpEndpoint::stop() {
+    if (!running_.exchange(false)) {
+        return;
+    }
+    shutdown(listen_fd_, SHUT_RDWR);    // Unblocks accept()
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    close(listen_fd_);
+    listen_fd_ = -1;
+}
+
+void HttpEndpoint::serve() {
+    while (running_) {
+        int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            break;
+        }
+        timeval timeout{1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        // Whatever was asked for, the answer is the metrics: just let the
+        // request headers arrive so the client sees a clean response
+        std::string request;
+        char chunk[1024];
+        while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192) {
+            ssize_t n = read(fd, chunk, sizeof(chunk));
+            if (n <= 0) break;
+            request.append(chunk, static_cast<size_t>(n));
+        }
+
+        std::string body = render_();
+        std::string response = "HTTP/1.0 200 OK\r\n"
+                               "Content-Type: text/plain; version=0.0.4\r\n"
+                               "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                               "Connection: close\r\n\r\n" + body;
+        size_t written = 0;
+        while (written < response.size()) {
+            ssize_t n = send(fd, response.data() + written, response.size() - written,
+                             MSG_NOSIGNAL);
+            if (n <= 0) break;
+            written += static_cast<size_t>(n);
+        }
+        close(fd);
+    }
+}
+
+}  // namespace metrics
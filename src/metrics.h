@@ -0,0 +1,185 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ * Metrics
+ *
+ * Counters and latency histograms cheap enough for the request path, kept
+ * in one process-wide Registry that the STATS command and the Prometheus
+ * endpoint render.
+ *
+ * HOT PATH COST:
+ * Every metric is striped: each thread updates its own cache line with a
+ * relaxed atomic add, so recording never takes a lock and threads don't
+ * bounce lines between cores. Readers sum the stripes; a reading may be a
+ * few updates behind, which is fine for monitoring.
+ *
+ * HISTOGRAMS:
+ * HDR-style log-linear buckets: every power of two is split into
+ * 2^kSubBits linear buckets, so any value is reported within 1/8 (12.5%)
+ * of its true size from nanoseconds up to hours, at a fixed ~4 KB per
+ * stripe. Percentiles are computed from the bucket counts at read time.
+ *
+ * Metrics are created on first use by name and labels and live as long as
+ * the process, so callers resolve them once and keep the reference.
+ */
+namespace metrics {
+
+using Labels = std::vector<std::pair<std::string, std::string>>;
+
+constexpr size_t kStripes = 8;
+
+// This thread's stripe, assigned round-robin on first use
+size_t threadStripe();
+
+class Counter {
+public:
+    void add(uint64_t n = 1) {
+        cells_[threadStripe()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+    uint64_t value() const;
+
+private:
+    struct alignas(64) Cell {
+        std::atomic<uint64_t> value{0};
+    };
+    Cell cells_[kStripes];
+};
+
+class Gauge {
+public:
+    void set(int64_t v) { value_.store(v, std::memory_order_relaxed); }
+    int64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<int64_t> value_{0};
+};
+
+enum class Unit {
+    NANOSECONDS,    // Latencies; exported in seconds (Prometheus) or µs (STATS)
+    NONE            // Plain quantities (queue depth, batch size)
+};
+
+class Histogram {
+public:
+    static constexpr int kSubBits = 3;
+    static constexpr size_t kSubBuckets = size_t(1) << kSubBits;
+    static constexpr size_t kBuckets = (64 - kSubBits + 1) * kSubBuckets;
+
+    explicit Histogram(Unit unit = Unit::NANOSECONDS) : unit_(unit) {}
+
+    void record(uint64_t value) {
+        Stripe& s = stripes_[threadStripe()];
+        s.buckets[bucketFor(value)].fetch_add(1, std::memory_order_relaxed);
+        s.sum.fetch_add(value, std::memory_order_relaxed);
+        uint64_t max = s.max.load(std::memory_order_relaxed);
+        while (value > max &&
+               !s.max.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+        }
+    }
+
+    // Convenience for the common case: time since start, in nanoseconds
+    template <typename TimePoint>
+    void recordSince(TimePoint start) {
+        auto elapsed = TimePoint::clock::now() - start;
+        record(static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+    }
+
+    struct Summary {
+        uint64_t count = 0;
+        uint64_t sum = 0;
+        uint64_t max = 0;
+        std::vector<uint64_t> buckets;
+
+        // Upper bound of the bucket holding the q-th value (at most max)
+        uint64_t percentile(double q) const;
+    };
+    Summary summary() const;
+
+    Unit unit() const { return unit_; }
+
+    static size_t bucketFor(uint64_t value);
+    static uint64_t bucketUpperBound(size_t bucket);
+
+private:
+    struct alignas(64) Stripe {
+        std::atomic<uint64_t> buckets[kBuckets] = {};
+        std::atomic<uint64_t> sum{0};
+        std::atomic<uint64_t> max{0};
+    };
+    Unit unit_;
+    Stripe stripes_[kStripes];
+};
+
+class Registry {
+public:
+    Counter& counter(const std::string& name, const std::string& help,
+                     const Labels& labels = {});
+    Gauge& gauge(const std::string& name, const std::string& help,
+                 const Labels& labels = {});
+    Histogram& histogram(const std::string& name, const std::string& help,
+                         const Labels& labels = {}, Unit unit = Unit::NANOSECONDS);
+
+    // "STAT <name>{labels} <value>" lines, histograms as count/mean/p50/p99/p999/max
+    std::string renderStats() const;
+
+    // Prometheus text exposition format (histograms as summaries)
+    std::string renderPrometheus() const;
+
+private:
+    enum class Kind { COUNTER, GAUGE, HISTOGRAM };
+
+    struct Family {
+        Kind kind;
+        std::string help;
+        // Keyed by rendered labels so output order is stable
+        std::map<std::string, std::unique_ptr<Counter>> counters;
+        std::map<std::string, std::unique_ptr<Gauge>> gauges;
+        std::map<std::string, std::unique_ptr<Histogram>> histograms;
+    };
+
+    mutable std::mutex mutex_;
+    std::map<std::string, Family> families_;
+
+    Family& family(const std::string& name, Kind kind, const std::string& help);
+};
+
+// The process-wide registry
+Registry& registry();
+
+/**
+ * HttpEndpoint
+ *
+ * Minimal HTTP/1.0 server for scrapers: every request on the port gets the
+ * output of render() back and the connection is closed. Runs on its own
+ * thread so a slow scraper never touches the request path.
+ */
+class HttpEndpoint {
+public:
+    HttpEndpoint() = default;
+    ~HttpEndpoint();
+
+    bool start(int port, std::function<std::string()> render);
+    void stop();
+
+private:
+    std::function<std::string()> render_;
+    std::atomic<bool> running_{false};
+    int listen_fd_ = -1;
+    std::thread thread_;
+
+    void serve();
+};
+
+}  // namespace metrics
@@ -0,0 +1,341 @@
+#include "node.h"
+#include "log.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cctype>
+
+namespace {
+
+// Whitespace separated words of a text request, as the servers read them
+std::vector<std::string_view> words(std::string_view line) {
+    std::vector<std::string_view> out;
+    size_t i = 0;
+    while (i < line.size()) {
+        while (i < line.size() && std::isspace(static_cast<unsigned char>(line[i]))) i++;
+        size_t start = i;
+        while (i < line.size() && !std::isspace(static_cast<unsigned char>(line[i]))) i++;
+        if (i > start) {
+            out.push_back(line.substr(start, i - start));
+        }
+    }
+    return out;
+}
+
+std::string_view firstWord(std::string_view line) {
+    size_t start = 0;
+    while (start < line.size() && std::isspace(static_cast<unsigned char>(line[start]))) start++;
+    size_t end = start;
+    while (end < line.size() && !std::isspace(static_cast<unsigned char>(line[end]))) end++;
+    return line.substr(start, end - start);
+}
+
+}  // namespace
+
+Node::Node(int port, Role role, int server_id,
+           const std::vector<std::string>& peers,
+           const ServerConfig& config, int groups)
+    : port_(port),
+      server_id_(server_id),
+      config_(config),
+      self_addr_(config.advertise_addr.empty() ? "127.0.0.1:" + std::to_string(port)
+                                               : config.advertise_addr) {
+    groups = std::max(1, groups);
+    reactor_ = std::make_unique<Reactor>(
+        config_.io_threads,
+        [this](const std::shared_ptr<Connection>& conn, std::string_view request) {
+            handleRequest(conn, request);
+        });
+    wal_writer_ = std::make_shared<WalWriter>(config_.wal);
+
+    // Every node sorts the same addresses the same way, so they agree on
+    // whose turn each group is
+    std::vector<std::string> members = peers;
+    members.push_back(self_addr_);
+    std::sort(members.begin(), members.end());
+    size_t position = std::find(members.begin(), members.end(), self_addr_) - members.begin();
+
+    for (int g = 0; g < groups; g++) {
+        ServerConfig group_config = config_;
+        group_config.advertise_addr = self_addr_;
+        group_config.group = g;
+        group_config.groups = groups;
+        group_config.max_memory = config_.max_memory / groups;  // Keys hash evenly
+        group_config.preferred_leader = groups > 1 && g % members.size() == position;
+        groups_.push_back(std::make_unique<Server>(port, role, server_id, peers, group_config,
+                                                   *reactor_, wal_writer_));
+        groups_.back()->setPeerDirectory([this](int id) { return addressOf(id); }, &forwarder_);
+    }
+}
+
+Node::~Node() {
+    shutdown();
+}
+
+void Node::shutdown() {
+    reactor_->stop();
+    metrics_endpoint_.stop();
+    forwarder_.stop();
+    for (auto& group : groups_) {
+        group->shutdown();
+    }
+}
+
+void Node::start() {
+    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (server_fd < 0) {
+        LOG_ERROR("socket() failed");
+        return;
+    }
+
+    int opt = 1;
+    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port_);
+
+    if (bind(server_fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        LOG_ERROR("bind() failed on port " << port_);
+        close(server_fd);
+        return;
+    }
+
+    listen(server_fd, SOMAXCONN);
+
+    LOG_INFO("LogKV server running on port " << port_ << " with " << groups_.size()
+              << (groups_.size() == 1 ? " Raft group" : " Raft groups"));
+
+    for (auto& group : groups_) {
+        group->start();
+    }
+    if (config_.metrics_port > 0 &&
+        metrics_endpoint_.start(config_.metrics_port, [this]{ return renderMetrics(true); })) {
+        LOG_INFO("Metrics endpoint on port " << config_.metrics_port);
+    }
+
+    // Serve client and peer connections until shutdown
+    reactor_->run(server_fd);
+
+    close(server_fd);
+}
+
+void Node::handleRequest(const std::shared_ptr<Connection>& conn, std::string_view request) {
+    // Runs on a reactor worker. Peer connections said which group they
+    // are for; client requests go by key.
+    int peer_group = conn->peerGroup();
+    if (peer_group >= 0) {
+        groups_[peer_group]->handleRequest(conn, request);
+        return;
+    }
+    if (handleNodeRequest(conn, request)) {
+        return;
+    }
+    size_t group = 0;
+    if (groups_.size() > 1 && !route(conn, request, group)) {
+        return;
+    }
+    groups_[group]->handleRequest(conn, request);
+}
+
+bool Node::handleNodeRequest(const std::shared_ptr<Connection>& conn, std::string_view request) {
+    proto::MsgType type;
+    proto::PeerHello hello;
+    bool hello_ok = false;
+    if (conn->binary()) {
+        proto::Frame frame;
+        size_t consumed;
+        if (proto::parseFrame(request, frame, consumed) != proto::ParseResult::FRAME) {
+            return false;
+        }
+        type = frame.type;
+        hello_ok = type == proto::MsgType::PEER_HELLO && proto::decodePeerHello(frame.payload, hello);
+    } else {
+        std::string_view cmd = firstWord(request);
+        if (cmd == "PEER_HELLO") {
+            type = proto::MsgType::PEER_HELLO;
+            hello_ok = proto::parsePeerHelloText(request, hello);
+        } else if (cmd == "STATS") {
+            type = proto::MsgType::STATS;
+        } else if (cmd == "ROUTES") {
+            type = proto::MsgType::ROUTES;
+        } else {
+            return false;
+        }
+    }
+
+    switch (type) {
+        case proto::MsgType::PEER_HELLO:
+            // No reply: the peer sends its first RPC right behind it
+            if (!hello_ok || hello.group < 0 || hello.group >= static_cast<int>(groups_.size())) {
+                LOG_WARN("Bad PEER_HELLO (group " << hello.group << " of " << groups_.size()
+                          << "); closing the connection");
+                conn->closeAfterResponses();
+                return true;
+            }
+            conn->setPeerGroup(hello.group);
+            if (hello.server_id >= 0 && hello.server_id != server_id_) {
+                std::lock_guard<std::mutex> lock(peers_mutex_);
+                peer_addrs_[hello.server_id] = hello.addr;
+            }
+            return true;
+        case proto::MsgType::STATS:
+            if (conn->binary()) {
+                reply(conn, conn->reserve(), proto::Status::OK, renderMetrics(false));
+            } else {
+                conn->respond(conn->reserve(), renderMetrics(false) + "END\n");
+            }
+            return true;
+        case proto::MsgType::ROUTES: {
+            std::vector<proto::Route> table = routes();
+            if (conn->binary()) {
+                std::string body;
+                proto::encodeRoutesBody(body, table);
+                reply(conn, conn->reserve(), proto::Status::OK, body);
+                return true;
+            }
+            // ROUTE <group> <leader, or - if unknown> <term>, then END
+            std::string out;
+            for (const auto& route : table) {
+                out += "ROUTE " + std::to_string(route.group) + " " +
+                       (route.leader.empty() ? std::string("-") : route.leader) + " " +
+                       std::to_string(route.term) + "\n";
+            }
+            out += "END\n";
+            conn->respond(conn->reserve(), std::move(out));
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+bool Node::route(const std::shared_ptr<Connection>& conn, std::string_view request,
+                 size_t& group) {
+    // What a request can't be parsed into goes to group 0, which answers
+    // it just as a single group would
+    size_t n = groups_.size();
+    std::vector<std::string_view> keys;
+    std::vector<std::string> decoded;   // MULTI_GET keys, which keys points into
+    bool ranged = false;
+    bool session = false;   // In a SESSION envelope, which is answered out of order
+    uint64_t seq = 0;
+    if (conn->binary()) {
+        proto::Frame frame;
+        size_t consumed;
+        proto::parseFrame(request, frame, consumed);
+        // Route on what's inside the envelope: a forwarded request has two
+        // (forwarder.h), and the reply goes to the outer one
+        uint64_t client_id, inner_seq;
+        std::string_view inner;
+        for (int depth = 0; depth < 2 && frame.type == proto::MsgType::SESSION &&
+                            proto::decodeSession(frame.payload, client_id, inner_seq, inner) &&
+                            proto::parseFrame(inner, frame, consumed) == proto::ParseResult::FRAME;
+             depth++) {
+            if (!session) {
+                seq = inner_seq;
+            }
+            session = true;
+        }
+        proto::Decoder d(frame.payload);
+        std::string_view key;
+        KeyValueViews pairs;
+        switch (frame.type) {
+            case proto::MsgType::PUT:
+            case proto::MsgType::GET:
+            case proto::MsgType::DELETE:
+                if (d.bytes(key)) keys.push_back(key);
+                break;
+            case proto::MsgType::MULTI_PUT:
+                if (decodeMultiPut(frame.payload, pairs)) {
+                    for (const auto& pair : pairs) keys.push_back(pair.first);
+                }
+                break;
+            case proto::MsgType::MULTI_GET:
+                if (proto::decodeMultiGet(frame.payload, decoded)) {
+                    keys.assign(decoded.begin(), decoded.end());
+                }
+                break;
+            case proto::MsgType::SCAN:
+                ranged = true;
+                break;
+            default:
+                break;
+        }
+    } else {
+        std::vector<std::string_view> w = words(request);
+        if (w.size() > 3 && w[0] == "SESSION") {
+            w.erase(w.begin(), w.begin() + 3);      // SESSION <client_id> <seq> <command>
+        }
+        std::string_view cmd = w.empty() ? std::string_view() : w[0];
+        if ((cmd == "PUT" || cmd == "GET" || cmd == "DELETE") && w.size() > 1) {
+            keys.push_back(w[1]);
+        } else if (cmd == "MPUT") {
+            for (size_t i = 1; i < w.size(); i += 2) keys.push_back(w[i]);
+        } else if (cmd == "MGET") {
+            keys.assign(w.begin() + 1, w.end());
+        } else if (cmd == "SCAN" || cmd == "PSCAN") {
+            ranged = true;
+        }
+    }
+
+    bool cross_group = ranged;
+    for (auto key : keys) {
+        cross_group = cross_group || proto::groupOf(key, n) != proto::groupOf(keys[0], n);
+    }
+    if (cross_group) {
+        reply(conn, session ? conn->reserveUnordered(seq) : conn->reserve(),
+              proto::Status::ERROR, "CROSS_GROUP");
+        return false;
+    }
+    if (!keys.empty()) {
+        group = proto::groupOf(keys[0], n);
+    }
+    return true;
+}
+
+std::vector<proto::Route> Node::routes() {
+    std::vector<proto::Route> table;
+    for (size_t g = 0; g < groups_.size(); g++) {
+        proto::Route route;
+        route.group = static_cast<int>(g);
+        route.term = groups_[g]->currentTerm();
+        route.leader = groups_[g]->leaderAddress();
+        table.push_back(std::move(route));
+    }
+    return table;
+}
+
+std::string Node::addressOf(int server_id) {
+    if (server_id == server_id_) {
+        return self_addr_;
+    }
+    std::lock_guard<std::mutex> lock(peers_mutex_);
+    auto it = peer_addrs_.find(server_id);
+    return it != peer_addrs_.end() ? it->second : std::string();
+}
+
+std::string Node::renderMetrics(bool prometheus) {
+    auto& registry = metrics::registry();
+    for (auto& group : groups_) {
+        group->refreshMetrics();
+    }
+    registry.gauge("logkv_connections", "Open client and peer connections")
+        .set(static_cast<int64_t>(reactor_->connectionCount()));
+    return prometheus ? registry.renderPrometheus() : registry.renderStats();
+}
+
+void Node::reply(const std::shared_ptr<Connection>& conn, uint64_t slot, proto::Status status,
+                 std::string_view body) {
+    std::string out;
+    if (conn->binary()) {
+        proto::encodeResponse(out, status, body);
+    } else {
+        out.assign(body.data(), body.size());
+        out.push_back('\n');
+    }
+    conn->respond(slot, std::move(out));
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include "server.h"
+#include "reactor.h"
+#include "metrics.h"
+#include "wal_writer.h"
+#include "forwarder.h"
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Node
+ *
+ * One process of the cluster, running every Raft group (multi-Raft). It
+ * owns what the groups share: the listening socket and reactor, one WAL
+ * writer, so the appends of all groups land in the same group commit, and
+ * the metrics endpoint. Each group is a Server with its own store, log
+ * and snapshots.
+ *
+ * PARTITIONING:
+ * Keys are hash partitioned: key k belongs to group proto::groupOf(k, n),
+ * which clients can compute themselves. ROUTES lists every group's leader
+ * so clients can send a group's writes straight to it; any node takes any
+ * request and the group's server answers as it always has (NOT_LEADER,
+ * or a follower read). A request naming keys of more than one group
+ * (MPUT, MGET) fails with CROSS_GROUP, and with more than one group there
+ * is no SCAN: every range spans all of them.
+ *
+ * PEERS:
+ * Nodes open their connections to each other with a PEER_HELLO, and the
+ * RPCs after it go to the group it named. Hellos also say where each
+ * server id listens, which is how ROUTES puts an address on a leader and
+ * a follower's NOT_LEADER names it. With forward_writes, followers proxy
+ * client writes to their group's leader over the node's Forwarder, whose
+ * connections every group shares.
+ *
+ * LEADERS:
+ * Group g prefers the node at position g % nodes in address order: that
+ * node stands for election first at startup, so leaderships start out
+ * spread over the nodes rather than all going to whoever is fastest.
+ * After a failure they go wherever the elections put them.
+ */
+class Node {
+public:
+    Node(int port, Role role, int server_id,
+         const std::vector<std::string>& peers,
+         const ServerConfig& config, int groups = 1);
+    ~Node();
+
+    Node(const Node&) = delete;
+    Node& operator=(const Node&) = delete;
+
+    // Serve until shutdown(). Blocks the caller.
+    void start();
+    void shutdown();
+
+private:
+    int port_;
+    int server_id_;
+    ServerConfig config_;
+    std::string self_addr_;
+
+    std::unique_ptr<Reactor> reactor_;
+    std::shared_ptr<WalWriter> wal_writer_;
+    std::vector<std::unique_ptr<Server>> groups_;
+    metrics::HttpEndpoint metrics_endpoint_;
+
+    // Where each server id listens, learned from PEER_HELLOs
+    std::mutex peers_mutex_;
+    std::unordered_map<int, std::string> peer_addrs_;
+    Forwarder forwarder_;
+    
+    std::string addressOf(int server_id);
+
+    void handleRequest(const std::shared_ptr<Connection>& conn, std::string_view request);
+    // Handled here rather than by a group: false if it is for a group
+    bool handleNodeRequest(const std::shared_ptr<Connection>& conn, std::string_view request);
+    // The group a client request is for; false if it was answered instead
+    bool route(const std::shared_ptr<Connection>& conn, std::string_view request, size_t& group);
+
+    std::string renderMetrics(bool prometheus);
+    std::vector<proto::Route> routes();
+    void reply(const std::shared_ptr<Connection>& conn, uint64_t slot, proto::Status status,
+               std::string_view body);
+};
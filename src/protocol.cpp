@@ -0,0 +1,684 @@
+#include "protocol.h"
+#include "coding.h"
+#include "crc32.h"
+#include <cstring>
+
+namespace proto {
+
+// ============================================================================
+// FRAMING
+// ============================================================================
+
+ParseResult parseFrame(std::string_view buf, Frame& frame, size_t& consumed) {
+    if (buf.empty()) {
+        return ParseResult::INCOMPLETE;
+    }
+    if (static_cast<uint8_t>(buf[0]) != kMagic) {
+        return ParseResult::INVALID;
+    }
+    if (buf.size() < kFrameHeaderSize) {
+        return ParseResult::INCOMPLETE;
+    }
+    if (static_cast<uint8_t>(buf[1]) != kVersion) {
+        return ParseResult::INVALID;
+    }
+
+    uint32_t len = decodeFixed32(buf.data() + 3);
+    if (len > kMaxPayload) {
+        return ParseResult::INVALID;
+    }
+    if (buf.size() < kFrameHeaderSize + len) {
+        return ParseResult::INCOMPLETE;
+    }
+
+    frame.type = static_cast<MsgType>(static_cast<uint8_t>(buf[2]));
+    frame.payload = buf.substr(kFrameHeaderSize, len);
+    consumed = kFrameHeaderSize + len;
+    return ParseResult::FRAME;
+}
+
+size_t beginFrame(std::string& out, MsgType type) {
+    size_t start = out.size();
+    out.push_back(static_cast<char>(kMagic));
+    out.push_back(static_cast<char>(kVersion));
+    out.push_back(static_cast<char>(type));
+    putFixed32(out, 0);  // Patched by finishFrame
+    return start;
+}
+
+void finishFrame(std::string& out, size_t start) {
+    uint32_t len = static_cast<uint32_t>(out.size() - start - kFrameHeaderSize);
+    std::string encoded;
+    putFixed32(encoded, len);
+    std::memcpy(&out[start + 3], encoded.data(), 4);
+}
+
+void putBytes(std::string& out, std::string_view bytes) {
+    putFixed32(out, static_cast<uint32_t>(bytes.size()));
+    out.append(bytes.data(), bytes.size());
+}
+
+// ============================================================================
+// DECODER
+// ============================================================================
+
+bool Decoder::u8(uint8_t& v) {
+    if (end_ - p_ < 1) return false;
+    v = static_cast<uint8_t>(*p_++);
+    return true;
+}
+
+bool Decoder::u32(uint32_t& v) {
+    if (end_ - p_ < 4) return false;
+    v = decodeFixed32(p_);
+    p_ += 4;
+    return true;
+}
+
+bool Decoder::u64(uint64_t& v) {
+    if (end_ - p_ < 8) return false;
+    v = decodeFixed64(p_);
+    p_ += 8;
+    return true;
+}
+
+bool Decoder::i32(int& v) {
+    uint32_t raw;
+    if (!u32(raw)) return false;
+    v = static_cast<int>(raw);
+    return true;
+}
+
+bool Decoder::i64(int& v) {
+    uint64_t raw;
+    if (!u64(raw)) return false;
+    v = static_cast<int>(raw);
+    return true;
+}
+
+bool Decoder::bytes(std::string_view& v) {
+    uint32_t len;
+    if (!u32(len) || static_cast<size_t>(end_ - p_) < len) return false;
+    v = std::string_view(p_, len);
+    p_ += len;
+    return true;
+}
+
+// ============================================================================
+// MESSAGES
+// ============================================================================
+
+void encodeAppendEntries(std::string& out, const AppendEntriesView& args,
+                         const std::vector<LogEntry>& entries) {
+    size_t start = beginFrame(out, MsgType::APPEND_ENTRIES);
+    putFixed64(out, static_cast<uint64_t>(args.term));
+    putFixed32(out, static_cast<uint32_t>(args.leader_id));
+    putFixed64(out, static_cast<uint64_t>(args.prev_log_index));
+    putFixed64(out, static_cast<uint64_t>(args.prev_log_term));
+    putFixed64(out, static_cast<uint64_t>(args.leader_commit));
+    putFixed32(out, static_cast<uint32_t>(entries.size()));
+    for (const auto& entry : entries) {
+        putFixed64(out, static_cast<uint64_t>(entry.index));
+        putFixed64(out, static_cast<uint64_t>(entry.term));
+        out.push_back(static_cast<char>(entry.op));
+        putBytes(out, entry.key());
+        putBytes(out, entry.value());
+    }
+    finishFrame(out, start);
+}
+
+bool decodeAppendEntries(std::string_view payload, AppendEntriesView& args) {
+    Decoder d(payload);
+    uint32_t count;
+    if (!d.i64(args.term) || !d.i32(args.leader_id) || !d.i64(args.prev_log_index) ||
+        !d.i64(args.prev_log_term) || !d.i64(args.leader_commit) || !d.u32(count)) {
+        return false;
+    }
+
+    // Each entry is at least 29 bytes, which bounds a hostile count
+    if (count > payload.size() / 29) {
+        return false;
+    }
+    args.entries.clear();
+    args.entries.resize(count);
+    for (auto& entry : args.entries) {
+        uint8_t op;
+        if (!d.i64(entry.index) || !d.i64(entry.term) || !d.u8(op) ||
+            !d.bytes(entry.key) || !d.bytes(entry.value)) {
+            return false;
+        }
+        entry.op = opFromCode(op);
+    }
+    return d.done();
+}
+
+void encodeAppendEntriesReply(std::string& out, const AppendEntriesReply& reply) {
+    size_t start = beginFrame(out, MsgType::APPEND_ENTRIES_REPLY);
+    out.push_back(reply.success ? 1 : 0);
+    putFixed64(out, static_cast<uint64_t>(reply.term));
+    putFixed64(out, static_cast<uint64_t>(reply.next_index));
+    putFixed64(out, static_cast<uint64_t>(reply.conflict_term));
+    putFixed64(out, static_cast<uint64_t>(reply.conflict_index));
+    finishFrame(out, start);
+}
+
+bool decodeAppendEntriesReply(std::string_view payload, AppendEntriesReply& reply) {
+    Decoder d(payload);
+    uint8_t success;
+    if (!d.u8(success) || !d.i64(reply.term) || !d.i64(reply.next_index)) {
+        return false;
+    }
+    reply.success = success != 0;
+    // The conflict hint is optional: a peer without it just sends next_index
+    if (!d.done() && (!d.i64(reply.conflict_term) || !d.i64(reply.conflict_index))) {
+        return false;
+    }
+    return true;
+}
+
+void encodeVoteRequest(std::string& out, const VoteRequest& req) {
+    size_t start = beginFrame(out, MsgType::REQUEST_VOTE);
+    putFixed64(out, static_cast<uint64_t>(req.term));
+    putFixed32(out, static_cast<uint32_t>(req.candidate_id));
+    putFixed64(out, static_cast<uint64_t>(req.last_log_index));
+    putFixed64(out, static_cast<uint64_t>(req.last_log_term));
+    out.push_back(req.pre_vote ? 1 : 0);
+    finishFrame(out, start);
+}
+
+bool decodeVoteRequest(std::string_view payload, VoteRequest& req) {
+    Decoder d(payload);
+    uint8_t pre_vote;
+    if (!d.i64(req.term) || !d.i32(req.candidate_id) ||
+        !d.i64(req.last_log_index) || !d.i64(req.last_log_term) || !d.u8(pre_vote)) {
+        return false;
+    }
+    req.pre_vote = pre_vote != 0;
+    return true;
+}
+
+void encodeVoteReply(std::string& out, const VoteReply& reply) {
+    size_t start = beginFrame(out, MsgType::VOTE_REPLY);
+    out.push_back(reply.granted ? 1 : 0);
+    putFixed64(out, static_cast<uint64_t>(reply.term));
+    finishFrame(out, start);
+}
+
+bool decodeVoteReply(std::string_view payload, VoteReply& reply) {
+    Decoder d(payload);
+    uint8_t granted;
+    if (!d.u8(granted) || !d.i64(reply.term)) {
+        return false;
+    }
+    reply.granted = granted != 0;
+    return true;
+}
+
+void encodeReadIndex(std::string& out) {
+    size_t start = beginFrame(out, MsgType::READ_INDEX);
+    finishFrame(out, start);
+}
+
+void encodeStats(std::string& out) {
+    size_t start = beginFrame(out, MsgType::STATS);
+    finishFrame(out, start);
+}
+
+void encodeReadIndexReply(std::string& out, const ReadIndexReply& reply) {
+    size_t start = beginFrame(out, MsgType::READ_INDEX_REPLY);
+    out.push_back(reply.ok ? 1 : 0);
+    putFixed64(out, static_cast<uint64_t>(reply.term));
+    putFixed64(out, static_cast<uint64_t>(reply.read_index));
+    finishFrame(out, start);
+}
+
+bool decodeReadIndexReply(std::string_view payload, ReadIndexReply& reply) {
+    Decoder d(payload);
+    uint8_t ok;
+    if (!d.u8(ok) || !d.i64(reply.term) || !d.i64(reply.read_index)) {
+        return false;
+    }
+    reply.ok = ok != 0;
+    return true;
+}
+
+void encodeInstallSnapshotHeader(std::string& out, const InstallSnapshotView& args,
+                                 uint32_t data_len) {
+    size_t start = beginFrame(out, MsgType::INSTALL_SNAPSHOT);
+    putFixed64(out, static_cast<uint64_t>(args.term));
+    putFixed32(out, static_cast<uint32_t>(args.leader_id));
+    putFixed64(out, static_cast<uint64_t>(args.last_index));
+    putFixed64(out, static_cast<uint64_t>(args.last_term));
+    putFixed64(out, args.total_size);
+    putFixed64(out, args.offset);
+    out.push_back(args.done ? 1 : 0);
+    putFixed32(out, data_len);
+
+    uint32_t len = static_cast<uint32_t>(out.size() - start - kFrameHeaderSize + data_len);
+    std::string encoded;
+    putFixed32(encoded, len);
+    std::memcpy(&out[start + 3], encoded.data(), 4);
+}
+
+bool decodeInstallSnapshot(std::string_view payload, InstallSnapshotView& args) {
+    Decoder d(payload);
+    uint8_t done;
+    if (!d.i64(args.term) || !d.i32(args.leader_id) || !d.i64(args.last_index) ||
+        !d.i64(args.last_term) || !d.u64(args.total_size) || !d.u64(args.offset) ||
+        !d.u8(done) || !d.bytes(args.data)) {
+        return false;
+    }
+    args.done = done != 0;
+    return d.done();
+}
+
+void encodeInstallSnapshotReply(std::string& out, const InstallSnapshotReply& reply) {
+    size_t start = beginFrame(out, MsgType::INSTALL_SNAPSHOT_REPLY);
+    out.push_back(reply.success ? 1 : 0);
+    putFixed64(out, static_cast<uint64_t>(reply.term));
+    putFixed64(out, reply.next_offset);
+    finishFrame(out, start);
+}
+
+bool decodeInstallSnapshotReply(std::string_view payload, InstallSnapshotReply& reply) {
+    Decoder d(payload);
+    uint8_t success;
+    if (!d.u8(success) || !d.i64(reply.term) || !d.u64(reply.next_offset)) {
+        return false;
+    }
+    reply.success = success != 0;
+    return true;
+}
+
+void encodePeerHello(std::string& out, const PeerHello& hello) {
+    size_t start = beginFrame(out, MsgType::PEER_HELLO);
+    putFixed32(out, static_cast<uint32_t>(hello.group));
+    putFixed32(out, static_cast<uint32_t>(hello.server_id));
+    putBytes(out, hello.addr);
+    finishFrame(out, start);
+}
+
+bool decodePeerHello(std::string_view payload, PeerHello& hello) {
+    Decoder d(payload);
+    std::string_view addr;
+    if (!d.i32(hello.group) || !d.i32(hello.server_id) || !d.bytes(addr)) {
+        return false;
+    }
+    hello.addr.assign(addr);
+    return d.done();
+}
+
+uint32_t groupOf(std::string_view key, size_t groups) {
+    return groups <= 1 ? 0 : static_cast<uint32_t>(crc32::value(key.data(), key.size()) % groups);
+}
+
+void encodeRoutes(std::string& out) {
+    size_t start = beginFrame(out, MsgType::ROUTES);
+    finishFrame(out, start);
+}
+
+void encodeRoutesBody(std::string& out, const std::vector<Route>& routes) {
+    putFixed32(out, static_cast<uint32_t>(routes.size()));
+    for (const auto& route : routes) {
+        putFixed32(out, static_cast<uint32_t>(route.group));
+        putFixed64(out, static_cast<uint64_t>(route.term));
+        putBytes(out, route.leader);
+    }
+}
+
+bool decodeRoutesBody(std::string_view body, std::vector<Route>& routes) {
+    Decoder d(body);
+    uint32_t count;
+    if (!d.u32(count) || count > body.size() / 16) {
+        return false;
+    }
+    routes.clear();
+    routes.reserve(count);
+    for (uint32_t i = 0; i < count; i++) {
+        Route route;
+        std::string_view leader;
+        if (!d.i32(route.group) || !d.i64(route.term) || !d.bytes(leader)) return false;
+        route.leader.assign(leader);
+        routes.push_back(std::move(route));
+    }
+    return d.done();
+}
+
+void encodeSession(std::string& out, uint64_t client_id, uint64_t seq, std::string_view request) {
+    size_t start = beginFrame(out, MsgType::SESSION);
+    putFixed64(out, client_id);
+    putFixed64(out, seq);
+    out.append(request.data(), request.size());
+    finishFrame(out, start);
+}
+
+bool decodeSession(std::string_view payload, uint64_t& client_id, uint64_t& seq,
+                   std::string_view& request) {
+    if (payload.size() < 16) {
+        return false;
+    }
+    client_id = decodeFixed64(payload.data());
+    seq = decodeFixed64(payload.data() + 8);
+    request = payload.substr(16);
+    return true;
+}
+
+void encodeSessionReply(std::string& out, uint64_t seq, std::string_view response) {
+    size_t start = beginFrame(out, MsgType::SESSION);
+    putFixed64(out, seq);
+    out.append(response.data(), response.size());
+    finishFrame(out, start);
+}
+
+bool decodeSessionReply(std::string_view payload, uint64_t& seq, std::string_view& response) {
+    if (payload.size() < 8) {
+        return false;
+    }
+    seq = decodeFixed64(payload.data());
+    response = payload.substr(8);
+    return true;
+}
+
+void encodePut(std::string& out, std::string_view key, std::string_view value,
+               uint32_t ttl_seconds) {
+    size_t start = beginFrame(out, MsgType::PUT);
+    putBytes(out, key);
+    putBytes(out, value);
+    if (ttl_seconds > 0) {
+        putFixed32(out, ttl_seconds);
+    }
+    finishFrame(out, start);
+}
+
+void encodeGet(std::string& out, std::string_view key) {
+    size_t start = beginFrame(out, MsgType::GET);
+    putBytes(out, key);
+    finishFrame(out, start);
+}
+
+void encodeDelete(std::string& out, std::string_view key) {
+    size_t start = beginFrame(out, MsgType::DELETE);
+    putBytes(out, key);
+    finishFrame(out, start);
+}
+
+void encodeMultiPut(std::string& out, const KeyValueViews& pairs) {
+    // The payload is exactly the MULTI_PUT log entry's value
+    size_t start = beginFrame(out, MsgType::MULTI_PUT);
+    ::encodeMultiPut(out, pairs);
+    finishFrame(out, start);
+}
+
+void encodeMultiGet(std::string& out, const std::vector<std::string_view>& keys) {
+    size_t start = beginFrame(out, MsgType::MULTI_GET);
+    putFixed32(out, static_cast<uint32_t>(keys.size()));
+    for (auto key : keys) {
+        putBytes(out, key);
+    }
+    finishFrame(out, start);
+}
+
+bool decodeMultiGet(std::string_view payload, std::vector<std::string>& keys) {
+    Decoder d(payload);
+    uint32_t count;
+    if (!d.u32(count) || count > payload.size() / 4) {
+        return false;
+    }
+    keys.clear();
+    keys.reserve(count);
+    for (uint32_t i = 0; i < count; i++) {
+        std::string_view key;
+        if (!d.bytes(key)) return false;
+        keys.emplace_back(key);
+    }
+    return d.done();
+}
+
+void encodeMultiGetBody(std::string& out, const std::vector<std::optional<std::string>>& values) {
+    putFixed32(out, static_cast<uint32_t>(values.size()));
+    for (const auto& value : values) {
+        out.push_back(value ? 1 : 0);
+        putBytes(out, value ? std::string_view(*value) : std::string_view());
+    }
+}
+
+bool decodeMultiGetBody(std::string_view body, std::vector<std::optional<std::string>>& values) {
+    Decoder d(body);
+    uint32_t count;
+    if (!d.u32(count) || count > body.size() / 5) {
+        return false;
+    }
+    values.clear();
+    for (uint32_t i = 0; i < count; i++) {
+        uint8_t found;
+        std::string_view value;
+        if (!d.u8(found) || !d.bytes(value)) return false;
+        values.push_back(found ? std::optional<std::string>(value) : std::nullopt);
+    }
+    return d.done();
+}
+
+void encodeScan(std::string& out, std::string_view start, std::string_view end, uint32_t limit) {
+    size_t frame = beginFrame(out, MsgType::SCAN);
+    putBytes(out, start);
+    putBytes(out, end);
+    putFixed32(out, limit);
+    finishFrame(out, frame);
+}
+
+bool decodeScan(std::string_view payload, std::string_view& start, std::string_view& end,
+                uint32_t& limit) {
+    Decoder d(payload);
+    return d.bytes(start) && d.bytes(end) && d.u32(limit) && d.done();
+}
+
+void encodeScanBody(std::string& out, const std::vector<std::pair<std::string, std::string>>& pairs,
+                    bool more, std::string_view next_key) {
+    putFixed32(out, static_cast<uint32_t>(pairs.size()));
+    for (const auto& [key, value] : pairs) {
+        putBytes(out, key);
+        putBytes(out, value);
+    }
+    out.push_back(more ? 1 : 0);
+    putBytes(out, more ? next_key : std::string_view());
+}
+
+bool decodeScanBody(std::string_view body, std::vector<std::pair<std::string, std::string>>& pairs,
+                    bool& more, std::string& next_key) {
+    Decoder d(body);
+    uint32_t count;
+    if (!d.u32(count) || count > body.size() / 8) {
+        return false;
+    }
+    pairs.clear();
+    pairs.reserve(count);
+    for (uint32_t i = 0; i < count; i++) {
+        std::string_view key, value;
+        if (!d.bytes(key) || !d.bytes(value)) return false;
+        pairs.emplace_back(key, value);
+    }
+    uint8_t more_flag;
+    std::string_view next;
+    if (!d.u8(more_flag) || !d.bytes(next)) return false;
+    more = more_flag != 0;
+    next_key.assign(next);
+    return d.done();
+}
+
+void encodeResponse(std::string& out, Status status, std::string_view body) {
+    size_t start = beginFrame(out, MsgType::RESPONSE);
+    out.push_back(static_cast<char>(status));
+    putBytes(out, body);
+    finishFrame(out, start);
+}
+
+bool decodeResponse(std::string_view payload, Status& status, std::string_view& body) {
+    Decoder d(payload);
+    uint8_t code;
+    if (!d.u8(code) || !d.bytes(body)) {
+        return false;
+    }
+    status = static_cast<Status>(code);
+    return true;
+}
+
+// ============================================================================
+// TEXT PROTOCOL
+// ============================================================================
+
+namespace {
+
+// Splits on single spaces; views point into the line
+class Tokenizer {
+public:
+    explicit Tokenizer(std::string_view line) : rest_(line) {}
+
+    bool next(std::string_view& token) {
+        while (!rest_.empty() && (rest_.front() == ' ' || rest_.front() == '\r')) {
+            rest_.remove_prefix(1);
+        }
+        if (rest_.empty()) return false;
+        size_t end = rest_.find_first_of(" \r");
+        token = rest_.substr(0, end);
+        rest_.remove_prefix(end == std::string_view::npos ? rest_.size() : end);
+        return true;
+    }
+
+    bool number(int& v) {
+        std::string_view token;
+        if (!next(token)) return false;
+        try {
+            v = std::stoi(std::string(token));
+        } catch (...) {
+            return false;
+        }
+        return true;
+    }
+
+private:
+    std::string_view rest_;
+};
+
+std::string toHex(std::string_view bytes) {
+    static const char kDigits[] = "0123456789abcdef";
+    std::string out;
+    out.reserve(bytes.size() * 2);
+    for (unsigned char c : bytes) {
+        out.push_back(kDigits[c >> 4]);
+        out.push_back(kDigits[c & 0x0F]);
+    }
+    return out;
+}
+
+bool fromHex(std::string_view hex, std::string& out) {
+    auto nibble = [](char c) -> int {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        return -1;
+    };
+    if (hex.size() % 2 != 0) return false;
+    out.resize(hex.size() / 2);
+    for (size_t i = 0; i < out.size(); i++) {
+        int hi = nibble(hex[2 * i]), lo = nibble(hex[2 * i + 1]);
+        if (hi < 0 || lo < 0) return false;
+        out[i] = static_cast<char>((hi << 4) | lo);
+    }
+    return true;
+}
+
+// Ops whose values are binary encodings rather than a client's bytes
+bool hexValue(LogOp op) {
+    return op == LogOp::MULTI_PUT || op == LogOp::SESSION || op == LogOp::PUT_TTL ||
+           op == LogOp::EXPIRE;
+}
+
+}  // namespace
+
+std::string formatAppendEntriesText(const AppendEntriesView& args,
+                                    const std::vector<LogEntry>& entries) {
+    std::string out = "APPEND_ENTRIES " + std::to_string(args.term) + " " +
+                      std::to_string(args.leader_id) + " " +
+                      std::to_string(args.prev_log_index) + " " +
+                      std::to_string(args.prev_log_term) + " " +
+                      std::to_string(args.leader_commit) + " " +
+                      std::to_string(entries.size());
+    // Empty fields (a NOOP's key and value) go out as "-" so the line still
+    // tokenizes; the text protocol is for debugging, not arbitrary data.
+    // MULTI_PUT, SESSION, PUT_TTL and EXPIRE values are binary, so they go
+    // out in hex.
+    auto field = [](std::string_view s) { return s.empty() ? std::string("-") : std::string(s); };
+    for (const auto& entry : entries) {
+        std::string value = hexValue(entry.op) ? toHex(entry.value()) : field(entry.value());
+        out += " " + std::to_string(entry.index) + " " + std::to_string(entry.term) +
+               " " + opName(entry.op) + " " + field(entry.key()) + " " + value;
+    }
+    out += "\n";
+    return out;
+}
+
+bool parseAppendEntriesText(std::string_view line, AppendEntriesView& args) {
+    Tokenizer t(line);
+    std::string_view cmd, op;
+    int count;
+    if (!t.next(cmd) || !t.number(args.term) || !t.number(args.leader_id) ||
+        !t.number(args.prev_log_index) || !t.number(args.prev_log_term) ||
+        !t.number(args.leader_commit) || !t.number(count) || count < 0) {
+        return false;
+    }
+
+    args.entries.clear();
+    args.decoded.clear();
+    for (int i = 0; i < count; i++) {
+        EntryView entry;
+        if (!t.number(entry.index) || !t.number(entry.term) || !t.next(op) ||
+            !t.next(entry.key) || !t.next(entry.value)) {
+            return false;
+        }
+        if (!parseOp(op, entry.op)) {
+            return false;
+        }
+        if (entry.key == "-") entry.key = std::string_view();
+        if (hexValue(entry.op)) {
+            args.decoded.emplace_back();
+            if (!fromHex(entry.value, args.decoded.back())) {
+                return false;
+            }
+            entry.value = args.decoded.back();
+        } else if (entry.value == "-") {
+            entry.value = std::string_view();
+        }
+        args.entries.push_back(entry);
+    }
+    return true;
+}
+
+bool parseAppendEntriesReplyText(std::string_view line, AppendEntriesReply& reply) {
+    Tokenizer t(line);
+    std::string_view result;
+    if (!t.next(result) || !t.number(reply.term) || !t.number(reply.next_index)) {
+        return false;
+    }
+    if (t.number(reply.conflict_term)) {
+        t.number(reply.conflict_index);
+    }
+    reply.success = result == "SUCCESS";
+    return result == "SUCCESS" || result == "FAIL";
+}
+
+std::string formatPeerHelloText(const PeerHello& hello) {
+    return "PEER_HELLO " + std::to_string(hello.group) + " " +
+           std::to_string(hello.server_id) + " " + hello.addr + "\n";
+}
+
+bool parsePeerHelloText(std::string_view line, PeerHello& hello) {
+    Tokenizer t(line);
+    std::string_view cmd, addr;
+    if (!t.next(cmd) || cmd != "PEER_HELLO" || !t.number(hello.group) ||
+        !t.number(hello.server_id) || !t.next(addr)) {
+        return false;
+    }
+    hello.addr.assign(addr);
+    return true;
+}
+
+}  // namespace proto
@@ -0,0 +1,315 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <optional>
+#include <string_view>
+#include <vector>
+#include "wal.h"
+
+/**
+ * Binary wire protocol
+ *
+ * FRAMING:
+ * Every message is one frame:
+ *   [u8 magic=0xFA][u8 version][u8 type][u32 payload_len][payload]
+ * Integers are little-endian (coding.h); strings are [u32 len][bytes], so
+ * keys and values may hold spaces, newlines or arbitrary bytes.
+ *
+ * NEGOTIATION:
+ * The first byte of a connection picks the protocol. 0xFA is never the
+ * start of a text command, so a connection that opens with it speaks
+ * frames and anything else speaks the newline-terminated text protocol,
+ * which stays around for debugging with a terminal. Replies use the
+ * protocol of the request.
+ *
+ * ZERO-COPY:
+ * Decoders fill *View structs whose string_views point into the receive
+ * buffer; they're only valid until the handler returns.
+ *
+ * PAYLOADS:
+ *   PUT                  key, value[, u32 ttl_seconds] - the key expires
+ *                        that long after the leader logs it; 0 or absent:
+ *                        never
+ *   GET                  key
+ *   DELETE               key
+ *   MULTI_PUT            u32 count, count x (key, value) - applied atomically
+ *   MULTI_GET            u32 count, count x key - answered with a RESPONSE
+ *                        whose body is u32 count, count x (u8 found, value)
+ *   SCAN                 start, end (empty: no end), u32 limit (0: the
+ *                        server's largest page) - keys in
+ *                        [start, end) in order, answered with a RESPONSE whose
+ *                        body is u32 count, count x (key, value), u8 more,
+ *                        next_key (where to start the next page, if more)
+ *   RESPONSE             u8 status, body - a NOT_LEADER body is "NOT_LEADER",
+ *                        then " host:port" of the leader if known
+ *   APPEND_ENTRIES       u64 term, u32 leader_id, u64 prev_log_index,
+ *                        u64 prev_log_term, u64 leader_commit, u32 count,
+ *                        count x (u64 index, u64 term, u8 op, key, value)
+ *   APPEND_ENTRIES_REPLY u8 success, u64 term, u64 next_index,
+ *                        u64 conflict_term, u64 conflict_index
+ *   REQUEST_VOTE         u64 term, u32 candidate_id, u64 last_log_index,
+ *                        u64 last_log_term, u8 pre_vote
+ *   VOTE_REPLY           u8 granted, u64 term
+ *   READ_INDEX           (empty) - a follower asking the leader for a read index
+ *   READ_INDEX_REPLY     u8 ok, u64 term, u64 read_index
+ *   INSTALL_SNAPSHOT     u64 term, u32 leader_id, u64 last_index, u64 last_term,
+ *                        u64 total_size, u64 offset, u8 done, data
+ *   INSTALL_SNAPSHOT_REPLY u8 success, u64 term, u64 next_offset
+ *   STATS                (empty) - answered with a RESPONSE whose body is
+ *                        the STAT lines (see metrics.h)
+ *   PEER_HELLO           u32 group, u32 server_id, addr - no reply
+ *   ROUTES               (empty) - answered with a RESPONSE whose body is
+ *                        u32 count, count x (u32 group, u64 term, leader)
+ *                        with an empty leader when it isn't known
+ *   SESSION              u64 client_id, u64 seq, request frame - answered
+ *                        with a SESSION whose payload is u64 seq, response
+ *                        frame
+ *
+ * INSTALL_SNAPSHOT carries one chunk of the leader's snapshot file. The
+ * follower answers with the offset it wants next, which is how a transfer
+ * resumes after a reconnect. Snapshot chunks are binary only; they go on
+ * their own connection even when peers otherwise speak text.
+ *
+ * PEER_HELLO opens every connection one node makes to another, in that
+ * connection's protocol, and says which Raft group the RPCs after it are
+ * for (see node.h). Client connections don't send one.
+ *
+ * SESSION wraps a client request. Its reply is sent as soon as it's ready
+ * rather than in request order, and seq tells the client which request it
+ * answers, so a slow write no longer holds up the reads pipelined behind
+ * it. With a nonzero client_id, seq also numbers the client's writes for
+ * deduplication (session.h): a retried write is acknowledged, not applied
+ * twice. client_id 0 only tags the reply.
+ */
+namespace proto {
+
+constexpr uint8_t kMagic = 0xFA;
+constexpr uint8_t kVersion = 1;
+constexpr size_t kFrameHeaderSize = 7;
+constexpr size_t kMaxPayload = 256u * 1024 * 1024;
+
+enum class MsgType : uint8_t {
+    PUT = 1,
+    GET = 2,
+    RESPONSE = 3,
+    APPEND_ENTRIES = 4,
+    APPEND_ENTRIES_REPLY = 5,
+    REQUEST_VOTE = 6,
+    VOTE_REPLY = 7,
+    READ_INDEX = 8,
+    READ_INDEX_REPLY = 9,
+    INSTALL_SNAPSHOT = 10,
+    INSTALL_SNAPSHOT_REPLY = 11,
+    STATS = 12,
+    DELETE = 13,
+    MULTI_PUT = 14,
+    MULTI_GET = 15,
+    SCAN = 16,
+    PEER_HELLO = 17,
+    ROUTES = 18,
+    SESSION = 19
+};
+
+enum class Status : uint8_t {
+    OK = 0,
+    NOT_FOUND = 1,
+    NOT_LEADER = 2,
+    ERROR = 3
+};
+
+struct Frame {
+    MsgType type;
+    std::string_view payload;
+};
+
+enum class ParseResult { FRAME, INCOMPLETE, INVALID };
+
+// Parse the frame at the front of buf; on FRAME, consumed is its full size
+ParseResult parseFrame(std::string_view buf, Frame& frame, size_t& consumed);
+
+// Frame building: beginFrame reserves the header, finishFrame patches the length
+size_t beginFrame(std::string& out, MsgType type);
+void finishFrame(std::string& out, size_t start);
+
+void putBytes(std::string& out, std::string_view bytes);
+
+// Bounds-checked cursor over a payload
+class Decoder {
+public:
+    explicit Decoder(std::string_view payload)
+        : p_(payload.data()), end_(payload.data() + payload.size()) {}
+
+    bool u8(uint8_t& v);
+    bool u32(uint32_t& v);
+    bool u64(uint64_t& v);
+    bool i32(int& v);       // Stored as u32 or u64 depending on the field
+    bool i64(int& v);
+    bool bytes(std::string_view& v);
+    bool done() const { return p_ == end_; }
+
+private:
+    const char* p_;
+    const char* end_;
+};
+
+struct EntryView {
+    int index = 0;
+    int term = 0;
+    LogOp op = LogOp::PUT;      // Same codes as the WAL records
+    std::string_view key;
+    std::string_view value;
+
+    LogEntry toLogEntry(LogArena& arena) const {
+        return arena.make(index, term, op, key, value);
+    }
+};
+
+struct AppendEntriesView {
+    int term = 0;
+    int leader_id = -1;
+    int prev_log_index = 0;
+    int prev_log_term = 0;
+    int leader_commit = 0;
+    std::vector<EntryView> entries;
+    std::deque<std::string> decoded;    // Text protocol: bytes unescaped from the line
+};
+
+struct AppendEntriesReply {
+    bool success = false;
+    int term = 0;
+    int next_index = 1;
+    // On a mismatch at prev_log_index: the follower's term there and the
+    // first index it holds of that term. 0 when it simply has no entry
+    // there, and next_index is then just past its last entry.
+    int conflict_term = 0;
+    int conflict_index = 0;
+};
+
+struct VoteRequest {
+    int term = 0;
+    int candidate_id = -1;
+    int last_log_index = 0;
+    int last_log_term = 0;
+    bool pre_vote = false;      // Would you vote for me at term? Changes nothing
+};
+
+struct VoteReply {
+    bool granted = false;
+    int term = 0;
+};
+
+// APPEND_ENTRIES: the header fields come from args, the entries from the log
+void encodeAppendEntries(std::string& out, const AppendEntriesView& args,
+                         const std::vector<LogEntry>& entries);
+bool decodeAppendEntries(std::string_view payload, AppendEntriesView& args);
+
+void encodeAppendEntriesReply(std::string& out, const AppendEntriesReply& reply);
+bool decodeAppendEntriesReply(std::string_view payload, AppendEntriesReply& reply);
+
+void encodeVoteRequest(std::string& out, const VoteRequest& req);
+bool decodeVoteRequest(std::string_view payload, VoteRequest& req);
+
+void encodeVoteReply(std::string& out, const VoteReply& reply);
+bool decodeVoteReply(std::string_view payload, VoteReply& reply);
+
+struct ReadIndexReply {
+    bool ok = false;
+    int term = 0;
+    int read_index = 0;
+};
+
+void encodeReadIndex(std::string& out);
+void encodeStats(std::string& out);
+void encodeReadIndexReply(std::string& out, const ReadIndexReply& reply);
+bool decodeReadIndexReply(std::string_view payload, ReadIndexReply& reply);
+
+struct InstallSnapshotView {
+    int term = 0;
+    int leader_id = -1;
+    int last_index = 0;
+    int last_term = 0;
+    uint64_t total_size = 0;
+    uint64_t offset = 0;
+    bool done = false;          // This chunk ends the file
+    std::string_view data;
+};
+
+struct InstallSnapshotReply {
+    bool success = false;
+    int term = 0;
+    uint64_t next_offset = 0;   // Where the follower wants the next chunk from
+};
+
+// Everything but the chunk bytes, with the frame length already covering
+// data_len more: the caller sends the chunk itself (e.g. with sendfile)
+void encodeInstallSnapshotHeader(std::string& out, const InstallSnapshotView& args,
+                                 uint32_t data_len);
+bool decodeInstallSnapshot(std::string_view payload, InstallSnapshotView& args);
+
+void encodeInstallSnapshotReply(std::string& out, const InstallSnapshotReply& reply);
+bool decodeInstallSnapshotReply(std::string_view payload, InstallSnapshotReply& reply);
+
+struct PeerHello {
+    int group = 0;
+    int server_id = -1;
+    std::string addr;           // Where the sender listens, host:port
+};
+
+void encodePeerHello(std::string& out, const PeerHello& hello);
+bool decodePeerHello(std::string_view payload, PeerHello& hello);
+
+// Group that owns key when a node runs `groups` Raft groups: crc32 of the
+// key, so clients can route without asking
+uint32_t groupOf(std::string_view key, size_t groups);
+
+struct Route {
+    int group = 0;
+    int term = 0;
+    std::string leader;         // host:port, empty if not known
+};
+
+void encodeRoutes(std::string& out);
+// ROUTES response body
+void encodeRoutesBody(std::string& out, const std::vector<Route>& routes);
+bool decodeRoutesBody(std::string_view body, std::vector<Route>& routes);
+
+// Wrap an encoded request frame
+void encodeSession(std::string& out, uint64_t client_id, uint64_t seq, std::string_view request);
+bool decodeSession(std::string_view payload, uint64_t& client_id, uint64_t& seq,
+                   std::string_view& request);
+// Wrap an encoded response frame
+void encodeSessionReply(std::string& out, uint64_t seq, std::string_view response);
+bool decodeSessionReply(std::string_view payload, uint64_t& seq, std::string_view& response);
+
+void encodePut(std::string& out, std::string_view key, std::string_view value,
+               uint32_t ttl_seconds = 0);
+void encodeGet(std::string& out, std::string_view key);
+void encodeDelete(std::string& out, std::string_view key);
+void encodeMultiPut(std::string& out, const KeyValueViews& pairs);
+void encodeMultiGet(std::string& out, const std::vector<std::string_view>& keys);
+bool decodeMultiGet(std::string_view payload, std::vector<std::string>& keys);
+// MULTI_GET response body
+void encodeMultiGetBody(std::string& out, const std::vector<std::optional<std::string>>& values);
+bool decodeMultiGetBody(std::string_view body, std::vector<std::optional<std::string>>& values);
+void encodeScan(std::string& out, std::string_view start, std::string_view end, uint32_t limit);
+bool decodeScan(std::string_view payload, std::string_view& start, std::string_view& end,
+                uint32_t& limit);
+// SCAN response body; next_key is only meaningful when more is set
+void encodeScanBody(std::string& out, const std::vector<std::pair<std::string, std::string>>& pairs,
+                    bool more, std::string_view next_key);
+bool decodeScanBody(std::string_view body, std::vector<std::pair<std::string, std::string>>& pairs,
+                    bool& more, std::string& next_key);
+void encodeResponse(std::string& out, Status status, std::string_view body);
+bool decodeResponse(std::string_view payload, Status& status, std::string_view& body);
+
+// Text protocol equivalents, for peers that negotiated text
+std::string formatAppendEntriesText(const AppendEntriesView& args,
+                                    const std::vector<LogEntry>& entries);
+bool parseAppendEntriesText(std::string_view line, AppendEntriesView& args);
+bool parseAppendEntriesReplyText(std::string_view line, AppendEntriesReply& reply);
+// PEER_HELLO <group> <server_id> <addr>
+std::string formatPeerHelloText(const PeerHello& hello);
+bool parsePeerHelloText(std::string_view line, PeerHello& hello);
+
+}  // namespace proto
@@ -0,0 +1,377 @@
+#include "reactor.h"
+#include "log.h"
+#include "protocol.h"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstring>
+
+// ============================================================================
+// Connection
+// ============================================================================
+
+Connection::Connection(int fd, int epoll_fd, size_t worker)
+    : fd_(fd), epoll_fd_(epoll_fd), worker_(worker), interest_(EPOLLIN) {}
+
+uint64_t Connection::reserve() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return next_slot_++;
+}
+
+uint64_t Connection::reserveUnordered(uint64_t seq) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t slot = next_unordered_++;
+    unordered_.emplace(slot, seq);
+    return slot;
+}
+
+void Connection::respond(uint64_t slot, std::string response) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (closed_) {
+        return;
+    }
+    if (slot & kUnorderedSlot) {
+        auto it = unordered_.find(slot);
+        if (it == unordered_.end()) {
+            return;
+        }
+        proto::encodeSessionReply(out_, it->second, response);
+        unordered_.erase(it);
+    } else {
+        ready_.emplace(slot, std::move(response));
+    }
+    flushLocked();
+    updateInterestLocked();
+    finishIfDoneLocked();
+}
+
+void Connection::closeAfterResponses() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (closed_) {
+        return;
+    }
+    closing_ = true;
+    finishIfDoneLocked();
+}
+
+void Connection::finishIfDoneLocked() {
+    // Assumes mutex_ is held
+    if (closing_ && doneLocked()) {
+        // The owning worker sees the hangup and closes the fd
+        shutdown(fd_, SHUT_RDWR);
+    }
+}
+
+void Connection::flushLocked() {
+    // Assumes mutex_ is held
+    for (auto it = ready_.begin(); it != ready_.end() && it->first == next_send_;
+         it = ready_.erase(it)) {
+        out_ += it->second;
+        next_send_++;
+    }
+
+    size_t written = 0;
+    while (written < out_.size()) {
+        ssize_t n = send(fd_, out_.data() + written, out_.size() - written, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            // Peer is gone: nothing more will be delivered
+            out_.clear();
+            written = 0;
+            closing_ = true;
+            shutdown(fd_, SHUT_RDWR);
+            break;
+        }
+        written += static_cast<size_t>(n);
+    }
+    out_.erase(0, written);
+}
+
+void Connection::updateInterestLocked() {
+    // Assumes mutex_ is held
+    uint32_t interest = (read_closed_ ? 0u : static_cast<uint32_t>(EPOLLIN)) |
+                        (out_.empty() ? 0u : static_cast<uint32_t>(EPOLLOUT));
+    if (interest == interest_ || closed_) {
+        return;
+    }
+    interest_ = interest;
+
+    epoll_event ev{};
+    ev.events = interest;
+    ev.data.fd = fd_;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd_, &ev);
+}
+
+bool Connection::doneLocked() const {
+    // Assumes mutex_ is held
+    return next_send_ == next_slot_ && unordered_.empty() && out_.empty();
+}
+
+// ============================================================================
+// Reactor
+// ============================================================================
+
+Reactor::Reactor(int num_workers, Handler handler) : handler_(std::move(handler)) {
+    wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    for (int i = 0; i < std::max(1, num_workers); i++) {
+        auto worker = std::make_unique<Worker>();
+        worker->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = wake_fd_;
+        epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, wake_fd_, &ev);
+
+        worker->task_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        ev.data.fd = worker->task_fd;
+        epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->task_fd, &ev);
+
+        workers_.push_back(std::move(worker));
+    }
+    for (auto& worker : workers_) {
+        worker->thread = std::thread(&Reactor::workerLoop, this, std::ref(*worker));
+    }
+}
+
+Reactor::~Reactor() {
+    stop();
+    for (auto& worker : workers_) {
+        if (worker->thread.joinable()) {
+            worker->thread.join();
+        }
+        for (auto& [fd, conn] : worker->conns) {
+            std::lock_guard<std::mutex> lock(conn->mutex_);
+            conn->closed_ = true;   // Late responders must not touch the fd
+            close(fd);
+        }
+        close(worker->task_fd);
+        close(worker->epoll_fd);
+    }
+    close(wake_fd_);
+}
+
+void Reactor::run(int listen_fd) {
+    listen_fd_ = listen_fd;
+    size_t next_worker = 0;
+
+    while (running_) {
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (!running_) break;
+            if (errno == EMFILE || errno == ENFILE) {
+                LOG_WARN("accept: out of file descriptors");
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            continue;
+        }
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        size_t index = next_worker++ % workers_.size();
+        Worker& worker = *workers_[index];
+        auto conn = std::make_shared<Connection>(fd, worker.epoll_fd, index);
+        {
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            worker.conns[fd] = conn;
+        }
+
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(worker.epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+    }
+}
+
+void Reactor::stop() {
+    if (!running_.exchange(false)) {
+        return;
+    }
+    int listen_fd = listen_fd_.load();
+    if (listen_fd >= 0) {
+        // Unblocks accept()
+        shutdown(listen_fd, SHUT_RDWR);
+    }
+    uint64_t one = 1;
+    ssize_t ignored = write(wake_fd_, &one, sizeof(one));
+    (void)ignored;
+}
+
+void Reactor::post(const std::shared_ptr<Connection>& conn, std::function<void()> task) {
+    Worker& worker = *workers_[conn->worker_];
+    {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.tasks.push_back(std::move(task));
+    }
+    uint64_t one = 1;
+    ssize_t ignored = write(worker.task_fd, &one, sizeof(one));
+    (void)ignored;
+}
+
+size_t Reactor::connectionCount() const {
+    size_t total = 0;
+    for (const auto& worker : workers_) {
+        std::lock_guard<std::mutex> lock(worker->mutex);
+        total += worker->conns.size();
+    }
+    return total;
+}
+
+void Reactor::workerLoop(Worker& worker) {
+    constexpr int kMaxEvents = 64;
+    epoll_event events[kMaxEvents];
+
+    while (running_) {
+        int n = epoll_wait(worker.epoll_fd, events, kMaxEvents, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            LOG_ERROR("epoll_wait failed: " << strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < n && running_; i++) {
+            int fd = events[i].data.fd;
+            if (fd == wake_fd_) {
+                continue;
+            }
+            if (fd == worker.task_fd) {
+                uint64_t count;
+                ssize_t ignored = read(worker.task_fd, &count, sizeof(count));
+                (void)ignored;
+                std::vector<std::function<void()>> tasks;
+                {
+                    std::lock_guard<std::mutex> lock(worker.mutex);
+                    tasks.swap(worker.tasks);
+                }
+                for (auto& task : tasks) {
+                    task();
+                }
+                continue;
+            }
+
+            std::shared_ptr<Connection> conn;
+            {
+                std::lock_guard<std::mutex> lock(worker.mutex);
+                auto it = worker.conns.find(fd);
+                if (it == worker.conns.end()) continue;
+                conn = it->second;
+            }
+
+            uint32_t mask = events[i].events;
+            if (mask & EPOLLOUT) {
+                std::lock_guard<std::mutex> lock(conn->mutex_);
+                conn->flushLocked();
+                conn->updateInterestLocked();
+                conn->finishIfDoneLocked();
+            }
+            if (mask & (EPOLLHUP | EPOLLERR)) {
+                // Reset by the peer, or our own shutdown() once a connection
+                // finished: nothing more can be delivered either way
+                closeConnection(worker, conn);
+            } else if (mask & EPOLLIN) {
+                onReadable(worker, conn);
+            }
+        }
+    }
+}
+
+void Reactor::onReadable(Worker& worker, const std::shared_ptr<Connection>& conn) {
+    char chunk[16384];
+    bool eof = false;
+
+    for (;;) {
+        ssize_t n = read(conn->fd_, chunk, sizeof(chunk));
+        if (n > 0) {
+            conn->in_.append(chunk, static_cast<size_t>(n));
+            if (static_cast<size_t>(n) < sizeof(chunk)) break;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        eof = true;  // Orderly hangup, reset or our own shutdown()
+        break;
+    }
+
+    if (!conn->negotiated_ && !conn->in_.empty()) {
+        conn->binary_ = static_cast<uint8_t>(conn->in_[0]) == proto::kMagic;
+        conn->negotiated_ = true;
+    }
+
+    // Hand every complete request to the handler, in order, without copying
+    std::string_view pending(conn->in_);
+    bool invalid = false;
+    for (;;) {
+        if (conn->binary_) {
+            proto::Frame frame;
+            size_t consumed = 0;
+            proto::ParseResult result = proto::parseFrame(pending, frame, consumed);
+            if (result == proto::ParseResult::INVALID) {
+                invalid = true;
+                break;
+            }
+            if (result == proto::ParseResult::INCOMPLETE) break;
+            handler_(conn, pending.substr(0, consumed));
+            pending.remove_prefix(consumed);
+        } else {
+            size_t nl = pending.find('\n');
+            if (nl == std::string_view::npos) break;
+            handler_(conn, pending.substr(0, nl));
+            pending.remove_prefix(nl + 1);
+        }
+    }
+    conn->in_.erase(0, conn->in_.size() - pending.size());
+
+    if (invalid || conn->in_.size() > kMaxRequestBytes) {
+        LOG_WARN("Dropping connection with malformed or oversized request");
+        closeConnection(worker, conn);
+        return;
+    }
+
+    if (eof) {
+        // Text clients that half-close may leave the last request unterminated
+        if (!conn->in_.empty() && !conn->binary_) {
+            std::string request;
+            request.swap(conn->in_);
+            handler_(conn, request);
+        }
+
+        bool done;
+        {
+            std::lock_guard<std::mutex> lock(conn->mutex_);
+            conn->read_closed_ = true;
+            conn->closing_ = true;
+            done = conn->doneLocked();
+            // Otherwise let pending responses (e.g. a PUT awaiting commit) go out first
+            conn->updateInterestLocked();
+        }
+        if (done) {
+            closeConnection(worker, conn);
+        }
+    }
+}
+
+void Reactor::closeConnection(Worker& worker, const std::shared_ptr<Connection>& conn) {
+    // The map entry goes before the fd is closed, both under worker.mutex:
+    // once closed, accept() may hand the same number to a new connection,
+    // whose entry this must not erase
+    std::lock_guard<std::mutex> worker_lock(worker.mutex);
+    std::lock_guard<std::mutex> lock(conn->mutex_);
+    if (conn->closed_) {
+        return;
+    }
+    conn->closed_ = true;
+    auto it = worker.conns.find(conn->fd_);
+    if (it != worker.conns.end() && it->second == conn) {
+        worker.conns.erase(it);
+    }
+    epoll_ctl(worker.epoll_fd, EPOLL_CTL_DEL, conn->fd_, nullptr);
+    close(conn->fd_);
+}
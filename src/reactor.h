@@ -0,0 +1,158 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+#include <string_view>
+
+class Reactor;
+
+/**
+ * Connection
+ *
+ * One accepted socket, owned by a single reactor worker. Requests on a
+ * connection are framed and handed to the request handler in arrival order
+ * on that worker's thread.
+ *
+ * RESPONSES:
+ * Handlers may answer later from any thread (a PUT answers once it's
+ * committed), so every request reserves a response slot up front and
+ * responses go out in slot order no matter which finishes first. That's
+ * what lets a client pipeline many commands on one connection.
+ *
+ * A request in a SESSION envelope (protocol.h) takes an unordered slot
+ * instead: its response goes out as soon as it's given, wrapped in a
+ * SESSION reply carrying the request's seq, and holds up nothing.
+ *
+ * Writes are attempted directly from the responding thread; whatever the
+ * socket doesn't take is flushed by the worker on EPOLLOUT. The fd is only
+ * ever closed by the owning worker, so a late respond() can't hit a reused
+ * descriptor.
+ */
+class Connection {
+public:
+    Connection(int fd, int epoll_fd, size_t worker);
+
+    // Reserve the next response slot, in request order
+    uint64_t reserve();
+
+    // Reserve a slot answered out of order, for the SESSION request seq
+    uint64_t reserveUnordered(uint64_t seq);
+
+    // Fill a reserved slot. Safe to call from any thread, at most once per slot.
+    void respond(uint64_t slot, std::string response);
+
+    // Hang up once all reserved responses are sent
+    void closeAfterResponses();
+
+    int fd() const { return fd_; }
+
+    // Whether this connection negotiated the binary protocol (see protocol.h)
+    bool binary() const { return binary_; }
+
+    // Raft group a peer connection is for, from its PEER_HELLO; -1 until
+    // then (and for clients). Request handler only, like the framing.
+    int peerGroup() const { return peer_group_; }
+    void setPeerGroup(int group) { peer_group_ = group; }
+
+private:
+    friend class Reactor;
+
+    // Unordered slots are numbered apart from the ordered ones
+    static constexpr uint64_t kUnorderedSlot = 1ull << 63;
+
+    const int fd_;
+    const int epoll_fd_;
+    const size_t worker_;
+
+    // Worker thread only
+    std::string in_;
+    bool negotiated_ = false;
+    bool binary_ = false;
+    int peer_group_ = -1;
+
+    std::mutex mutex_;
+    uint64_t next_slot_ = 0;                    // Next slot handed out
+    uint64_t next_send_ = 0;                    // Next slot due on the wire
+    std::map<uint64_t, std::string> ready_;     // Answered out of order
+    std::unordered_map<uint64_t, uint64_t> unordered_;  // Unordered slot -> seq
+    uint64_t next_unordered_ = kUnorderedSlot;
+    std::string out_;                           // In order, not yet written
+    uint32_t interest_;                         // epoll events registered
+    bool read_closed_ = false;                  // Peer finished sending
+    bool closing_ = false;
+    bool closed_ = false;
+
+    // Assumes mutex_ is held
+    void flushLocked();
+    void finishIfDoneLocked();
+    void updateInterestLocked();
+    bool doneLocked() const;
+};
+
+/**
+ * Reactor
+ *
+ * epoll front end: an acceptor plus a small pool of worker threads, each
+ * with its own epoll set. Accepted sockets are made non-blocking and
+ * assigned round-robin to a worker, which reads whatever is available,
+ * splits it into requests (a request may span many reads) and calls the
+ * handler for each. The first byte of a connection picks the framing:
+ * binary frames or newline-terminated text (see protocol.h). Connections persist until the
+ * peer hangs up.
+ *
+ * A handler that blocks (e.g. an AppendEntries waiting for fdatasync) only
+ * delays the other connections on its worker, so the pool should be a few
+ * threads even on small machines.
+ */
+class Reactor {
+public:
+    // Gets one text line (without the newline) or one whole binary frame.
+    // The view points into the receive buffer and dies when the call returns.
+    using Handler = std::function<void(const std::shared_ptr<Connection>&, std::string_view)>;
+
+    // Requests longer than this drop the connection
+    static constexpr size_t kMaxRequestBytes = 256u * 1024 * 1024;
+
+    Reactor(int num_workers, Handler handler);
+    ~Reactor();
+
+    // Accept on listen_fd and serve until stop(). Blocks the caller.
+    void run(int listen_fd);
+    void stop();
+
+    // Run task on the worker that owns conn (e.g. to serve a read that
+    // became ready on another thread). Safe from any thread.
+    void post(const std::shared_ptr<Connection>& conn, std::function<void()> task);
+
+    // Currently open connections across all workers
+    size_t connectionCount() const;
+
+private:
+    friend class Connection;
+
+    struct Worker {
+        int epoll_fd = -1;
+        std::thread thread;
+        std::mutex mutex;   // Guards conns (the acceptor inserts); before a Connection's, never after
+        std::unordered_map<int, std::shared_ptr<Connection>> conns;
+        int task_fd = -1;   // eventfd: tasks were posted
+        std::vector<std::function<void()>> tasks;   // Guarded by mutex
+    };
+
+    Handler handler_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::atomic<bool> running_{true};
+    std::atomic<int> listen_fd_{-1};
+    int wake_fd_ = -1;      // eventfd that unblocks every worker on stop()
+
+    void workerLoop(Worker& worker);
+    void onReadable(Worker& worker, const std::shared_ptr<Connection>& conn);
+    void closeConnection(Worker& worker, const std::shared_ptr<Connection>& conn);
+};
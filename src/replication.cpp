@@ -1,166 +1,656 @@
 #include "replication.h"
+#include "log.h"
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <unistd.h>
-#include <sstream>
 #include <iostream>
 #include <sys/socket.h>
+#include <sys/sendfile.h>
 #include <algorithm>
-#include <thread>
+#include <cerrno>
+
+Replicator::Replicator(const std::vector<std::string>& followers, int server_id, int term,
+                       WriteAheadLog& wal, SnapshotManager* snapshots,
+                       const ReplicationOptions& options,
+                       std::function<void()> on_progress,
+                       std::function<void(int)> on_higher_term,
+                       std::function<void(uint64_t, Clock::time_point)> on_round_confirmed)
+    : followers_(followers),
+      server_id_(server_id),
+      term_(term),
+      wal_(wal),
+      snapshots_(snapshots),
+      options_(options),
+      on_progress_(std::move(on_progress)),
+      on_higher_term_(std::move(on_higher_term)),
+      on_round_confirmed_(std::move(on_round_confirmed)) {
 
-Replicator::Replicator(const std::vector<std::string>& followers, int server_id)
-    : followers_(followers), server_id_(server_id) {
-    
     for (const auto& follower : followers_) {
-        follower_state_[follower] = ReplicationState();
+        auto peer = std::make_unique<Peer>();
+        peer->addr = follower;
+        metrics::Labels labels = options_.metric_labels;
+        labels.emplace_back("follower", follower);
+        peer->rtt = &metrics::registry().histogram(
+            "logkv_append_entries_rtt_seconds", "AppendEntries round trip to each follower",
+            labels);
+        peers_.push_back(std::move(peer));
     }
 }
 
+Replicator::~Replicator() {
+    stop();
+}
+
 const std::vector<std::string>& Replicator::followers() const {
     return followers_;
 }
 
-void Replicator::resetState(int last_log_index) {
+void Replicator::start(int last_log_index) {
     std::lock_guard<std::mutex> lock(state_mutex_);
-    
-    for (auto& pair : follower_state_) {
-        pair.second.next_index = last_log_index + 1;
-        pair.second.match_index = 0;
+
+    last_log_index_ = last_log_index;
+    for (auto& peer : peers_) {
+        peer->state.next_index = last_log_index + 1;
+        peer->state.match_index = 0;
+        peer->next_send_index = last_log_index + 1;
+        peer->heartbeat_due = true;
+        peer->sender = std::thread(&Replicator::senderLoop, this, std::ref(*peer));
     }
 }
 
-void Replicator::sendHeartbeats(int leader_term, int leader_commit, WriteAheadLog& wal) {
-    for (const auto& follower : followers_) {
-        std::thread([this, follower, leader_term, leader_commit, &wal]() {
-            int dummy_next_index = 1;
-            
-            int prev_log_index, prev_log_term;
-            {
-                std::lock_guard<std::mutex> lock(state_mutex_);
-                prev_log_index = follower_state_[follower].next_index - 1;
+void Replicator::stop() {
+    {
+        std::lock_guard<std::mutex> lock(state_mutex_);
+        if (stopping_) {
+            return;
+        }
+        stopping_ = true;
+        for (auto& peer : peers_) {
+            if (peer->sock >= 0) {
+                // Unblocks the ack reader; it closes the fd on its way out
+                shutdown(peer->sock, SHUT_RDWR);
             }
-            
-            LogEntry prev_entry;
-            if (prev_log_index > 0 && wal.getEntry(prev_log_index, prev_entry)) {
-                prev_log_term = prev_entry.term;
-            } else {
-                prev_log_term = 0;
+            if (peer->snapshot_sock >= 0) {
+                shutdown(peer->snapshot_sock, SHUT_RDWR);
             }
-            
-            std::vector<LogEntry> empty_entries;
-            sendAppendEntries(follower, leader_term, prev_log_index, prev_log_term,
-                            empty_entries, leader_commit, dummy_next_index);
-        }).detach();
+            peer->cv.notify_all();
+            peer->snapshot_cv.notify_all();
+        }
+    }
+
+    for (auto& peer : peers_) {
+        if (peer->sender.joinable()) {
+            peer->sender.join();
+        }
+        // Only the sender starts snapshot threads, so none can appear now
+        if (peer->snapshot_sender.joinable()) {
+            peer->snapshot_sender.join();
+        }
     }
 }
 
-bool Replicator::replicateEntries(int leader_term, int leader_commit,
-                                  WriteAheadLog& wal, int start_index) {
-    int acks = 1; // Leader counts as one
-    std::mutex ack_mutex;
-    std::vector<std::thread> threads;
-    
-    for (const auto& follower : followers_) {
-        threads.emplace_back([&, follower]() {
-            int prev_log_index, prev_log_term;
-            {
-                std::lock_guard<std::mutex> lock(state_mutex_);
-                prev_log_index = follower_state_[follower].next_index - 1;
-            }
-            
-            LogEntry prev_entry;
-            if (prev_log_index > 0 && wal.getEntry(prev_log_index, prev_entry)) {
-                prev_log_term = prev_entry.term;
-            } else {
-                prev_log_term = 0;
-            }
-            
-            std::vector<LogEntry> entries = wal.getEntriesFrom(prev_log_index + 1);
-            
-            int new_next_index = prev_log_index + 1;
-            bool success = sendAppendEntries(follower, leader_term, prev_log_index,
-                                            prev_log_term, entries, leader_commit,
-                                            new_next_index);
-            
-            if (success) {
-                std::lock_guard<std::mutex> lock(ack_mutex);
-                acks++;
-                
-                // Update follower state
-                std::lock_guard<std::mutex> state_lock(state_mutex_);
-                if (!entries.empty()) {
-                    follower_state_[follower].match_index = entries.back().index;
-                    follower_state_[follower].next_index = entries.back().index + 1;
-                }
-            } else {
-                // Decrement next_index and retry (handled in next heartbeat/replication)
-                std::lock_guard<std::mutex> state_lock(state_mutex_);
-                if (follower_state_[follower].next_index > 1) {
-                    follower_state_[follower].next_index--;
-                }
-            }
-        });
+void Replicator::setCommitIndex(int commit_index) {
+    leader_commit_ = commit_index;
+}
+
+void Replicator::notifyNewEntries() {
+    int last_index, last_term;
+    wal_.getLastLogInfo(last_index, last_term);
+
+    std::lock_guard<std::mutex> lock(state_mutex_);
+    last_log_index_ = std::max(last_log_index_, last_index);
+    for (auto& peer : peers_) {
+        peer->cv.notify_one();
     }
-    
-    for (auto& t : threads) {
-        if (t.joinable()) t.join();
+}
+
+void Replicator::sendHeartbeats() {
+    std::lock_guard<std::mutex> lock(state_mutex_);
+    startRoundLocked();
+}
+
+uint64_t Replicator::requestRound() {
+    std::lock_guard<std::mutex> lock(state_mutex_);
+    return startRoundLocked();
+}
+
+uint64_t Replicator::startRoundLocked() {
+    // Assumes state_mutex_ is held
+    round_++;
+    round_starts_.emplace_back(round_, Clock::now());
+    for (auto& peer : peers_) {
+        peer->heartbeat_due = true;
+        peer->cv.notify_one();
+    }
+    return round_;
+}
+
+uint64_t Replicator::quorumRoundLocked() const {
+    // Assumes state_mutex_ is held. The leader counts itself, so it takes
+    // answers from half the cluster (rounded down) among the followers.
+    std::vector<uint64_t> acked;
+    for (const auto& peer : peers_) {
+        acked.push_back(peer->acked_round);
+    }
+    size_t needed = (followers_.size() + 1) / 2;
+    if (needed == 0) {
+        return round_;
     }
-    
-    int cluster_size = static_cast<int>(followers_.size()) + 1;
-    return acks > (cluster_size / 2);
+    std::nth_element(acked.begin(), acked.begin() + (needed - 1), acked.end(),
+                     std::greater<uint64_t>());
+    return acked[needed - 1];
 }
 
-int Replicator::calculateCommitIndex(int current_commit, int current_term, WriteAheadLog& wal) {
+int Replicator::calculateCommitIndex(int current_commit, int current_term) {
     std::lock_guard<std::mutex> lock(state_mutex_);
-    
+
     int last_log_index, last_log_term;
-    wal.getLastLogInfo(last_log_index, last_log_term);
-    
+    wal_.getLastLogInfo(last_log_index, last_log_term);
+
     // Find the highest index that's replicated on a majority
     for (int N = last_log_index; N > current_commit; N--) {
-        LogEntry entry;
-        if (!wal.getEntry(N, entry) || entry.term != current_term) {
-            continue; // Only commit entries from current term
-        }
-        
-        int replicas = 1; // Leader has it
-        for (const auto& pair : follower_state_) {
-            if (pair.second.match_index >= N) {
+        int term;
+        if (!wal_.getTerm(N, term) || term < current_term) {
+            break; // Only commit entries from current term; terms only shrink going back
+        }
+        if (term != current_term) {
+            continue;
+        }
+
+        int replicas = wal_.failed() ? 0 : 1; // Leader has it, if its log is sound
+        for (const auto& peer : peers_) {
+            if (peer->state.match_index >= N) {
                 replicas++;
             }
         }
-        
+
         int cluster_size = static_cast<int>(followers_.size()) + 1;
         if (replicas > (cluster_size / 2)) {
             return N;
         }
     }
-    
+
     return current_commit;
 }
 
-bool Replicator::sendAppendEntries(const std::string& follower_addr,
-                                   int term,
-                                   int prev_log_index,
-                                   int prev_log_term,
-                                   const std::vector<LogEntry>& entries,
-                                   int leader_commit,
-                                   int& follower_next_index) {
-    std::string ip = follower_addr.substr(0, follower_addr.find(':'));
-    int port = std::stoi(follower_addr.substr(follower_addr.find(':') + 1));
+void Replicator::senderLoop(Peer& peer) {
+    std::unique_lock<std::mutex> lock(state_mutex_);
+
+    while (!stopping_) {
+        if (peer.sock < 0) {
+            // (Re)connect. The previous ack reader owns the old fd, so wait
+            // for it to finish before opening a new one.
+            lock.unlock();
+            if (peer.receiver.joinable()) {
+                peer.receiver.join();
+            }
+            int sock = connectTo(peer.addr, options_.text_protocol);
+            lock.lock();
+
+            if (stopping_) {
+                if (sock >= 0) close(sock);
+                break;
+            }
+            if (sock < 0) {
+                peer.cv.wait_for(lock, std::chrono::milliseconds(200), [&]{ return stopping_; });
+                continue;
+            }
+
+            peer.sock = sock;
+            peer.next_send_index = peer.state.next_index;
+            peer.in_flight.clear();
+            peer.epoch++;
+            peer.heartbeat_due = true;
+            peer.waiting_for_snapshot = false;
+            peer.receiver = std::thread(&Replicator::receiverLoop, this, std::ref(peer), sock);
+        }
+
+        auto can_send_entries = [&]{
+            return !peer.waiting_for_snapshot &&
+                   static_cast<int>(peer.in_flight.size()) < options_.max_in_flight &&
+                   peer.next_send_index <= last_log_index_;
+        };
+
+        peer.cv.wait(lock, [&]{
+            return stopping_ || peer.sock < 0 || peer.heartbeat_due || can_send_entries();
+        });
+        if (stopping_ || peer.sock < 0) {
+            continue;
+        }
+
+        int sock = peer.sock;
+        uint64_t epoch = peer.epoch;
+        int prev_log_index = peer.next_send_index - 1;
+        bool with_entries = can_send_entries();
+        peer.heartbeat_due = false;
+        lock.unlock();
+
+        int prev_log_term = 0;
+        if (prev_log_index > 0 && !wal_.getTerm(prev_log_index, prev_log_term)) {
+            // The entry before next_index is compacted away; only a snapshot
+            // can bring this follower up to date. Keep heartbeating from the
+            // snapshot boundary so it doesn't start an election meanwhile.
+            int first_index = wal_.getFirstLogIndex();
+            {
+                std::lock_guard<std::mutex> guard(state_mutex_);
+                if (!peer.waiting_for_snapshot) {
+                    LOG_WARN("Follower " << peer.addr << " needs entries before index "
+                              << first_index << ", which are compacted");
+                }
+                peer.waiting_for_snapshot = true;
+            }
+            bool launch = false;
+            {
+                std::lock_guard<std::mutex> guard(state_mutex_);
+                if (!peer.snapshot_running && snapshots_ && !stopping_) {
+                    peer.snapshot_running = true;
+                    launch = true;
+                }
+            }
+            if (launch) {
+                if (peer.snapshot_sender.joinable()) {
+                    peer.snapshot_sender.join();  // The previous transfer's thread
+                }
+                peer.snapshot_sender = std::thread(&Replicator::snapshotLoop, this, std::ref(peer));
+            }
+            prev_log_index = first_index - 1;
+            wal_.getTerm(prev_log_index, prev_log_term);
+            with_entries = false;
+        }
+
+        std::vector<LogEntry> entries;
+        if (with_entries) {
+            entries = wal_.getEntriesFrom(prev_log_index + 1, options_.max_batch_entries,
+                                          options_.max_batch_bytes);
+        }
+        std::string msg = buildAppendEntries(prev_log_index, prev_log_term, entries);
+
+        lock.lock();
+        if (peer.sock != sock || peer.epoch != epoch) {
+            continue;  // Connection dropped or pipeline rewound meanwhile
+        }
+        int last_index = entries.empty() ? prev_log_index : entries.back().index;
+        peer.in_flight.push_back({prev_log_index, last_index, peer.epoch, round_, Clock::now()});
+        if (!entries.empty()) {
+            peer.next_send_index = last_index + 1;
+        }
+        lock.unlock();
+
+        size_t written = 0;
+        bool ok = true;
+        while (written < msg.size()) {
+            ssize_t n = write(sock, msg.data() + written, msg.size() - written);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                ok = false;
+                break;
+            }
+            written += static_cast<size_t>(n);
+        }
+
+        lock.lock();
+        if (!ok) {
+            dropConnection(peer, sock);
+        }
+    }
+
+    lock.unlock();
+    if (peer.receiver.joinable()) {
+        peer.receiver.join();
+    }
+}
+
+void Replicator::receiverLoop(Peer& peer, int sock) {
+    std::string buffer;
+    char chunk[4096];
+
+    while (true) {
+        // Acks are tiny; handle every complete one before reading more
+        bool bad = false;
+        size_t start = 0;
+        while (true) {
+            std::string_view pending(buffer.data() + start, buffer.size() - start);
+            proto::AppendEntriesReply reply;
+            if (options_.text_protocol) {
+                size_t nl = pending.find('\n');
+                if (nl == std::string_view::npos) break;
+                bad = !proto::parseAppendEntriesReplyText(pending.substr(0, nl), reply);
+                start += nl + 1;
+            } else {
+                proto::Frame frame;
+                size_t consumed = 0;
+                proto::ParseResult result = proto::parseFrame(pending, frame, consumed);
+                if (result == proto::ParseResult::INCOMPLETE) break;
+                bad = result == proto::ParseResult::INVALID ||
+                      frame.type != proto::MsgType::APPEND_ENTRIES_REPLY ||
+                      !proto::decodeAppendEntriesReply(frame.payload, reply);
+                start += consumed;
+            }
+            if (bad) break;
+            handleResponse(peer, sock, reply);
+        }
+        buffer.erase(0, start);
+        if (bad) {
+            LOG_WARN("Malformed AppendEntries reply from " << peer.addr);
+            break;
+        }
+
+        ssize_t n = read(sock, chunk, sizeof(chunk));
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            // Read timeout: fine while idle, a dead follower if acks are owed
+            std::lock_guard<std::mutex> lock(state_mutex_);
+            if (!stopping_ && peer.sock == sock && peer.in_flight.empty()) {
+                continue;
+            }
+            break;
+        }
+        if (n <= 0) {
+            break;
+        }
+        buffer.append(chunk, static_cast<size_t>(n));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(state_mutex_);
+        dropConnection(peer, sock);
+    }
+    close(sock);
+}
+
+void Replicator::handleResponse(Peer& peer, int sock, const proto::AppendEntriesReply& reply) {
+    int resp_term = reply.term;
+    int resp_next_index = reply.next_index;
+    if (!reply.success && reply.conflict_term > 0) {
+        // If we have the follower's conflicting term, our logs agree up to
+        // our last entry of it; if not, none of that term can stay
+        int last = wal_.lastIndexOfTerm(reply.conflict_term);
+        resp_next_index = last > 0 ? last + 1 : reply.conflict_index;
+    }
+
+    bool progressed = false;
+    uint64_t confirmed = 0;
+    Clock::time_point confirmed_start;
+    {
+        std::lock_guard<std::mutex> lock(state_mutex_);
+        if (peer.sock != sock || peer.in_flight.empty()) {
+            return;
+        }
+
+        InFlight batch = peer.in_flight.front();
+        peer.in_flight.pop_front();
+        peer.cv.notify_one();  // A pipeline slot just freed up
+        peer.rtt->recordSince(batch.sent_at);
+
+        if (resp_term <= term_ && batch.round > peer.acked_round) {
+            // Any answer in our term, success or not, means this follower
+            // still recognised us when the round started
+            peer.acked_round = batch.round;
+            uint64_t quorum = quorumRoundLocked();
+            while (!round_starts_.empty() && round_starts_.front().first <= quorum) {
+                confirmed = round_starts_.front().first;
+                confirmed_start = round_starts_.front().second;
+                round_starts_.pop_front();
+            }
+            if (confirmed > confirmed_round_) {
+                confirmed_round_ = confirmed;
+            } else {
+                confirmed = 0;
+            }
+        }
+
+        if (resp_term > term_) {
+            // Deposed; the server steps down and throws this replicator away
+        } else if (batch.epoch != peer.epoch) {
+            // Sent before the last rewind: its outcome no longer matters
+        } else if (reply.success) {
+            if (batch.last_index > peer.state.match_index) {
+                peer.state.match_index = batch.last_index;
+                progressed = true;
+            }
+            peer.state.next_index = std::max(peer.state.next_index, batch.last_index + 1);
+            if (peer.next_send_index < peer.state.next_index) {
+                // A probe from the snapshot boundary matched: resume from there
+                peer.next_send_index = peer.state.next_index;
+                peer.waiting_for_snapshot = false;
+            }
+        } else {
+            // Log mismatch at or before prev_log_index: back up to where the
+            // follower's hint says the logs may agree and resend from there
+            peer.state.next_index = std::max(1, std::min(resp_next_index, batch.prev_log_index));
+            peer.next_send_index = peer.state.next_index;
+            peer.epoch++;
+            LOG_DEBUG("Follower " << peer.addr << " rejected entries after "
+                      << batch.prev_log_index << "; resending from " << peer.state.next_index);
+        }
+    }
+
+    if (resp_term > term_) {
+        if (on_higher_term_) on_higher_term_(resp_term);
+        return;
+    }
+    if (confirmed > 0 && on_round_confirmed_) {
+        on_round_confirmed_(confirmed, confirmed_start);
+    }
+    if (progressed && on_progress_) {
+        on_progress_();
+    }
+}
+
+void Replicator::snapshotLoop(Peer& peer) {
+    int fd = -1;
+    int sock = -1;
+    SnapshotMetadata metadata;
+    uint64_t file_size = 0;
+    uint64_t offset = 0;
+    uint64_t sent = 0;
+    bool installed = false;
+    auto started = Clock::now();
+    std::unique_lock<std::mutex> lock(state_mutex_);
+
+    auto pause = [&](Clock::time_point until) {
+        // Assumes lock is held
+        peer.snapshot_cv.wait_until(lock, until, [&]{ return stopping_; });
+    };
+    auto closeSocket = [&]() {
+        // Assumes lock is held
+        if (sock >= 0) {
+            close(sock);
+            sock = -1;
+            peer.snapshot_sock = -1;
+        }
+    };
+
+    // Done once the follower no longer needs anything we compacted (a
+    // boundary probe matched, or our snapshot got installed)
+    while (!stopping_ && peer.state.next_index < wal_.getFirstLogIndex()) {
+        if (fd < 0) {
+            lock.unlock();
+            fd = snapshots_->openLatestSnapshot(metadata, file_size);
+            lock.lock();
+            if (fd < 0) {
+                pause(Clock::now() + std::chrono::seconds(1));
+                continue;
+            }
+            // Pick up where an earlier attempt at this same snapshot stopped
+            offset = metadata.last_included_index == peer.snapshot_index ? peer.snapshot_offset : 0;
+            peer.snapshot_index = metadata.last_included_index;
+            LOG_INFO("Sending snapshot at index " << metadata.last_included_index
+                      << " (" << file_size << " bytes) to " << peer.addr
+                      << " from offset " << offset);
+        }
+
+        if (sock < 0) {
+            lock.unlock();
+            int new_sock = connectTo(peer.addr, false);
+            lock.lock();
+            if (new_sock < 0) {
+                pause(Clock::now() + std::chrono::milliseconds(200));
+                continue;
+            }
+            sock = new_sock;
+            peer.snapshot_sock = sock;
+            if (stopping_) {
+                break;
+            }
+        }
+
+        proto::InstallSnapshotView args;
+        args.term = term_;
+        args.leader_id = server_id_;
+        args.last_index = metadata.last_included_index;
+        args.last_term = metadata.last_included_term;
+        args.total_size = file_size;
+        args.offset = offset;
+        size_t len = static_cast<size_t>(
+            std::min<uint64_t>(options_.snapshot_chunk_bytes, file_size - offset));
+        args.done = offset + len == file_size;
+
+        lock.unlock();
+        proto::InstallSnapshotReply reply;
+        bool ok = sendSnapshotChunk(sock, fd, args, len, reply);
+        lock.lock();
+
+        if (!ok) {
+            // Reconnect and resume from the last acked offset
+            closeSocket();
+            pause(Clock::now() + std::chrono::milliseconds(200));
+            continue;
+        }
+        if (reply.term > term_) {
+            lock.unlock();
+            if (on_higher_term_) on_higher_term_(reply.term);
+            lock.lock();
+            break;
+        }
+
+        offset = reply.next_offset <= file_size ? reply.next_offset : 0;
+        peer.snapshot_offset = offset;
+        if (reply.success && args.done) {
+            installed = true;
+            break;
+        }
+        if (!reply.success) {
+            pause(Clock::now() + std::chrono::milliseconds(200));
+            continue;
+        }
+
+        // Pace to snapshot_rate_bytes on average
+        sent += len;
+        if (options_.snapshot_rate_bytes > 0) {
+            auto due = started + std::chrono::microseconds(
+                sent * 1000000 / options_.snapshot_rate_bytes);
+            pause(std::chrono::time_point_cast<Clock::duration>(due));
+        }
+    }
+
+    closeSocket();
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    bool progressed = false;
+    if (installed) {
+        int index = metadata.last_included_index;
+        if (index > peer.state.match_index) {
+            peer.state.match_index = index;
+            progressed = true;
+        }
+        peer.state.next_index = std::max(peer.state.next_index, index + 1);
+        peer.next_send_index = std::max(peer.next_send_index, peer.state.next_index);
+        peer.waiting_for_snapshot = false;
+        peer.snapshot_offset = 0;
+        peer.epoch++;  // Boundary probes still in flight no longer matter
+        peer.cv.notify_one();
+        LOG_INFO("Follower " << peer.addr << " installed snapshot at index "
+                  << index);
+    }
+    peer.snapshot_running = false;
+    lock.unlock();
+
+    if (progressed && on_progress_) {
+        on_progress_();
+    }
+}
+
+bool Replicator::sendSnapshotChunk(int sock, int fd, const proto::InstallSnapshotView& args,
+                                   size_t len, proto::InstallSnapshotReply& reply) {
+    std::string header;
+    proto::encodeInstallSnapshotHeader(header, args, static_cast<uint32_t>(len));
+
+    size_t written = 0;
+    while (written < header.size()) {
+        ssize_t n = send(sock, header.data() + written, header.size() - written, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        written += static_cast<size_t>(n);
+    }
+
+    // The chunk goes from the page cache straight to the socket
+    off_t file_offset = static_cast<off_t>(args.offset);
+    size_t remaining = len;
+    while (remaining > 0) {
+        ssize_t n = sendfile(sock, fd, &file_offset, remaining);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        remaining -= static_cast<size_t>(n);
+    }
+
+    std::string buffer;
+    char chunk[256];
+    while (true) {
+        proto::Frame frame;
+        size_t consumed;
+        proto::ParseResult result = proto::parseFrame(buffer, frame, consumed);
+        if (result == proto::ParseResult::FRAME) {
+            return frame.type == proto::MsgType::INSTALL_SNAPSHOT_REPLY &&
+                   proto::decodeInstallSnapshotReply(frame.payload, reply);
+        }
+        if (result == proto::ParseResult::INVALID) {
+            return false;
+        }
+        ssize_t n = read(sock, chunk, sizeof(chunk));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;  // Includes the receive timeout
+        buffer.append(chunk, static_cast<size_t>(n));
+    }
+}
+
+void Replicator::dropConnection(Peer& peer, int sock) {
+    if (peer.sock != sock) {
+        return;
+    }
+    shutdown(sock, SHUT_RDWR);
+    peer.sock = -1;
+    peer.in_flight.clear();
+    peer.next_send_index = peer.state.next_index;
+    peer.epoch++;
+    peer.cv.notify_one();
+}
+
+int Replicator::connectTo(const std::string& addr, bool text) const {
+    std::string ip = addr.substr(0, addr.find(':'));
+    int port = std::stoi(addr.substr(addr.find(':') + 1));
 
     int sock = socket(AF_INET, SOCK_STREAM, 0);
     if (sock < 0) {
-        std::cerr << "[ERROR] Failed to create socket for " << follower_addr << std::endl;
-        return false;
+        LOG_ERROR("Failed to create socket for " << addr);
+        return -1;
     }
 
-    // Set socket timeout
+    // Acks owed for longer than this mean the follower is gone
     struct timeval timeout;
     timeout.tv_sec = 2;
     timeout.tv_usec = 0;
     setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
     setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
 
+    // Small pipelined batches must not sit in Nagle's buffer
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
     sockaddr_in serv{};
     serv.sin_family = AF_INET;
     serv.sin_port = htons(port);
@@ -168,54 +658,35 @@ bool Replicator::sendAppendEntries(const std::string& follower_addr,
 
     if (connect(sock, (sockaddr*)&serv, sizeof(serv)) < 0) {
         close(sock);
-        return false;
-    }
-
-    std::ostringstream oss;
-    oss << "APPEND_ENTRIES "
-        << term << " "
-        << server_id_ << " "
-        << prev_log_index << " "
-        << prev_log_term << " "
-        << leader_commit << " "
-        << entries.size();
-    
-    for (const auto& entry : entries) {
-        oss << " " << entry.index
-            << " " << entry.term
-            << " " << entry.operation
-            << " " << entry.key
-            << " " << entry.value;
-    }
-    oss << "\n";
-
-    std::string msg = oss.str();
-    ssize_t written = write(sock, msg.c_str(), msg.size());
-    if (written < 0) {
+        return -1;
+    }
+
+    std::string hello;
+    if (text) {
+        hello = proto::formatPeerHelloText(options_.hello);
+    } else {
+        proto::encodePeerHello(hello, options_.hello);
+    }
+    if (send(sock, hello.data(), hello.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(hello.size())) {
         close(sock);
-        return false;
+        return -1;
     }
+    return sock;
+}
 
-    char buffer[256];
-    ssize_t n = read(sock, buffer, sizeof(buffer));
-    close(sock);
+std::string Replicator::buildAppendEntries(int prev_log_index, int prev_log_term,
+                                           const std::vector<LogEntry>& entries) const {
+    proto::AppendEntriesView args;
+    args.term = term_;
+    args.leader_id = server_id_;
+    args.prev_log_index = prev_log_index;
+    args.prev_log_term = prev_log_term;
+    args.leader_commit = leader_commit_.load();
 
-    if (n > 0) {
-        std::string resp(buffer, n);
-        std::istringstream iss(resp);
-        std::string result;
-        int resp_term, resp_next_index;
-        
-        iss >> result >> resp_term >> resp_next_index;
-        
-        if (result == "SUCCESS") {
-            follower_next_index = resp_next_index;
-            return true;
-        } else if (result == "FAIL") {
-            follower_next_index = resp_next_index;
-            return false;
-        }
+    if (options_.text_protocol) {
+        return proto::formatAppendEntriesText(args, entries);
     }
-
-    return false;
+    std::string out;
+    proto::encodeAppendEntries(out, args, entries);
+    return out;
 }
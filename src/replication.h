@@ -1,51 +1,198 @@
 #pragma once
 #include <vector>
 #include <string>
-#include <unordered_map>
+#include <deque>
+#include <memory>
 #include <mutex>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+#include <chrono>
 #include "wal.h"
+#include "protocol.h"
+#include "snapshot.h"
+#include "metrics.h"
+
+struct ReplicationOptions {
+    int max_in_flight = 8;          // AppendEntries batches sent ahead of their acks
+    int max_batch_entries = 1024;   // Entries per AppendEntries batch
+    size_t max_batch_bytes = 1 << 20;   // Key and value bytes per batch (past the first entry)
+    bool text_protocol = false;     // Text instead of binary frames (debugging)
+    size_t snapshot_chunk_bytes = 1 << 20;      // InstallSnapshot chunk size
+    uint64_t snapshot_rate_bytes = 32ull << 20; // Per-follower snapshot bytes/s; 0 = unpaced
+    proto::PeerHello hello;         // Opens every connection to a follower
+    metrics::Labels metric_labels;  // Added to the per-follower metrics' labels
+};
 
 struct ReplicationState {
     int next_index;      // Next log index to send to this follower
     int match_index;     // Highest log index known to be replicated
-    
+
     ReplicationState() : next_index(1), match_index(0) {}
 };
 
+/**
+ * Replicator
+ *
+ * Leader-side replication for one term. Each follower gets one long-lived
+ * TCP connection, a sender thread and an ack-reader thread, so no write
+ * pays for a TCP handshake or a thread spawn.
+ *
+ * PIPELINING:
+ * The sender keeps up to max_in_flight AppendEntries batches outstanding
+ * without waiting for acks. next_send_index runs ahead optimistically;
+ * next_index/match_index only move when an ack arrives. Responses come back
+ * in send order on the connection, so each ack is matched to the oldest
+ * in-flight batch. A rejection rewinds next_send_index and bumps the
+ * pipeline epoch; acks for batches sent before the rewind are then ignored.
+ *
+ * CATCH-UP:
+ * A rejection carries the follower's hint: a follower that is simply
+ * behind says where its log ends; one holding entries of a term we don't
+ * agree with names that term and where it starts in its log, and we back
+ * up past the whole term (to just after our own last entry of it, if we
+ * have any). Either way one round trip moves next_index, however far
+ * behind the follower is. Batches are capped at max_batch_entries and
+ * max_batch_bytes, so a lagging follower gets a steady stream of bounded
+ * messages rather than one huge one.
+ *
+ * Progress (match_index moving) is reported through on_progress, and a
+ * response carrying a higher term through on_higher_term. Both run on the
+ * ack-reader thread.
+ *
+ * LEADERSHIP ROUNDS (ReadIndex / leases):
+ * Every AppendEntries is stamped with the current round. requestRound()
+ * starts a new round and makes every sender emit a heartbeat; once a
+ * majority (counting the leader) has answered something stamped with that
+ * round in our term, nobody else can have been leader when the round
+ * started. on_round_confirmed then reports the highest confirmed round and
+ * when it started, which is what ReadIndex waits for and what a lease is
+ * measured from.
+ *
+ * SNAPSHOTS:
+ * When a follower needs entries that compaction already discarded, the
+ * sender keeps heartbeating from the snapshot boundary and starts a
+ * snapshot thread for it. That thread streams the latest snapshot file on
+ * its own connection, one InstallSnapshot chunk at a time (sendfile, no
+ * copy through user space). Each chunk waits for its ack, which tells us
+ * the offset the follower wants next: that's the flow control, and it is
+ * also how a transfer resumes after a reconnect. The follower answers the
+ * last chunk before installing, with success = false at the end offset;
+ * that sends an empty last chunk every retry pause until it says success,
+ * so a long load never outlasts the socket's receive timeout. The rate is
+ * capped at snapshot_rate_bytes so the transfer doesn't crowd out
+ * AppendEntries.
+ */
 class Replicator {
 public:
-    Replicator(const std::vector<std::string>& followers, int server_id);
+    using Clock = std::chrono::steady_clock;
+
+    Replicator(const std::vector<std::string>& followers, int server_id, int term,
+               WriteAheadLog& wal, SnapshotManager* snapshots,
+               const ReplicationOptions& options,
+               std::function<void()> on_progress,
+               std::function<void(int)> on_higher_term,
+               std::function<void(uint64_t, Clock::time_point)> on_round_confirmed = nullptr);
+    ~Replicator();
 
     const std::vector<std::string>& followers() const;
 
-    // Send heartbeats with AppendEntries (empty entries)
-    void sendHeartbeats(int leader_term, int leader_commit, WriteAheadLog& wal);
+    // Reset state for new leadership term and start the per-follower threads
+    void start(int last_log_index);
+
+    // Stop all threads and close the connections (also done by the destructor)
+    void stop();
+
+    // Commit index piggybacked on every AppendEntries from now on
+    void setCommitIndex(int commit_index);
+
+    // New entries were appended locally; senders pick them up
+    void notifyNewEntries();
+
+    // Make every follower's sender emit an AppendEntries now, even if empty.
+    // Also starts a new leadership round.
+    void sendHeartbeats();
+
+    // Start a new leadership round (and heartbeat it); returns its number
+    uint64_t requestRound();
 
-    // Replicate new entries to followers
-    // Returns true if majority acknowledged
-    bool replicateEntries(int leader_term, int leader_commit, 
-                         WriteAheadLog& wal, int start_index);
-    
     // Update commit index based on match indices
-    int calculateCommitIndex(int current_commit, int current_term, WriteAheadLog& wal);
-    
-    // Reset state for new leadership term
-    void resetState(int last_log_index);
+    int calculateCommitIndex(int current_commit, int current_term);
 
 private:
+    struct InFlight {
+        int prev_log_index;
+        int last_index;             // == prev_log_index for an empty batch
+        uint64_t epoch;
+        uint64_t round;             // Leadership round when it was sent
+        Clock::time_point sent_at;
+    };
+
+    struct Peer {
+        std::string addr;
+        ReplicationState state;
+        int sock = -1;
+        int next_send_index = 1;    // First index not sent yet (optimistic)
+        uint64_t epoch = 0;         // Bumped whenever the pipeline is rewound
+        std::deque<InFlight> in_flight;
+        bool heartbeat_due = false;
+        bool waiting_for_snapshot = false;
+        uint64_t acked_round = 0;   // Highest round this follower answered in our term
+        std::condition_variable cv;
+        std::thread sender;
+        std::thread receiver;
+        metrics::Histogram* rtt = nullptr;  // Send to ack, per follower
+
+        // InstallSnapshot transfer (see snapshotLoop)
+        bool snapshot_running = false;
+        int snapshot_sock = -1;
+        int snapshot_index = 0;             // Snapshot being sent...
+        uint64_t snapshot_offset = 0;       // ...and where the follower is in it
+        std::condition_variable snapshot_cv;
+        std::thread snapshot_sender;        // Started and joined by the sender thread
+    };
+
     std::vector<std::string> followers_;
     int server_id_;
-    
-    // Track replication progress for each follower
-    std::unordered_map<std::string, ReplicationState> follower_state_;
+    int term_;
+    WriteAheadLog& wal_;
+    SnapshotManager* snapshots_;
+    ReplicationOptions options_;
+    std::function<void()> on_progress_;
+    std::function<void(int)> on_higher_term_;
+    std::function<void(uint64_t, Clock::time_point)> on_round_confirmed_;
+
+    std::atomic<int> leader_commit_{0};
+
+    // Guards every Peer's mutable fields and last_log_index_
     std::mutex state_mutex_;
-    
-    // Send AppendEntries to a specific follower
-    bool sendAppendEntries(const std::string& follower_addr,
-                          int term,
-                          int prev_log_index,
-                          int prev_log_term,
-                          const std::vector<LogEntry>& entries,
-                          int leader_commit,
-                          int& follower_next_index);
+    std::vector<std::unique_ptr<Peer>> peers_;
+    int last_log_index_ = 0;
+    bool stopping_ = false;
+    uint64_t round_ = 0;
+    uint64_t confirmed_round_ = 0;
+    std::deque<std::pair<uint64_t, Clock::time_point>> round_starts_;  // Unconfirmed rounds
+
+    // Start a round and heartbeat it. Assumes state_mutex_ is held.
+    uint64_t startRoundLocked();
+    // Highest round a majority has answered. Assumes state_mutex_ is held.
+    uint64_t quorumRoundLocked() const;
+
+    void senderLoop(Peer& peer);
+    void receiverLoop(Peer& peer, int sock);
+    void handleResponse(Peer& peer, int sock, const proto::AppendEntriesReply& reply);
+    void snapshotLoop(Peer& peer);
+    // One chunk out and its ack back; false on a connection problem
+    bool sendSnapshotChunk(int sock, int fd, const proto::InstallSnapshotView& args,
+                           size_t len, proto::InstallSnapshotReply& reply);
+
+    // Forget the connection (if still current) and rewind the pipeline.
+    // Assumes state_mutex_ is held.
+    void dropConnection(Peer& peer, int sock);
+
+    // Connected and greeted with options_.hello in the given protocol; -1 on failure
+    int connectTo(const std::string& addr, bool text) const;
+    std::string buildAppendEntries(int prev_log_index, int prev_log_term,
+                                   const std::vector<LogEntry>& entries) const;
 };
@@ -1,4 +1,5 @@
 #include "server.h"
+#include "log.h"
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <sstream>
@@ -6,33 +7,126 @@
 #include <iostream>
 #include <cstring>
 #include <sys/socket.h>
+#include <poll.h>
+#include <netinet/tcp.h>
 #include <netinet/in.h>
 #include <algorithm>
+#include <iterator>
+#include <limits>
+
+namespace {
+
+// One group keeps the paths a single-group node has always used
+std::string walDir(int port, const ServerConfig& config) {
+    std::string dir = "wal_" + std::to_string(port);
+    return config.groups > 1 ? dir + "_g" + std::to_string(config.group) : dir;
+}
+
+std::string snapshotDir(const ServerConfig& config) {
+    return config.groups > 1 ? "snapshots_g" + std::to_string(config.group)
+                             : std::string("snapshots");
+}
+
+// LRU eviction needs reads stamped
+StoreOptions storeOptions(const ServerConfig& config) {
+    StoreOptions options = config.store;
+    options.track_access |= config.memory_policy == MemoryPolicy::EVICT_LRU;
+    return options;
+}
+
+}  // namespace
 
 Server::Server(int port, Role role, int server_id,
-               const std::vector<std::string>& peers)
+               const std::vector<std::string>& peers,
+               const ServerConfig& config, Reactor& reactor,
+               std::shared_ptr<WalWriter> wal_writer)
     : port_(port),
       server_id_(server_id),
       peers_(peers),
       role_(role),
-      wal_("wal_" + std::to_string(port) + ".log"),
-      snapshot_manager_("snapshots", server_id),
-      rng_(std::random_device{}()) {
+      config_(config),
+      store_(storeOptions(config)),
+      wal_(walDir(port, config), config.wal, std::move(wal_writer)),
+      snapshot_manager_(snapshotDir(config), server_id, config.snapshot),
+      rng_(std::random_device{}()),
+      reactor_(reactor) {
+    
+    hello_.group = config_.group;
+    hello_.server_id = server_id_;
+    hello_.addr = config_.advertise_addr.empty() ? "127.0.0.1:" + std::to_string(port_)
+                                                 : config_.advertise_addr;
+    if (config_.groups > 1) {
+        tag_ = "[g" + std::to_string(config_.group) + "] ";
+        labels_ = {{"group", std::to_string(config_.group)}};
+    }
+    
+    auto& registry = metrics::registry();
+    metrics_.put_commit = &registry.histogram(
+        "logkv_put_commit_seconds", "Client write latency, received to committed and acknowledged",
+        labels_);
+    metrics_.get = &registry.histogram(
+        "logkv_get_seconds", "Client GET/MULTI_GET latency, including any read index confirmation",
+        labels_);
+    metrics_.put_batch = &registry.histogram(
+        "logkv_put_batch_entries", "Client PUTs folded into one log append", labels_,
+        metrics::Unit::NONE);
+    metrics_.queue_depth = &registry.histogram(
+        "logkv_event_queue_depth", "Events waiting in the event queue, sampled per drain", labels_,
+        metrics::Unit::NONE);
+    metrics_.snapshot_create = &registry.histogram(
+        "logkv_snapshot_create_seconds", "Time to write a snapshot and compact the log", labels_);
+    metrics_.snapshot_install = &registry.histogram(
+        "logkv_snapshot_load_seconds", "Time to load a snapshot into the store", labels_);
+    metrics_.writes = &registry.counter("logkv_client_writes_total",
+                                        "Client PUT, DELETE and MULTI_PUT requests", labels_);
+    metrics_.gets = &registry.counter("logkv_client_gets_total", "Client GET requests", labels_);
+    metrics_.applied = &registry.counter("logkv_applied_entries_total",
+                                         "Log entries applied to the store", labels_);
+    metrics_.elections = &registry.counter("logkv_elections_total", "Elections started", labels_);
+    metrics_.prevotes_failed = &registry.counter(
+        "logkv_prevotes_failed_total", "Pre-votes that found no majority, so no election", labels_);
+    metrics_.quorum_lost = &registry.counter(
+        "logkv_quorum_lost_total", "Times the leader stepped down on losing majority contact", labels_);
+    metrics_.forwarded = &registry.counter("logkv_forwarded_writes_total",
+                                           "Client writes a follower proxied to the leader", labels_);
+    metrics_.evicted = &registry.counter("logkv_evicted_keys_total",
+                                         "Keys the leader deleted to stay under the memory budget",
+                                         labels_);
+    metrics_.rejected_oom = &registry.counter("logkv_oom_rejected_writes_total",
+                                              "Client writes refused for the memory budget", labels_);
+    metrics_.expired = &registry.counter("logkv_expired_keys_total",
+                                         "Keys deleted by EXPIRE entries for being past their deadline",
+                                         labels_);
+    metrics_.duplicates = &registry.counter("logkv_duplicate_writes_total",
+                                            "Retried client writes acknowledged without applying them again",
+                                            labels_);
     
     // Load persistent state
     loadState();
     
-    // Try to load snapshot first (faster recovery)
+    // Recovery: the snapshot (blocks decoded in parallel), then only the
+    // log entries after it, spread over the same number of threads
+    auto recovery_start = std::chrono::steady_clock::now();
     if (loadSnapshot()) {
-        std::cout << "[INFO] Loaded from snapshot" << std::endl;
+        LOG_INFO("Loaded from snapshot");
     }
-    
-    // Replay WAL to apply entries after snapshot
-    wal_.replay(store_);
-    
-    std::cout << "[INFO] Server " << server_id_ << " initialized on port " 
-              << port_ << " in role " << (role_ == Role::LEADER ? "LEADER" : "FOLLOWER") 
-              << std::endl;
+    size_t snapshot_records = store_.size();
+    size_t threads = config_.recovery_threads > 0
+        ? static_cast<size_t>(config_.recovery_threads)
+        : std::min<size_t>(8, std::max(1u, std::thread::hardware_concurrency()));
+    WalReplayStats replayed = wal_.replay(store_, last_applied_, threads, &sessions_);
+    entries_since_snapshot_ = static_cast<int>(replayed.entries);
+    
+    double seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - recovery_start).count();
+    size_t records = snapshot_records + replayed.entries;
+    LOG_INFO(tag_ << "Recovered " << records << " records (" << snapshot_records
+              << " from snapshot, " << replayed.entries << " from log) in "
+              << static_cast<int64_t>(seconds * 1000) << " ms ("
+              << static_cast<int64_t>(seconds > 0 ? records / seconds : 0) << " records/s)");
+    
+    LOG_INFO(tag_ << "Server " << server_id_ << " initialized on port "
+              << port_ << " in role " << (role_ == Role::LEADER ? "LEADER" : "FOLLOWER"));
 }
 
 Server::~Server() {
@@ -41,21 +135,45 @@ Server::~Server() {
 
 void Server::shutdown() {
     running_ = false;
+    timers_.stop();
     event_queue_.shutdown();
+    {
+        std::lock_guard<std::mutex> lock(forward_mutex_);
+        forward_cv_.notify_all();
+    }
+    {
+        std::lock_guard<std::mutex> lock(apply_wake_mutex_);
+        apply_cv_.notify_all();
+    }
+    {
+        std::lock_guard<std::mutex> lock(election_mutex_);
+        election_cv_.notify_all();
+    }
     
     if (event_loop_thread_.joinable()) {
         event_loop_thread_.join();
     }
-    if (heartbeat_thread_.joinable()) {
-        heartbeat_thread_.join();
+    if (apply_thread_.joinable()) {
+        apply_thread_.join();
     }
     if (election_thread_.joinable()) {
         election_thread_.join();
     }
+    if (read_forwarder_thread_.joinable()) {
+        read_forwarder_thread_.join();
+    }
+    if (snapshot_thread_.joinable()) {
+        snapshot_thread_.join();
+    }
+    if (install_thread_.joinable()) {
+        install_thread_.join();
+    }
 }
 
 void Server::loadState() {
-    wal_.loadMetadata(current_term_, voted_for_);
+    int term = 0;
+    wal_.loadMetadata(term, voted_for_);
+    current_term_ = term;
 }
 
 void Server::persistState() {
@@ -63,132 +181,329 @@ void Server::persistState() {
 }
 
 int Server::getElectionTimeout() {
-    // Random timeout between 150-300ms (scaled up for testing: 3-6 seconds)
-    std::uniform_int_distribution<> dist(3000, 6000);
+    // Random so that followers of a failed leader don't all time out together
+    std::uniform_int_distribution<> dist(
+        static_cast<int>(config_.election_timeout_min.count()),
+        static_cast<int>(std::max(config_.election_timeout_min, config_.election_timeout_max).count()));
     return dist(rng_);
 }
 
 void Server::startEventLoop() {
     event_loop_thread_ = std::thread([this]() {
-        std::cout << "[INFO] Event loop started\n";
+        LOG_INFO("Event loop started");
         
+        std::vector<Event> events;
         while (running_) {
-            auto event_opt = event_queue_.pop_with_timeout(std::chrono::milliseconds(100));
-            if (!event_opt.has_value()) {
-                continue;
+            // Blocks (spin, then park) until something arrives or shutdown
+            events.clear();
+            if (!event_queue_.drain(events, kEventDrainBatch)) {
+                break;
             }
+            metrics_.queue_depth->record(events.size() + event_queue_.size());
             
-            processEvent(event_opt.value());
+            size_t i = 0;
+            while (i < events.size()) {
+                if (events[i].type != EventType::CLIENT_PUT) {
+                    processEvent(events[i++]);
+                    continue;
+                }
+                
+                // Coalesce this PUT and the ones queued right behind it into one append
+                std::vector<Event> batch;
+                while (i < events.size() && events[i].type == EventType::CLIENT_PUT &&
+                       batch.size() < config_.put_batch_entries) {
+                    batch.push_back(std::move(events[i++]));
+                }
+                if (i == events.size() && batch.size() < config_.put_batch_entries) {
+                    auto more = event_queue_.pop_run(EventType::CLIENT_PUT,
+                                                     config_.put_batch_entries - batch.size(),
+                                                     config_.put_batch_linger);
+                    std::move(more.begin(), more.end(), std::back_inserter(batch));
+                }
+                processPutBatch(batch);
+            }
         }
         
-        std::cout << "[INFO] Event loop stopped\n";
+        LOG_INFO("Event loop stopped");
     });
 }
 
-void Server::processEvent(const Event& e) {
+void Server::processEvent(Event& e) {
     if (e.type == EventType::CLIENT_PUT) {
-        // Leader appends to log and initiates replication
-        if (role_ != Role::LEADER) {
-            if (e.client_callback) {
-                e.client_callback(false, "NOT_LEADER");
-            }
-            return;
+        std::vector<Event> batch;
+        batch.push_back(std::move(e));
+        processPutBatch(batch);
+    }
+    else if (e.type == EventType::REPL_ACK) {
+        onReplicationAck(e.ack_index);
+    }
+    else if (e.type == EventType::CHECK_QUORUM) {
+        // CheckQuorum: a leader that hasn't heard from a majority for an
+        // election timeout is probably cut off, and a new leader may be
+        // taking writes on the other side. Step down rather than hold on
+        // to clients whose writes can't commit.
+        std::lock_guard<std::mutex> lock(raft_mutex_);
+        if (role_ == Role::LEADER && current_term_ == e.term && !leaderIsAlive()) {
+            LOG_WARN(tag_ << "Lost contact with a majority for "
+                      << config_.election_timeout_min.count() << "ms; stepping down");
+            metrics_.quorum_lost->add();
+            stepDown(current_term_);
+            leader_id_ = -1;
+            last_heartbeat_ = std::chrono::steady_clock::now();
         }
-        
-        // Get last log info
-        int last_index, last_term;
-        wal_.getLastLogInfo(last_index, last_term);
-        
-        int new_index = last_index + 1;
-        LogEntry entry(new_index, current_term_, e.key, e.value, "PUT");
-        
-        // Append to local log
-        wal_.appendEntry(entry);
-        
-        // Store callback for when this gets committed
-        if (e.client_callback) {
-            std::lock_guard<std::mutex> lock(pending_requests_mutex_);
-            pending_requests_[new_index] = {new_index, e.client_callback};
+    }
+    else if (e.type == EventType::APPEND_ENTRIES_RESPONSE) {
+        // A follower answered with a newer term: we've been deposed
+        std::lock_guard<std::mutex> lock(raft_mutex_);
+        if (e.term > current_term_) {
+            stepDown(e.term);
+        }
+    }
+}
+
+void Server::onReplicationAck(int ack_index) {
+    // Replication succeeded, advance commit index
+    if (role_ != Role::LEADER) {
+        return;
+    }
+    int new_commit = ack_index;
+    
+    auto replicator = std::atomic_load(&replicator_);
+    if (replicator) {
+        new_commit = replicator->calculateCommitIndex(commit_index_, current_term_);
+    }
+    
+    if (new_commit > commit_index_) {
+        commit_index_ = new_commit;
+        if (replicator) {
+            replicator->setCommitIndex(commit_index_);
         }
+        LOG_DEBUG("Advanced commit index to " << commit_index_);
         
-        // Trigger replication
-        std::thread([this, new_index]() {
-            if (replicator_) {
-                bool success = replicator_->replicateEntries(
-                    current_term_, commit_index_, wal_, new_index
-                );
-                
-                if (success) {
-                    // Update commit index
-                    Event commit_event;
-                    commit_event.type = EventType::REPL_ACK;
-                    commit_event.ack_index = new_index;
-                    event_queue_.push(commit_event);
-                }
-            } else {
-                // Single-node cluster, commit immediately
-                Event commit_event;
-                commit_event.type = EventType::REPL_ACK;
-                commit_event.ack_index = new_index;
-                event_queue_.push(commit_event);
-            }
-        }).detach();
+        // Apply committed entries
+        advanceCommitIndex();
     }
-    else if (e.type == EventType::REPL_ACK) {
-        // Replication succeeded, advance commit index
-        if (role_ == Role::LEADER) {
-            int new_commit = e.ack_index;
-            
-            if (replicator_) {
-                new_commit = replicator_->calculateCommitIndex(commit_index_, current_term_, wal_);
-            }
-            
-            if (new_commit > commit_index_) {
-                commit_index_ = new_commit;
-                std::cout << "[INFO] Advanced commit index to " << commit_index_ << std::endl;
-                
-                // Apply committed entries
-                advanceCommitIndex();
+}
+
+void Server::processPutBatch(std::vector<Event>& batch) {
+    // Leader appends to log and initiates replication. Under raft_mutex_,
+    // so we can't step down and have our log truncated halfway through.
+    std::lock_guard<std::mutex> lock(raft_mutex_);
+    if (role_ != Role::LEADER) {
+        for (auto& e : batch) {
+            if (e.client_callback) {
+                e.client_callback(false, "NOT_LEADER");
             }
         }
+        return;
+    }
+    
+    // Get last log info
+    int last_index, last_term;
+    wal_.getLastLogInfo(last_index, last_term);
+    metrics_.put_batch->record(batch.size());
+    
+    // One arena block holds the whole batch's keys and values
+    size_t batch_bytes = 0;
+    for (const auto& e : batch) {
+        batch_bytes += e.key.size() + e.value.size();
     }
-    else if (e.type == EventType::HEARTBEAT_TICK) {
-        if (role_ == Role::LEADER && replicator_) {
-            replicator_->sendHeartbeats(current_term_, commit_index_, wal_);
+    LogArena arena(batch_bytes);
+    std::vector<LogEntry> entries;
+    entries.reserve(batch.size());
+    {
+        // Callbacks fire from the apply thread in log order
+        std::lock_guard<std::mutex> lock(pending_requests_mutex_);
+        for (auto& e : batch) {
+            int new_index = last_index + 1 + static_cast<int>(entries.size());
+            entries.push_back(arena.make(new_index, current_term_, e.op, e.key, e.value));
+            if (e.client_callback) {
+                pending_requests_[new_index] = {new_index, std::move(e.client_callback)};
+            }
         }
     }
+    
+    // Append the whole batch to the local log with one durability wait. A
+    // log that can't make it durable can't lead: nothing of the batch is
+    // acknowledged, and the clients retry with whoever takes over.
+    if (!wal_.appendEntries(entries)) {
+        LOG_ERROR(tag_ << "WAL append failed; stepping down");
+        stepDown(current_term_);
+        return;
+    }
+    
+    // Trigger one replication round; the per-follower senders pick it up
+    auto replicator = std::atomic_load(&replicator_);
+    if (replicator) {
+        replicator->notifyNewEntries();
+    } else {
+        // Single-node cluster, commit immediately. Right here rather than
+        // through a REPL_ACK: this is the event loop, and a push into its
+        // own full queue would wait forever.
+        onReplicationAck(entries.back().index);
+    }
 }
 
 void Server::advanceCommitIndex() {
-    while (last_applied_ < commit_index_) {
-        last_applied_++;
-        
-        LogEntry entry;
-        if (wal_.getEntry(last_applied_, entry)) {
-            applyLogEntry(entry);
+    // Taking the lock orders this wakeup after the applier's last check
+    std::lock_guard<std::mutex> lock(apply_wake_mutex_);
+    apply_cv_.notify_one();
+}
+
+void Server::startApplier() {
+    apply_thread_ = std::thread([this]() {
+        std::vector<LogEntry> entries;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(apply_wake_mutex_);
+                apply_cv_.wait(lock, [&]{ return !running_ || last_applied_ < commit_index_; });
+                if (!running_) {
+                    break;
+                }
+            }
             
-            // Notify waiting client if this was their request
-            std::lock_guard<std::mutex> lock(pending_requests_mutex_);
-            auto it = pending_requests_.find(last_applied_);
-            if (it != pending_requests_.end()) {
-                if (it->second.callback) {
-                    it->second.callback(true, "OK");
+            // Committed entries come out of the log a batch at a time
+            // (sharing the cached bytes) and go to the store as one batch
+            {
+                std::lock_guard<std::mutex> lock(apply_mutex_);
+                int from = last_applied_ + 1;
+                int upto = commit_index_;
+                if (upto < from) {
+                    continue;   // A snapshot install got there first
+                }
+                entries = wal_.getEntriesFrom(from, std::min(static_cast<size_t>(upto - from + 1),
+                                                             kApplyBatch));
+                if (!entries.empty()) {
+                    applyEntries(entries);
+                    continue;
                 }
-                pending_requests_.erase(it);
             }
+            // Compacted away under us: the snapshot covering it moves
+            // last_applied_ past it once installed
+            std::unique_lock<std::mutex> lock(apply_wake_mutex_);
+            apply_cv_.wait_for(lock, std::chrono::milliseconds(10));
         }
-    }
+    });
 }
 
-void Server::applyLogEntry(const LogEntry& entry) {
-    if (entry.operation == "PUT") {
-        store_.put(entry.key, entry.value);
-        std::cout << "[INFO] Applied entry " << entry.index << ": PUT " 
-                  << entry.key << "=" << entry.value << std::endl;
+void Server::applyEntries(const std::vector<LogEntry>& entries) {
+    // Assumes apply_mutex_ is held
+    std::vector<KVStore::Write> writes;
+    writes.reserve(entries.size());
+    auto addWrite = [&](int index, LogOp op, std::string_view key, std::string_view value) {
+        switch (op) {
+            case LogOp::PUT:
+                writes.emplace_back(std::string(key), std::string(value));
+                LOG_DEBUG("Applying entry " << index << ": PUT " << key << "=" << value);
+                break;
+            case LogOp::PUT_TTL: {
+                uint64_t deadline = 0;
+                std::string_view bytes;
+                if (decodeExpiringPut(value, deadline, bytes)) {
+                    writes.emplace_back(std::string(key), std::string(bytes), deadline);
+                }
+                LOG_DEBUG("Applying entry " << index << ": PUT " << key << " until " << deadline);
+                break;
+            }
+            case LogOp::EXPIRE: {
+                // Goes by the deadline each key has at this point in the
+                // log, so the writes before it land first
+                uint64_t now;
+                std::vector<std::string_view> keys;
+                if (decodeExpire(value, now, keys)) {
+                    if (!writes.empty()) {
+                        store_.applyBatch(std::move(writes));
+                        writes.clear();
+                    }
+                    metrics_.expired->add(store_.expire(keys, now));
+                }
+                LOG_DEBUG("Applying entry " << index << ": EXPIRE of " << keys.size() << " keys");
+                break;
+            }
+            case LogOp::DELETE:
+                writes.emplace_back(std::string(key), std::nullopt);
+                LOG_DEBUG("Applying entry " << index << ": DELETE " << key);
+                break;
+            case LogOp::MULTI_PUT: {
+                // Validated when the leader accepted it, so this only fails on
+                // a corrupt log, which the record CRC already rules out
+                KeyValueViews pairs;
+                if (decodeMultiPut(value, pairs)) {
+                    for (const auto& [k, v] : pairs) {
+                        writes.emplace_back(std::string(k), std::string(v));
+                    }
+                }
+                LOG_DEBUG("Applying entry " << index << ": MPUT of " << pairs.size() << " keys");
+                break;
+            }
+            default:
+                break;
+        }
+    };
+    for (const LogEntry& entry : entries) {
+        if (entry.op != LogOp::SESSION) {
+            addWrite(entry.index, entry.op, entry.key(), entry.value());
+            continue;
+        }
+        // A numbered client write: applied unless this client's write was
+        // already (a retry logged twice). Its client is answered OK either way.
+        uint64_t client_id, seq;
+        LogOp op;
+        std::string_view value;
+        if (!decodeSessionWrite(entry.value(), client_id, seq, op, value)) {
+            continue;
+        }
+        bool fresh;
+        {
+            std::lock_guard<std::mutex> lock(sessions_mutex_);
+            fresh = sessions_.admit(client_id, seq, entry.index);
+        }
+        if (fresh) {
+            addWrite(entry.index, op, entry.key(), value);
+        } else {
+            metrics_.duplicates->add();
+        }
+    }
+    store_.applyBatch(std::move(writes));
+    
+    // Published after the store has the whole batch, for reads waiting on it
+    last_applied_ = entries.back().index;
+    metrics_.applied->add(entries.size());
+    entries_since_snapshot_ += static_cast<int>(entries.size());
+    
+    // Answer the batch's clients in log order, outside the lock
+    std::vector<std::function<void(bool, const std::string&)>> done;
+    {
+        std::lock_guard<std::mutex> lock(pending_requests_mutex_);
+        if (!pending_requests_.empty()) {
+            for (const LogEntry& entry : entries) {
+                auto it = pending_requests_.find(entry.index);
+                if (it != pending_requests_.end()) {
+                    done.push_back(std::move(it->second.callback));
+                    pending_requests_.erase(it);
+                }
+            }
+        }
+    }
+    for (auto& callback : done) {
+        if (callback) {
+            callback(true, "OK");
+        }
     }
     
-    // Track entries since last snapshot
-    entries_since_snapshot_++;
+    // Release reads whose read index is now applied
+    std::vector<std::function<void()>> ready;
+    {
+        std::lock_guard<std::mutex> lock(read_mutex_);
+        auto end = apply_waiters_.upper_bound(last_applied_);
+        for (auto it = apply_waiters_.begin(); it != end; ++it) {
+            ready.push_back(std::move(it->second));
+        }
+        apply_waiters_.erase(apply_waiters_.begin(), end);
+    }
+    for (auto& task : ready) {
+        task();
+    }
     
     // Trigger snapshot if threshold reached (async, doesn't block)
     if (role_ == Role::LEADER) {
@@ -200,165 +515,492 @@ void Server::stepDown(int new_term) {
     if (new_term > current_term_) {
         current_term_ = new_term;
         voted_for_ = -1;
+        leader_id_ = -1;
         persistState();
     }
     
     role_ = Role::FOLLOWER;
-    replicator_.reset();
+    std::atomic_store(&replicator_, std::shared_ptr<Replicator>());
+    failPendingReads();
+    
+    // Our uncommitted entries may yet commit under the next leader, or be
+    // replaced by others at the same indexes. Either way they're no longer
+    // ours to acknowledge: the clients retry, and numbered writes dedup.
+    std::vector<std::function<void(bool, const std::string&)>> orphaned;
+    {
+        std::lock_guard<std::mutex> lock(pending_requests_mutex_);
+        for (auto& [index, request] : pending_requests_) {
+            orphaned.push_back(std::move(request.callback));
+        }
+        pending_requests_.clear();
+    }
+    for (auto& callback : orphaned) {
+        if (callback) {
+            callback(false, "NOT_LEADER");
+        }
+    }
     
-    std::cout << "[INFO] Stepped down to FOLLOWER, term " << current_term_ << std::endl;
+    LOG_INFO(tag_ << "Stepped down to FOLLOWER, term " << current_term_);
 }
 
 void Server::startElection() {
+    if (wal_.failed()) {
+        return;     // Couldn't log our own entries as leader
+    }
+    int cluster_size = static_cast<int>(peers_.size()) + 1;
+    
+    // The vote rounds go out without raft_mutex_, so the term and our log
+    // are checked again once they're back
+    std::unique_lock<std::mutex> lock(raft_mutex_);
+    int last_log_index, last_log_term;
+    wal_.getLastLogInfo(last_log_index, last_log_term);
+    
+    proto::VoteRequest req;
+    req.term = current_term_ + 1;
+    req.candidate_id = server_id_;
+    req.last_log_index = last_log_index;
+    req.last_log_term = last_log_term;
+    
+    // PreVote (Raft thesis 9.6): ask first whether a majority would vote
+    // for us in the next term, changing nobody's term. A node that was cut
+    // off or stalled finds out it can't win instead of deposing a healthy
+    // leader with its higher term.
+    if (config_.pre_vote && !peers_.empty()) {
+        req.pre_vote = true;
+        lock.unlock();
+        int highest_term = 0;
+        int votes = requestVotes(req, highest_term);
+        lock.lock();
+        if (highest_term > current_term_) {
+            stepDown(highest_term);
+        }
+        if (votes <= cluster_size / 2 || role_ != Role::FOLLOWER ||
+            current_term_ + 1 != req.term) {
+            metrics_.prevotes_failed->add();
+            LOG_INFO(tag_ << "Pre-vote for term " << req.term << " failed, got " << votes
+                      << " votes; not standing");
+            return;
+        }
+        req.pre_vote = false;
+        // Whatever was appended meanwhile came from a leader of our term
+        wal_.getLastLogInfo(req.last_log_index, req.last_log_term);
+    }
+    
     role_ = Role::CANDIDATE;
     current_term_++;
+    metrics_.elections->add();
     voted_for_ = server_id_;
+    leader_id_ = -1;
     persistState();
     
     last_heartbeat_ = std::chrono::steady_clock::now();
     
-    std::cout << "[INFO] Starting election for term " << current_term_ << std::endl;
+    LOG_INFO(tag_ << "Starting election for term " << current_term_);
     
-    int votes = 1; // Vote for self
-    std::mutex vote_mutex;
-    std::vector<std::thread> threads;
-    
-    int last_log_index, last_log_term;
-    wal_.getLastLogInfo(last_log_index, last_log_term);
+    req.term = current_term_;
+    int highest_term = 0;
+    int votes = 1;
+    if (!peers_.empty()) {
+        lock.unlock();
+        votes = requestVotes(req, highest_term);
+        lock.lock();
+    }
+    if (highest_term > current_term_) {
+        stepDown(highest_term);
+    }
     
-    for (const auto& peer : peers_) {
-        threads.emplace_back([&, peer]() {
-            std::string ip = peer.substr(0, peer.find(':'));
-            int port = std::stoi(peer.substr(peer.find(':') + 1));
-
-            int sock = socket(AF_INET, SOCK_STREAM, 0);
-            if (sock < 0) return;
-
-            struct timeval timeout;
-            timeout.tv_sec = 1;
-            timeout.tv_usec = 0;
-            setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
-
-            sockaddr_in serv{};
-            serv.sin_family = AF_INET;
-            serv.sin_port = htons(port);
-            inet_pton(AF_INET, ip.c_str(), &serv.sin_addr);
+    // Check if we won. A leader of this term may have reached us meanwhile,
+    // or a newer term deposed us.
+    if (votes > (cluster_size / 2) && role_ == Role::CANDIDATE && current_term_ == req.term) {
+        becomeLeader();
+    } else {
+        role_ = Role::FOLLOWER;
+        LOG_INFO(tag_ << "Election failed, got " << votes << " votes");
+    }
+}
 
-            if (connect(sock, (sockaddr*)&serv, sizeof(serv)) < 0) {
-                close(sock);
-                return;
+int Server::requestVotes(const proto::VoteRequest& req, int& highest_term) {
+    // Runs on the election thread, which owns vote_peers_. Connections stay
+    // open between rounds. Replies come back in order, so one that misses
+    // its round is still owed and gets skipped in the next.
+    std::string msg;
+    if (config_.text_rpc) {
+        std::ostringstream oss;
+        oss << "REQUEST_VOTE " << req.term << " " << req.candidate_id << " "
+            << req.last_log_index << " " << req.last_log_term << " "
+            << (req.pre_vote ? 1 : 0) << "\n";
+        msg = oss.str();
+    } else {
+        proto::encodeVoteRequest(msg, req);
+    }
+    
+    size_t n = peers_.size();
+    vote_peers_.resize(n);
+    enum class State { CONNECTING, WAITING, DONE };
+    std::vector<State> state(n, State::DONE);
+    
+    auto drop = [&](size_t i) {
+        VotePeer& peer = vote_peers_[i];
+        if (peer.sock >= 0) close(peer.sock);
+        peer = VotePeer{};
+        state[i] = State::DONE;
+    };
+    auto sendRequest = [&](size_t i, bool fresh) {
+        VotePeer& peer = vote_peers_[i];
+        std::string out = fresh ? helloMessage() + msg : msg;
+        if (send(peer.sock, out.data(), out.size(), MSG_NOSIGNAL) !=
+            static_cast<ssize_t>(out.size())) {
+            return false;
+        }
+        peer.owed++;
+        state[i] = State::WAITING;
+        return true;
+    };
+    
+    for (size_t i = 0; i < n; i++) {
+        VotePeer& peer = vote_peers_[i];
+        if (peer.sock >= 0) {
+            // A peer that stopped answering altogether gets a fresh connection
+            if (peer.owed < kMaxOwedVotes && sendRequest(i, false)) continue;
+            drop(i);
+        }
+        const std::string& addr = peers_[i];
+        std::string ip = addr.substr(0, addr.find(':'));
+        int port = std::stoi(addr.substr(addr.find(':') + 1));
+        
+        // Non-blocking, so an unreachable peer costs nothing but its slot
+        // in the poll below
+        int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (sock < 0) continue;
+        int one = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        sockaddr_in serv{};
+        serv.sin_family = AF_INET;
+        serv.sin_port = htons(port);
+        inet_pton(AF_INET, ip.c_str(), &serv.sin_addr);
+        peer.sock = sock;
+        if (connect(sock, (sockaddr*)&serv, sizeof(serv)) == 0) {
+            if (!sendRequest(i, true)) drop(i);
+        } else if (errno == EINPROGRESS) {
+            state[i] = State::CONNECTING;
+        } else {
+            drop(i);
+        }
+    }
+    
+    // Give up on a silent peer well before the next election timeout
+    auto deadline = std::chrono::steady_clock::now() + config_.election_timeout_min / 2;
+    int votes = 1;  // Our own
+    int majority = static_cast<int>(n + 1) / 2 + 1;
+    std::vector<pollfd> fds;
+    std::vector<size_t> owner;
+    while (votes < majority) {
+        fds.clear();
+        owner.clear();
+        for (size_t i = 0; i < n; i++) {
+            if (state[i] == State::DONE) continue;
+            short events = state[i] == State::CONNECTING ? POLLOUT : POLLIN;
+            fds.push_back(pollfd{vote_peers_[i].sock, events, 0});
+            owner.push_back(i);
+        }
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now()).count();
+        if (fds.empty() || left <= 0) break;
+        if (poll(fds.data(), fds.size(), static_cast<int>(left)) < 0 && errno != EINTR) break;
+        
+        for (size_t f = 0; f < fds.size(); f++) {
+            size_t i = owner[f];
+            VotePeer& peer = vote_peers_[i];
+            if (fds[f].revents == 0) continue;
+            if (state[i] == State::CONNECTING) {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(peer.sock, SOL_SOCKET, SO_ERROR, &err, &len);
+                if (err != 0 || !sendRequest(i, true)) drop(i);
+                continue;
             }
-
-            std::ostringstream oss;
-            oss << "REQUEST_VOTE " << current_term_ << " " << server_id_ 
-                << " " << last_log_index << " " << last_log_term << "\n";
-            std::string msg = oss.str();
-            write(sock, msg.c_str(), msg.size());
-
-            char buf[128];
-            int n = read(sock, buf, sizeof(buf));
-            if (n > 0) {
-                std::string resp(buf, n);
-                if (resp.find("VOTE_GRANTED") != std::string::npos) {
-                    std::lock_guard<std::mutex> lock(vote_mutex);
-                    votes++;
+            char buf[256];
+            ssize_t got = recv(peer.sock, buf, sizeof(buf), 0);
+            if (got < 0 && (errno == EAGAIN || errno == EINTR)) continue;
+            if (got <= 0) {
+                drop(i);
+                continue;
+            }
+            peer.in.append(buf, static_cast<size_t>(got));
+            
+            // Whole replies (lines or frames); only the last one owed is
+            // this round's
+            bool bad = false;
+            while (state[i] == State::WAITING) {
+                proto::VoteReply reply;
+                if (config_.text_rpc) {
+                    size_t nl = peer.in.find('\n');
+                    if (nl == std::string::npos) break;
+                    std::istringstream iss(peer.in.substr(0, nl));
+                    std::string verdict;
+                    iss >> verdict >> reply.term;
+                    reply.granted = verdict == "VOTE_GRANTED";
+                    peer.in.erase(0, nl + 1);
+                } else {
+                    proto::Frame frame;
+                    size_t consumed;
+                    proto::ParseResult result = proto::parseFrame(peer.in, frame, consumed);
+                    if (result == proto::ParseResult::INCOMPLETE) break;
+                    if (result != proto::ParseResult::FRAME ||
+                        frame.type != proto::MsgType::VOTE_REPLY ||
+                        !proto::decodeVoteReply(frame.payload, reply)) {
+                        bad = true;
+                        break;
+                    }
+                    peer.in.erase(0, consumed);
+                }
+                highest_term = std::max(highest_term, reply.term);
+                if (--peer.owed == 0) {
+                    state[i] = State::DONE;
+                    if (reply.granted) votes++;
                 }
             }
-
-            close(sock);
-        });
-    }
-    
-    for (auto& t : threads) {
-        if (t.joinable()) t.join();
+            if (bad) drop(i);
+        }
     }
     
-    // Check if we won
-    int cluster_size = static_cast<int>(peers_.size()) + 1;
-    if (votes > (cluster_size / 2) && role_ == Role::CANDIDATE) {
-        becomeLeader();
-    } else {
-        role_ = Role::FOLLOWER;
-        std::cout << "[INFO] Election failed, got " << votes << " votes\n";
+    // Still connecting: start over next round. Still waiting: the reply
+    // stays owed.
+    for (size_t i = 0; i < n; i++) {
+        if (state[i] == State::CONNECTING) {
+            drop(i);
+        }
     }
+    return votes;
 }
 
 void Server::becomeLeader() {
     role_ = Role::LEADER;
+    leader_id_ = server_id_;
     
     int last_log_index, last_log_term;
     wal_.getLastLogInfo(last_log_index, last_log_term);
     
-    replicator_ = std::make_unique<Replicator>(peers_, server_id_);
-    replicator_->resetState(last_log_index);
+    // Commit an entry of our own term right away: until one is committed we
+    // can't tell which earlier entries are, so reads wait for this NOOP
+    int noop_index = last_log_index + 1;
+    if (!wal_.appendEntry(LogEntry(noop_index, current_term_, "", "", LogOp::NOOP))) {
+        LOG_ERROR(tag_ << "WAL append failed; not taking leadership");
+        stepDown(current_term_);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(read_mutex_);
+        leader_term_ = current_term_;
+        term_start_index_ = noop_index;
+        lease_expiry_ = Replicator::Clock::time_point();
+        quorum_contact_ = Replicator::Clock::now();  // CheckQuorum's grace period
+    }
+    
+    std::shared_ptr<Replicator> replicator;
+    if (!peers_.empty()) {
+        ReplicationOptions options = config_.replication;
+        options.text_protocol = config_.text_rpc;
+        options.hello = hello_;
+        options.metric_labels = labels_;
+        // The senders' events give up on a full queue once we stop leading
+        // this term: stepDown() joins them, under raft_mutex_ that the
+        // event loop may be waiting for
+        int term = current_term_;
+        auto deposed = [this, term]() {
+            return role_ != Role::LEADER || current_term_ != term;
+        };
+        replicator = std::make_shared<Replicator>(
+            peers_, server_id_, term, wal_, &snapshot_manager_, options,
+            [this, deposed]() {
+                Event e;
+                e.type = EventType::REPL_ACK;
+                event_queue_.push(std::move(e), deposed);
+            },
+            [this, deposed](int reply_term) {
+                Event e;
+                e.type = EventType::APPEND_ENTRIES_RESPONSE;
+                e.term = reply_term;
+                event_queue_.push(std::move(e), deposed);
+            },
+            [this, term](uint64_t round, Replicator::Clock::time_point start) {
+                onLeadershipConfirmed(term, round, start);
+            });
+        replicator->setCommitIndex(commit_index_);
+        // Senders open with an empty AppendEntries to establish leadership,
+        // then ship the NOOP
+        replicator->start(last_log_index);
+        replicator->notifyNewEntries();
+    }
+    std::atomic_store(&replicator_, replicator);
+    
+    if (!replicator) {
+        // Single-node cluster, commit the NOOP immediately. Not through a
+        // REPL_ACK: the event loop may be waiting on raft_mutex_, which we
+        // hold, so a push into its full queue would never return. Without
+        // a replicator every ack is made under raft_mutex_ anyway.
+        onReplicationAck(noop_index);
+    }
     
-    std::cout << "[INFO] *** BECAME LEADER for term " << current_term_ << " ***\n";
+    LOG_INFO(tag_ << "*** BECAME LEADER for term " << current_term_ << " ***");
     
     // Start sending heartbeats
-    startHeartbeatSender();
-    
-    // Send initial empty AppendEntries to establish leadership
-    if (replicator_) {
-        replicator_->sendHeartbeats(current_term_, commit_index_, wal_);
+    if (replicator) {
+        scheduleHeartbeat(current_term_);
     }
 }
 
-void Server::startHeartbeatSender() {
-    heartbeat_thread_ = std::thread([this]() {
-        while (running_ && role_ == Role::LEADER) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(1000));
-            
+void Server::scheduleHeartbeat(int term) {
+    // Re-armed from its own callback for as long as we lead this term, so a
+    // later term's leadership starts a chain of its own. The heartbeats go
+    // out over the replicator's connections.
+    timers_.schedule(config_.heartbeat_interval, [this, term]() {
+        if (!running_ || role_ != Role::LEADER || current_term_ != term) {
+            return;
+        }
+        auto replicator = std::atomic_load(&replicator_);
+        if (replicator) {
+            replicator->sendHeartbeats();
+            scheduleHeartbeat(term);
+        }
+        if (config_.check_quorum) {
             Event e;
-            e.type = EventType::HEARTBEAT_TICK;
-            event_queue_.push(e);
+            e.type = EventType::CHECK_QUORUM;
+            e.term = term;
+            event_queue_.push(std::move(e));
         }
     });
 }
 
+void Server::scheduleExpiry() {
+    // Re-armed from its own callback. Followers only drain the wheel, which
+    // keeps it small and their due set ready should they take over.
+    timers_.schedule(config_.expiry_interval, [this]() {
+        if (!running_) {
+            return;
+        }
+        bool leading = role_ == Role::LEADER && !expire_in_flight_;
+        std::vector<std::string> keys = store_.expiredKeys(leading ? config_.expire_batch : 0);
+        if (leading && !keys.empty()) {
+            Event e;
+            e.type = EventType::CLIENT_PUT;
+            e.op = LogOp::EXPIRE;
+            encodeExpire(e.value, KVStore::nowMillis(), keys);
+            e.client_callback = [this](bool, const std::string&) { expire_in_flight_ = false; };
+            expire_in_flight_ = true;
+            if (!event_queue_.push(std::move(e))) {
+                expire_in_flight_ = false;
+            }
+            LOG_DEBUG(tag_ << "Expiring " << keys.size() << " keys");
+        }
+        scheduleExpiry();
+    });
+}
+
 void Server::startElectionTimer() {
+    // The election itself blocks on vote RPCs, so it runs here rather than
+    // on the timer thread
     election_thread_ = std::thread([this]() {
-        last_heartbeat_ = std::chrono::steady_clock::now();
-        
-        while (running_) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
-            
-            if (role_ == Role::LEADER) {
-                continue; // Leaders don't run election timers
+        std::unique_lock<std::mutex> lock(election_mutex_);
+        while (true) {
+            election_cv_.wait(lock, [this]() { return !running_ || election_due_; });
+            if (!running_) {
+                break;
             }
+            election_due_ = false;
+            lock.unlock();
             
-            auto now = std::chrono::steady_clock::now();
-            auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
-                now - last_heartbeat_
-            ).count();
+            startElection();
+            last_heartbeat_ = std::chrono::steady_clock::now();
+            armElectionTimer();
             
-            int timeout = getElectionTimeout();
-            if (elapsed > timeout) {
-                std::cout << "[WARN] Election timeout! Last heartbeat " 
-                          << elapsed << "ms ago\n";
-                startElection();
-                last_heartbeat_ = std::chrono::steady_clock::now();
-            }
+            lock.lock();
         }
+        for (auto& peer : vote_peers_) {
+            if (peer.sock >= 0) close(peer.sock);
+        }
+        vote_peers_.clear();
     });
+    
+    last_heartbeat_ = std::chrono::steady_clock::now();
+    if (config_.preferred_leader) {
+        // Time out before any other node can, yet not while a leader's
+        // heartbeats keep arriving; later timeouts are drawn as usual
+        std::chrono::milliseconds timeout(
+            (config_.heartbeat_interval + config_.election_timeout_min) / 2);
+        timers_.schedule(timeout, [this, timeout]() { onElectionTimer(timeout); });
+    } else {
+        armElectionTimer();
+    }
 }
 
-void Server::handleRequestVote(int client_fd, const std::string& request) {
-    std::istringstream iss(request);
-    std::string cmd;
-    int term, candidate_id, last_log_index, last_log_term;
+void Server::armElectionTimer() {
+    // One timeout per arming: a heartbeat arriving meanwhile only pushes
+    // the deadline out, it doesn't draw a new one
+    std::chrono::milliseconds timeout(getElectionTimeout());
+    auto wait = last_heartbeat_ + timeout - std::chrono::steady_clock::now();
+    timers_.schedule(wait, [this, timeout]() { onElectionTimer(timeout); });
+}
+
+void Server::onElectionTimer(std::chrono::milliseconds timeout) {
+    if (!running_) {
+        return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    auto deadline = last_heartbeat_ + timeout;
+    if (role_ == Role::LEADER || now < deadline) {
+        // Leaders don't time out, but keep checking in case we step down
+        auto wait = role_ == Role::LEADER ? std::chrono::steady_clock::duration(timeout)
+                                          : deadline - now;
+        timers_.schedule(wait, [this, timeout]() { onElectionTimer(timeout); });
+        return;
+    }
     
-    iss >> cmd >> term >> candidate_id >> last_log_index >> last_log_term;
+    LOG_WARN("Election timeout! Last heartbeat "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(now - last_heartbeat_).count()
+              << "ms ago");
+    std::lock_guard<std::mutex> lock(election_mutex_);
+    election_due_ = true;
+    election_cv_.notify_one();
+}
+
+proto::VoteReply Server::handleRequestVote(const proto::VoteRequest& req) {
+    int term = req.term;
+    int candidate_id = req.candidate_id;
+    int last_log_index = req.last_log_index;
+    int last_log_term = req.last_log_term;
     
     bool vote_granted = false;
+    proto::VoteReply reply;
+    std::lock_guard<std::mutex> lock(raft_mutex_);
+    
+    // While we hear from a leader, nobody needs a new one (thesis 4.2.3):
+    // refuse without taking up the candidate's term, so a node that was
+    // cut off can't depose a healthy leader
+    if (config_.check_quorum && leaderIsAlive()) {
+        LOG_DEBUG(tag_ << "Ignoring " << (req.pre_vote ? "pre-vote" : "vote") << " request from "
+                  << candidate_id << " for term " << term << ": leader is alive");
+        reply.term = current_term_;
+        return reply;
+    }
+    
+    int my_last_log_index, my_last_log_term;
+    wal_.getLastLogInfo(my_last_log_index, my_last_log_term);
+    bool up_to_date = (last_log_term > my_last_log_term) ||
+                      (last_log_term == my_last_log_term && last_log_index >= my_last_log_index);
+    
+    // A pre-vote is only a question: nothing here changes
+    if (req.pre_vote) {
+        reply.granted = term > current_term_ && up_to_date;
+        reply.term = current_term_;
+        return reply;
+    }
     
     // Update term if necessary
     if (term > current_term_) {
         stepDown(term);
     }
     
-    int my_last_log_index, my_last_log_term;
-    wal_.getLastLogInfo(my_last_log_index, my_last_log_term);
-    
     // Grant vote if:
     // 1. Term matches
     // 2. Haven't voted or already voted for this candidate
@@ -366,35 +1008,45 @@ void Server::handleRequestVote(int client_fd, const std::string& request) {
     if (term == current_term_ && 
         (voted_for_ == -1 || voted_for_ == candidate_id)) {
         
-        bool log_ok = (last_log_term > my_last_log_term) ||
-                      (last_log_term == my_last_log_term && 
-                       last_log_index >= my_last_log_index);
-        
-        if (log_ok) {
+        if (up_to_date) {
             voted_for_ = candidate_id;
             persistState();
             vote_granted = true;
             last_heartbeat_ = std::chrono::steady_clock::now();
             
-            std::cout << "[INFO] Granted vote to " << candidate_id 
-                      << " for term " << term << std::endl;
+            LOG_INFO(tag_ << "Granted vote to " << candidate_id 
+                      << " for term " << term);
         }
     }
     
-    std::string response = vote_granted ? "VOTE_GRANTED\n" : "VOTE_DENIED\n";
-    write(client_fd, response.c_str(), response.size());
+    reply.granted = vote_granted;
+    reply.term = current_term_;
+    return reply;
 }
 
-void Server::handleAppendEntries(int client_fd, const std::string& request) {
-    std::istringstream iss(request);
-    std::string cmd;
-    int term, leader_id, prev_log_index, prev_log_term, leader_commit, num_entries;
-    
-    iss >> cmd >> term >> leader_id >> prev_log_index >> prev_log_term 
-        >> leader_commit >> num_entries;
+bool Server::leaderIsAlive() {
+    auto now = std::chrono::steady_clock::now();
+    if (role_ == Role::LEADER) {
+        std::lock_guard<std::mutex> lock(read_mutex_);
+        return now - quorum_contact_ < config_.election_timeout_min;
+    }
+    return leader_id_ >= 0 && now - last_heartbeat_ < config_.election_timeout_min;
+}
+
+proto::AppendEntriesReply Server::handleAppendEntries(const proto::AppendEntriesView& args) {
+    int term = args.term;
+    int prev_log_index = args.prev_log_index;
+    int prev_log_term = args.prev_log_term;
+    int leader_commit = args.leader_commit;
     
     bool success = false;
     int next_index = 1;
+    int conflict_term = 0;
+    int conflict_index = 0;
+    
+    // Held throughout: the log is matched against, truncated and appended
+    // to as one step, which a leader's own appends mustn't interleave with
+    std::lock_guard<std::mutex> lock(raft_mutex_);
     
     // Update term if necessary
     if (term > current_term_) {
@@ -404,18 +1056,27 @@ void Server::handleAppendEntries(int client_fd, const std::string& request) {
     if (term == current_term_) {
         // Reset election timeout - we heard from the leader
         last_heartbeat_ = std::chrono::steady_clock::now();
+        leader_id_ = args.leader_id;
         
         if (role_ != Role::FOLLOWER) {
             role_ = Role::FOLLOWER;
         }
         
-        // Check if our log matches at prev_log_index
+        // Check if our log matches at prev_log_index. Anything below our
+        // snapshot boundary is committed and therefore matches by definition.
         bool log_ok = true;
-        if (prev_log_index > 0) {
-            LogEntry prev_entry;
-            if (wal_.getEntry(prev_log_index, prev_entry)) {
-                if (prev_entry.term != prev_log_term) {
+        if (prev_log_index > 0 && prev_log_index >= wal_.getFirstLogIndex() - 1) {
+            int prev_term;
+            if (wal_.getTerm(prev_log_index, prev_term)) {
+                if (prev_term != prev_log_term) {
                     log_ok = false;
+                    // Name the whole conflicting term, so the leader skips
+                    // it in one round instead of one entry per round
+                    conflict_term = prev_term;
+                    conflict_index = wal_.termStartIndex(prev_log_index);
+                    if (conflict_index == 0) {
+                        conflict_index = prev_log_index;
+                    }
                     // Conflict: delete conflicting entry and all that follow
                     wal_.truncateFrom(prev_log_index);
                 }
@@ -425,30 +1086,51 @@ void Server::handleAppendEntries(int client_fd, const std::string& request) {
         }
         
         if (log_ok) {
-            // Append new entries
-            for (int i = 0; i < num_entries; i++) {
-                LogEntry entry;
-                iss >> entry.index >> entry.term >> entry.operation 
-                    >> entry.key >> entry.value;
-                
-                // Check if we already have this entry
-                LogEntry existing;
-                bool have_it = wal_.getEntry(entry.index, existing);
+            // Append new entries. Only what we actually need is copied out of
+            // the request, and it goes to the WAL with one durability wait.
+            size_t request_bytes = 0;
+            for (const auto& view : args.entries) {
+                request_bytes += view.key.size() + view.value.size();
+            }
+            LogArena arena(request_bytes);
+            std::vector<LogEntry> to_append;
+            for (const auto& view : args.entries) {
+                // Entries already folded into our snapshot are committed
+                if (view.index < wal_.getFirstLogIndex()) {
+                    continue;
+                }
                 
-                if (!have_it) {
-                    wal_.appendEntry(entry);
-                } else if (existing.term != entry.term) {
-                    // Conflict: replace this and all following entries
-                    wal_.truncateFrom(entry.index);
-                    wal_.appendEntry(entry);
+                if (to_append.empty()) {
+                    // Check if we already have this entry
+                    int existing_term;
+                    if (wal_.getTerm(view.index, existing_term)) {
+                        if (existing_term == view.term) {
+                            continue;
+                        }
+                        // Conflict: replace this and all following entries
+                        wal_.truncateFrom(view.index);
+                    }
                 }
+                to_append.push_back(view.toLogEntry(arena));
+            }
+            if (!wal_.appendEntries(to_append)) {
+                // Not durable, so not acknowledged: the leader mustn't count
+                // us toward committing these
+                LOG_ERROR(tag_ << "WAL append failed; refusing AppendEntries");
+                proto::AppendEntriesReply reply;
+                reply.term = current_term_;
+                reply.next_index = prev_log_index + 1;
+                return reply;
             }
             
-            // Update commit index
-            if (leader_commit > commit_index_) {
-                int last_log_index, last_log_term;
-                wal_.getLastLogInfo(last_log_index, last_log_term);
-                commit_index_ = std::min(leader_commit, last_log_index);
+            // Update commit index, no further than this request verified:
+            // batches are capped, so entries of an older term may still sit
+            // past the last one it carried (Raft Figure 2, "index of last
+            // new entry")
+            int last_new_index = prev_log_index + static_cast<int>(args.entries.size());
+            int new_commit = std::min(leader_commit, last_new_index);
+            if (new_commit > commit_index_) {
+                commit_index_ = new_commit;
                 
                 // Apply committed entries
                 advanceCommitIndex();
@@ -458,141 +1140,845 @@ void Server::handleAppendEntries(int client_fd, const std::string& request) {
             int last_log_index, last_log_term;
             wal_.getLastLogInfo(last_log_index, last_log_term);
             next_index = last_log_index + 1;
+        } else if (conflict_term > 0) {
+            next_index = conflict_index;
         } else {
-            // Log doesn't match, tell leader to back up
-            next_index = prev_log_index;
+            // Too short: the leader can resume right after our last entry
+            int last_log_index, last_log_term;
+            wal_.getLastLogInfo(last_log_index, last_log_term);
+            next_index = std::min(prev_log_index, last_log_index + 1);
         }
     }
     
-    std::ostringstream oss;
-    oss << (success ? "SUCCESS" : "FAIL") << " " << current_term_ << " " << next_index << "\n";
-    std::string response = oss.str();
-    write(client_fd, response.c_str(), response.size());
+    proto::AppendEntriesReply reply;
+    reply.success = success;
+    reply.term = current_term_;
+    reply.next_index = next_index;
+    reply.conflict_term = conflict_term;
+    reply.conflict_index = conflict_index;
+    return reply;
 }
 
-void Server::handleClientPut(int client_fd, const std::string& request) {
-    std::istringstream iss(request);
-    std::string cmd, key, value;
-    iss >> cmd >> key >> value;
-    
+void Server::handleClientWrite(const std::shared_ptr<Connection>& conn, uint64_t slot,
+                               LogOp op, std::string_view key, std::string_view value,
+                               const RequestContext& ctx, uint32_t ttl_seconds) {
     if (role_ != Role::LEADER) {
-        write(client_fd, "NOT_LEADER\n", 11);
+        if (!config_.forward_writes || ctx.forwarded ||
+            !forwardWrite(conn, slot, op, key, value, ctx, ttl_seconds)) {
+            respondNotLeader(conn, slot);
+        }
         return;
     }
+    metrics_.writes->add();
+    
+    // The deadline is fixed here and logged, so it doesn't move with
+    // replicas' clocks or with when a node happens to replay the entry
+    std::string expiring;
+    if (op == LogOp::PUT && ttl_seconds > 0) {
+        encodeExpiringPut(expiring, KVStore::nowMillis() + uint64_t(ttl_seconds) * 1000, value);
+        op = LogOp::PUT_TTL;
+        value = expiring;
+    }
     
-    // Create event with callback
+    // Create event with callback; answered in order once committed
     Event e;
     e.type = EventType::CLIENT_PUT;
-    e.key = key;
-    e.value = value;
-    e.client_callback = [client_fd](bool success, const std::string& msg) {
+    e.op = op;
+    e.key = std::string(key);
+    if (ctx.client_id != 0 && ctx.seq != 0) {
+        // A retry of a write we've applied is answered straight away. One
+        // still in flight is logged again, and applying skips the copy.
+        bool applied;
+        {
+            std::lock_guard<std::mutex> lock(sessions_mutex_);
+            applied = sessions_.applied(ctx.client_id, ctx.seq);
+        }
+        if (applied) {
+            metrics_.duplicates->add();
+            respond(conn, slot, proto::Status::OK, "OK");
+            return;
+        }
+        e.op = LogOp::SESSION;
+        encodeSessionWrite(e.value, ctx.client_id, ctx.seq, op, value);
+    } else {
+        e.value = std::string(value);
+    }
+    if (config_.max_memory > 0 && op != LogOp::DELETE && !makeRoom(key.size() + value.size())) {
+        metrics_.rejected_oom->add();
+        respond(conn, slot, proto::Status::ERROR, "OUT_OF_MEMORY");
+        return;
+    }
+    auto received = std::chrono::steady_clock::now();
+    e.client_callback = [this, conn, slot, received](bool success, const std::string& msg) {
         if (success) {
-            write(client_fd, "OK\n", 3);
+            metrics_.put_commit->recordSince(received);
+            respond(conn, slot, proto::Status::OK, "OK");
+        } else if (msg == "NOT_LEADER") {
+            respondNotLeader(conn, slot);
         } else {
-            write(client_fd, msg.c_str(), msg.size());
-            write(client_fd, "\n", 1);
+            respond(conn, slot, proto::Status::ERROR, msg);
         }
-        close(client_fd);
     };
     
-    event_queue_.push(e);
+    if (!event_queue_.push(std::move(e))) {
+        respond(conn, slot, proto::Status::ERROR, "SHUTTING_DOWN");
+    }
 }
 
-void Server::handleClientGet(int client_fd, const std::string& request) {
-    std::istringstream iss(request);
-    std::string cmd, key, value;
-    iss >> cmd >> key;
+bool Server::makeRoom(size_t incoming) {
+    auto over = [&]() -> size_t {
+        size_t used = store_.memory().total;
+        size_t freeing = std::min(used, evicting_bytes_.load());
+        size_t after = used - freeing + incoming;
+        return after > config_.max_memory ? after - config_.max_memory : 0;
+    };
+    if (over() == 0) {
+        return true;
+    }
+    if (config_.memory_policy == MemoryPolicy::REJECT) {
+        return false;
+    }
     
-    if (store_.get(key, value)) {
-        write(client_fd, value.c_str(), value.size());
-        write(client_fd, "\n", 1);
-    } else {
-        write(client_fd, "NOT_FOUND\n", 10);
+    // One evicting thread at a time; whoever waited finds the room made
+    std::lock_guard<std::mutex> lock(evict_mutex_);
+    size_t need = over();
+    if (need == 0) {
+        return true;
+    }
+    auto victims = store_.evictionCandidates(need, config_.memory_policy);
+    if (victims.empty()) {
+        return false;
+    }
+    // Logged ahead of the write, through the same batches as client writes
+    for (auto& [key, bytes] : victims) {
+        Event e;
+        e.type = EventType::CLIENT_PUT;
+        e.op = LogOp::DELETE;
+        e.key = std::move(key);
+        e.client_callback = [this, bytes = bytes](bool, const std::string&) {
+            evicting_bytes_ -= bytes;
+        };
+        evicting_bytes_ += bytes;
+        if (!event_queue_.push(std::move(e))) {
+            evicting_bytes_ -= bytes;
+            return false;
+        }
+    }
+    metrics_.evicted->add(victims.size());
+    LOG_DEBUG(tag_ << "Evicting " << victims.size() << " keys to free " << need << " bytes");
+    return true;
+}
+
+bool Server::forwardWrite(const std::shared_ptr<Connection>& conn, uint64_t slot,
+                          LogOp op, std::string_view key, std::string_view value,
+                          const RequestContext& ctx, uint32_t ttl_seconds) {
+    std::string leader = leaderAddress();
+    if (!forwarder_ || leader.empty() || leader_id_ == server_id_) {
+        return false;
     }
     
-    close(client_fd);
+    // The request as the client would have sent it to the leader, session
+    // and all, so dedup works through the proxy too
+    std::string request;
+    size_t start;
+    switch (op) {
+        case LogOp::PUT:
+            proto::encodePut(request, key, value, ttl_seconds);
+            break;
+        case LogOp::DELETE:
+            proto::encodeDelete(request, key);
+            break;
+        case LogOp::MULTI_PUT:
+            start = proto::beginFrame(request, proto::MsgType::MULTI_PUT);
+            request.append(value.data(), value.size());
+            proto::finishFrame(request, start);
+            break;
+        default:
+            return false;
+    }
+    std::string envelope;
+    proto::encodeSession(envelope, ctx.client_id, ctx.seq, request);
+    
+    metrics_.forwarded->add();
+    forwarder_->forward(leader, std::move(envelope),
+        [this, conn, slot](bool answered, proto::Status status, std::string_view body) {
+            if (answered) {
+                respond(conn, slot, status, body);
+            } else {
+                respondNotLeader(conn, slot);
+            }
+        });
+    return true;
 }
 
-void Server::start() {
-    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_fd < 0) {
-        std::cerr << "[ERROR] socket() failed\n";
-        return;
+void Server::handleClientGet(const std::shared_ptr<Connection>& conn, uint64_t slot,
+                             std::string_view key) {
+    metrics_.gets->add();
+    auto received = std::chrono::steady_clock::now();
+    auto serve = [this, conn, slot, received, key = std::string(key)]() {
+        std::string value;
+        if (store_.get(key, value)) {
+            respond(conn, slot, proto::Status::OK, value);
+        } else {
+            respond(conn, slot, proto::Status::NOT_FOUND, "NOT_FOUND");
+        }
+        metrics_.get->recordSince(received);
+    };
+    serveRead(conn, slot, std::move(serve));
+}
+
+void Server::handleClientMultiGet(const std::shared_ptr<Connection>& conn, uint64_t slot,
+                                  std::vector<std::string> keys) {
+    metrics_.gets->add();
+    auto received = std::chrono::steady_clock::now();
+    auto serve = [this, conn, slot, received, keys = std::move(keys)]() {
+        std::vector<std::optional<std::string>> values;
+        store_.getMany(keys, values);
+        std::string out;
+        if (conn->binary()) {
+            std::string body;
+            proto::encodeMultiGetBody(body, values);
+            proto::encodeResponse(out, proto::Status::OK, body);
+        } else {
+            // Memcached style: a VALUE line per key found, then END
+            for (size_t i = 0; i < keys.size(); i++) {
+                if (values[i]) {
+                    out += "VALUE " + keys[i] + " " + *values[i] + "\n";
+                }
+            }
+            out += "END\n";
+        }
+        conn->respond(slot, std::move(out));
+        metrics_.get->recordSince(received);
+    };
+    serveRead(conn, slot, std::move(serve));
+}
+
+void Server::handleClientScan(const std::shared_ptr<Connection>& conn, uint64_t slot,
+                              std::string start, std::string end, size_t limit) {
+    metrics_.gets->add();
+    if (limit == 0 || limit > kScanMaxLimit) {
+        limit = kScanMaxLimit;
     }
+    auto received = std::chrono::steady_clock::now();
+    auto serve = [this, conn, slot, received, start = std::move(start),
+                  end = std::move(end), limit]() {
+        // One key past the page tells whether there is a next page and
+        // where it starts
+        std::vector<std::pair<std::string, std::string>> pairs;
+        KVStore::Cursor cursor = store_.scan(start, end);
+        std::string key, value;
+        bool more = false;
+        while (cursor.next(key, value)) {
+            if (pairs.size() == limit) {
+                more = true;
+                break;
+            }
+            pairs.emplace_back(std::move(key), std::move(value));
+        }
+        std::string out;
+        if (conn->binary()) {
+            std::string body;
+            proto::encodeScanBody(body, pairs, more, key);
+            proto::encodeResponse(out, proto::Status::OK, body);
+        } else {
+            for (const auto& [k, v] : pairs) {
+                out += "VALUE " + k + " " + v + "\n";
+            }
+            out += more ? "CURSOR " + key + "\n" : std::string("END\n");
+        }
+        conn->respond(slot, std::move(out));
+        metrics_.get->recordSince(received);
+    };
+    serveRead(conn, slot, std::move(serve));
+}
 
-    int opt = 1;
-    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+void Server::serveRead(const std::shared_ptr<Connection>& conn, uint64_t slot,
+                       std::function<void()> serve) {
+    if (config_.read_mode == ReadMode::STALE) {
+        serve();
+        return;
+    }
+    
+    // Once the read index is known and applied, the read itself goes back to
+    // the connection's worker; the event loop and ack readers never touch
+    // the store for a GET
+    ReadIndexCallback on_index = [this, conn, slot, serve](bool ok, int read_index) {
+        if (!ok) {
+            respondNotLeader(conn, slot);
+            return;
+        }
+        waitApplied(read_index, [this, conn, serve]() { reactor_.post(conn, serve); });
+    };
+    
+    if (role_ == Role::LEADER) {
+        confirmReadIndex(std::move(on_index));
+    } else if (config_.follower_reads && !peers_.empty()) {
+        std::lock_guard<std::mutex> lock(forward_mutex_);
+        forward_queue_.push_back(std::move(on_index));
+        forward_cv_.notify_one();
+    } else {
+        respondNotLeader(conn, slot);
+    }
+}
 
-    sockaddr_in addr{};
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = INADDR_ANY;
-    addr.sin_port = htons(port_);
+// ============================================================================
+// LINEARIZABLE READS
+// ============================================================================
 
-    if (bind(server_fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
-        std::cerr << "[ERROR] bind() failed on port " << port_ << std::endl;
-        close(server_fd);
+void Server::confirmReadIndex(ReadIndexCallback done, bool use_lease) {
+    /**
+     * READ INDEX (Raft thesis 6.4)
+     *
+     * 1. read_index = commit index, but never below our term's NOOP: until
+     *    that commits we don't know what earlier entries are committed
+     * 2. Confirm we're still leader: start a heartbeat round and wait for a
+     *    majority to answer it in our term. Reads that arrive while a round
+     *    is out share the next one, so a burst of reads costs one round.
+     * 3. The caller serves the read once last_applied_ >= read_index
+     *
+     * LEASE mode skips step 2 while a round confirmed within lease_ms holds
+     * the lease: no one else can have been elected since, assuming bounded
+     * clock drift and a lease shorter than the election timeout. Forwarded
+     * follower reads don't use it: the round's heartbeat is also what
+     * carries the read index's commit to the follower.
+     */
+    std::unique_lock<std::mutex> lock(read_mutex_);
+    if (role_ != Role::LEADER || leader_term_ != current_term_) {
+        lock.unlock();
+        done(false, 0);
         return;
     }
+    
+    int read_index = std::max(commit_index_.load(), term_start_index_);
+    auto replicator = std::atomic_load(&replicator_);
+    bool leased = use_lease && config_.read_mode == ReadMode::LEASE &&
+                  Replicator::Clock::now() < lease_expiry_;
+    if (!replicator || leased) {
+        lock.unlock();
+        done(true, read_index);
+        return;
+    }
+    
+    // Registered before the round can possibly complete (the confirmation
+    // callback needs read_mutex_)
+    uint64_t round = replicator->requestRound();
+    pending_confirms_.push_back({leader_term_, round, read_index, std::move(done)});
+}
+
+void Server::onLeadershipConfirmed(int term, uint64_t round,
+                                   Replicator::Clock::time_point start) {
+    // Runs on a replicator ack-reader thread
+    std::vector<PendingConfirm> ready;
+    {
+        std::lock_guard<std::mutex> lock(read_mutex_);
+        if (term != leader_term_) {
+            return;  // A replicator from an earlier term of ours
+        }
+        lease_expiry_ = std::max(lease_expiry_,
+                                 start + std::chrono::milliseconds(config_.lease_ms));
+        quorum_contact_ = std::max(quorum_contact_, start);
+        
+        auto keep = std::partition(pending_confirms_.begin(), pending_confirms_.end(),
+                                   [&](const PendingConfirm& p) { return p.round > round; });
+        std::move(keep, pending_confirms_.end(), std::back_inserter(ready));
+        pending_confirms_.erase(keep, pending_confirms_.end());
+    }
+    for (auto& pending : ready) {
+        pending.done(true, pending.read_index);
+    }
+}
 
-    listen(server_fd, 10);
+void Server::failPendingReads() {
+    std::vector<PendingConfirm> failed;
+    {
+        std::lock_guard<std::mutex> lock(read_mutex_);
+        leader_term_ = 0;
+        lease_expiry_ = Replicator::Clock::time_point();
+        failed.swap(pending_confirms_);
+    }
+    for (auto& pending : failed) {
+        pending.done(false, 0);
+    }
+}
 
-    std::cout << "[INFO] LogKV server running on port " << port_ << std::endl;
+void Server::waitApplied(int index, std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(read_mutex_);
+        if (last_applied_ < index) {
+            // The apply thread publishes last_applied_ before taking
+            // read_mutex_, so this can't miss the wakeup
+            apply_waiters_.emplace(index, std::move(task));
+            return;
+        }
+    }
+    task();
+}
+
+void Server::startReadForwarder() {
+    read_forwarder_thread_ = std::thread([this]() {
+        // One connection per peer, opened on demand; leader_hint is the peer
+        // that last answered as leader
+        std::vector<int> socks(peers_.size(), -1);
+        size_t leader_hint = 0;
+        
+        while (running_) {
+            std::vector<ReadIndexCallback> batch;
+            {
+                std::unique_lock<std::mutex> lock(forward_mutex_);
+                forward_cv_.wait(lock, [this]() {
+                    return !running_ || !forward_queue_.empty();
+                });
+                batch.swap(forward_queue_);
+            }
+            if (batch.empty()) {
+                continue;
+            }
+            
+            // Every GET queued before the request went out shares its answer
+            int read_index = 0;
+            bool ok = running_ && fetchReadIndex(socks, leader_hint, read_index);
+            for (auto& done : batch) {
+                done(ok, read_index);
+            }
+        }
+        
+        for (int sock : socks) {
+            if (sock >= 0) close(sock);
+        }
+    });
+}
+
+bool Server::fetchReadIndex(std::vector<int>& socks, size_t& leader_hint, int& read_index) {
+    std::string msg;
+    if (config_.text_rpc) {
+        msg = "READ_INDEX\n";
+    } else {
+        proto::encodeReadIndex(msg);
+    }
     
-    // Start subsystems
+    // Try the last known leader first, then everyone else
+    for (size_t attempt = 0; attempt < peers_.size(); attempt++) {
+        size_t i = (leader_hint + attempt) % peers_.size();
+        int& sock = socks[i];
+        
+        if (sock < 0) {
+            const std::string& peer = peers_[i];
+            std::string ip = peer.substr(0, peer.find(':'));
+            int port = std::stoi(peer.substr(peer.find(':') + 1));
+            
+            sock = socket(AF_INET, SOCK_STREAM, 0);
+            if (sock < 0) continue;
+            
+            // A new leader may need a full heartbeat round (or a NOOP
+            // commit) before it answers
+            struct timeval timeout;
+            timeout.tv_sec = 2;
+            timeout.tv_usec = 0;
+            setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            
+            sockaddr_in serv{};
+            serv.sin_family = AF_INET;
+            serv.sin_port = htons(port);
+            inet_pton(AF_INET, ip.c_str(), &serv.sin_addr);
+            
+            std::string hello = helloMessage();
+            if (connect(sock, (sockaddr*)&serv, sizeof(serv)) < 0 ||
+                send(sock, hello.data(), hello.size(), MSG_NOSIGNAL) !=
+                    static_cast<ssize_t>(hello.size())) {
+                close(sock);
+                sock = -1;
+                continue;
+            }
+        }
+        
+        bool answered = false;
+        bool ok = false;
+        if (send(sock, msg.data(), msg.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(msg.size())) {
+            std::string resp;
+            char buf[128];
+            while (!answered) {
+                ssize_t n = read(sock, buf, sizeof(buf));
+                if (n <= 0) break;
+                resp.append(buf, static_cast<size_t>(n));
+                
+                if (config_.text_rpc) {
+                    size_t nl = resp.find('\n');
+                    if (nl == std::string::npos) continue;
+                    std::istringstream iss(resp.substr(0, nl));
+                    std::string result;
+                    iss >> result >> read_index;
+                    ok = result == "READ_INDEX_OK" && !iss.fail();
+                    answered = true;
+                    break;
+                }
+                proto::Frame frame;
+                size_t consumed;
+                proto::ParseResult result = proto::parseFrame(resp, frame, consumed);
+                if (result == proto::ParseResult::INCOMPLETE) continue;
+                proto::ReadIndexReply reply;
+                answered = result == proto::ParseResult::FRAME &&
+                           frame.type == proto::MsgType::READ_INDEX_REPLY &&
+                           proto::decodeReadIndexReply(frame.payload, reply);
+                ok = answered && reply.ok;
+                read_index = reply.read_index;
+                break;
+            }
+        }
+        
+        if (!answered) {
+            // Timed out or broken: a late reply would desync the stream
+            close(sock);
+            sock = -1;
+            continue;
+        }
+        if (ok) {
+            leader_hint = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+void Server::respond(const std::shared_ptr<Connection>& conn, uint64_t slot,
+                     proto::Status status, std::string_view body) {
+    std::string out;
+    if (conn->binary()) {
+        proto::encodeResponse(out, status, body);
+    } else {
+        // Text replies are the body itself (OK, the value, NOT_FOUND, ...)
+        out.reserve(body.size() + 1);
+        out.append(body.data(), body.size());
+        out.push_back('\n');
+    }
+    conn->respond(slot, std::move(out));
+}
+
+void Server::respondNotLeader(const std::shared_ptr<Connection>& conn, uint64_t slot) {
+    std::string leader = leader_id_ == server_id_ ? std::string() : leaderAddress();
+    respond(conn, slot, proto::Status::NOT_LEADER,
+            leader.empty() ? std::string("NOT_LEADER") : "NOT_LEADER " + leader);
+}
+
+std::string Server::leaderAddress() const {
+    int leader = leader_id_;
+    if (leader < 0) {
+        return {};
+    }
+    if (leader == server_id_) {
+        return hello_.addr;
+    }
+    return address_of_ ? address_of_(leader) : std::string();
+}
+
+void Server::setPeerDirectory(std::function<std::string(int)> address_of, Forwarder* forwarder) {
+    address_of_ = std::move(address_of);
+    forwarder_ = forwarder;
+}
+
+void Server::refreshMetrics() {
+    auto& registry = metrics::registry();
+    auto gauge = [&](const char* name, const char* help, int64_t value) {
+        registry.gauge(name, help, labels_).set(value);
+    };
+    EventQueueStats queue = event_queue_.stats();
+    gauge("logkv_term", "Current Raft term", current_term_);
+    gauge("logkv_role", "0 = follower, 1 = candidate, 2 = leader",
+          role_ == Role::LEADER ? 2 : role_ == Role::CANDIDATE ? 1 : 0);
+    gauge("logkv_commit_index", "Highest log index known to be committed", commit_index_);
+    gauge("logkv_last_applied", "Highest log index applied to the store", last_applied_);
+    StoreMemory memory = store_.memory();
+    gauge("logkv_store_keys", "Keys in the store", static_cast<int64_t>(memory.keys));
+    gauge("logkv_store_memory_bytes", "Estimated heap use of the store, keys, values and overhead",
+          static_cast<int64_t>(memory.total));
+    gauge("logkv_store_key_bytes", "Bytes of keys in the store", static_cast<int64_t>(memory.key_bytes));
+    gauge("logkv_store_value_bytes", "Bytes of values in the store, as written",
+          static_cast<int64_t>(memory.value_bytes));
+    gauge("logkv_store_stored_value_bytes", "Bytes of values in the store, as held after compression",
+          static_cast<int64_t>(memory.stored_value_bytes));
+    gauge("logkv_store_compressed_values", "Values held LZ4-compressed",
+          static_cast<int64_t>(memory.compressed_values));
+    gauge("logkv_store_memory_budget_bytes", "Memory budget for the store; 0 = none",
+          static_cast<int64_t>(config_.max_memory));
+    {
+        std::lock_guard<std::mutex> lock(sessions_mutex_);
+        gauge("logkv_client_sessions", "Clients whose write numbers are tracked for dedup",
+              static_cast<int64_t>(sessions_.size()));
+    }
+    gauge("logkv_event_queue_pushed", "Events accepted by the event queue",
+          static_cast<int64_t>(queue.pushed));
+    gauge("logkv_event_queue_full_waits", "Event queue pushes that found the ring full",
+          static_cast<int64_t>(queue.producer_full_waits));
+}
+
+std::string Server::helloMessage() const {
+    if (config_.text_rpc) {
+        return proto::formatPeerHelloText(hello_);
+    }
+    std::string out;
+    proto::encodePeerHello(out, hello_);
+    return out;
+}
+
+void Server::start() {
+    startApplier();
     startEventLoop();
     
     if (role_ == Role::LEADER) {
+        std::lock_guard<std::mutex> lock(raft_mutex_);
         becomeLeader();
-    } else {
-        startElectionTimer();
     }
+    startElectionTimer();
+    scheduleExpiry();
+    if (!peers_.empty()) {
+        startReadForwarder();
+    }
+}
 
-    // Accept client connections
-    while (running_) {
-        int client = accept(server_fd, nullptr, nullptr);
-        if (client < 0) continue;
-        std::thread(&Server::handleClient, this, client).detach();
+void Server::handleRequest(const std::shared_ptr<Connection>& conn, std::string_view request) {
+    if (!conn->binary()) {
+        handleTextRequest(conn, conn->reserve(), request);
+        return;
     }
-    
-    close(server_fd);
+    // A SESSION envelope gets an unordered slot, answered as soon as the
+    // request inside it is
+    proto::Frame frame;
+    size_t consumed;
+    uint64_t client_id, seq;
+    std::string_view inner;
+    if (proto::parseFrame(request, frame, consumed) == proto::ParseResult::FRAME &&
+        frame.type == proto::MsgType::SESSION) {
+        if (!proto::decodeSession(frame.payload, client_id, seq, inner)) {
+            respond(conn, conn->reserve(), proto::Status::ERROR, "BAD_REQUEST");
+            return;
+        }
+        handleBinaryRequest(conn, conn->reserveUnordered(seq), inner, RequestContext{client_id, seq});
+        return;
+    }
+    handleBinaryRequest(conn, conn->reserve(), request);
 }
 
-void Server::handleClient(int client_fd) {
-    char buffer[4096];
-    int n = read(client_fd, buffer, sizeof(buffer));
-    if (n <= 0) {
-        close(client_fd);
+void Server::handleBinaryRequest(const std::shared_ptr<Connection>& conn, uint64_t slot,
+                                 std::string_view request, const RequestContext& ctx) {
+    proto::Frame frame;
+    size_t consumed;
+    if (proto::parseFrame(request, frame, consumed) != proto::ParseResult::FRAME) {
+        respond(conn, slot, proto::Status::ERROR, "BAD_FRAME");
         return;
     }
+    
+    proto::Decoder d(frame.payload);
+    std::string out;
+    switch (frame.type) {
+        case proto::MsgType::APPEND_ENTRIES: {
+            proto::AppendEntriesView args;
+            if (!proto::decodeAppendEntries(frame.payload, args)) break;
+            proto::encodeAppendEntriesReply(out, handleAppendEntries(args));
+            conn->respond(slot, std::move(out));
+            return;
+        }
+        case proto::MsgType::INSTALL_SNAPSHOT: {
+            proto::InstallSnapshotView args;
+            if (!proto::decodeInstallSnapshot(frame.payload, args)) break;
+            proto::encodeInstallSnapshotReply(out, handleInstallSnapshot(args));
+            conn->respond(slot, std::move(out));
+            return;
+        }
+        case proto::MsgType::REQUEST_VOTE: {
+            proto::VoteRequest req;
+            if (!proto::decodeVoteRequest(frame.payload, req)) break;
+            proto::encodeVoteReply(out, handleRequestVote(req));
+            conn->respond(slot, std::move(out));
+            return;
+        }
+        case proto::MsgType::PUT: {
+            std::string_view key, value;
+            uint32_t ttl_seconds = 0;
+            if (!d.bytes(key) || !d.bytes(value) || (!d.done() && !d.u32(ttl_seconds))) break;
+            handleClientWrite(conn, slot, LogOp::PUT, key, value, ctx, ttl_seconds);
+            return;
+        }
+        case proto::MsgType::DELETE: {
+            std::string_view key;
+            if (!d.bytes(key)) break;
+            handleClientWrite(conn, slot, LogOp::DELETE, key, {}, ctx);
+            return;
+        }
+        case proto::MsgType::MULTI_PUT: {
+            // The payload already is the log entry's encoding
+            KeyValueViews pairs;
+            if (!decodeMultiPut(frame.payload, pairs) || pairs.empty()) break;
+            handleClientWrite(conn, slot, LogOp::MULTI_PUT, {}, frame.payload, ctx);
+            return;
+        }
+        case proto::MsgType::MULTI_GET: {
+            std::vector<std::string> keys;
+            if (!proto::decodeMultiGet(frame.payload, keys) || keys.empty()) break;
+            handleClientMultiGet(conn, slot, std::move(keys));
+            return;
+        }
+        case proto::MsgType::SCAN: {
+            std::string_view start, end;
+            uint32_t limit;
+            if (!proto::decodeScan(frame.payload, start, end, limit)) break;
+            handleClientScan(conn, slot, std::string(start), std::string(end), limit);
+            return;
+        }
+        case proto::MsgType::GET: {
+            std::string_view key;
+            if (!d.bytes(key)) break;
+            handleClientGet(conn, slot, key);
+            return;
+        }
+        case proto::MsgType::SESSION: {
+            // A Forwarder's tag around the client's own envelope (forwarder.h)
+            uint64_t client_id, seq;
+            std::string_view inner;
+            if (ctx.client_id != 0 || ctx.forwarded ||
+                !proto::decodeSession(frame.payload, client_id, seq, inner)) break;
+            handleBinaryRequest(conn, slot, inner, RequestContext{client_id, seq, true});
+            return;
+        }
+        case proto::MsgType::READ_INDEX: {
+            int term = current_term_;
+            confirmReadIndex([conn, slot, term](bool ok, int read_index) {
+                proto::ReadIndexReply reply;
+                reply.ok = ok;
+                reply.term = term;
+                reply.read_index = read_index;
+                std::string out;
+                proto::encodeReadIndexReply(out, reply);
+                conn->respond(slot, std::move(out));
+            }, false);
+            return;
+        }
+        default:
+            respond(conn, slot, proto::Status::ERROR, "UNKNOWN_CMD");
+            return;
+    }
+    respond(conn, slot, proto::Status::ERROR, "BAD_REQUEST");
+}
 
-    std::string req(buffer, n);
-    std::istringstream iss(req);
+void Server::handleTextRequest(const std::shared_ptr<Connection>& conn, uint64_t slot,
+                               std::string_view request, const RequestContext& ctx) {
+    std::string line(request);
+    std::istringstream iss(line);
     std::string cmd;
     iss >> cmd;
-
-    if (cmd == "REQUEST_VOTE") {
-        handleRequestVote(client_fd, req);
-        close(client_fd);
+    
+    if (cmd == "SESSION" && ctx.client_id == 0) {
+        // SESSION <client_id> <seq> <command>: write deduplication only,
+        // text replies stay in request order
+        uint64_t session_client = 0, session_seq = 0;
+        std::string rest;
+        if (!(iss >> session_client >> session_seq) || !std::getline(iss, rest)) {
+            conn->respond(slot, "BAD_REQUEST\n");
+            return;
+        }
+        handleTextRequest(conn, slot, rest, RequestContext{session_client, session_seq});
     }
     else if (cmd == "APPEND_ENTRIES") {
-        handleAppendEntries(client_fd, req);
-        close(client_fd);
+        proto::AppendEntriesView args;
+        if (!proto::parseAppendEntriesText(request, args)) {
+            conn->respond(slot, "BAD_REQUEST\n");
+            return;
+        }
+        proto::AppendEntriesReply reply = handleAppendEntries(args);
+        std::ostringstream oss;
+        oss << (reply.success ? "SUCCESS" : "FAIL") << " " << reply.term << " "
+            << reply.next_index << " " << reply.conflict_term << " "
+            << reply.conflict_index << "\n";
+        conn->respond(slot, oss.str());
+    }
+    else if (cmd == "REQUEST_VOTE") {
+        proto::VoteRequest req;
+        int pre_vote = 0;
+        iss >> req.term >> req.candidate_id >> req.last_log_index >> req.last_log_term >> pre_vote;
+        req.pre_vote = pre_vote != 0;
+        proto::VoteReply reply = handleRequestVote(req);
+        conn->respond(slot, std::string(reply.granted ? "VOTE_GRANTED " : "VOTE_DENIED ") +
+                            std::to_string(reply.term) + "\n");
     }
     else if (cmd == "PUT") {
-        handleClientPut(client_fd, req);
-        // Don't close - callback will close
+        // PUT key value [EX seconds]
+        std::string key, value, option;
+        iss >> key >> value;
+        uint64_t ttl_seconds = 0;
+        if (iss >> option && (option != "EX" || !(iss >> ttl_seconds) || ttl_seconds == 0 ||
+                              ttl_seconds > std::numeric_limits<uint32_t>::max())) {
+            conn->respond(slot, "BAD_REQUEST\n");
+            return;
+        }
+        handleClientWrite(conn, slot, LogOp::PUT, key, value, ctx,
+                          static_cast<uint32_t>(ttl_seconds));
+    }
+    else if (cmd == "DELETE") {
+        std::string key;
+        iss >> key;
+        handleClientWrite(conn, slot, LogOp::DELETE, key, {}, ctx);
+    }
+    else if (cmd == "MPUT") {
+        // MPUT k1 v1 k2 v2 ...: all pairs commit as one entry
+        std::vector<std::string> tokens{std::istream_iterator<std::string>(iss),
+                                        std::istream_iterator<std::string>()};
+        if (tokens.empty() || tokens.size() % 2 != 0) {
+            conn->respond(slot, "BAD_REQUEST\n");
+            return;
+        }
+        KeyValueViews pairs;
+        for (size_t i = 0; i < tokens.size(); i += 2) {
+            pairs.emplace_back(tokens[i], tokens[i + 1]);
+        }
+        std::string payload;
+        encodeMultiPut(payload, pairs);
+        handleClientWrite(conn, slot, LogOp::MULTI_PUT, {}, payload, ctx);
+    }
+    else if (cmd == "MGET") {
+        std::vector<std::string> keys{std::istream_iterator<std::string>(iss),
+                                      std::istream_iterator<std::string>()};
+        if (keys.empty()) {
+            conn->respond(slot, "BAD_REQUEST\n");
+            return;
+        }
+        handleClientMultiGet(conn, slot, std::move(keys));
+    }
+    else if (cmd == "SCAN" || cmd == "PSCAN") {
+        // SCAN start end [limit], with "-" for an open end; PSCAN prefix [limit].
+        // A page that doesn't reach the end finishes with "CURSOR <key>":
+        // scan again from that key for the next one.
+        std::string start, end;
+        if (!(iss >> start) || (cmd == "SCAN" && !(iss >> end))) {
+            conn->respond(slot, "BAD_REQUEST\n");
+            return;
+        }
+        if (cmd == "PSCAN") {
+            end = KVStore::prefixEnd(start);
+        } else {
+            if (start == "-") start.clear();
+            if (end == "-") end.clear();
+        }
+        size_t limit = kScanDefaultLimit;
+        if (!(iss >> limit)) {
+            limit = kScanDefaultLimit;
+        }
+        handleClientScan(conn, slot, std::move(start), std::move(end), limit);
     }
     else if (cmd == "GET") {
-        handleClientGet(client_fd, req);
-        // Already closed in handler
+        std::string key;
+        iss >> key;
+        handleClientGet(conn, slot, key);
+    }
+    else if (cmd == "READ_INDEX") {
+        confirmReadIndex([conn, slot](bool ok, int read_index) {
+            conn->respond(slot, ok ? "READ_INDEX_OK " + std::to_string(read_index) + "\n"
+                                   : std::string("NOT_LEADER\n"));
+        }, false);
     }
-    else if (cmd == "INSTALL_SNAPSHOT") {
-        handleInstallSnapshot(client_fd, req);
-        close(client_fd);
+    else if (cmd.empty()) {
+        conn->respond(slot, "");
     }
     else {
-        write(client_fd, "UNKNOWN_CMD\n", 12);
-        close(client_fd);
+        conn->respond(slot, "UNKNOWN_CMD\n");
     }
 }
 
@@ -601,37 +1987,50 @@ void Server::handleClient(int client_fd) {
 // ============================================================================
 
 bool Server::loadSnapshot() {
-    std::unordered_map<std::string, std::string> data;
     SnapshotMetadata metadata;
     
-    if (!snapshot_manager_.loadSnapshot(data, metadata)) {
+    // Decoded straight into the store
+    auto start = std::chrono::steady_clock::now();
+    std::string sessions;
+    if (!snapshot_manager_.loadSnapshot(store_, metadata, &sessions)) {
+        store_.clear();  // Don't keep half of a corrupt snapshot
         return false;
     }
-    
-    // Apply snapshot data to store
-    for (const auto& [key, value] : data) {
-        store_.put(key, value);
+    {
+        std::lock_guard<std::mutex> lock(sessions_mutex_);
+        if (!sessions_.decode(sessions) && !sessions.empty()) {
+            LOG_WARN(tag_ << "Snapshot's client session table is malformed; starting without it");
+        }
     }
+    metrics_.snapshot_install->recordSince(start);
     
     // Update state to reflect snapshot
     last_applied_ = metadata.last_included_index;
     commit_index_ = metadata.last_included_index;
     
-    // Tell WAL to install the snapshot
-    // This clears the log and sets up for entries after the snapshot
-    wal_.installSnapshot(metadata.last_included_index, metadata.last_included_term);
+    // The log normally continues after the snapshot and is replayed from
+    // there. If we stopped before compacting, finish that; if the whole log
+    // is older than the snapshot, start it over after it.
+    int last_log_index, last_log_term;
+    wal_.getLastLogInfo(last_log_index, last_log_term);
+    if (metadata.last_included_index > last_log_index) {
+        wal_.installSnapshot(metadata.last_included_index, metadata.last_included_term);
+    } else if (metadata.last_included_index >= wal_.getFirstLogIndex()) {
+        wal_.discardEntriesBefore(metadata.last_included_index);
+    }
     
-    std::cout << "[SUCCESS] Restored from snapshot: " << data.size() 
-              << " entries, up to index " << metadata.last_included_index << std::endl;
+    LOG_INFO("Restored from snapshot: " << metadata.data_size 
+              << " entries, up to index " << metadata.last_included_index);
     
     return true;
 }
 
 void Server::createSnapshotIfNeeded() {
-    // Check if we've applied enough entries since last snapshot
-    if (entries_since_snapshot_ >= snapshot_threshold_) {
-        std::cout << "[INFO] Snapshot threshold reached (" 
-                  << entries_since_snapshot_ << " entries), creating snapshot..." << std::endl;
+    // Check if we've applied enough entries since last snapshot. If the
+    // previous one is still being written, try again on a later apply.
+    if (entries_since_snapshot_ >= snapshot_threshold_ && !snapshot_in_progress_) {
+        LOG_INFO("Snapshot threshold reached (" 
+                  << entries_since_snapshot_ << " entries), creating snapshot...");
         createSnapshot();
         entries_since_snapshot_ = 0;
     }
@@ -641,215 +2040,205 @@ void Server::createSnapshot() {
     /**
      * SNAPSHOT CREATION PROCESS:
      * 
-     * 1. Get current state (can't be done while applying entries)
-     * 2. Determine what log index this snapshot covers (last_applied_)
-     * 3. Write snapshot to disk atomically
-     * 4. Compact the log (discard old entries)
+     * 1. On the apply path: freeze the store (KVStore::snapshot(), one lock
+     *    per shard, no copying) and record the index and term it covers
+     * 2. On snapshot_thread_: stream the frozen view to disk atomically
+     * 3. Compact the log (discard entries the snapshot covers)
      * 
      * SAFETY CONSIDERATIONS:
-     * - Only snapshot committed entries (never uncommitted)
-     * - Snapshot creation is async - server continues operating
+     * - Only snapshot applied entries, which are committed
+     * - Applies keep going while the file is written; writes made meanwhile
+     *   land in the store's delta and aren't part of this snapshot
      * - If snapshot fails, we still have the WAL
      * - Log compaction only happens after successful snapshot
      */
     
-    std::cout << "[INFO] Creating snapshot at index " << last_applied_ << std::endl;
-    
-    // Get a copy of the current state
-    // In production, we'd use a read lock or copy-on-write structure
-    std::unordered_map<std::string, std::string> snapshot_data;
-    
-    // Copy all keys from store
-    auto keys = store_.getAllKeys();
-    for (const auto& key : keys) {
-        std::string value;
-        if (store_.get(key, value)) {
-            snapshot_data[key] = value;
-        }
+    std::unique_ptr<KVStore::Snapshot> view = store_.snapshot();
+    if (!view) {
+        return;  // The previous view is still being written
     }
-    
-    // Get the term of the last applied entry
-    int last_term = current_term_;
-    LogEntry last_entry;
-    if (wal_.getEntry(last_applied_, last_entry)) {
-        last_term = last_entry.term;
+    int snapshot_index = last_applied_;
+    int snapshot_term = current_term_;
+    wal_.getTerm(snapshot_index, snapshot_term);
+    std::string sessions;
+    {
+        std::lock_guard<std::mutex> lock(sessions_mutex_);
+        sessions = sessions_.encode();
     }
     
-    // Create the snapshot (atomic write to disk)
-    bool success = snapshot_manager_.createSnapshot(
-        snapshot_data, 
-        last_applied_, 
-        last_term
-    );
+    LOG_INFO("Creating snapshot at index " << snapshot_index);
     
-    if (success) {
-        // Compact the log - discard entries up to last_applied_
-        // This frees disk space and speeds up future recoveries
-        wal_.discardEntriesBefore(last_applied_);
-        
-        std::cout << "[SUCCESS] Snapshot created and log compacted at index " 
-                  << last_applied_ << std::endl;
-    } else {
-        std::cerr << "[ERROR] Failed to create snapshot" << std::endl;
+    snapshot_in_progress_ = true;
+    if (snapshot_thread_.joinable()) {
+        snapshot_thread_.join();  // Done, or at most finishing its log compaction
     }
+    snapshot_thread_ = std::thread(
+        [this, snapshot_index, snapshot_term, view = std::move(view),
+         sessions = std::move(sessions)]() mutable {
+            auto start = std::chrono::steady_clock::now();
+            bool success = snapshot_manager_.createSnapshot(*view, snapshot_index, snapshot_term,
+                                                            sessions);
+            view.reset();  // Fold the writes made meanwhile back into the store
+            
+            if (success) {
+                // Compact the log - discard entries the snapshot covers
+                // This frees disk space and speeds up future recoveries
+                wal_.discardEntriesBefore(snapshot_index);
+                
+                metrics_.snapshot_create->recordSince(start);
+                LOG_INFO("Snapshot created and log compacted at index " 
+                          << snapshot_index);
+            } else {
+                LOG_ERROR("Failed to create snapshot");
+            }
+            snapshot_in_progress_ = false;
+        });
 }
 
-void Server::handleInstallSnapshot(int client_fd, const std::string& request) {
+proto::InstallSnapshotReply Server::handleInstallSnapshot(const proto::InstallSnapshotView& args) {
     /**
      * INSTALL_SNAPSHOT RPC (Follower Side)
      * 
-     * Called when leader sends us a snapshot because we're too far behind.
-     * 
-     * WHEN THIS HAPPENS:
-     * - Follower needs entry at index 100
-     * - Leader's first log entry is index 500 (already compacted)
-     * - Leader sends snapshot instead of log entries
+     * Called when the leader sends us its snapshot because we're too far
+     * behind: the entries we need were compacted away on its side.
      * 
-     * FORMAT:
-     * INSTALL_SNAPSHOT <term> <leader_id> <last_index> <last_term> <data_size> <data...>
-     * 
-     * RESPONSE:
-     * SUCCESS <current_term>
+     * The file arrives in chunks, in order, straight into the snapshot
+     * directory. Every reply names the offset we want next, so after a
+     * dropped connection the leader resumes where we are instead of
+     * starting over. Once the last chunk is in, install_thread_ loads it
+     * into a fresh store and swaps that in, so a reactor worker never sits
+     * through a load. Until it's done the last chunk is answered with
+     * success = false at the end offset; the leader asks again with an
+     * empty one and hears success once the snapshot is installed.
      */
-    
-    std::istringstream iss(request);
-    std::string cmd;
-    int term, leader_id, last_included_index, last_included_term;
-    size_t data_size;
-    
-    iss >> cmd >> term >> leader_id >> last_included_index 
-        >> last_included_term >> data_size;
-    
-    std::cout << "[INFO] Receiving InstallSnapshot from leader " << leader_id
-              << ": index=" << last_included_index << ", term=" << last_included_term
-              << ", size=" << data_size << " bytes" << std::endl;
-    
-    // Update term if necessary
-    if (term > current_term_) {
-        stepDown(term);
-    }
-    
-    if (term < current_term_) {
-        // Reject stale snapshot
-        std::ostringstream oss;
-        oss << "REJECT " << current_term_ << "\n";
-        write(client_fd, oss.str().c_str(), oss.str().size());
-        return;
-    }
-    
-    // Reset election timeout - we heard from leader
-    last_heartbeat_ = std::chrono::steady_clock::now();
-    
-    // Read snapshot data
-    std::vector<char> snapshot_data(data_size);
-    // In a real implementation, we'd read this from the socket
-    // For now, we'll implement the chunked transfer in replicator
-    
-    // For this simplified version, we'll trigger a snapshot load
-    // In production, this would involve chunked transfer
-    
-    std::unordered_map<std::string, std::string> data;
-    SnapshotMetadata metadata;
-    
-    if (snapshot_manager_.loadSnapshot(data, metadata)) {
-        // Clear current state
-        store_.clear();
+    proto::InstallSnapshotReply reply;
+    {
+        std::lock_guard<std::mutex> raft_lock(raft_mutex_);
         
-        // Apply snapshot
-        for (const auto& [key, value] : data) {
-            store_.put(key, value);
+        // Update term if necessary
+        if (args.term > current_term_) {
+            stepDown(args.term);
         }
+        reply.term = current_term_;
         
-        // Update state
-        last_applied_ = metadata.last_included_index;
-        commit_index_ = metadata.last_included_index;
-        
-        // Install snapshot in WAL
-        wal_.installSnapshot(metadata.last_included_index, metadata.last_included_term);
+        if (args.term < current_term_) {
+            // Reject stale leader
+            return reply;
+        }
         
-        std::cout << "[SUCCESS] Installed snapshot at index " 
-                  << last_included_index << std::endl;
+        // Reset election timeout - we heard from leader
+        last_heartbeat_ = std::chrono::steady_clock::now();
+        leader_id_ = args.leader_id;
+        if (role_ != Role::FOLLOWER) {
+            role_ = Role::FOLLOWER;
+        }
     }
     
-    // Send acknowledgment
-    std::ostringstream oss;
-    oss << "SUCCESS " << current_term_ << "\n";
-    write(client_fd, oss.str().c_str(), oss.str().size());
-}
-
-void Server::sendSnapshotToFollower(const std::string& follower_addr) {
-    /**
-     * INSTALL_SNAPSHOT RPC (Leader Side)
-     * 
-     * Send our snapshot to a follower who is too far behind.
-     * 
-     * WHEN TO CALL:
-     * - Leader needs to send entry at index 100 to follower
-     * - But leader's first log entry is 500 (already compacted)
-     * - Must send snapshot instead
-     * 
-     * CHUNKED TRANSFER:
-     * - Snapshots can be huge (GBs)
-     * - Send in chunks to avoid memory issues
-     * - Track offset for each follower
-     */
-    
-    std::cout << "[INFO] Sending snapshot to follower: " << follower_addr << std::endl;
-    
-    // Get snapshot metadata
-    SnapshotMetadata metadata;
-    if (!snapshot_manager_.getSnapshotMetadata(metadata)) {
-        std::cerr << "[ERROR] No snapshot available to send" << std::endl;
-        return;
+    std::lock_guard<std::mutex> lock(snapshot_receive_mutex_);
+    SnapshotReceive& rx = snapshot_receive_;
+    bool same = rx.last_index == args.last_index && rx.last_term == args.last_term &&
+                rx.total == args.total_size;
+    if (rx.installing) {
+        // The file is being read; nothing may rewrite it until that's over
+        reply.next_offset = same ? rx.received : 0;
+        return reply;
     }
-    
-    // In a full implementation, we'd:
-    // 1. Read snapshot in chunks
-    // 2. Send each chunk via INSTALL_SNAPSHOT RPC
-    // 3. Track offset for each follower
-    // 4. Handle retries and failures
-    
-    // For this implementation, we'll send a simplified version
-    std::string ip = follower_addr.substr(0, follower_addr.find(':'));
-    int port = std::stoi(follower_addr.substr(follower_addr.find(':') + 1));
-    
-    int sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock < 0) {
-        std::cerr << "[ERROR] Failed to create socket" << std::endl;
-        return;
+    if (!same && args.offset == 0) {
+        // A new transfer replaces whatever we were receiving
+        LOG_INFO("Receiving snapshot from leader " << args.leader_id
+                  << ": index=" << args.last_index << ", term=" << args.last_term
+                  << ", size=" << args.total_size << " bytes");
+        rx = SnapshotReceive{args.last_index, args.last_term, args.total_size, 0, false, false};
+        same = true;
     }
     
-    sockaddr_in serv{};
-    serv.sin_family = AF_INET;
-    serv.sin_port = htons(port);
-    inet_pton(AF_INET, ip.c_str(), &serv.sin_addr);
-    
-    if (connect(sock, (sockaddr*)&serv, sizeof(serv)) < 0) {
-        close(sock);
-        return;
+    // Already have everything it covers (installed it, or caught up by log)
+    if (rx.complete || args.last_index <= commit_index_) {
+        reply.success = true;
+        reply.next_offset = args.total_size;
+        return reply;
     }
     
-    std::ostringstream oss;
-    oss << "INSTALL_SNAPSHOT "
-        << current_term_ << " "
-        << server_id_ << " "
-        << metadata.last_included_index << " "
-        << metadata.last_included_term << " "
-        << metadata.data_size << "\n";
+    // Out of order (e.g. we restarted mid-transfer): say where we are
+    if (!same || args.offset != rx.received) {
+        reply.next_offset = same ? rx.received : 0;
+        return reply;
+    }
     
-    std::string msg = oss.str();
-    write(sock, msg.c_str(), msg.size());
+    if (!snapshot_manager_.writeSnapshotChunk(args.offset, args.data, args.done)) {
+        // Start over
+        rx = SnapshotReceive{};
+        reply.next_offset = 0;
+        return reply;
+    }
+    rx.received += args.data.size();
+    reply.next_offset = rx.received;
+    if (!args.done) {
+        reply.success = true;
+        return reply;
+    }
     
-    // Read response
-    char buffer[128];
-    int n = read(sock, buffer, sizeof(buffer));
-    if (n > 0) {
-        std::string resp(buffer, n);
-        if (resp.find("SUCCESS") != std::string::npos) {
-            std::cout << "[SUCCESS] Follower installed snapshot" << std::endl;
+    rx.installing = true;
+    if (install_thread_.joinable()) {
+        install_thread_.join();     // The last install, long finished
+    }
+    install_thread_ = std::thread([this, index = args.last_index, term = args.last_term]() {
+        installReceivedSnapshot(index, term);
+    });
+    return reply;
+}
+
+void Server::installReceivedSnapshot(int last_index, int last_term) {
+    // Loaded on the side and swapped in whole. On the way out, incoming
+    // frees the old contents, off every lock.
+    SnapshotMetadata metadata;
+    auto start = std::chrono::steady_clock::now();
+    KVStore incoming(storeOptions(config_));
+    std::string sessions;
+    bool ok = snapshot_manager_.installReceivedSnapshot(incoming, metadata, &sessions) &&
+              metadata.last_included_index == last_index &&
+              metadata.last_included_term == last_term;
+    
+    if (ok) {
+        std::lock_guard<std::mutex> apply_lock(apply_mutex_);
+        store_.assign(incoming);
+        {
+            std::lock_guard<std::mutex> sessions_lock(sessions_mutex_);
+            sessions_.decode(sessions);
         }
+        
+        // If our log has the snapshot's last entry, what follows it may be
+        // entries we've acknowledged since; keep them. Otherwise the whole
+        // log is superseded.
+        std::lock_guard<std::mutex> raft_lock(raft_mutex_);
+        int term = 0;
+        if (wal_.getTerm(last_index, term) && term == last_term) {
+            if (last_index >= wal_.getFirstLogIndex()) {
+                wal_.discardEntriesBefore(last_index);
+            }
+        } else {
+            wal_.installSnapshot(last_index, last_term);
+        }
+        if (commit_index_ < last_index) {
+            commit_index_ = last_index;
+        }
+        last_applied_ = last_index;
+        entries_since_snapshot_ = 0;
+        metrics_.snapshot_install->recordSince(start);
+        LOG_INFO(tag_ << "Installed snapshot at index " << last_index);
+    } else {
+        LOG_ERROR(tag_ << "Failed to install received snapshot");
+    }
+    {
+        std::lock_guard<std::mutex> apply_wake_lock(apply_wake_mutex_);
+        apply_cv_.notify_all();     // Entries after it may be committed already
+    }
+    std::lock_guard<std::mutex> lock(snapshot_receive_mutex_);
+    if (ok) {
+        snapshot_receive_.installing = false;
+        snapshot_receive_.complete = true;
+    } else {
+        snapshot_receive_ = SnapshotReceive{};  // The leader starts over
     }
-    
-    close(sock);
 }
 
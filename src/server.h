@@ -3,6 +3,12 @@
 #include "wal.h"
 #include "replication.h"
 #include "snapshot.h"
+#include "reactor.h"
+#include "protocol.h"
+#include "metrics.h"
+#include "timer_wheel.h"
+#include "session.h"
+#include "forwarder.h"
 #include <memory>
 #include <atomic>
 #include <chrono>
@@ -10,6 +16,9 @@
 #include "event_queue.h"
 #include <thread>
 #include <unordered_map>
+#include <map>
+#include <mutex>
+#include <condition_variable>
 
 enum class Role {
     LEADER,
@@ -17,38 +26,163 @@ enum class Role {
     CANDIDATE
 };
 
+// How GETs are made linearizable
+enum class ReadMode {
+    STALE,          // Read the local store as is, on any node
+    READ_INDEX,     // Confirm leadership with a heartbeat quorum per read batch
+    LEASE           // Skip the quorum while a recently confirmed lease holds
+};
+
+// Tunables that aren't part of a node's identity (port/id/peers)
+struct ServerConfig {
+    WalOptions wal;
+    ReplicationOptions replication;
+    SnapshotOptions snapshot;
+    StoreOptions store;
+    int io_threads = 4;             // Reactor workers serving client/peer connections
+    int recovery_threads = 0;       // Log replay threads at startup; 0 = one per core (max 8)
+    bool text_rpc = false;          // Speak the text protocol to peers (debugging)
+    int metrics_port = 0;           // Prometheus scrape endpoint; 0 = off (STATS still works)
+    std::string advertise_addr;     // How peers reach this node; default 127.0.0.1:<port>
+    
+    // Multi-Raft (see node.h): this server is Raft group `group` of the
+    // node's `groups`. With one group, storage paths and metric names are
+    // what they have always been. A preferred leader stands for election
+    // first at startup, which is how leaderships start out spread.
+    int group = 0;
+    int groups = 1;
+    bool preferred_leader = false;
+    
+    // Queued client PUTs the leader folds into one log append and one
+    // replication round, and how long it waits for a batch to fill up
+    size_t put_batch_entries = 256;
+    std::chrono::microseconds put_batch_linger{0};
+    
+    // Raft timing. Each time the election timer is armed it draws a fresh
+    // timeout from [min, max].
+    std::chrono::milliseconds heartbeat_interval{1000};
+    std::chrono::milliseconds election_timeout_min{3000};
+    std::chrono::milliseconds election_timeout_max{6000};
+    
+    // Reads. The lease has to stay well below election_timeout_min so a
+    // deposed leader stops serving before a successor can exist.
+    ReadMode read_mode = ReadMode::READ_INDEX;
+    int lease_ms = 2000;
+    bool follower_reads = true;     // Followers serve GETs via the leader's read index
+    
+    // Elections. PreVote: a node times out into a pre-vote round and only
+    // stands (bumping its term) if a majority would vote for it.
+    // CheckQuorum: the leader steps down after an election timeout without
+    // hearing from a majority, and nodes that hear from a live leader
+    // refuse votes without adopting the candidate's term.
+    bool pre_vote = true;
+    bool check_quorum = true;
+    
+    // Client writes reaching a follower: proxied to the leader (Forwarder)
+    // if set, else answered NOT_LEADER with the leader's address
+    bool forward_writes = false;
+    
+    // Memory budget for the store (KVStore::memory().total); 0 = none. The
+    // leader checks it as it accepts a write that adds data. Over budget,
+    // the write is refused with OUT_OF_MEMORY or, under an eviction policy,
+    // admitted after the leader logs DELETEs for enough victims, so every
+    // replica evicts the same keys. Soft: writes already in flight land
+    // regardless.
+    size_t max_memory = 0;
+    MemoryPolicy memory_policy = MemoryPolicy::REJECT;
+    
+    // Expiring keys (PUT ... EX): every expiry_interval each node moves the
+    // store's expiry wheel on, and the leader logs one EXPIRE entry for up
+    // to expire_batch of the keys it finds due, one batch in flight at a
+    // time. Reads hide a key past its deadline before that lands.
+    std::chrono::milliseconds expiry_interval{500};
+    size_t expire_batch = 1024;
+};
+
+// The SESSION envelope a client request came in (protocol.h): the client's
+// id and write number, 0 if none. forwarded marks one proxied here by
+// another node's Forwarder; it is never forwarded again.
+struct RequestContext {
+    uint64_t client_id = 0;
+    uint64_t seq = 0;
+    bool forwarded = false;
+};
+
 struct PendingClientRequest {
     int log_index;
     std::function<void(bool, const std::string&)> callback;
 };
 
+/**
+ * Server
+ *
+ * One Raft group's replica: its store, log, snapshots and Raft state. The
+ * node it runs on (node.h) owns the sockets and hands it the requests for
+ * its group through handleRequest; the reactor and, optionally, the WAL
+ * writer are shared with the node's other groups.
+ */
 class Server {
 public:
     Server(int port, Role role, int server_id,
-           const std::vector<std::string>& peers);
+           const std::vector<std::string>& peers,
+           const ServerConfig& config, Reactor& reactor,
+           std::shared_ptr<WalWriter> wal_writer = nullptr);
     
     ~Server();
 
+    // Start the Raft side (apply thread, event loop, timers); returns at once
     void start();
     void shutdown();
+    
+    // Runs on a reactor worker. Every request gets a response slot so a
+    // pipelining client sees answers in the order it asked.
+    void handleRequest(const std::shared_ptr<Connection>& conn, std::string_view request);
+    
+    // The leader we last heard from in currentTerm() (ourselves when
+    // leading); -1 if none yet
+    int leaderId() const { return leader_id_; }
+    // Where leaderId() listens (host:port), empty if not known
+    std::string leaderAddress() const;
+    int currentTerm() const { return current_term_; }
+    int serverId() const { return server_id_; }
+    
+    // Bring the gauges that mirror server state up to date (see metrics.h)
+    void refreshMetrics();
+    
+    // The node's directory of where server ids listen, for leaderAddress(),
+    // and its pooled connections for forward_writes. Set before start().
+    void setPeerDirectory(std::function<std::string(int server_id)> address_of,
+                          Forwarder* forwarder);
 
 private:
-    // Core Raft state (persistent)
-    int current_term_ = 0;
+    // Core Raft state (persistent). raft_mutex_ serializes everything that
+    // changes the term, the vote or the role, and everything that matches,
+    // truncates or appends to the log: the RPC handlers on the reactor
+    // workers, elections, and the event loop's appends and step-downs.
+    // Lock order: apply_mutex_, raft_mutex_, then read_mutex_ or
+    // pending_requests_mutex_. Never held across a network round.
+    // current_term_ is atomic for the readers that only look.
+    std::mutex raft_mutex_;
+    std::atomic<int> current_term_{0};
     int voted_for_ = -1;
     
-    // Volatile state
-    int commit_index_ = 0;
-    int last_applied_ = 0;
+    // Volatile state. Atomic because reads check them from reactor workers.
+    std::atomic<int> commit_index_{0};
+    std::atomic<int> last_applied_{0};
+    std::atomic<int> leader_id_{-1};
     
-    // Leader state
-    std::unique_ptr<Replicator> replicator_;
+    // Leader state. Swapped with std::atomic_load/atomic_store: RPC threads
+    // may step down while the event loop is using it.
+    std::shared_ptr<Replicator> replicator_;
     
     // Server configuration
     int port_;
     int server_id_;
     std::vector<std::string> peers_;
     std::atomic<Role> role_;
+    ServerConfig config_;
+    proto::PeerHello hello_;        // Opens our connections to peers
+    std::string tag_;               // Log prefix naming the group, if several
     
     // Storage
     KVStore store_;
@@ -58,59 +192,227 @@ private:
     // Snapshot configuration
     int snapshot_threshold_ = 1000;  // Take snapshot every N log entries
     std::atomic<int> entries_since_snapshot_{0};
+    std::atomic<bool> snapshot_in_progress_{false};
+    std::thread snapshot_thread_;    // Writes the frozen store view to disk
+    
+    // Snapshot being received from the leader (see handleInstallSnapshot)
+    struct SnapshotReceive {
+        int last_index = 0;
+        int last_term = 0;
+        uint64_t total = 0;
+        uint64_t received = 0;      // Bytes written so far, in order
+        bool installing = false;    // All here; install_thread_ is loading it
+        bool complete = false;      // Installed
+    };
+    std::mutex snapshot_receive_mutex_;
+    SnapshotReceive snapshot_receive_;
+    std::thread install_thread_;    // Loads a received snapshot off the reactor
     
     // Event-driven architecture
+    static constexpr size_t kEventDrainBatch = 256;  // Events taken per wakeup
+    static constexpr size_t kApplyBatch = 256;       // Committed entries fetched per log read
+    static constexpr size_t kScanDefaultLimit = 1000; // SCAN page size when none is given
+    static constexpr size_t kScanMaxLimit = 10000;    // Largest SCAN page served
     EventQueue event_queue_;
     std::thread event_loop_thread_;
     
-    // Timing
+    // Timing. Heartbeats and the election timeout run off timers_; an
+    // expired election timeout wakes election_thread_, which runs the
+    // election off the wheel thread.
     std::chrono::steady_clock::time_point last_heartbeat_;
     std::mt19937 rng_;
+    TimerWheel timers_;
+    std::mutex election_mutex_;
+    std::condition_variable election_cv_;
+    bool election_due_ = false;
+    
+    // Vote connections, one per peer, reused across elections. Election
+    // thread only.
+    static constexpr int kMaxOwedVotes = 4;     // Unanswered requests before reconnecting
+    struct VotePeer {
+        int sock = -1;
+        int owed = 0;               // Requests sent and not yet answered
+        std::string in;             // Reply bytes read so far
+    };
+    std::vector<VotePeer> vote_peers_;
+    
+    // Memory budget: bytes the eviction DELETEs logged and not yet applied
+    // will free, so a backlog of them doesn't trigger more
+    std::mutex evict_mutex_;
+    std::atomic<size_t> evicting_bytes_{0};
+    
+    // An EXPIRE entry is logged and not yet applied (or failed)
+    std::atomic<bool> expire_in_flight_{false};
     
-    // Client request tracking
+    // Client request tracking. Callbacks wait here, by log index, until
+    // their entry is applied; stepping down fails them all, since a later
+    // leader may put a different entry at the same index.
     std::unordered_map<int, PendingClientRequest> pending_requests_;
     std::mutex pending_requests_mutex_;
     
+    // Client writes already applied (session.h). Changed by the apply
+    // thread, read by request handlers; part of the snapshot.
+    std::mutex sessions_mutex_;
+    ClientSessions sessions_;
+    
+    // Apply stage: apply_thread_ applies whatever commit_index_ is ahead of
+    // last_applied_. Whoever moves commit_index_ only wakes it, through
+    // apply_wake_mutex_/apply_cv_. apply_mutex_ is held for each batch, so
+    // installing a snapshot can't interleave with one.
+    std::thread apply_thread_;
+    std::mutex apply_wake_mutex_;
+    std::condition_variable apply_cv_;
+    std::mutex apply_mutex_;
+    
+    // Linearizable reads (see confirmReadIndex). Everything below is
+    // guarded by read_mutex_.
+    using ReadIndexCallback = std::function<void(bool ok, int read_index)>;
+    struct PendingConfirm {
+        int term;
+        uint64_t round;
+        int read_index;
+        ReadIndexCallback done;
+    };
+    std::mutex read_mutex_;
+    int leader_term_ = 0;               // Term we lead in; 0 when not leader
+    int term_start_index_ = 0;          // Our NOOP for leader_term_
+    Replicator::Clock::time_point lease_expiry_;
+    Replicator::Clock::time_point quorum_contact_;  // Start of the last round a majority answered
+    std::vector<PendingConfirm> pending_confirms_;
+    std::multimap<int, std::function<void()>> apply_waiters_;   // By log index
+    
+    // Follower reads: GETs waiting for the forwarder to fetch a read index
+    std::mutex forward_mutex_;
+    std::condition_variable forward_cv_;
+    std::vector<ReadIndexCallback> forward_queue_;
+    std::thread read_forwarder_thread_;
+    
+    // Metrics (see metrics.h), resolved once at construction
+    struct Metrics {
+        metrics::Histogram* put_commit;      // PUT received -> acknowledged
+        metrics::Histogram* get;             // GET received -> answered
+        metrics::Histogram* put_batch;       // PUTs folded into one append
+        metrics::Histogram* queue_depth;     // Events waiting, sampled per drain
+        metrics::Histogram* snapshot_create;
+        metrics::Histogram* snapshot_install;
+        metrics::Counter* writes;
+        metrics::Counter* gets;
+        metrics::Counter* applied;
+        metrics::Counter* elections;
+        metrics::Counter* prevotes_failed;
+        metrics::Counter* quorum_lost;
+        metrics::Counter* duplicates;
+        metrics::Counter* forwarded;
+        metrics::Counter* evicted;
+        metrics::Counter* rejected_oom;
+        metrics::Counter* expired;
+    };
+    Metrics metrics_;
+    metrics::Labels labels_;        // The group, if several
+    
     // Thread management
     std::atomic<bool> running_{true};
-    std::thread heartbeat_thread_;
     std::thread election_thread_;
     
     // Core event loop
     void startEventLoop();
-    void processEvent(const Event& e);
+    void processEvent(Event& e);
+    void processPutBatch(std::vector<Event>& batch);
+    // A REPL_ACK: move commit_index_ as far as the log is replicated. Event
+    // loop only, or with raft_mutex_ held in a single-node cluster.
+    void onReplicationAck(int ack_index);
     
     // Raft RPCs - Server side
-    void handleAppendEntries(int client_fd, const std::string& request);
-    void handleRequestVote(int client_fd, const std::string& request);
+    proto::AppendEntriesReply handleAppendEntries(const proto::AppendEntriesView& args);
+    proto::VoteReply handleRequestVote(const proto::VoteRequest& req);
+    
+    // Client operations. Writes (PUT, DELETE, MULTI_PUT) all become one log
+    // entry, a SESSION entry if the client numbered it (ctx.client_id != 0);
+    // a PUT with a ttl_seconds becomes a PUT_TTL with the deadline it makes
+    // on the leader's clock. Reads run serve() once it gives a
+    // linearizable answer.
+    void handleClientWrite(const std::shared_ptr<Connection>& conn, uint64_t slot,
+                           LogOp op, std::string_view key, std::string_view value,
+                           const RequestContext& ctx = {}, uint32_t ttl_seconds = 0);
+    // Proxy a write to the leader; false if there's no leader to send it to
+    bool forwardWrite(const std::shared_ptr<Connection>& conn, uint64_t slot,
+                      LogOp op, std::string_view key, std::string_view value,
+                      const RequestContext& ctx, uint32_t ttl_seconds);
+    void handleClientGet(const std::shared_ptr<Connection>& conn, uint64_t slot,
+                         std::string_view key);
+    void handleClientMultiGet(const std::shared_ptr<Connection>& conn, uint64_t slot,
+                              std::vector<std::string> keys);
+    // Keys in [start, end) in order (empty end: no end), at most limit of
+    // them; the reply says where to pick up if there are more
+    void handleClientScan(const std::shared_ptr<Connection>& conn, uint64_t slot,
+                          std::string start, std::string end, size_t limit);
+    void serveRead(const std::shared_ptr<Connection>& conn, uint64_t slot,
+                   std::function<void()> serve);
+    // Under max_memory, room for a write adding about incoming bytes: true
+    // if it fits, or once evictions for it are logged
+    bool makeRoom(size_t incoming);
     
-    // Client operations
-    void handleClientPut(int client_fd, const std::string& request);
-    void handleClientGet(int client_fd, const std::string& request);
+    // ReadIndex: on the leader, done(true, read_index) fires once leadership
+    // is confirmed for a round that started after this call (or at once under
+    // a valid lease, if use_lease); done(false, 0) if we aren't or stop being
+    // leader.
+    void confirmReadIndex(ReadIndexCallback done, bool use_lease = true);
+    void onLeadershipConfirmed(int term, uint64_t round, Replicator::Clock::time_point start);
+    void failPendingReads();
+    // Run task once last_applied_ reaches index (right away if it has)
+    void waitApplied(int index, std::function<void()> task);
+    // Follower side: ask the leader for a read index on behalf of queued GETs
+    void startReadForwarder();
+    bool fetchReadIndex(std::vector<int>& socks, size_t& leader_hint, int& read_index);
     
     // Election and heartbeat management
     void startElection();
+    // One (pre-)vote round: votes granted, counting our own, and the highest
+    // term any reply carried
+    int requestVotes(const proto::VoteRequest& req, int& highest_term);
+    // Whether we're a leader in contact with a majority, or a follower that
+    // heard from one within the minimum election timeout
+    bool leaderIsAlive();
+    // Both assume raft_mutex_ is held
     void becomeLeader();
     void stepDown(int new_term);
-    void startHeartbeatSender();
+    void scheduleHeartbeat(int term);     // Every heartbeat_interval while leader of term
+    void scheduleExpiry();                // Every expiry_interval, any role
     void startElectionTimer();
+    void armElectionTimer();
+    void onElectionTimer(std::chrono::milliseconds timeout);
     int getElectionTimeout();
     
-    // Log management
-    void applyLogEntry(const LogEntry& entry);
+    // Log management. advanceCommitIndex is called after raising
+    // commit_index_ and returns at once; the apply thread catches up.
+    void startApplier();
+    void applyEntries(const std::vector<LogEntry>& entries);
     void advanceCommitIndex();
     
     // Snapshot management
     void createSnapshotIfNeeded();
     void createSnapshot();
     bool loadSnapshot();
-    void handleInstallSnapshot(int client_fd, const std::string& request);
-    void sendSnapshotToFollower(const std::string& follower_addr);
+    proto::InstallSnapshotReply handleInstallSnapshot(const proto::InstallSnapshotView& args);
+    void installReceivedSnapshot(int last_index, int last_term);
     
     // Network
-    void handleClient(int client_fd);
+    Reactor& reactor_;
+    std::string helloMessage() const;   // hello_ in the peer protocol
+    void handleBinaryRequest(const std::shared_ptr<Connection>& conn, uint64_t slot,
+                             std::string_view request, const RequestContext& ctx = {});
+    void handleTextRequest(const std::shared_ptr<Connection>& conn, uint64_t slot,
+                           std::string_view request, const RequestContext& ctx = {});
+    std::function<std::string(int)> address_of_;
+    Forwarder* forwarder_ = nullptr;
+    
+    // Client reply in the connection's protocol
+    void respond(const std::shared_ptr<Connection>& conn, uint64_t slot,
+                 proto::Status status, std::string_view body);
+    // NOT_LEADER, followed by the leader's address when we know it
+    void respondNotLeader(const std::shared_ptr<Connection>& conn, uint64_t slot);
     
-    // Persistence
+    // Persistence. persistState() assumes raft_mutex_ is held.
     void persistState();
     void loadState();
 };
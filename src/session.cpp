@@ -0,0 +1,68 @@
+#include "session.h"
+#include "coding.h"
+#include <algorithm>
+#include <vector>
+
+bool ClientSessions::admit(uint64_t client_id, uint64_t seq, int index) {
+    Session& session = sessions_[client_id];
+    if (seq <= session.last_seq) {
+        return false;
+    }
+    session.last_seq = seq;
+    session.last_index = index;
+    if (sessions_.size() > kMaxSessions) {
+        evict();
+    }
+    return true;
+}
+
+bool ClientSessions::applied(uint64_t client_id, uint64_t seq) const {
+    auto it = sessions_.find(client_id);
+    return it != sessions_.end() && seq <= it->second.last_seq;
+}
+
+void ClientSessions::evict() {
+    // An eighth at a time, so a full table isn't scanned for every new
+    // client. Each entry admits one client, so last indexes are distinct
+    // and every replica picks the same ones.
+    std::vector<std::pair<int, uint64_t>> by_age;
+    by_age.reserve(sessions_.size());
+    for (const auto& [client_id, session] : sessions_) {
+        by_age.emplace_back(session.last_index, client_id);
+    }
+    size_t drop = std::max<size_t>(1, sessions_.size() - kMaxSessions + kMaxSessions / 8);
+    std::nth_element(by_age.begin(), by_age.begin() + (drop - 1), by_age.end());
+    for (size_t i = 0; i < drop; i++) {
+        sessions_.erase(by_age[i].second);
+    }
+}
+
+std::string ClientSessions::encode() const {
+    std::string out;
+    out.reserve(4 + sessions_.size() * 24);
+    putFixed32(out, static_cast<uint32_t>(sessions_.size()));
+    for (const auto& [client_id, session] : sessions_) {
+        putFixed64(out, client_id);
+        putFixed64(out, session.last_seq);
+        putFixed64(out, static_cast<uint64_t>(session.last_index));
+    }
+    return out;
+}
+
+bool ClientSessions::decode(std::string_view data) {
+    sessions_.clear();
+    if (data.size() < 4) {
+        return false;
+    }
+    uint32_t count = decodeFixed32(data.data());
+    if (data.size() != 4 + static_cast<uint64_t>(count) * 24) {
+        return false;
+    }
+    const char* p = data.data() + 4;
+    for (uint32_t i = 0; i < count; i++, p += 24) {
+        Session& session = sessions_[decodeFixed64(p)];
+        session.last_seq = decodeFixed64(p + 8);
+        session.last_index = static_cast<int>(decodeFixed64(p + 16));
+    }
+    return true;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+/**
+ * ClientSessions
+ *
+ * Which client writes have been applied, so that a retried write is
+ * applied once (Raft thesis 6.3). A client picks a client id and numbers
+ * its writes 1, 2, 3, ...; a retry reuses the number. Writes carrying a
+ * number are logged as SESSION entries, and every replica runs them
+ * through this table in log order as it applies them, so the table is
+ * part of the replicated state. It travels in snapshots.
+ *
+ * ORDERING:
+ * Only the highest applied number is kept per client, so numbers at or
+ * below it are duplicates. A client therefore sends its writes in order on
+ * one connection and, after a failure, resends every unacknowledged one in
+ * the same order; a leader appends a connection's writes in order, so
+ * whatever part of them survives a leader change is a prefix.
+ *
+ * BOUNDS:
+ * Past kMaxSessions, the clients whose last write is oldest are dropped.
+ * That goes by log index, so every replica drops the same ones. A dropped
+ * client's retries apply again, which is why the cap is generous.
+ *
+ * Not thread safe; the server guards it.
+ */
+class ClientSessions {
+public:
+    static constexpr size_t kMaxSessions = 65536;
+
+    // Record that the client's write number seq is applied at index; false
+    // (and nothing recorded) if it already was
+    bool admit(uint64_t client_id, uint64_t seq, int index);
+
+    // Whether the write is known to be applied
+    bool applied(uint64_t client_id, uint64_t seq) const;
+
+    size_t size() const { return sessions_.size(); }
+    void clear() { sessions_.clear(); }
+
+    // Snapshot form: u32 count, count x (u64 client_id, u64 last_seq, u64 last_index)
+    std::string encode() const;
+    bool decode(std::string_view data);
+
+private:
+    struct Session {
+        uint64_t last_seq = 0;
+        int last_index = 0;
+    };
+    std::unordered_map<uint64_t, Session> sessions_;
+
+    void evict();
+};
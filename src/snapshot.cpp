@@ -1,23 +1,118 @@
 #include "snapshot.h"
+#include "coding.h"
+#include "crc32.h"
+#include "log.h"
+#include "lz4_block.h"
 #include <iostream>
 #include <sstream>
 #include <algorithm>
+#include <atomic>
+#include <thread>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <cerrno>
 #include <cstring>
 #include <unistd.h>
 
-SnapshotManager::SnapshotManager(const std::string& snapshot_dir, int server_id)
-    : snapshot_dir_(snapshot_dir), server_id_(server_id) {
+namespace {
+
+constexpr char kMagicV2[8] = {'L', 'K', 'V', 'S', 'N', 'A', 'P', '2'};
+constexpr char kMagicV1[] = "LOGKV_SNAPSHOT_V1";
+constexpr size_t kHeaderSize = 8 + 8 + 8 + 8 + 4;
+constexpr size_t kIndexEntrySize = 8 + 4 + 4 + 4 + 4 + 1;
+constexpr size_t kFooterSize = 8 + 4 + 4 + 8;
+constexpr size_t kRecordHeaderSize = 8;
+// Codec byte of the block holding the client session table: stored raw,
+// no pairs, not counted in the header's entry count
+constexpr uint8_t kSessionsBlock = 0x80;
+// Codec byte of the block of key deadlines: stored raw, entries being the
+// number of [u64 deadline][u32 key_len][key] records, also left out of the
+// header's count
+constexpr uint8_t kExpiryBlock = 0x81;
+
+struct BlockInfo {
+    uint64_t offset;
+    uint32_t stored_len;
+    uint32_t raw_len;
+    uint32_t entries;
+    uint32_t crc;
+    uint8_t codec;
+};
+
+bool writeAll(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+void syncDirectory(const std::string& dir) {
+    int dfd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dfd >= 0) {
+        fsync(dfd);
+        close(dfd);
+    }
+}
+
+// Put every record of a decoded block into the store
+bool applyBlock(const char* p, size_t len, uint32_t expected_entries, KVStore& store) {
+    const char* end = p + len;
+    uint32_t entries = 0;
+    while (p < end) {
+        if (static_cast<size_t>(end - p) < kRecordHeaderSize) return false;
+        uint32_t key_len = decodeFixed32(p);
+        uint32_t value_len = decodeFixed32(p + 4);
+        p += kRecordHeaderSize;
+        if (static_cast<size_t>(end - p) < static_cast<uint64_t>(key_len) + value_len) {
+            return false;
+        }
+        store.put(std::string(p, key_len), std::string(p + key_len, value_len));
+        p += key_len + value_len;
+        entries++;
+    }
+    return entries == expected_entries;
+}
+
+// Deadlines go on once every block is in, since they name keys anywhere
+bool applyExpiryBlock(const char* p, size_t len, uint32_t expected_entries, KVStore& store) {
+    const char* end = p + len;
+    uint32_t entries = 0;
+    while (p < end) {
+        if (static_cast<size_t>(end - p) < 12) return false;
+        uint64_t deadline = decodeFixed64(p);
+        uint32_t key_len = decodeFixed32(p + 8);
+        p += 12;
+        if (static_cast<size_t>(end - p) < key_len) return false;
+        store.expireAt(std::string(p, key_len), deadline);
+        p += key_len;
+        entries++;
+    }
+    return entries == expected_entries;
+}
+
+}  // namespace
+
+SnapshotManager::SnapshotManager(const std::string& snapshot_dir, int server_id,
+                                 const SnapshotOptions& options)
+    : snapshot_dir_(snapshot_dir), server_id_(server_id), options_(options) {
     
     // Create snapshot directory if it doesn't exist
     struct stat st;
     if (stat(snapshot_dir_.c_str(), &st) != 0) {
         mkdir(snapshot_dir_.c_str(), 0755);
-        std::cout << "[INFO] Created snapshot directory: " << snapshot_dir_ << std::endl;
+        LOG_INFO("Created snapshot directory: " << snapshot_dir_);
     }
     
     temp_snapshot_path_ = snapshot_dir_ + "/temp_" + std::to_string(server_id_) + ".snap";
+    receive_snapshot_path_ = snapshot_dir_ + "/recv_" + std::to_string(server_id_) + ".snap";
 }
 
 std::string SnapshotManager::generateSnapshotFilename(int last_index) const {
@@ -28,93 +123,236 @@ std::string SnapshotManager::generateSnapshotFilename(int last_index) const {
 }
 
 bool SnapshotManager::createSnapshot(
-    const std::unordered_map<std::string, std::string>& data,
+    const KVStore::Snapshot& data,
     int last_index,
-    int last_term) {
+    int last_term,
+    std::string_view sessions) {
     
     std::lock_guard<std::mutex> lock(mutex_);
     
-    std::cout << "[INFO] Creating snapshot at index " << last_index 
-              << ", term " << last_term << " (" << data.size() << " entries)" << std::endl;
+    LOG_INFO("Creating snapshot at index " << last_index 
+              << ", term " << last_term << " (" << data.size() << " entries)");
     
     // Step 1: Write to temporary file
     // WHY TEMP FILE? If we crash during write, we don't corrupt the last good snapshot
-    std::ofstream temp_out(temp_snapshot_path_, std::ios::binary);
-    if (!temp_out) {
-        std::cerr << "[ERROR] Failed to create temp snapshot file: " 
-                  << temp_snapshot_path_ << std::endl;
+    int fd = open(temp_snapshot_path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        LOG_ERROR("Failed to create temp snapshot file: " 
+                  << temp_snapshot_path_);
         return false;
     }
     
-    // Step 2: Write metadata header
-    // Format: SNAPSHOT_MAGIC last_index last_term data_size\n
-    // Magic number helps detect file corruption
-    temp_out << "LOGKV_SNAPSHOT_V1\n";
-    temp_out << last_index << " " << last_term << " " << data.size() << "\n";
-    
-    // Step 3: Write all key-value pairs
-    // Format: key_length value_length key value
-    // This format handles keys/values with spaces or newlines
-    for (const auto& [key, value] : data) {
-        temp_out << key.size() << " " << value.size() << "\n";
-        temp_out << key << "\n";
-        temp_out << value << "\n";
+    // Step 2: Header. Its CRC lets getSnapshotMetadata trust it alone.
+    std::string header(kMagicV2, sizeof(kMagicV2));
+    putFixed64(header, static_cast<uint64_t>(last_index));
+    putFixed64(header, static_cast<uint64_t>(last_term));
+    putFixed64(header, data.size());
+    putFixed32(header, crc32::value(header.data(), header.size()));
+    bool ok = writeAll(fd, header.data(), header.size());
+    uint64_t offset = header.size();
+    
+    // Step 3: Blocks, filled straight from the frozen view and written as
+    // each one fills up
+    std::vector<BlockInfo> blocks;
+    std::string raw;
+    std::string compressed;
+    uint32_t block_entries = 0;
+    size_t entries_written = 0;
+    raw.reserve(options_.block_bytes + 1024);
+    
+    auto flushBlock = [&]() {
+        if (block_entries == 0 || !ok) {
+            return;
+        }
+        const std::string* stored = &raw;
+        uint8_t codec = static_cast<uint8_t>(SnapshotCompression::NONE);
+        if (options_.compression == SnapshotCompression::LZ4) {
+            compressed.clear();
+            lz4::compress(raw.data(), raw.size(), compressed);
+            if (compressed.size() < raw.size()) {
+                stored = &compressed;
+                codec = static_cast<uint8_t>(SnapshotCompression::LZ4);
+            }
+        }
+        
+        BlockInfo info;
+        info.offset = offset;
+        info.stored_len = static_cast<uint32_t>(stored->size());
+        info.raw_len = static_cast<uint32_t>(raw.size());
+        info.entries = block_entries;
+        info.crc = crc32::value(stored->data(), stored->size());
+        info.codec = codec;
+        blocks.push_back(info);
+        
+        ok = writeAll(fd, stored->data(), stored->size());
+        offset += stored->size();
+        raw.clear();
+        block_entries = 0;
+    };
+    
+    std::string deadlines;
+    uint32_t expiring = 0;
+    data.forEach([&](const std::string& key, const std::string& value, uint64_t expires_at) {
+        if (expires_at != 0) {
+            putFixed64(deadlines, expires_at);
+            putFixed32(deadlines, static_cast<uint32_t>(key.size()));
+            deadlines += key;
+            expiring++;
+        }
+        putFixed32(raw, static_cast<uint32_t>(key.size()));
+        putFixed32(raw, static_cast<uint32_t>(value.size()));
+        raw += key;
+        raw += value;
+        block_entries++;
+        entries_written++;
+        // A pair larger than a block simply gets a block to itself
+        if (raw.size() >= options_.block_bytes) {
+            flushBlock();
+        }
+    });
+    flushBlock();
+    auto rawBlock = [&](std::string_view bytes, uint32_t entries, uint8_t codec) {
+        BlockInfo info;
+        info.offset = offset;
+        info.stored_len = static_cast<uint32_t>(bytes.size());
+        info.raw_len = info.stored_len;
+        info.entries = entries;
+        info.crc = crc32::value(bytes.data(), bytes.size());
+        info.codec = codec;
+        blocks.push_back(info);
+        ok = writeAll(fd, bytes.data(), bytes.size());
+        offset += bytes.size();
+    };
+    if (expiring > 0 && ok) {
+        rawBlock(deadlines, expiring, kExpiryBlock);
+    }
+    if (!sessions.empty() && ok) {
+        rawBlock(sessions, 0, kSessionsBlock);
     }
     
-    // Step 4: Flush to ensure data is on disk
-    temp_out.flush();
-    temp_out.close();
-    
-    if (!temp_out) {
-        std::cerr << "[ERROR] Failed to write snapshot data" << std::endl;
+    // Step 4: Index and footer
+    std::string index;
+    index.reserve(blocks.size() * kIndexEntrySize + kFooterSize);
+    for (const auto& block : blocks) {
+        putFixed64(index, block.offset);
+        putFixed32(index, block.stored_len);
+        putFixed32(index, block.raw_len);
+        putFixed32(index, block.entries);
+        putFixed32(index, block.crc);
+        index.push_back(static_cast<char>(block.codec));
+    }
+    uint32_t index_crc = crc32::value(index.data(), index.size());
+    putFixed64(index, offset);
+    putFixed32(index, static_cast<uint32_t>(blocks.size()));
+    putFixed32(index, index_crc);
+    index.append(kMagicV2, sizeof(kMagicV2));
+    ok = ok && writeAll(fd, index.data(), index.size());
+    
+    // Step 5: Make it durable before it can replace the previous snapshot
+    ok = ok && fdatasync(fd) == 0;
+    close(fd);
+    
+    if (!ok || entries_written != data.size()) {
+        LOG_ERROR("Failed to write snapshot data");
+        unlink(temp_snapshot_path_.c_str());
         return false;
     }
     
-    // Step 5: Atomic rename
+    // Step 6: Atomic rename
     // This is the critical step! Rename is atomic on POSIX systems.
     // Even if we crash here, we either have the old snapshot or the new one,
     // never a partially written file.
     std::string final_path = generateSnapshotFilename(last_index);
     if (rename(temp_snapshot_path_.c_str(), final_path.c_str()) != 0) {
-        std::cerr << "[ERROR] Failed to rename snapshot: " << strerror(errno) << std::endl;
+        LOG_ERROR("Failed to rename snapshot: " << strerror(errno));
         return false;
     }
+    syncDirectory(snapshot_dir_);
     
-    std::cout << "[SUCCESS] Snapshot created: " << final_path << std::endl;
+    LOG_INFO("Snapshot created: " << final_path << " (" << blocks.size()
+              << " blocks, " << offset << " bytes of data)");
     
-    // Step 6: Clean up old snapshots
+    // Step 7: Clean up old snapshots
     cleanupOldSnapshots(2);  // Keep last 2 snapshots for safety
     
     return true;
 }
 
-bool SnapshotManager::loadSnapshot(
-    std::unordered_map<std::string, std::string>& data,
-    SnapshotMetadata& metadata) {
-    
+bool SnapshotManager::loadSnapshot(KVStore& store, SnapshotMetadata& metadata,
+                                   std::string* sessions) {
     std::lock_guard<std::mutex> lock(mutex_);
     
     std::string snapshot_path = findLatestSnapshot();
     if (snapshot_path.empty()) {
-        std::cout << "[INFO] No snapshot found" << std::endl;
+        LOG_INFO("No snapshot found");
         return false;
     }
     
-    std::cout << "[INFO] Loading snapshot: " << snapshot_path << std::endl;
+    LOG_INFO("Loading snapshot: " << snapshot_path);
+    bool loaded = loadFile(snapshot_path, store, metadata, sessions);
+    if (loaded) {
+        LOG_INFO("Loaded " << metadata.data_size << " entries from snapshot");
+    }
+    return loaded;
+}
+
+bool SnapshotManager::installReceivedSnapshot(KVStore& store, SnapshotMetadata& metadata,
+                                              std::string* sessions) {
+    // No lock while loading: only writeSnapshotChunk touches the file, and
+    // the caller doesn't run the two together. Holding mutex_ would stall
+    // everything else the manager does for the length of the load.
+    LOG_INFO("Loading received snapshot: " << receive_snapshot_path_);
+    if (!loadFile(receive_snapshot_path_, store, metadata, sessions)) {
+        // Never let it become the latest snapshot
+        unlink(receive_snapshot_path_.c_str());
+        return false;
+    }
     
-    std::ifstream in(snapshot_path, std::ios::binary);
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string final_path = generateSnapshotFilename(metadata.last_included_index);
+    if (rename(receive_snapshot_path_.c_str(), final_path.c_str()) != 0) {
+        LOG_ERROR("Failed to finalize snapshot: " << strerror(errno));
+        unlink(receive_snapshot_path_.c_str());
+        return false;
+    }
+    syncDirectory(snapshot_dir_);
+    
+    LOG_INFO("Received snapshot at index " << metadata.last_included_index
+              << " (" << metadata.data_size << " entries)");
+    cleanupOldSnapshots(2);
+    return true;
+}
+
+bool SnapshotManager::loadFile(const std::string& path, KVStore& store,
+                               SnapshotMetadata& metadata, std::string* sessions) {
+    char magic[sizeof(kMagicV2)] = {};
+    std::ifstream probe(path, std::ios::binary);
+    probe.read(magic, sizeof(magic));
+    probe.close();
+    
+    if (sessions) {
+        sessions->clear();
+    }
+    if (memcmp(magic, kMagicV2, sizeof(kMagicV2)) == 0) {
+        return loadV2(path, store, metadata, sessions);
+    }
+    if (memcmp(magic, kMagicV1, sizeof(magic)) == 0) {
+        return loadV1(path, store, metadata);
+    }
+    LOG_ERROR("Invalid snapshot format: " << path);
+    return false;
+}
+
+bool SnapshotManager::loadV1(const std::string& path, KVStore& store,
+                             SnapshotMetadata& metadata) {
+    std::ifstream in(path, std::ios::binary);
     if (!in) {
-        std::cerr << "[ERROR] Failed to open snapshot: " << snapshot_path << std::endl;
+        LOG_ERROR("Failed to open snapshot: " << path);
         return false;
     }
     
-    // Read and verify magic header
     std::string magic;
     std::getline(in, magic);
-    if (magic != "LOGKV_SNAPSHOT_V1") {
-        std::cerr << "[ERROR] Invalid snapshot format: " << magic << std::endl;
-        return false;
-    }
     
     // Read metadata
     in >> metadata.last_included_index 
@@ -122,12 +360,12 @@ bool SnapshotManager::loadSnapshot(
        >> metadata.data_size;
     in.ignore();  // Skip newline
     
-    std::cout << "[INFO] Snapshot metadata: index=" << metadata.last_included_index
+    LOG_INFO("Snapshot metadata (V1): index=" << metadata.last_included_index
               << ", term=" << metadata.last_included_term
-              << ", entries=" << metadata.data_size << std::endl;
+              << ", entries=" << metadata.data_size);
     
     // Read all key-value pairs
-    data.clear();
+    store.reserve(metadata.data_size);
     for (size_t i = 0; i < metadata.data_size; i++) {
         size_t key_len, value_len;
         in >> key_len >> value_len;
@@ -141,37 +379,218 @@ bool SnapshotManager::loadSnapshot(
         in.read(&value[0], value_len);
         in.ignore();  // Skip newline
         
-        data[key] = value;
+        if (!in) {
+            LOG_ERROR("Truncated V1 snapshot: " << path);
+            return false;
+        }
+        store.put(std::move(key), std::move(value));
     }
-    
-    std::cout << "[SUCCESS] Loaded " << data.size() << " entries from snapshot" << std::endl;
-    
     return true;
 }
 
-bool SnapshotManager::getSnapshotMetadata(SnapshotMetadata& metadata) {
-    std::lock_guard<std::mutex> lock(mutex_);
+bool SnapshotManager::loadV2(const std::string& path, KVStore& store,
+                             SnapshotMetadata& metadata, std::string* sessions) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOG_ERROR("Failed to open snapshot: " << path);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < kHeaderSize + kFooterSize) {
+        close(fd);
+        LOG_ERROR("Truncated snapshot: " << path);
+        return false;
+    }
+    size_t size = static_cast<size_t>(st.st_size);
+    void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        LOG_ERROR("Failed to map snapshot: " << strerror(errno));
+        return false;
+    }
+    madvise(mapped, size, MADV_WILLNEED);
+    const char* base = static_cast<const char*>(mapped);
     
-    std::string snapshot_path = findLatestSnapshot();
-    if (snapshot_path.empty()) {
+    auto fail = [&](const char* what) {
+        LOG_ERROR("Corrupt snapshot " << path << ": " << what);
+        munmap(mapped, size);
         return false;
+    };
+    
+    // Header
+    if (decodeFixed32(base + kHeaderSize - 4) != crc32::value(base, kHeaderSize - 4)) {
+        return fail("header checksum");
+    }
+    metadata.last_included_index = static_cast<int>(decodeFixed64(base + 8));
+    metadata.last_included_term = static_cast<int>(decodeFixed64(base + 16));
+    metadata.data_size = decodeFixed64(base + 24);
+    
+    // Footer and index
+    const char* footer = base + size - kFooterSize;
+    if (memcmp(footer + 16, kMagicV2, sizeof(kMagicV2)) != 0) {
+        return fail("missing footer");
+    }
+    uint64_t index_offset = decodeFixed64(footer);
+    uint32_t block_count = decodeFixed32(footer + 8);
+    uint32_t index_crc = decodeFixed32(footer + 12);
+    if (index_offset < kHeaderSize ||
+        index_offset + static_cast<uint64_t>(block_count) * kIndexEntrySize != size - kFooterSize) {
+        return fail("index bounds");
+    }
+    const char* index = base + index_offset;
+    if (crc32::value(index, block_count * kIndexEntrySize) != index_crc) {
+        return fail("index checksum");
     }
     
-    std::ifstream in(snapshot_path, std::ios::binary);
+    std::vector<BlockInfo> blocks;
+    blocks.reserve(block_count);
+    std::vector<BlockInfo> expiry;
+    uint64_t total_entries = 0;
+    for (uint32_t i = 0; i < block_count; i++) {
+        const char* e = index + i * kIndexEntrySize;
+        BlockInfo block;
+        block.offset = decodeFixed64(e);
+        block.stored_len = decodeFixed32(e + 8);
+        block.raw_len = decodeFixed32(e + 12);
+        block.entries = decodeFixed32(e + 16);
+        block.crc = decodeFixed32(e + 20);
+        block.codec = static_cast<uint8_t>(e[24]);
+        if (block.offset < kHeaderSize || block.offset + block.stored_len > index_offset) {
+            return fail("block bounds");
+        }
+        if (block.codec == kSessionsBlock) {
+            if (block.entries != 0 || block.raw_len != block.stored_len ||
+                crc32::value(base + block.offset, block.stored_len) != block.crc) {
+                return fail("session table");
+            }
+            if (sessions) {
+                sessions->assign(base + block.offset, block.stored_len);
+            }
+            continue;
+        }
+        if (block.codec == kExpiryBlock) {
+            if (block.raw_len != block.stored_len ||
+                crc32::value(base + block.offset, block.stored_len) != block.crc) {
+                return fail("key deadlines");
+            }
+            expiry.push_back(block);
+            continue;
+        }
+        total_entries += block.entries;
+        blocks.push_back(block);
+    }
+    if (total_entries != metadata.data_size) {
+        return fail("entry count");
+    }
+    
+    LOG_INFO("Snapshot metadata: index=" << metadata.last_included_index
+              << ", term=" << metadata.last_included_term
+              << ", entries=" << metadata.data_size
+              << ", blocks=" << block_count);
+    
+    // Blocks decode independently, so hand them out to a few threads that
+    // put straight into the (pre-sized) store
+    store.reserve(metadata.data_size);
+    size_t threads = options_.load_threads > 0
+        ? static_cast<size_t>(options_.load_threads)
+        : std::min<size_t>(8, std::max(1u, std::thread::hardware_concurrency()));
+    threads = std::max<size_t>(1, std::min<size_t>(threads, blocks.size()));
+    
+    std::atomic<size_t> next_block{0};
+    std::atomic<bool> corrupt{false};
+    auto decodeBlocks = [&]() {
+        std::string buffer;
+        for (size_t i = next_block++; i < blocks.size() && !corrupt; i = next_block++) {
+            const BlockInfo& block = blocks[i];
+            const char* stored = base + block.offset;
+            if (crc32::value(stored, block.stored_len) != block.crc) {
+                corrupt = true;
+                break;
+            }
+            
+            const char* raw = stored;
+            if (block.codec == static_cast<uint8_t>(SnapshotCompression::LZ4)) {
+                buffer.resize(block.raw_len);
+                if (!lz4::decompress(stored, block.stored_len, &buffer[0], block.raw_len)) {
+                    corrupt = true;
+                    break;
+                }
+                raw = buffer.data();
+            } else if (block.codec != static_cast<uint8_t>(SnapshotCompression::NONE) ||
+                       block.raw_len != block.stored_len) {
+                corrupt = true;
+                break;
+            }
+            
+            if (!applyBlock(raw, block.raw_len, block.entries, store)) {
+                corrupt = true;
+                break;
+            }
+        }
+    };
+    
+    std::vector<std::thread> workers;
+    for (size_t t = 1; t < threads; t++) {
+        workers.emplace_back(decodeBlocks);
+    }
+    decodeBlocks();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    
+    if (corrupt) {
+        return fail("block checksum or contents");
+    }
+    for (const BlockInfo& block : expiry) {
+        if (!applyExpiryBlock(base + block.offset, block.stored_len, block.entries, store)) {
+            return fail("key deadlines");
+        }
+    }
+    munmap(mapped, size);
+    return true;
+}
+
+bool SnapshotManager::readMetadata(const std::string& path, SnapshotMetadata& metadata) const {
+    std::ifstream in(path, std::ios::binary);
     if (!in) {
         return false;
     }
     
-    // Skip magic
+    char header[kHeaderSize];
+    in.read(header, sizeof(header));
+    if (in.gcount() >= static_cast<std::streamsize>(sizeof(header)) &&
+        memcmp(header, kMagicV2, sizeof(kMagicV2)) == 0) {
+        if (decodeFixed32(header + kHeaderSize - 4) != crc32::value(header, kHeaderSize - 4)) {
+            return false;
+        }
+        metadata.last_included_index = static_cast<int>(decodeFixed64(header + 8));
+        metadata.last_included_term = static_cast<int>(decodeFixed64(header + 16));
+        metadata.data_size = decodeFixed64(header + 24);
+        return true;
+    }
+    
+    // V1: text header line, then "index term count"
+    in.clear();
+    in.seekg(0);
     std::string magic;
     std::getline(in, magic);
-    
-    // Read metadata
+    if (magic != kMagicV1) {
+        return false;
+    }
     in >> metadata.last_included_index 
        >> metadata.last_included_term 
        >> metadata.data_size;
+    return static_cast<bool>(in);
+}
+
+bool SnapshotManager::getSnapshotMetadata(SnapshotMetadata& metadata) {
+    std::lock_guard<std::mutex> lock(mutex_);
     
-    return true;
+    std::string snapshot_path = findLatestSnapshot();
+    if (snapshot_path.empty()) {
+        return false;
+    }
+    return readMetadata(snapshot_path, metadata);
 }
 
 bool SnapshotManager::hasSnapshot() const {
@@ -270,67 +689,63 @@ size_t SnapshotManager::readSnapshotChunk(
 
 bool SnapshotManager::writeSnapshotChunk(
     size_t offset,
-    const std::vector<char>& data,
+    std::string_view data,
     bool is_last) {
     
     std::lock_guard<std::mutex> lock(mutex_);
     
-    // Open in append mode for first chunk, update mode for subsequent chunks
-    std::ios::openmode mode = std::ios::binary;
-    if (offset == 0) {
-        mode |= std::ios::trunc;  // Truncate if starting fresh
-    } else {
-        mode |= std::ios::in | std::ios::out;  // Read-write for seeking
-    }
-    
-    std::fstream out(temp_snapshot_path_, mode);
-    if (!out) {
-        std::cerr << "[ERROR] Failed to open temp snapshot for chunk write" << std::endl;
+    // Truncate if starting fresh, otherwise write in place
+    int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (offset == 0 ? O_TRUNC : 0);
+    int fd = open(receive_snapshot_path_.c_str(), flags, 0644);
+    if (fd < 0) {
+        LOG_ERROR("Failed to open temp snapshot for chunk write");
         return false;
     }
     
-    // Seek to offset
-    out.seekp(offset);
-    if (!out) {
-        std::cerr << "[ERROR] Failed to seek to offset " << offset << std::endl;
-        return false;
+    // Write chunk
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t n = pwrite(fd, data.data() + written, data.size() - written,
+                           static_cast<off_t>(offset + written));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        written += static_cast<size_t>(n);
     }
+    bool ok = written == data.size();
     
-    // Write chunk
-    out.write(data.data(), data.size());
-    out.flush();
+    // The last chunk makes the file durable before it can be installed
+    if (ok && is_last) {
+        ok = fdatasync(fd) == 0;
+    }
+    close(fd);
     
-    if (!out) {
-        std::cerr << "[ERROR] Failed to write snapshot chunk" << std::endl;
+    if (!ok) {
+        LOG_ERROR("Failed to write snapshot chunk at offset " << offset);
         return false;
     }
+    return true;
+}
+
+int SnapshotManager::openLatestSnapshot(SnapshotMetadata& metadata, uint64_t& file_size) {
+    std::lock_guard<std::mutex> lock(mutex_);
     
-    // If this is the last chunk, read metadata and finalize
-    if (is_last) {
-        out.close();
-        
-        // Read metadata to determine final filename
-        std::ifstream in(temp_snapshot_path_, std::ios::binary);
-        std::string magic;
-        std::getline(in, magic);
-        
-        int last_index, last_term;
-        size_t data_size;
-        in >> last_index >> last_term >> data_size;
-        in.close();
-        
-        // Rename to final location
-        std::string final_path = generateSnapshotFilename(last_index);
-        if (rename(temp_snapshot_path_.c_str(), final_path.c_str()) != 0) {
-            std::cerr << "[ERROR] Failed to finalize snapshot" << std::endl;
-            return false;
-        }
-        
-        std::cout << "[SUCCESS] Received and installed snapshot at index " 
-                  << last_index << std::endl;
+    std::string snapshot_path = findLatestSnapshot();
+    if (snapshot_path.empty() || !readMetadata(snapshot_path, metadata)) {
+        return -1;
     }
-    
-    return true;
+    int fd = open(snapshot_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    file_size = static_cast<uint64_t>(st.st_size);
+    return fd;
 }
 
 void SnapshotManager::cleanupOldSnapshots(int keep_count) {
@@ -365,7 +780,7 @@ void SnapshotManager::cleanupOldSnapshots(int keep_count) {
     
     // Delete all except the most recent keep_count
     for (size_t i = keep_count; i < snapshots.size(); i++) {
-        std::cout << "[INFO] Deleting old snapshot: " << snapshots[i].second << std::endl;
+        LOG_INFO("Deleting old snapshot: " << snapshots[i].second);
         unlink(snapshots[i].second.c_str());
     }
 }
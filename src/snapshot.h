@@ -4,6 +4,9 @@
 #include <vector>
 #include <mutex>
 #include <unordered_map>
+#include <cstdint>
+#include <string_view>
+#include "store.h"
 
 /**
  * Snapshot Metadata
@@ -28,6 +31,17 @@ struct SnapshotMetadata {
         : last_included_index(idx), last_included_term(term), data_size(size) {}
 };
 
+enum class SnapshotCompression : uint8_t {
+    NONE = 0,
+    LZ4 = 1
+};
+
+struct SnapshotOptions {
+    size_t block_bytes = 256 * 1024;    // Uncompressed payload per block
+    SnapshotCompression compression = SnapshotCompression::LZ4;
+    int load_threads = 0;               // Block decoders on load; 0 = one per core (max 8)
+};
+
 /**
  * SnapshotManager
  * 
@@ -57,41 +71,65 @@ struct SnapshotMetadata {
  * - Must preserve last_included_index and last_included_term for log matching
  * - Leader can send snapshots to followers who are too far behind
  * - Followers must handle receiving snapshots (InstallSnapshot RPC)
+ * 
+ * FILE FORMAT (V2):
+ * All integers little-endian (coding.h).
+ *   header  "LKVSNAP2" u64 last_index u64 last_term u64 entry_count u32 crc
+ *   blocks  each is [u32 key_len][u32 value_len][key][value]... covering
+ *           about block_bytes, LZ4-compressed unless that didn't shrink it
+ *   index   per block: u64 offset u32 stored_len u32 raw_len u32 entries
+ *           u32 crc(stored bytes) u8 codec
+ *           A block with codec 0x81 holds the deadlines of expiring keys,
+ *           [u64 deadline][u32 key_len][key]... with entries their count.
+ *           A last block with codec 0x80 holds the client session table
+ *           (session.h) rather than pairs.
+ *   footer  u64 index_offset u32 block_count u32 crc(index) "LKVSNAP2"
+ * The header answers getSnapshotMetadata() on its own. Loading maps the
+ * file, checks the footer and index, then decodes blocks in parallel
+ * straight into the KVStore. V1 (text) snapshots still load.
  */
 class SnapshotManager {
 public:
-    explicit SnapshotManager(const std::string& snapshot_dir, int server_id);
+    SnapshotManager(const std::string& snapshot_dir, int server_id,
+                    const SnapshotOptions& options = SnapshotOptions());
     
     /**
      * Create a snapshot of the current state
      * 
-     * @param data: The complete KV store state
+     * @param data: Point-in-time view of the KV store (KVStore::snapshot())
      * @param last_index: The highest log index applied to this state
      * @param last_term: The term of that log entry
+     * @param sessions: Client session table as of last_index
+     *                  (ClientSessions::encode()), stored in a block of its own
      * @return: True if snapshot created successfully
      * 
      * IMPLEMENTATION NOTES:
-     * - Atomic write: Write to temp file, then rename (crash-safe)
-     * - Format: Simple text format for readability (production might use protobuf)
-     * - Thread-safe: Can be called while server is running
+     * - Atomic write: Write to temp file, fsync, then rename (crash-safe)
+     * - Format: V2 blocks (see above)
+     * - Streams straight from the frozen view one block at a time: no copy
+     *   of the data is made, and the store keeps taking writes meanwhile
      */
-    bool createSnapshot(const std::unordered_map<std::string, std::string>& data,
+    bool createSnapshot(const KVStore::Snapshot& data,
                        int last_index,
-                       int last_term);
+                       int last_term,
+                       std::string_view sessions = {});
     
     /**
      * Load the most recent snapshot
      * 
-     * @param data: Output - will be filled with snapshot data
+     * @param store: Output - the snapshot's pairs are put() into it; expected
+     *               to be empty. On failure it may hold part of the snapshot.
      * @param metadata: Output - will be filled with snapshot metadata
+     * @param sessions: Output, if given - the client session table, empty
+     *                  if the snapshot has none
      * @return: True if snapshot loaded successfully
      * 
      * WHEN TO USE:
      * - On server startup (before replaying WAL)
      * - When receiving InstallSnapshot from leader
      */
-    bool loadSnapshot(std::unordered_map<std::string, std::string>& data,
-                     SnapshotMetadata& metadata);
+    bool loadSnapshot(KVStore& store, SnapshotMetadata& metadata,
+                      std::string* sessions = nullptr);
     
     /**
      * Get metadata of the most recent snapshot
@@ -101,6 +139,14 @@ public:
      */
     bool getSnapshotMetadata(SnapshotMetadata& metadata);
     
+    /**
+     * Open the most recent snapshot for sending (InstallSnapshot)
+     * 
+     * @return: A read-only fd the caller closes, or -1 if there's none.
+     *          Cleanup may unlink the file afterwards; the fd stays valid.
+     */
+    int openLatestSnapshot(SnapshotMetadata& metadata, uint64_t& file_size);
+    
     /**
      * Check if a snapshot exists
      */
@@ -131,10 +177,26 @@ public:
      * 
      * @param offset: Where to write this chunk
      * @param data: The chunk data
-     * @param is_last: True if this is the final chunk
+     * @param is_last: True if this is the final chunk; the file is synced,
+     *                 ready for installReceivedSnapshot()
      * @return: True if write successful
      */
-    bool writeSnapshotChunk(size_t offset, const std::vector<char>& data, bool is_last);
+    bool writeSnapshotChunk(size_t offset, std::string_view data, bool is_last);
+    
+    /**
+     * Load the fully received snapshot, and only then make it ours
+     * 
+     * @param store: Output, as for loadSnapshot(): give it a fresh store and
+     *               swap that in on success (KVStore::assign), so a bad
+     *               file never costs the state we have
+     * @return: True if every block checked out and the file was renamed
+     *          into place as the latest snapshot. On failure it's deleted.
+     * 
+     * Loading is the validation: header, footer, index and every block's
+     * checksum and contents. Must not run alongside writeSnapshotChunk().
+     */
+    bool installReceivedSnapshot(KVStore& store, SnapshotMetadata& metadata,
+                                 std::string* sessions = nullptr);
     
     /**
      * Delete old snapshots (keep only the most recent)
@@ -148,9 +210,11 @@ public:
 private:
     std::string snapshot_dir_;      // Directory to store snapshots
     int server_id_;                 // Server ID for naming
+    SnapshotOptions options_;
     mutable std::mutex mutex_;      // Thread safety
     
     std::string temp_snapshot_path_;  // Temporary file during creation
+    std::string receive_snapshot_path_;  // Snapshot arriving from the leader
     
     // Generate snapshot filename based on index
     std::string generateSnapshotFilename(int last_index) const;
@@ -160,4 +224,14 @@ private:
     
     // Parse snapshot filename to extract index
     int parseSnapshotIndex(const std::string& filename) const;
+    
+    // Header of a V1 or V2 file
+    bool readMetadata(const std::string& path, SnapshotMetadata& metadata) const;
+    
+    // Any version, by its magic
+    bool loadFile(const std::string& path, KVStore& store, SnapshotMetadata& metadata,
+                  std::string* sessions);
+    bool loadV1(const std::string& path, KVStore& store, SnapshotMetadata& metadata);
+    bool loadV2(const std::string& path, KVStore& store, SnapshotMetadata& metadata,
+                std::string* sessions);
 };
@@ -1,48 +1,752 @@
 #include "store.h"
+#include "lz4_block.h"
 #include <algorithm>
+#include <chrono>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <random>
+#include <unordered_set>
 
-void KVStore::put(const std::string& key, const std::string& value) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    data_[key] = value;
+namespace {
+
+// Per entry on top of its key and value bytes: the map's share (for the
+// flat map, a slot and control byte at a typical three-quarters load; else
+// the hash node with its next pointer, cached hash, bucket slot and
+// allocator header), plus the ordered-set node with the key's second
+// string and its allocator header
+#ifdef LOGKV_FLAT_MAP
+constexpr size_t kMapEntryBytes = (sizeof(KVStore::Map::Slot) + 1) * 4 / 3;
+#else
+constexpr size_t kMapEntryBytes = sizeof(KVStore::Map::value_type) + 3 * sizeof(void*) + 16;
+#endif
+constexpr size_t kEntryOverhead = kMapEntryBytes + sizeof(std::string) + 4 * sizeof(void*) + 16;
+
+// A random entry of a non-empty map, or nullptr if none turned up
+template <typename Rng>
+const KVStore::Map::value_type* sampleEntry(const KVStore::Map& map, Rng& rng) {
+#ifdef LOGKV_FLAT_MAP
+    auto it = map.sample(rng());
+    return it == map.end() ? nullptr : &*it;
+#else
+    // A random bucket, walking on past empty ones for a little while
+    size_t buckets = map.bucket_count();
+    size_t bucket = rng() % buckets;
+    for (size_t step = 0; step < 16 && map.bucket_size(bucket) == 0; step++) {
+        bucket = (bucket + 1) % buckets;
+    }
+    return map.bucket_size(bucket) == 0 ? nullptr : &*map.begin(bucket);
+#endif
+}
+
+}  // namespace
+
+KVStore::KVStore(size_t num_shards)
+    : num_shards_(num_shards == 0 ? 1 : num_shards),
+      compress_min_bytes_(0),
+      track_access_(false),
+      shards_(new Shard[num_shards_]) {}
+
+KVStore::KVStore(const StoreOptions& options)
+    : num_shards_(options.shards == 0 ? 1 : options.shards),
+      compress_min_bytes_(options.compress_min_bytes),
+      track_access_(options.track_access),
+      shards_(new Shard[num_shards_]) {}
+
+void KVStore::Usage::add(const std::string& key, const Value& value) {
+    key_bytes += key.size();
+    value_bytes += value.size();
+    stored_bytes += value.data.size();
+    compressed += value.raw_size != 0;
+}
+
+void KVStore::Usage::sub(const std::string& key, const Value& value) {
+    key_bytes -= key.size();
+    value_bytes -= value.size();
+    stored_bytes -= value.data.size();
+    compressed -= value.raw_size != 0;
+}
+
+uint64_t KVStore::nowMillis() {
+    auto now = std::chrono::system_clock::now().time_since_epoch();
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(now).count());
+}
+
+uint32_t KVStore::clockNow() {
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(now).count() / 100);
+}
+
+KVStore::Value KVStore::pack(std::string&& value, uint64_t expires_at) const {
+    uint32_t now = track_access_ ? clockNow() : 0;
+    if (compress_min_bytes_ == 0 || value.size() < compress_min_bytes_ ||
+        value.size() > std::numeric_limits<uint32_t>::max()) {
+        return Value(std::move(value), 0, now, expires_at);
+    }
+    // Compressed into a reused buffer, then copied out at its exact size so
+    // the held string doesn't keep the worst-case capacity
+    thread_local std::string scratch;
+    scratch.clear();
+    lz4::compress(value.data(), value.size(), scratch);
+    if (scratch.size() > value.size() - value.size() / 8) {
+        return Value(std::move(value), 0, now, expires_at);
+    }
+    return Value(std::string(scratch), static_cast<uint32_t>(value.size()), now, expires_at);
+}
+
+void KVStore::unpack(const Value& value, std::string& out) {
+    if (value.raw_size == 0) {
+        out = value.data;
+        return;
+    }
+    out.resize(value.raw_size);
+    // Our own output, so this can't fail short of memory corruption
+    lz4::decompress(value.data.data(), value.data.size(), &out[0], out.size());
+}
+
+size_t KVStore::shardOf(std::string_view key) const {
+    return std::hash<std::string_view>{}(key) % num_shards_;
+}
+
+KVStore::Shard& KVStore::shardFor(const std::string& key) const {
+    return shards_[shardOf(key)];
+}
+
+const KVStore::Value* KVStore::findLocked(const Shard& shard, const std::string& key) {
+    // Assumes the shard's lock is held
+    if (shard.frozen) {
+        auto it = shard.delta.find(key);
+        if (it != shard.delta.end()) {
+            return it->second ? &*it->second : nullptr;
+        }
+    }
+    auto it = shard.data->find(key);
+    return it == shard.data->end() ? nullptr : &it->second;
+}
+
+template <typename K>
+void KVStore::putImpl(K&& key, std::string&& value, uint64_t expires_at) {
+    Value packed = pack(std::move(value), expires_at);
+    Shard& shard = shardFor(key);
+    std::vector<std::pair<uint64_t, std::string>> expiring;
+    if (expires_at != 0) {
+        expiring.emplace_back(expires_at, key);
+    }
+    {
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        putLocked(shard, std::forward<K>(key), std::move(packed));
+    }
+    if (!expiring.empty()) {
+        scheduleExpiry(std::move(expiring));
+    }
+}
+
+template <typename K>
+void KVStore::putLocked(Shard& shard, K&& key, Value&& value) {
+    // Assumes the shard's lock is held exclusively
+    if (!shard.frozen) {
+        // try_emplace leaves value alone if the key is there
+        auto result = shard.data->try_emplace(std::forward<K>(key), std::move(value));
+        if (result.second) {
+            shard.index.insert(result.first->first);
+        } else {
+            shard.usage.sub(result.first->first, result.first->second);
+            result.first->second = std::move(value);
+        }
+        shard.usage.add(result.first->first, result.first->second);
+        shard.count = shard.data->size();
+        return;
+    }
+    const Value* old = findLocked(shard, key);
+    if (old) {
+        shard.usage.sub(key, *old);
+    } else {
+        shard.count++;
+        shard.index.insert(key);
+    }
+    shard.usage.add(key, value);
+    shard.delta.insert_or_assign(std::forward<K>(key), std::optional<Value>(std::move(value)));
+}
+
+void KVStore::put(const std::string& key, const std::string& value, uint64_t expires_at) {
+    putImpl(key, std::string(value), expires_at);
+}
+
+void KVStore::put(std::string&& key, std::string&& value, uint64_t expires_at) {
+    putImpl(std::move(key), std::move(value), expires_at);
 }
 
 bool KVStore::get(const std::string& key, std::string& value) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    auto it = data_.find(key);
-    if (it == data_.end()) return false;
-    value = it->second;
+    Shard& shard = shardFor(key);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    const Value* found = findLocked(shard, key);
+    if (!found || (found->expires_at != 0 && found->expired(nowMillis()))) return false;
+    if (track_access_) {
+        touch(*found);
+    }
+    unpack(*found, value);
     return true;
 }
 
 bool KVStore::remove(const std::string& key) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    return data_.erase(key) > 0;
+    Shard& shard = shardFor(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    return removeLocked(shard, key);
+}
+
+bool KVStore::removeLocked(Shard& shard, const std::string& key) {
+    // Assumes the shard's lock is held exclusively
+    if (!shard.frozen) {
+        auto it = shard.data->find(key);
+        if (it == shard.data->end()) {
+            return false;
+        }
+        shard.usage.sub(it->first, it->second);
+        shard.index.erase(key);
+        shard.data->erase(it);
+        shard.count = shard.data->size();
+        return true;
+    }
+    const Value* old = findLocked(shard, key);
+    if (!old) {
+        return false;
+    }
+    shard.usage.sub(key, *old);
+    shard.count--;
+    shard.index.erase(key);
+    if (shard.data->count(key)) {
+        shard.delta[key] = std::nullopt;   // Hide the frozen value
+    } else {
+        shard.delta.erase(key);            // Only ever lived in the delta
+    }
+    return true;
+}
+
+template <typename Keys, typename KeyOf>
+std::vector<size_t> KVStore::shardsOf(const Keys& keys, KeyOf key_of) const {
+    std::vector<size_t> shards;
+    shards.reserve(keys.size());
+    for (const auto& item : keys) {
+        shards.push_back(shardOf(key_of(item)));
+    }
+    std::sort(shards.begin(), shards.end());
+    shards.erase(std::unique(shards.begin(), shards.end()), shards.end());
+    return shards;
+}
+
+void KVStore::putMany(std::vector<std::pair<std::string, std::string>> pairs) {
+    auto shards = shardsOf(pairs, [](const auto& pair) -> const std::string& { return pair.first; });
+    std::vector<Value> packed;
+    packed.reserve(pairs.size());
+    for (auto& pair : pairs) {
+        packed.push_back(pack(std::move(pair.second)));
+    }
+    std::vector<std::unique_lock<std::shared_mutex>> locks;
+    locks.reserve(shards.size());
+    for (size_t s : shards) {
+        locks.emplace_back(shards_[s].mutex);
+    }
+    // In order, so a key given twice ends up with its last value
+    for (size_t i = 0; i < pairs.size(); i++) {
+        Shard& shard = shardFor(pairs[i].first);
+        putLocked(shard, std::move(pairs[i].first), std::move(packed[i]));
+    }
+}
+
+void KVStore::applyBatch(std::vector<Write> writes) {
+    auto shards = shardsOf(writes, [](const Write& write) -> const std::string& { return write.key; });
+    std::vector<Value> packed(writes.size());
+    std::vector<std::pair<uint64_t, std::string>> expiring;
+    for (size_t i = 0; i < writes.size(); i++) {
+        if (writes[i].value) {
+            packed[i] = pack(std::move(*writes[i].value), writes[i].expires_at);
+            if (writes[i].expires_at != 0) {
+                expiring.emplace_back(writes[i].expires_at, writes[i].key);
+            }
+        }
+    }
+    {
+        std::vector<std::unique_lock<std::shared_mutex>> locks;
+        locks.reserve(shards.size());
+        for (size_t s : shards) {
+            locks.emplace_back(shards_[s].mutex);
+        }
+        for (size_t i = 0; i < writes.size(); i++) {
+            std::string& key = writes[i].key;
+            Shard& shard = shardFor(key);
+            if (writes[i].value) {
+                putLocked(shard, std::move(key), std::move(packed[i]));
+            } else {
+                removeLocked(shard, key);
+            }
+        }
+    }
+    if (!expiring.empty()) {
+        scheduleExpiry(std::move(expiring));
+    }
+}
+
+void KVStore::getMany(const std::vector<std::string>& keys,
+                      std::vector<std::optional<std::string>>& values) {
+    auto shards = shardsOf(keys, [](const std::string& key) -> const std::string& { return key; });
+    std::vector<std::shared_lock<std::shared_mutex>> locks;
+    locks.reserve(shards.size());
+    for (size_t s : shards) {
+        locks.emplace_back(shards_[s].mutex);
+    }
+    values.clear();
+    values.reserve(keys.size());
+    uint64_t now = 0;   // Read once, and only if some value has a deadline
+    for (const auto& key : keys) {
+        const Value* found = findLocked(shardFor(key), key);
+        if (found && found->expires_at != 0) {
+            now = now ? now : nowMillis();
+            found = found->expired(now) ? nullptr : found;
+        }
+        if (found) {
+            if (track_access_) {
+                touch(*found);
+            }
+            values.emplace_back(std::in_place);
+            unpack(*found, *values.back());
+        } else {
+            values.push_back(std::nullopt);
+        }
+    }
 }
 
 bool KVStore::exists(const std::string& key) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    return data_.find(key) != data_.end();
+    Shard& shard = shardFor(key);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    const Value* found = findLocked(shard, key);
+    return found && (found->expires_at == 0 || !found->expired(nowMillis()));
 }
 
 std::vector<std::string> KVStore::getAllKeys() {
-    std::lock_guard<std::mutex> lock(mutex_);
     std::vector<std::string> keys;
-    keys.reserve(data_.size());
-    
-    for (const auto& pair : data_) {
-        keys.push_back(pair.first);
+    keys.reserve(size());
+
+    // Already in order: no sort
+    Cursor cursor = scan(std::string());
+    std::string key, value;
+    while (cursor.next(key, value)) {
+        keys.push_back(std::move(key));
     }
-    
-    std::sort(keys.begin(), keys.end());
     return keys;
 }
 
+KVStore::Cursor KVStore::scan(std::string start, std::string end) {
+    return Cursor(*this, std::move(start), std::move(end));
+}
+
+std::string KVStore::prefixEnd(std::string prefix) {
+    // Bump the last byte that can be bumped and drop what follows it
+    while (!prefix.empty()) {
+        unsigned char last = static_cast<unsigned char>(prefix.back());
+        if (last != 0xFF) {
+            prefix.back() = static_cast<char>(last + 1);
+            return prefix;
+        }
+        prefix.pop_back();
+    }
+    return prefix;
+}
+
 size_t KVStore::size() const {
-    std::lock_guard<std::mutex> lock(mutex_);
-    return data_.size();
+    size_t total = 0;
+    for (size_t i = 0; i < num_shards_; i++) {
+        std::shared_lock<std::shared_mutex> lock(shards_[i].mutex);
+        total += shards_[i].count;
+    }
+    return total;
 }
 
 void KVStore::clear() {
-    std::lock_guard<std::mutex> lock(mutex_);
-    data_.clear();
-}
\ No newline at end of file
+    for (size_t i = 0; i < num_shards_; i++) {
+        Shard& shard = shards_[i];
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        if (shard.frozen) {
+            // A snapshot still reads the old map; start a fresh one
+            shard.data = std::make_shared<Map>();
+            shard.delta.clear();
+            shard.frozen = false;
+        } else {
+            shard.data->clear();
+        }
+        shard.index.clear();
+        shard.count = 0;
+        shard.usage = Usage();
+    }
+    std::lock_guard<std::mutex> lock(expiry_.mutex);
+    for (auto& slot : expiry_.slots) {
+        slot.clear();
+    }
+    expiry_.due.clear();
+}
+
+void KVStore::assign(KVStore& other) {
+    std::vector<std::unique_lock<std::shared_mutex>> locks;
+    locks.reserve(num_shards_ * 2);
+    for (size_t i = 0; i < num_shards_; i++) {
+        locks.emplace_back(shards_[i].mutex);
+    }
+    for (size_t i = 0; i < num_shards_; i++) {
+        locks.emplace_back(other.shards_[i].mutex);
+    }
+    for (size_t i = 0; i < num_shards_; i++) {
+        Shard& shard = shards_[i];
+        Shard& incoming = other.shards_[i];
+        if (shard.frozen) {
+            // A snapshot still reads the old map; it goes on doing so, and
+            // thawing finds nothing to fold back
+            shard.delta.clear();
+            shard.frozen = false;
+        }
+        std::swap(shard.data, incoming.data);
+        std::swap(shard.index, incoming.index);
+        std::swap(shard.count, incoming.count);
+        std::swap(shard.usage, incoming.usage);
+    }
+    locks.clear();
+    
+    std::scoped_lock lock(expiry_.mutex, other.expiry_.mutex);
+    std::swap(expiry_.slots, other.expiry_.slots);
+    std::swap(expiry_.swept, other.expiry_.swept);
+    std::swap(expiry_.due, other.expiry_.due);
+}
+
+StoreMemory KVStore::memory() const {
+    StoreMemory memory;
+    for (size_t i = 0; i < num_shards_; i++) {
+        std::shared_lock<std::shared_mutex> lock(shards_[i].mutex);
+        const Usage& usage = shards_[i].usage;
+        memory.keys += shards_[i].count;
+        memory.key_bytes += usage.key_bytes;
+        memory.value_bytes += usage.value_bytes;
+        memory.stored_value_bytes += usage.stored_bytes;
+        memory.compressed_values += usage.compressed;
+    }
+    memory.total = memory.keys * kEntryOverhead + 2 * memory.key_bytes + memory.stored_value_bytes;
+    return memory;
+}
+
+std::vector<std::pair<std::string, size_t>> KVStore::evictionCandidates(size_t bytes,
+                                                                        MemoryPolicy policy) {
+    std::vector<std::pair<std::string, size_t>> victims;
+    if (policy == MemoryPolicy::REJECT) {
+        return victims;
+    }
+    thread_local std::mt19937_64 rng(std::random_device{}());
+    std::unordered_set<std::string> picked;
+    size_t freed = 0;
+    uint32_t now = clockNow();
+    // Bounded, so a store that's nearly all picked or empty gives up
+    for (size_t attempt = 0; freed < bytes && attempt < 64 + 4 * victims.size(); attempt++) {
+        const Shard& shard = shards_[rng() % num_shards_];
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        const Map& map = *shard.data;
+        if (map.empty()) {
+            continue;
+        }
+        const std::string* best = nullptr;
+        const Value* best_value = nullptr;
+        for (size_t sample = 0; sample < kEvictionSamples; sample++) {
+            const Map::value_type* it = sampleEntry(map, rng);
+            if (!it) {
+                continue;
+            }
+            // The frozen map may hold keys since deleted or rewritten
+            const Value* value = findLocked(shard, it->first);
+            if (!value || picked.count(it->first)) {
+                continue;
+            }
+            uint32_t age = now - value->touched.load(std::memory_order_relaxed);
+            if (!best || (policy == MemoryPolicy::EVICT_LRU &&
+                          age > now - best_value->touched.load(std::memory_order_relaxed))) {
+                best = &it->first;
+                best_value = value;
+            }
+            if (policy == MemoryPolicy::EVICT_RANDOM) {
+                break;
+            }
+        }
+        if (best) {
+            size_t cost = kEntryOverhead + 2 * best->size() + best_value->data.size();
+            picked.insert(*best);
+            victims.emplace_back(*best, cost);
+            freed += cost;
+        }
+    }
+    return victims;
+}
+
+void KVStore::scheduleExpiry(std::vector<std::pair<uint64_t, std::string>> keys) {
+    std::lock_guard<std::mutex> lock(expiry_.mutex);
+    for (auto& entry : keys) {
+        // A deadline in a second already drained goes in the next one
+        uint64_t second = std::max(entry.first / 1000, expiry_.swept + 1);
+        expiry_.slots[second % ExpiryWheel::kSlots].push_back(std::move(entry));
+    }
+}
+
+std::vector<std::string> KVStore::expiredKeys(size_t max) {
+    // Is deadline still what the key carries? Anything else means it was
+    // rewritten or deleted since it was filed.
+    auto current = [this](const std::string& key, uint64_t deadline) {
+        const Shard& shard = shardFor(key);
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        const Value* value = findLocked(shard, key);
+        return value && value->expires_at == deadline;
+    };
+
+    // Drain the whole seconds passed since the last call (at most a turn):
+    // what's filed there is due, bar keys a turn or more further out
+    std::vector<std::pair<uint64_t, std::string>> drained;
+    {
+        std::lock_guard<std::mutex> lock(expiry_.mutex);
+        uint64_t last = nowMillis() / 1000 - 1;
+        uint64_t steps = std::min<uint64_t>(last - std::min(last, expiry_.swept), ExpiryWheel::kSlots);
+        for (uint64_t second = last + 1 - steps; second <= last; second++) {
+            auto& slot = expiry_.slots[second % ExpiryWheel::kSlots];
+            size_t kept = 0;
+            for (size_t i = 0; i < slot.size(); i++) {
+                if (slot[i].first / 1000 <= last) {
+                    drained.push_back(std::move(slot[i]));
+                } else if (kept++ != i) {
+                    slot[kept - 1] = std::move(slot[i]);
+                }
+            }
+            if (kept == 0) {
+                std::vector<std::pair<uint64_t, std::string>>().swap(slot);   // Let a burst go
+            } else {
+                slot.resize(kept);
+            }
+        }
+        expiry_.swept = std::max(expiry_.swept, last);
+    }
+    drained.erase(std::remove_if(drained.begin(), drained.end(),
+                                 [&](const auto& entry) { return !current(entry.second, entry.first); }),
+                  drained.end());
+
+    std::vector<std::pair<std::string, uint64_t>> picked;
+    {
+        std::lock_guard<std::mutex> lock(expiry_.mutex);
+        for (auto& [deadline, key] : drained) {
+            expiry_.due.insert_or_assign(std::move(key), deadline);
+        }
+        for (const auto& [key, deadline] : expiry_.due) {
+            if (picked.size() >= max) {
+                break;
+            }
+            picked.emplace_back(key, deadline);
+        }
+    }
+
+    // Due keys rewritten since they came due are dropped, unless they came
+    // due again meanwhile
+    std::vector<std::string> keys;
+    std::vector<std::pair<std::string, uint64_t>> stale;
+    for (auto& entry : picked) {
+        if (current(entry.first, entry.second)) {
+            keys.push_back(std::move(entry.first));
+        } else {
+            stale.push_back(std::move(entry));
+        }
+    }
+    if (!stale.empty()) {
+        std::lock_guard<std::mutex> lock(expiry_.mutex);
+        for (const auto& [key, deadline] : stale) {
+            auto it = expiry_.due.find(key);
+            if (it != expiry_.due.end() && it->second == deadline) {
+                expiry_.due.erase(it);
+            }
+        }
+    }
+    return keys;
+}
+
+size_t KVStore::expire(const std::vector<std::string_view>& keys, uint64_t now) {
+    std::vector<std::string> owned(keys.begin(), keys.end());
+    auto shards = shardsOf(owned, [](const std::string& key) -> const std::string& { return key; });
+    std::vector<std::pair<std::string, uint64_t>> gone;
+    {
+        std::vector<std::unique_lock<std::shared_mutex>> locks;
+        locks.reserve(shards.size());
+        for (size_t s : shards) {
+            locks.emplace_back(shards_[s].mutex);
+        }
+        for (auto& key : owned) {
+            Shard& shard = shardFor(key);
+            const Value* value = findLocked(shard, key);
+            if (value && value->expired(now)) {
+                uint64_t deadline = value->expires_at;
+                removeLocked(shard, key);
+                gone.emplace_back(std::move(key), deadline);
+            }
+        }
+    }
+    if (!gone.empty()) {
+        std::lock_guard<std::mutex> lock(expiry_.mutex);
+        for (const auto& [key, deadline] : gone) {
+            auto it = expiry_.due.find(key);
+            if (it != expiry_.due.end() && it->second == deadline) {
+                expiry_.due.erase(it);
+            }
+        }
+    }
+    return gone.size();
+}
+
+void KVStore::expireAt(const std::string& key, uint64_t expires_at) {
+    Shard& shard = shardFor(key);
+    {
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        const Value* value = findLocked(shard, key);
+        if (!value) {
+            return;
+        }
+        if (shard.frozen && !shard.delta.count(key)) {
+            // The frozen map is a snapshot's, so the key is written again
+            std::string bytes;
+            unpack(*value, bytes);
+            putLocked(shard, std::string(key), pack(std::move(bytes), expires_at));
+        } else {
+            const_cast<Value*>(value)->expires_at = expires_at;
+        }
+    }
+    if (expires_at != 0) {
+        scheduleExpiry({{expires_at, key}});
+    }
+}
+
+void KVStore::reserve(size_t total_keys) {
+    size_t per_shard = total_keys / num_shards_ + 1;
+    for (size_t i = 0; i < num_shards_; i++) {
+        std::unique_lock<std::shared_mutex> lock(shards_[i].mutex);
+        if (!shards_[i].frozen) {
+            shards_[i].data->reserve(per_shard);
+        }
+    }
+}
+
+std::unique_ptr<KVStore::Snapshot> KVStore::snapshot() {
+    if (snapshot_live_.exchange(true)) {
+        return nullptr;
+    }
+
+    // Callers snapshot from the apply path, so no write slips in between
+    // freezing one shard and the next
+    std::vector<std::shared_ptr<const Map>> frozen;
+    frozen.reserve(num_shards_);
+    size_t total = 0;
+    for (size_t i = 0; i < num_shards_; i++) {
+        Shard& shard = shards_[i];
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        shard.frozen = true;
+        frozen.push_back(shard.data);
+        total += shard.count;
+    }
+    return std::unique_ptr<Snapshot>(new Snapshot(*this, std::move(frozen), total));
+}
+
+void KVStore::thawLocked(Shard& shard) {
+    // Assumes the shard's lock is held. Costs one map operation per key
+    // written while the snapshot was alive.
+    if (!shard.frozen) {
+        return;  // clear() already replaced the map
+    }
+    for (auto& [key, value] : shard.delta) {
+        if (value) {
+            (*shard.data)[key] = std::move(*value);
+        } else {
+            shard.data->erase(key);
+        }
+    }
+    shard.delta.clear();
+    shard.frozen = false;
+    shard.count = shard.data->size();
+}
+
+void KVStore::release() {
+    for (size_t i = 0; i < num_shards_; i++) {
+        std::unique_lock<std::shared_mutex> lock(shards_[i].mutex);
+        thawLocked(shards_[i]);
+    }
+    snapshot_live_.store(false);
+}
+
+KVStore::Snapshot::~Snapshot() {
+    // Nothing reads the frozen maps past this point, so the store may
+    // mutate them again
+    shards_.clear();
+    store_.release();
+}
+
+// ============================================================================
+// Cursor
+// ============================================================================
+
+KVStore::Cursor::Cursor(KVStore& store, std::string start, std::string end)
+    : store_(store), start_(std::move(start)), end_(std::move(end)),
+      lanes_(store.num_shards_) {}
+
+bool KVStore::Cursor::fill(size_t shard_index) {
+    // Next chunk of this shard's keys, picking up after the last one taken
+    Lane& lane = lanes_[shard_index];
+    lane.buffered.clear();
+    lane.pos = 0;
+
+    const Shard& shard = store_.shards_[shard_index];
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = lane.started ? shard.index.upper_bound(lane.resume)
+                           : shard.index.lower_bound(start_);
+    lane.started = true;
+    uint64_t now = 0;
+    for (; it != shard.index.end() && lane.buffered.size() < kChunkKeys; ++it) {
+        if (!end_.empty() && *it >= end_) {
+            break;
+        }
+        // Scans don't count as use for eviction: one pass over the store
+        // would make everything look fresh
+        const Value* value = findLocked(shard, *it);
+        if (value && value->expires_at != 0) {
+            now = now ? now : nowMillis();
+            value = value->expired(now) ? nullptr : value;
+        }
+        if (value) {
+            lane.buffered.emplace_back(*it, std::string());
+            unpack(*value, lane.buffered.back().second);
+        }
+    }
+    if (lane.buffered.empty()) {
+        lane.exhausted = true;
+        return false;
+    }
+    lane.resume = lane.buffered.back().first;
+    return true;
+}
+
+bool KVStore::Cursor::next(std::string& key, std::string& value) {
+    // The smallest buffered key across shards; a handful of shards makes a
+    // linear pass cheaper than keeping a heap
+    Lane* best = nullptr;
+    for (size_t i = 0; i < lanes_.size(); i++) {
+        Lane& lane = lanes_[i];
+        if (lane.exhausted) {
+            continue;
+        }
+        if (lane.pos == lane.buffered.size() && !fill(i)) {
+            continue;
+        }
+        if (!best || lane.buffered[lane.pos].first < best->buffered[best->pos].first) {
+            best = &lane;
+        }
+    }
+    if (!best) {
+        return false;
+    }
+    auto& pair = best->buffered[best->pos++];
+    key = std::move(pair.first);
+    value = std::move(pair.second);
+    return true;
+}
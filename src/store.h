@@ -1,26 +1,381 @@
 #pragma once
 #include <unordered_map>
+#include <set>
 #include <string>
+#include <string_view>
+#include <shared_mutex>
+#include <memory>
 #include <mutex>
+#include <optional>
+#include <atomic>
 #include <vector>
+#include <utility>
+#include <cstdint>
+#ifdef LOGKV_FLAT_MAP
+#include "flat_map.h"
+#endif
 
+struct StoreOptions {
+    size_t shards = 16;                 // KVStore::kDefaultShards
+    size_t compress_min_bytes = 0;      // LZ4-compress values at least this long; 0 = never
+    bool track_access = false;          // Stamp values on every GET, for EVICT_LRU
+};
+
+// How a store over its memory budget makes room (ServerConfig::max_memory)
+enum class MemoryPolicy {
+    REJECT,         // Refuse writes that add data until deletes make room
+    EVICT_LRU,      // Delete the least recently used keys (sampled)
+    EVICT_RANDOM    // Delete random keys
+};
+
+// What a store holds, from KVStore::memory()
+struct StoreMemory {
+    size_t keys = 0;
+    size_t key_bytes = 0;
+    size_t value_bytes = 0;         // As written
+    size_t stored_value_bytes = 0;  // As held, after compression
+    size_t compressed_values = 0;
+    size_t total = 0;               // Estimated heap use, per-entry overhead included
+};
+
+/**
+ * KVStore
+ *
+ * Hash-partitioned key-value store. Keys are spread over a fixed number of
+ * shards, each with its own map and reader-writer lock, so a GET only
+ * contends with writes that land in the same shard and concurrent GETs never
+ * block each other.
+ *
+ * POINT-IN-TIME SNAPSHOTS:
+ * snapshot() freezes every shard's map and hands the frozen maps to a
+ * Snapshot, which can be read from another thread without any lock. While
+ * it's alive, writes go to a small per-shard delta (deletes as tombstones)
+ * that reads check first; nothing is copied up front. Destroying the
+ * Snapshot folds each delta back into its map. So taking a snapshot costs
+ * a lock per shard, and the extra memory is just what was written while it
+ * was being saved.
+ *
+ * ORDERED ACCESS:
+ * Next to its hash map, each shard keeps its live keys in an ordered set.
+ * Point operations still go to the hash map; the set is only touched when
+ * a key appears or goes away. A Cursor merges the shards' sets to stream a
+ * key range in order.
+ *
+ * MEMORY:
+ * Each shard keeps a running count of its key and value bytes, so memory()
+ * is a lock per shard rather than a walk. The total adds a fixed per-entry
+ * cost for the hash and ordered-set nodes and the key's second copy; it's
+ * an estimate of heap use, not an allocator reading, and counts what the
+ * store holds live (a running snapshot also pins the values overwritten
+ * since it started). Values at least StoreOptions::compress_min_bytes long
+ * are held LZ4-compressed when that saves an eighth or more, and inflated
+ * again on the way out, so callers only ever see the bytes they wrote.
+ * With StoreOptions::track_access, every value also records when it was
+ * last read or written, coarsely, for evictionCandidates(); without it,
+ * only when it was written, and reads skip the clock.
+ *
+ * EXPIRY:
+ * A value may carry a deadline, in Unix milliseconds. Reads treat a value
+ * past it as gone, checking the clock only for values that have one, but
+ * the key stays until expire() deletes it: that's the caller's to drive
+ * (through the log, so replicas delete the same keys). expiredKeys() says
+ * which keys are due. It's served by a hashed timing wheel of one-second
+ * slots, like TimerWheel's but holding keys rather than callbacks: a TTL
+ * write files its key under the second of its deadline, and each call
+ * drains the seconds passed since the last into a set of due keys. The
+ * wheel is only a hint; every entry is checked against the key's current
+ * deadline before it's believed, so rewrites and deletes never touch it.
+ */
 class KVStore {
 public:
-    void put(const std::string& key, const std::string& value);
+    static constexpr size_t kDefaultShards = 16;
+
+    // A value as held: the bytes as written, or their LZ4 block form if
+    // raw_size is nonzero. touched is the store clock at the last GET or
+    // write; readers bump it under the shared lock, hence atomic.
+    // expires_at is the deadline in Unix milliseconds, 0 for none.
+    struct Value {
+        std::string data;
+        uint64_t expires_at = 0;
+        uint32_t raw_size = 0;
+        mutable std::atomic<uint32_t> touched{0};
+
+        Value() = default;
+        Value(std::string bytes, uint32_t raw, uint32_t now, uint64_t deadline = 0)
+            : data(std::move(bytes)), expires_at(deadline), raw_size(raw), touched(now) {}
+        Value(Value&& other) noexcept
+            : data(std::move(other.data)), expires_at(other.expires_at), raw_size(other.raw_size),
+              touched(other.touched.load(std::memory_order_relaxed)) {}
+        Value& operator=(Value&& other) noexcept {
+            data = std::move(other.data);
+            expires_at = other.expires_at;
+            raw_size = other.raw_size;
+            touched.store(other.touched.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            return *this;
+        }
+
+        size_t size() const { return raw_size ? raw_size : data.size(); }
+        bool expired(uint64_t now) const { return expires_at != 0 && expires_at <= now; }
+    };
+
+    // Per shard. LOGKV_FLAT_MAP (a build option) swaps in the open-addressing
+    // FlatStringMap: no allocation per entry and shorter lookups, but
+    // growing invalidates references into it, which nothing here keeps.
+#ifdef LOGKV_FLAT_MAP
+    using Map = FlatStringMap<Value>;
+#else
+    using Map = std::unordered_map<std::string, Value>;
+#endif
+    // One write of a batch: a put, or a delete when the value is nullopt
+    struct Write {
+        std::string key;
+        std::optional<std::string> value;
+        uint64_t expires_at = 0;            // As for put()
+
+        Write(std::string k, std::optional<std::string> v, uint64_t deadline = 0)
+            : key(std::move(k)), value(std::move(v)), expires_at(deadline) {}
+    };
+
+    class Snapshot;
+    class Cursor;
+
+    explicit KVStore(size_t num_shards = kDefaultShards);
+    explicit KVStore(const StoreOptions& options);
+
+    // expires_at: the key's deadline in Unix milliseconds; 0 for none
+    void put(const std::string& key, const std::string& value, uint64_t expires_at = 0);
+    void put(std::string&& key, std::string&& value, uint64_t expires_at = 0);
     bool get(const std::string& key, std::string& value);
     bool remove(const std::string& key);
     bool exists(const std::string& key);
-    
-    // Get all keys (for debugging/admin)
+
+    // Multi-key operations lock every shard involved (in shard order, so
+    // they can't deadlock each other) before touching any key. A reader
+    // sees all of a putMany or none of it, and getMany reads one
+    // consistent cut of its keys.
+    void putMany(std::vector<std::pair<std::string, std::string>> pairs);
+    void getMany(const std::vector<std::string>& keys,
+                 std::vector<std::optional<std::string>>& values);
+    // Writes in order under one lock acquisition per shard, with putMany's
+    // all-or-nothing visibility. How committed log batches are applied.
+    void applyBatch(std::vector<Write> writes);
+
+    // Stream keys in [start, end) in order; an empty end means no upper
+    // bound. See Cursor for what it does and doesn't guarantee.
+    Cursor scan(std::string start, std::string end = std::string());
+
+    // The smallest key greater than every key starting with prefix, for
+    // prefix scans; empty (unbounded) if there is none
+    static std::string prefixEnd(std::string prefix);
+
+    // Get all keys in order (for debugging/admin)
     std::vector<std::string> getAllKeys();
-    
+
     // Get store size
     size_t size() const;
-    
+
     // Clear all data (for testing)
     void clear();
 
+    // Take over other's contents, for installing a store loaded on the
+    // side. other is left holding our old maps, to be freed wherever it's
+    // destroyed; it's fit for nothing else. Every shard is locked at once,
+    // so readers see the old contents or the new, never a mix. Both stores
+    // must have the same shard count (same options) and other no live
+    // snapshot; one of ours keeps reading what it froze.
+    void assign(KVStore& other);
+
+    size_t shardCount() const { return num_shards_; }
+
+    StoreMemory memory() const;
+
+    // Keys worth about `bytes` of memory() to delete, with what each frees.
+    // Every pick is the oldest-touched (EVICT_LRU) or first (EVICT_RANDOM)
+    // of kEvictionSamples random keys, in the manner of Redis' approximate
+    // LRU; fewer come back if the store runs out. The store is left alone:
+    // the caller deletes them (through the log, so replicas agree).
+    static constexpr size_t kEvictionSamples = 5;
+    std::vector<std::pair<std::string, size_t>> evictionCandidates(size_t bytes,
+                                                                   MemoryPolicy policy);
+
+    // The clock deadlines are read against: Unix time in milliseconds
+    static uint64_t nowMillis();
+
+    // Up to max keys past their deadline, after moving the wheel on to now;
+    // max 0 only moves it on. A key stays due until expire() or a rewrite
+    // deals with it, so ask again only once the last batch is through.
+    std::vector<std::string> expiredKeys(size_t max);
+    // Delete those of keys whose deadline is at or before now, which is
+    // what the log's EXPIRE entries do; returns how many went
+    size_t expire(const std::vector<std::string_view>& keys, uint64_t now);
+    // Set a present key's deadline; for loading snapshots
+    void expireAt(const std::string& key, uint64_t expires_at);
+
+    // Shard a key lives in, [0, shardCount())
+    size_t shardOf(std::string_view key) const;
+
+    // Size the shards for about this many keys up front (bulk loads)
+    void reserve(size_t total_keys);
+
+    // Freeze the current contents. Only one snapshot may be alive at a time;
+    // returns nullptr while another is. The store must outlive it.
+    std::unique_ptr<Snapshot> snapshot();
+
 private:
-    std::unordered_map<std::string, std::string> data_;
-    mutable std::mutex mutex_;
-};
\ No newline at end of file
+    // Byte counts of a shard's live entries, for memory()
+    struct Usage {
+        size_t key_bytes = 0;
+        size_t value_bytes = 0;
+        size_t stored_bytes = 0;
+        size_t compressed = 0;
+
+        void add(const std::string& key, const Value& value);
+        void sub(const std::string& key, const Value& value);
+    };
+
+    // Padded to a cache line so neighbouring shard locks don't false-share
+    struct alignas(64) Shard {
+        std::shared_ptr<Map> data = std::make_shared<Map>();
+        // Writes since the shard was frozen; nullopt marks a delete
+        std::unordered_map<std::string, std::optional<Value>> delta;
+        bool frozen = false;        // data belongs to a Snapshot: don't touch it
+        size_t count = 0;           // Live keys, data and delta combined
+        Usage usage;                // Of the same live keys
+        std::set<std::string> index;    // Live keys in order; never frozen
+        mutable std::shared_mutex mutex;
+    };
+
+    // Keys with a deadline, filed under the second it falls in. Never
+    // locked together with a shard: writes file keys after they unlock.
+    struct ExpiryWheel {
+        static constexpr size_t kSlots = 1024;     // Seconds per turn
+        std::vector<std::vector<std::pair<uint64_t, std::string>>> slots{kSlots};
+        uint64_t swept = 0;                         // Last second drained
+        std::unordered_map<std::string, uint64_t> due;     // Key -> deadline
+        std::mutex mutex;
+    };
+
+    size_t num_shards_;
+    size_t compress_min_bytes_;
+    bool track_access_;
+    std::unique_ptr<Shard[]> shards_;
+    std::atomic<bool> snapshot_live_{false};
+    ExpiryWheel expiry_;
+
+    Shard& shardFor(const std::string& key) const;
+
+    // The held form of a value (compressed if it pays), built before any
+    // lock is taken; and back
+    Value pack(std::string&& value, uint64_t expires_at = 0) const;
+    static void unpack(const Value& value, std::string& out);
+    // Coarse clock for Value::touched, in tenths of a second
+    static uint32_t clockNow();
+    static void touch(const Value& value) {
+        // Only a store when the clock moved, so hot keys' lines stay shared
+        uint32_t now = clockNow();
+        if (value.touched.load(std::memory_order_relaxed) != now) {
+            value.touched.store(now, std::memory_order_relaxed);
+        }
+    }
+
+    template <typename K>
+    void putImpl(K&& key, std::string&& value, uint64_t expires_at);
+    template <typename K>
+    static void putLocked(Shard& shard, K&& key, Value&& value);
+    static bool removeLocked(Shard& shard, const std::string& key);
+    
+    // Distinct shards holding keys, ascending
+    template <typename Keys, typename KeyOf>
+    std::vector<size_t> shardsOf(const Keys& keys, KeyOf key_of) const;
+
+    // Assume the shard's lock is held
+    static const Value* findLocked(const Shard& shard, const std::string& key);
+    static void thawLocked(Shard& shard);
+
+    // File keys with their deadlines in the wheel
+    void scheduleExpiry(std::vector<std::pair<uint64_t, std::string>> keys);
+
+    void release();
+};
+
+/**
+ * KVStore::Cursor
+ *
+ * Merges the shards' ordered indexes to walk a key range in order. Keys and
+ * values are pulled a chunk per shard at a time under that shard's read
+ * lock, so a long scan never holds a lock for long and writers keep going
+ * between chunks. The price is that it isn't a point-in-time view: a key
+ * written or deleted after the scan started may or may not show up, but
+ * every key that stays put throughout is returned exactly once.
+ */
+class KVStore::Cursor {
+public:
+    static constexpr size_t kChunkKeys = 64;
+
+    // Next pair in key order; false once the range is exhausted
+    bool next(std::string& key, std::string& value);
+
+private:
+    friend class KVStore;
+
+    struct Lane {
+        std::vector<std::pair<std::string, std::string>> buffered;
+        size_t pos = 0;
+        std::string resume;         // Last key taken; the next chunk starts after it
+        bool started = false;
+        bool exhausted = false;
+    };
+
+    Cursor(KVStore& store, std::string start, std::string end);
+    bool fill(size_t shard);
+
+    KVStore& store_;
+    std::string start_;
+    std::string end_;
+    std::vector<Lane> lanes_;
+};
+
+/**
+ * KVStore::Snapshot
+ *
+ * Immutable view of the store as of KVStore::snapshot(). Safe to read from
+ * any one thread while the store keeps taking writes.
+ */
+class KVStore::Snapshot {
+public:
+    ~Snapshot();
+
+    Snapshot(const Snapshot&) = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+
+    size_t size() const { return size_; }
+
+    // Visit every key/value pair, with its deadline (0 for none), in no
+    // particular order. Compressed values are inflated one at a time into a
+    // scratch buffer that fn mustn't keep. Keys past their deadline are
+    // included: they're still in the store until expired.
+    template <typename Fn>
+    void forEach(Fn&& fn) const {
+        std::string scratch;
+        for (const auto& shard : shards_) {
+            for (const auto& [key, value] : *shard) {
+                if (value.raw_size == 0) {
+                    fn(key, value.data, value.expires_at);
+                } else {
+                    KVStore::unpack(value, scratch);
+                    fn(key, scratch, value.expires_at);
+                }
+            }
+        }
+    }
+
+private:
+    friend class KVStore;
+
+    Snapshot(KVStore& store, std::vector<std::shared_ptr<const Map>> shards, size_t size)
+        : store_(store), shards_(std::move(shards)), size_(size) {}
+
+    KVStore& store_;
+    std::vector<std::shared_ptr<const Map>> shards_;
+    size_t size_;
+};
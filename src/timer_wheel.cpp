@@ -0,0 +1,102 @@
+#include "timer_wheel.h"
+#include <algorithm>
+
+TimerWheel::TimerWheel(std::chrono::milliseconds tick, size_t slots)
+    : tick_(std::max<Clock::duration>(tick, std::chrono::milliseconds(1))),
+      slots_(std::max<size_t>(slots, 1)),
+      start_(Clock::now()) {
+    thread_ = std::thread(&TimerWheel::run, this);
+}
+
+TimerWheel::~TimerWheel() {
+    stop();
+}
+
+TimerWheel::TimerId TimerWheel::schedule(Clock::duration delay, std::function<void()> fn) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopping_) {
+        return 0;
+    }
+
+    // The first tick at or after now + delay, and never one already processed
+    auto due_at = Clock::now() - start_ + std::max(delay, Clock::duration::zero());
+    uint64_t due_tick = static_cast<uint64_t>((due_at + tick_ - Clock::duration(1)) / tick_);
+    due_tick = std::max(due_tick, current_tick_ + 1);
+
+    TimerId id = next_id_++;
+    size_t slot = due_tick % slots_.size();
+    slots_[slot].push_back(Timer{id, due_tick, std::move(fn)});
+    slot_of_[id] = slot;
+    return id;
+}
+
+bool TimerWheel::cancel(TimerId id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = slot_of_.find(id);
+    if (it == slot_of_.end()) {
+        return false;
+    }
+    auto& slot = slots_[it->second];
+    slot.erase(std::find_if(slot.begin(), slot.end(),
+                            [id](const Timer& timer) { return timer.id == id; }));
+    slot_of_.erase(it);
+    return true;
+}
+
+void TimerWheel::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+        for (auto& slot : slots_) {
+            slot.clear();
+        }
+        slot_of_.clear();
+        cv_.notify_all();
+    }
+    if (thread_.joinable() && thread_.get_id() != std::this_thread::get_id()) {
+        thread_.join();
+    }
+}
+
+void TimerWheel::run() {
+    std::vector<Timer> due;
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    while (!stopping_) {
+        cv_.wait_until(lock, start_ + tick_ * (current_tick_ + 1), [&]{ return stopping_; });
+        if (stopping_) {
+            break;
+        }
+
+        // Every tick that has passed, in case we woke late; a full turn
+        // of the wheel already visits every slot
+        uint64_t now_tick = static_cast<uint64_t>((Clock::now() - start_) / tick_);
+        if (now_tick <= current_tick_) {
+            continue;
+        }
+        uint64_t first = std::max(current_tick_ + 1, now_tick + 1 - std::min<uint64_t>(
+                                      now_tick, slots_.size()));
+        for (uint64_t t = first; t <= now_tick; t++) {
+            auto& slot = slots_[t % slots_.size()];
+            auto keep = std::stable_partition(slot.begin(), slot.end(),
+                                              [&](const Timer& timer) { return timer.due_tick > now_tick; });
+            for (auto it = keep; it != slot.end(); ++it) {
+                slot_of_.erase(it->id);
+                due.push_back(std::move(*it));
+            }
+            slot.erase(keep, slot.end());
+        }
+        current_tick_ = now_tick;
+
+        // In due order, so timers set for the same moment keep theirs
+        std::stable_sort(due.begin(), due.end(), [](const Timer& a, const Timer& b) {
+            return a.due_tick < b.due_tick;
+        });
+        lock.unlock();
+        for (auto& timer : due) {
+            timer.fn();
+        }
+        due.clear();
+        lock.lock();
+    }
+}
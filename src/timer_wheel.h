@@ -0,0 +1,67 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * TimerWheel
+ *
+ * Hashed timing wheel driving all of a server's timers from one thread.
+ * Time is cut into ticks; a timer due in n ticks goes into slot
+ * (now + n) % slots, so scheduling and cancelling are O(1) and each tick
+ * only looks at the timers hashed to its slot. Timers further out than one
+ * turn of the wheel share slots with nearer ones and are skipped until
+ * their tick comes round.
+ *
+ * Callbacks run on the wheel thread, outside the lock, and must be quick:
+ * a slow one delays every timer behind it. Anything long (an election)
+ * belongs on a thread of its own that the callback wakes. A callback may
+ * schedule further timers, which is how periodic timers are written.
+ *
+ * Timers fire no earlier than asked and at most about a tick late.
+ */
+class TimerWheel {
+public:
+    using Clock = std::chrono::steady_clock;
+    using TimerId = uint64_t;
+
+    explicit TimerWheel(std::chrono::milliseconds tick = std::chrono::milliseconds(5),
+                        size_t slots = 512);
+    ~TimerWheel();
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    // Run fn once delay has passed. Ids are never reused.
+    TimerId schedule(Clock::duration delay, std::function<void()> fn);
+    // False if the timer already fired (or is firing) or was cancelled
+    bool cancel(TimerId id);
+
+    // Drop pending timers and join the thread; schedule() is then a no-op
+    void stop();
+
+private:
+    struct Timer {
+        TimerId id;
+        uint64_t due_tick;
+        std::function<void()> fn;
+    };
+
+    Clock::duration tick_;
+    std::vector<std::vector<Timer>> slots_;
+    std::unordered_map<TimerId, size_t> slot_of_;   // Pending timers
+    Clock::time_point start_;
+    uint64_t current_tick_ = 0;                     // Last tick processed
+    TimerId next_id_ = 1;
+    bool stopping_ = false;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::thread thread_;
+
+    void run();
+};
@@ -1,119 +1,976 @@
 #include "wal.h"
+#include "session.h"
+#include "coding.h"
+#include "crc32.h"
+#include "log.h"
+#include "metrics.h"
 #include <sstream>
 #include <iostream>
 #include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <condition_variable>
+#include <thread>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
 
-WriteAheadLog::WriteAheadLog(const std::string& filename)
-    : filename_(filename), metadata_filename_(filename + ".meta") {
+namespace {
+
+const char kWalMagic[8] = {'L', 'O', 'G', 'K', 'V', 'W', 'A', 'L'};
+const uint32_t kWalVersion = 2;
+const size_t kFileHeaderSize = sizeof(kWalMagic) + 4;
+const size_t kRecordHeaderSize = 8;                 // crc32 + payload_len
+const size_t kPayloadFixedSize = 8 + 8 + 1 + 4 + 4; // index, term, op, key_len, value_len
+const size_t kMaxRecordSize = 256 * 1024 * 1024;    // Anything longer is a corrupt length
+const int kIndexInterval = 32;                      // Entries between sparse index points
+
+std::string fileHeader() {
+    std::string header(kWalMagic, sizeof(kWalMagic));
+    putFixed32(header, kWalVersion);
+    return header;
+}
+
+bool hasValidHeader(const char* data, size_t size) {
+    return size >= kFileHeaderSize &&
+           memcmp(data, kWalMagic, sizeof(kWalMagic)) == 0 &&
+           decodeFixed32(data + sizeof(kWalMagic)) == kWalVersion;
+}
+
+size_t cachedSize(const LogEntry& entry) {
+    return sizeof(LogEntry) + entry.payloadBytes();
+}
+
+void syncDirectory(const std::string& dir) {
+    int dfd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dfd >= 0) {
+        fsync(dfd);
+        close(dfd);
+    }
+}
+
+}  // namespace
+
+WriteAheadLog::WriteAheadLog(const std::string& dir, const WalOptions& options,
+                             std::shared_ptr<WalWriter> writer)
+    : dir_(dir),
+      manifest_path_(dir + "/MANIFEST"),
+      metadata_filename_(dir + "/meta"),
+      options_(options) {
+    mkdir(dir_.c_str(), 0755);
     rebuildCache();
+    writer_ = writer ? std::move(writer) : std::make_shared<WalWriter>(options);
+    stream_ = writer_->addStream(fd_);
 }
 
-void WriteAheadLog::appendEntry(const LogEntry& entry) {
-    std::lock_guard<std::mutex> lock(mutex_);
+WriteAheadLog::~WriteAheadLog() {
+    // Drains whatever of ours is still queued
+    writer_->removeStream(stream_);
+    writer_.reset();
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+}
+
+std::string WriteAheadLog::encodeRecord(const LogEntry& entry) {
+    std::string payload;
+    std::string_view key = entry.key();
+    std::string_view value = entry.value();
+    payload.reserve(kPayloadFixedSize + key.size() + value.size());
+    putFixed64(payload, static_cast<uint64_t>(entry.index));
+    putFixed64(payload, static_cast<uint64_t>(entry.term));
+    payload.push_back(static_cast<char>(entry.op));
+    putFixed32(payload, static_cast<uint32_t>(key.size()));
+    putFixed32(payload, static_cast<uint32_t>(value.size()));
+    payload.append(key.data(), key.size());
+    payload.append(value.data(), value.size());
+    
+    std::string record;
+    record.reserve(kRecordHeaderSize + payload.size());
+    putFixed32(record, crc32::value(payload.data(), payload.size()));
+    putFixed32(record, static_cast<uint32_t>(payload.size()));
+    record += payload;
+    return record;
+}
+
+bool WriteAheadLog::decodeRecord(const char* data, size_t available, LogArena& arena,
+                                 LogEntry& entry, size_t& consumed) {
+    if (available < kRecordHeaderSize) {
+        return false;
+    }
+    
+    uint32_t crc = decodeFixed32(data);
+    uint32_t payload_len = decodeFixed32(data + 4);
+    if (payload_len < kPayloadFixedSize || payload_len > available - kRecordHeaderSize) {
+        return false;
+    }
+    
+    const char* payload = data + kRecordHeaderSize;
+    if (crc32::value(payload, payload_len) != crc) {
+        return false;
+    }
+    
+    uint32_t key_len = decodeFixed32(payload + 17);
+    uint32_t value_len = decodeFixed32(payload + 21);
+    if (static_cast<uint64_t>(kPayloadFixedSize) + key_len + value_len != payload_len) {
+        return false;
+    }
+    
+    entry = arena.make(static_cast<int>(decodeFixed64(payload)),
+                       static_cast<int>(decodeFixed64(payload + 8)),
+                       opFromCode(static_cast<uint8_t>(payload[16])),
+                       std::string_view(payload + kPayloadFixedSize, key_len),
+                       std::string_view(payload + kPayloadFixedSize + key_len, value_len));
+    
+    consumed = kRecordHeaderSize + payload_len;
+    return true;
+}
+
+std::string WriteAheadLog::segmentPath(int first_index) const {
+    char name[32];
+    snprintf(name, sizeof(name), "%020d.seg", first_index);
+    return dir_ + "/" + name;
+}
+
+int WriteAheadLog::openSegmentFile(const std::string& path) {
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+        LOG_ERROR("Failed to open WAL segment: " << path << ": "
+                  << strerror(errno));
+    }
+    return fd;
+}
+
+bool WriteAheadLog::createSegment(int first_index) {
+    // Assumes mutex is already held
+    Segment segment;
+    segment.first_index = first_index;
+    segment.last_index = first_index - 1;
+    segment.path = segmentPath(first_index);
+    
+    int fd = open(segment.path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (fd < 0) {
+        LOG_ERROR("Failed to create WAL segment: " << segment.path << ": "
+                  << strerror(errno));
+        return false;
+    }
+    
+    std::string header = fileHeader();
+    if (write(fd, header.data(), header.size()) != static_cast<ssize_t>(header.size())) {
+        LOG_ERROR("Failed to write WAL segment header: " << segment.path);
+        close(fd);
+        return false;
+    }
+    if (fdatasync(fd) != 0) {
+        LOG_ERROR("Failed to sync WAL segment header: " << segment.path << ": "
+                  << strerror(errno));
+        close(fd);
+        return false;
+    }
+    segment.bytes = header.size();
     
-    // Append to file
-    std::ofstream out(filename_, std::ios::app);
+    // Everything queued for the old tail must land there before we switch
+    if (writer_) {
+        writer_->setFd(stream_, fd);
+    }
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+    fd_ = fd;
+    
+    // Until the manifest lists it, startup would delete it as a stray
+    segments_.push_back(segment);
+    return persistManifest();
+}
+
+bool WriteAheadLog::persistManifest() {
+    // Assumes mutex is already held
+    // Format:
+    //   LOGKV_WAL_MANIFEST_V1
+    //   first_log_index <n>
+    //   snapshot_term <t>         (term of entry first_log_index - 1)
+    //   segment <first_index>     (one line per live segment, oldest first)
+    std::string temp_path = manifest_path_ + ".tmp";
+    std::ofstream out(temp_path, std::ios::trunc);
     if (!out) {
-        std::cerr << "[ERROR] Failed to open WAL for writing: " << filename_ << std::endl;
-        return;
+        LOG_ERROR("Failed to write WAL manifest");
+        return false;
     }
     
-    out << entry.index << " " 
-        << entry.term << " " 
-        << entry.operation << " " 
-        << entry.key << " " 
-        << entry.value << "\n";
+    out << "LOGKV_WAL_MANIFEST_V1\n";
+    out << "first_log_index " << first_log_index_ << "\n";
+    out << "snapshot_term " << snapshot_term_ << "\n";
+    for (const auto& segment : segments_) {
+        out << "segment " << segment.first_index << "\n";
+    }
     out.flush();
+    out.close();
+    if (!out) {
+        LOG_ERROR("Failed to write WAL manifest");
+        return false;
+    }
+    
+    int fd = open(temp_path.c_str(), O_RDONLY);
+    bool synced = fd >= 0 && fsync(fd) == 0;
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (!synced) {
+        LOG_ERROR("Failed to sync WAL manifest: " << strerror(errno));
+        return false;
+    }
     
-    // Add to cache
+    if (rename(temp_path.c_str(), manifest_path_.c_str()) != 0) {
+        LOG_ERROR("Failed to install WAL manifest: " << strerror(errno));
+        return false;
+    }
+    syncDirectory(dir_);
+    return true;
+}
+
+bool WriteAheadLog::loadManifest(std::vector<int>& segment_starts) {
+    std::ifstream in(manifest_path_);
+    if (!in) {
+        return false;
+    }
+    
+    std::string magic;
+    std::getline(in, magic);
+    if (magic != "LOGKV_WAL_MANIFEST_V1") {
+        LOG_ERROR("Invalid WAL manifest: " << magic);
+        return false;
+    }
+    
+    std::string tag;
+    while (in >> tag) {
+        int value;
+        in >> value;
+        if (tag == "first_log_index") {
+            first_log_index_ = value;
+        } else if (tag == "snapshot_term") {
+            snapshot_term_ = value;
+        } else if (tag == "segment") {
+            segment_starts.push_back(value);
+        }
+    }
+    return true;
+}
+
+void WriteAheadLog::removeSegmentFile(const Segment& segment) {
+    if (unlink(segment.path.c_str()) != 0 && errno != ENOENT) {
+        LOG_WARN("Failed to delete WAL segment " << segment.path << ": "
+                  << strerror(errno));
+    }
+}
+
+size_t WriteAheadLog::scanSegment(int fd, size_t start_offset,
+                                  const std::function<bool(LogEntry&, size_t, size_t)>& fn) {
+    // Reads the segment in growing chunks instead of slurping it: point
+    // lookups touch a few KB, full scans settle at a bounded 1 MB buffer
+    const size_t kMaxChunk = 1 << 20;
+    size_t chunk = 16 * 1024;
+    
+    std::string buf;
+    size_t base = start_offset;   // File offset of buf[0]
+    size_t pos = 0;               // Parse position inside buf
+    size_t want = kRecordHeaderSize;
+    bool eof = false;
+    LogArena arena;   // Shared by the entries this scan decodes
+    
+    while (true) {
+        size_t avail = buf.size() - pos;
+        if (avail < want && !eof) {
+            buf.erase(0, pos);
+            base += pos;
+            pos = 0;
+            
+            size_t old_size = buf.size();
+            size_t grow = std::max(chunk, want - old_size);
+            chunk = std::min(chunk * 2, kMaxChunk);
+            buf.resize(old_size + grow);
+            ssize_t n = pread(fd, &buf[old_size], grow, static_cast<off_t>(base + old_size));
+            if (n <= 0) {
+                buf.resize(old_size);
+                eof = true;
+            } else {
+                buf.resize(old_size + static_cast<size_t>(n));
+                eof = static_cast<size_t>(n) < grow;
+            }
+            continue;
+        }
+        
+        if (avail < kRecordHeaderSize) {
+            break;
+        }
+        
+        size_t record_size = kRecordHeaderSize + decodeFixed32(buf.data() + pos + 4);
+        if (record_size > kMaxRecordSize) {
+            break;  // Garbage length: corrupt tail
+        }
+        if (avail < record_size) {
+            if (eof) break;
+            want = record_size;
+            continue;
+        }
+        
+        LogEntry entry;
+        size_t consumed = 0;
+        if (!decodeRecord(buf.data() + pos, avail, arena, entry, consumed)) {
+            break;
+        }
+        want = kRecordHeaderSize;
+        
+        if (!fn(entry, base + pos, consumed)) {
+            break;
+        }
+        pos += consumed;
+    }
+    
+    return base + pos;
+}
+
+size_t WriteAheadLog::seekOffset(const Segment& segment, int index) const {
+    // Assumes mutex is already held
+    // Index points are recorded every kIndexInterval entries starting at the
+    // segment's first index, so the nearest one is found arithmetically
+    if (index <= segment.first_index || segment.index_points.empty()) {
+        return kFileHeaderSize;
+    }
+    size_t slot = static_cast<size_t>(index - segment.first_index) / kIndexInterval;
+    slot = std::min(slot, segment.index_points.size() - 1);
+    return segment.index_points[slot];
+}
+
+WriteAheadLog::SegmentRead::~SegmentRead() {
+    for (const auto& file : files) {
+        close(file.fd);
+    }
+}
+
+bool WriteAheadLog::planRead(int from, int to, SegmentRead& plan) const {
+    // Assumes mutex is already held. An open fd keeps its segment readable
+    // even if compaction unlinks it once the lock is gone.
+    plan.truncations = truncations_;
+    for (const auto& segment : segments_) {
+        if (segment.last_index < from || segment.first_index > to) {
+            continue;
+        }
+        int fd = open(segment.path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            LOG_ERROR("Failed to open WAL segment for reading: " << segment.path
+                      << ": " << strerror(errno));
+            return false;
+        }
+        plan.files.push_back({fd, seekOffset(segment, from)});
+        plan.tail = plan.tail || &segment == &segments_.back();
+    }
+    return true;
+}
+
+void WriteAheadLog::readPlanned(const SegmentRead& plan, int from, int to,
+                                const std::function<bool(LogEntry&)>& fn) const {
+    // Entries still queued in the writer aren't in the file yet
+    if (plan.tail) {
+        writer_->flush(stream_);
+    }
+    
+    for (const auto& file : plan.files) {
+        bool done = false;
+        scanSegment(file.fd, file.offset, [&](LogEntry& entry, size_t, size_t) {
+            if (entry.index > to) {
+                done = true;
+                return false;
+            }
+            if (entry.index >= from && !fn(entry)) {
+                done = true;
+                return false;
+            }
+            return true;
+        });
+        if (done) {
+            break;
+        }
+    }
+}
+
+bool WriteAheadLog::readFromSegments(int from, int to,
+                                     const std::function<bool(LogEntry&)>& fn) const {
+    // Assumes mutex is already held
+    SegmentRead plan;
+    if (!planRead(from, to, plan)) {
+        return false;
+    }
+    readPlanned(plan, from, to, fn);
+    return true;
+}
+
+void WriteAheadLog::noteTerm(int index, int term) {
+    // Assumes mutex is already held
+    if (term_runs_.empty() || term_runs_.back().second != term) {
+        term_runs_.emplace_back(index, term);
+    }
+}
+
+void WriteAheadLog::cacheAppend(const LogEntry& entry) {
+    // Assumes mutex is already held
+    if (log_cache_.empty()) {
+        cache_first_index_ = entry.index;
+    }
     log_cache_.push_back(entry);
+    cache_bytes_ += cachedSize(entry);
+    
+    // Keep only the newest entries that fit the budget; older ones are
+    // served from disk via the segment index
+    while (cache_bytes_ > options_.cache_bytes && !log_cache_.empty()) {
+        cache_bytes_ -= cachedSize(log_cache_.front());
+        log_cache_.pop_front();
+        cache_first_index_++;
+    }
 }
 
-bool WriteAheadLog::getEntry(int index, LogEntry& entry) const {
+namespace {
+
+// Append call to durable (or handed to the OS, in OS sync mode)
+metrics::Histogram& appendLatency() {
+    static metrics::Histogram& h = metrics::registry().histogram(
+        "logkv_wal_append_seconds", "WAL append latency, including the wait for its sync");
+    return h;
+}
+
+}  // namespace
+
+bool WriteAheadLog::appendEntry(const LogEntry& entry) {
+    auto start = std::chrono::steady_clock::now();
+    uint64_t ticket = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (failed_ || !appendLocked(entry, ticket)) {
+            return false;
+        }
+    }
+    
+    // Wait outside the lock so concurrent appenders share one write+fdatasync
+    bool durable = writer_->wait(stream_, ticket);
+    appendLatency().recordSince(start);
+    if (!durable) {
+        markFailed();
+    }
+    return durable;
+}
+
+bool WriteAheadLog::appendEntries(const std::vector<LogEntry>& entries) {
+    if (entries.empty()) {
+        return !failed();
+    }
+    
+    auto start = std::chrono::steady_clock::now();
+    uint64_t ticket = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (failed_) {
+            return false;
+        }
+        for (const auto& entry : entries) {
+            if (!appendLocked(entry, ticket)) {
+                return false;
+            }
+        }
+    }
+    
+    // Tickets complete in order, so the last one covers the whole batch
+    bool durable = writer_->wait(stream_, ticket);
+    appendLatency().recordSince(start);
+    if (!durable) {
+        markFailed();
+    }
+    return durable;
+}
+
+void WriteAheadLog::markFailed() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    markFailedLocked("can no longer make appends durable");
+}
+
+void WriteAheadLog::markFailedLocked(const char* why) {
+    // Assumes mutex is already held
+    if (!failed_) {
+        LOG_ERROR("WAL " << dir_ << " " << why << "; refusing further appends");
+    }
+    failed_ = true;
+}
+
+bool WriteAheadLog::failed() const {
     std::lock_guard<std::mutex> lock(mutex_);
+    return failed_;
+}
+
+bool WriteAheadLog::appendLocked(const LogEntry& entry, uint64_t& ticket) {
+    // Assumes mutex is already held
+    std::string record = encodeRecord(entry);
     
-    // Log is 1-indexed, cache is 0-indexed
-    if (index < 1 || index > static_cast<int>(log_cache_.size())) {
-        return false;
+    // Start a new segment once the tail is full (never leave one empty)
+    Segment* tail = segments_.empty() ? nullptr : &segments_.back();
+    if (!tail || (tail->bytes + record.size() > options_.segment_bytes &&
+                  tail->last_index >= tail->first_index)) {
+        if (!createSegment(entry.index)) {
+            markFailedLocked("can't start a new segment");
+            return false;
+        }
+        tail = &segments_.back();
     }
     
-    entry = log_cache_[index - 1];
+    if ((entry.index - tail->first_index) % kIndexInterval == 0) {
+        tail->index_points.push_back(tail->bytes);
+    }
+    tail->bytes += record.size();
+    tail->last_index = entry.index;
+    ticket = writer_->submit(stream_, record);
+    
+    last_index_ = entry.index;
+    last_term_ = entry.term;
+    noteTerm(entry.index, entry.term);
+    cacheAppend(entry);
     return true;
 }
 
-bool WriteAheadLog::getLastEntry(LogEntry& entry) const {
+bool WriteAheadLog::getEntry(int index, LogEntry& entry) const {
+    // A cached entry is copied under the lock; an older one is read from
+    // its segment after it, again if the log was truncated meanwhile
+    for (;;) {
+        SegmentRead plan;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (index < first_log_index_ || index > last_index_) {
+                return false;
+            }
+            if (!log_cache_.empty() && index >= cache_first_index_) {
+                entry = log_cache_[index - cache_first_index_];
+                return true;
+            }
+            if (!planRead(index, index, plan)) {
+                return false;
+            }
+        }
+        
+        bool found = false;
+        readPlanned(plan, index, index, [&](LogEntry& e) {
+            entry = std::move(e);
+            found = true;
+            return true;
+        });
+        
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (plan.truncations == truncations_) {
+            return found;
+        }
+    }
+}
+
+bool WriteAheadLog::getTerm(int index, int& term) const {
     std::lock_guard<std::mutex> lock(mutex_);
     
-    if (log_cache_.empty()) {
+    // The entry just before the log start lives only in the snapshot
+    if (index == first_log_index_ - 1) {
+        term = snapshot_term_;
+        return true;
+    }
+    if (index < first_log_index_ || index > last_index_ || term_runs_.empty()) {
         return false;
     }
     
-    entry = log_cache_.back();
+    // Last run starting at or before index
+    auto it = std::upper_bound(term_runs_.begin(), term_runs_.end(), index,
+                               [](int i, const std::pair<int, int>& run) { return i < run.first; });
+    if (it == term_runs_.begin()) {
+        return false;
+    }
+    term = std::prev(it)->second;
     return true;
 }
 
-void WriteAheadLog::getLastLogInfo(int& last_index, int& last_term) const {
+int WriteAheadLog::termStartIndex(int index) const {
     std::lock_guard<std::mutex> lock(mutex_);
-    
-    if (log_cache_.empty()) {
-        last_index = 0;
-        last_term = 0;
-    } else {
-        last_index = log_cache_.back().index;
-        last_term = log_cache_.back().term;
+    if (index < first_log_index_ || index > last_index_ || term_runs_.empty()) {
+        return 0;
+    }
+    auto it = std::upper_bound(term_runs_.begin(), term_runs_.end(), index,
+                               [](int i, const std::pair<int, int>& run) { return i < run.first; });
+    if (it == term_runs_.begin()) {
+        return 0;
     }
+    return std::max(std::prev(it)->first, first_log_index_);
+}
+
+int WriteAheadLog::lastIndexOfTerm(int term) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Runs ascend in term as well as index
+    auto it = std::lower_bound(term_runs_.begin(), term_runs_.end(), term,
+                               [](const std::pair<int, int>& run, int t) { return run.second < t; });
+    if (it == term_runs_.end() || it->second != term) {
+        return 0;
+    }
+    int last = std::next(it) == term_runs_.end() ? last_index_ : std::next(it)->first - 1;
+    return last >= first_log_index_ ? last : 0;
+}
+
+bool WriteAheadLog::getLastEntry(LogEntry& entry) const {
+    int index;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        index = last_index_;
+    }
+    return getEntry(index, entry);
+}
+
+void WriteAheadLog::getLastLogInfo(int& last_index, int& last_term) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    last_index = last_index_;
+    last_term = last_term_;
 }
 
 void WriteAheadLog::truncateFrom(int index) {
     std::lock_guard<std::mutex> lock(mutex_);
     
-    if (index < 1 || index > static_cast<int>(log_cache_.size())) {
+    if (index < first_log_index_ || index > last_index_ || segments_.empty()) {
         return;
     }
+    truncations_++;
     
-    // Remove from cache (index is 1-indexed)
-    log_cache_.erase(log_cache_.begin() + (index - 1), log_cache_.end());
+    // Nothing queued may be written past the cut point
+    writer_->flush(stream_);
     
-    // Rewrite entire file
-    persistCache();
-}
-
-void WriteAheadLog::replay(KVStore& store) {
-    std::lock_guard<std::mutex> lock(mutex_);
+    // Segments that start at or after the cut point go away entirely; only
+    // the (new) tail is cut, at the offset of the first removed record.
+    // The file is cut before anything in memory moves: if that fails, the
+    // records past the cut are still there, and appending after them
+    // would replay out of order, so the log takes no more appends.
+    size_t keep = segments_.size();
+    while (keep > 1 && segments_[keep - 1].first_index >= index) {
+        keep--;
+    }
+    Segment& tail = segments_[keep - 1];
+    int fd = openSegmentFile(tail.path);
+    if (fd < 0) {
+        markFailedLocked("can't reopen its tail segment to truncate it");
+        return;
+    }
+    size_t offset = scanSegment(fd, seekOffset(tail, index),
+                                [&](LogEntry& entry, size_t, size_t) {
+        return entry.index < index;
+    });
+    if (ftruncate(fd, static_cast<off_t>(offset)) != 0 || fdatasync(fd) != 0) {
+        LOG_ERROR("Failed to truncate WAL segment: " << strerror(errno));
+        close(fd);
+        markFailedLocked("can't truncate its tail segment");
+        return;
+    }
+    writer_->setFd(stream_, fd);
+    close(fd_);
+    fd_ = fd;
+    tail.bytes = offset;
+    tail.last_index = index - 1;
+    size_t live_points = tail.last_index < tail.first_index
+        ? 0 : static_cast<size_t>(tail.last_index - tail.first_index) / kIndexInterval + 1;
+    tail.index_points.resize(std::min(tail.index_points.size(), live_points));
+    
+    std::vector<Segment> dropped(segments_.begin() + keep, segments_.end());
+    segments_.resize(keep);
     
-    for (const auto& entry : log_cache_) {
-        if (entry.operation == "PUT") {
-            store.put(entry.key, entry.value);
-        } else if (entry.operation == "DELETE") {
-            // Future: implement delete in store
-            std::string dummy;
-            store.get(entry.key, dummy); // placeholder
+    // Remove from cache
+    if (!log_cache_.empty() && index >= cache_first_index_) {
+        while (!log_cache_.empty() && log_cache_.back().index >= index) {
+            cache_bytes_ -= cachedSize(log_cache_.back());
+            log_cache_.pop_back();
         }
+    } else {
+        log_cache_.clear();
+        cache_bytes_ = 0;
+        cache_first_index_ = index;
+    }
+    
+    last_index_ = index - 1;
+    while (!term_runs_.empty() && term_runs_.back().first >= index) {
+        term_runs_.pop_back();
     }
+    last_term_ = term_runs_.empty() ? snapshot_term_ : term_runs_.back().second;
     
-    std::cout << "[INFO] Replayed " << log_cache_.size() << " log entries\n";
+    if (!dropped.empty()) {
+        // Files the manifest still lists must stay, or startup would find
+        // it naming segments that are gone; but then the entries they hold
+        // come back on startup, so nothing more may be appended after them
+        if (!persistManifest()) {
+            markFailedLocked("can't record truncated segments in its manifest");
+            return;
+        }
+        for (const auto& segment : dropped) {
+            removeSegmentFile(segment);
+        }
+    }
 }
 
-std::vector<LogEntry> WriteAheadLog::getEntriesFrom(int start_index) const {
-    std::lock_guard<std::mutex> lock(mutex_);
+namespace {
+
+void applyReplayed(KVStore& store, const LogEntry& entry) {
+    uint64_t deadline;
+    std::string_view value;
+    std::vector<std::string_view> keys;
+    if (entry.op == LogOp::PUT) {
+        store.put(std::string(entry.key()), std::string(entry.value()));
+    } else if (entry.op == LogOp::PUT_TTL) {
+        if (decodeExpiringPut(entry.value(), deadline, value)) {
+            store.put(std::string(entry.key()), std::string(value), deadline);
+        }
+    } else if (entry.op == LogOp::EXPIRE) {
+        if (decodeExpire(entry.value(), deadline, keys)) {
+            store.expire(keys, deadline);
+        }
+    } else if (entry.op == LogOp::DELETE) {
+        store.remove(std::string(entry.key()));
+    } else if (entry.op == LogOp::MULTI_PUT) {
+        KeyValueViews pairs;
+        if (decodeMultiPut(entry.value(), pairs)) {
+            std::vector<std::pair<std::string, std::string>> owned(pairs.begin(), pairs.end());
+            store.putMany(std::move(owned));
+        }
+    }
+}
+
+// One replay applier: batches in, store writes out
+struct ReplayLane {
+    static constexpr size_t kBatchEntries = 512;
+    static constexpr size_t kMaxQueuedBatches = 8;  // Bounds decoded-but-unapplied memory
+    
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::vector<LogEntry>> queued;
+    std::vector<LogEntry> filling;      // Reader side only
+    bool done = false;
+    std::thread thread;
     
-    std::vector<LogEntry> result;
+    void push(std::vector<LogEntry> batch) {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&]{ return queued.size() < kMaxQueuedBatches; });
+        queued.push_back(std::move(batch));
+        cv.notify_all();
+    }
+    
+    void run(KVStore& store) {
+        for (;;) {
+            std::vector<LogEntry> batch;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [&]{ return done || !queued.empty(); });
+                if (queued.empty()) {
+                    return;
+                }
+                batch = std::move(queued.front());
+                queued.pop_front();
+                cv.notify_all();
+            }
+            for (const auto& entry : batch) {
+                applyReplayed(store, entry);
+            }
+        }
+    }
+};
+
+}  // namespace
+
+WalReplayStats WriteAheadLog::replay(KVStore& store, int after_index, size_t threads,
+                                     const ClientSessions* sessions) {
+    std::lock_guard<std::mutex> lock(mutex_);
     
-    if (start_index < 1 || start_index > static_cast<int>(log_cache_.size())) {
-        return result;
+    // Entries up to after_index are already in the store (snapshot)
+    int from = std::max(first_log_index_, after_index + 1);
+    WalReplayStats stats;
+    if (from > last_index_) {
+        LOG_INFO("Replayed 0 log entries");
+        return stats;
     }
     
-    for (size_t i = start_index - 1; i < log_cache_.size(); i++) {
-        result.push_back(log_cache_[i]);
+    // The cached tail is already decoded; only older entries are read back
+    auto forEachEntry = [&](const std::function<void(LogEntry&)>& fn) {
+        if (from < cache_first_index_) {
+            readFromSegments(from, cache_first_index_ - 1, [&](LogEntry& e) {
+                fn(e);
+                return true;
+            });
+        }
+        size_t skip = from > cache_first_index_ ? static_cast<size_t>(from - cache_first_index_) : 0;
+        for (size_t i = skip; i < log_cache_.size(); i++) {
+            LogEntry entry = log_cache_[i];     // Shares the cached bytes
+            fn(entry);
+        }
+    };
+    
+    // A SESSION entry becomes the write it carries, unless it's a retry of
+    // one already seen. That's decided here, in log order, on a copy: the
+    // server's table only moves as entries are applied for real.
+    ClientSessions seen = sessions ? *sessions : ClientSessions();
+    LogArena unwrap_arena;
+    auto unwrap = [&](LogEntry& entry) {
+        if (entry.op != LogOp::SESSION) {
+            return true;
+        }
+        uint64_t client_id, seq;
+        LogOp op;
+        std::string_view value;
+        if (!decodeSessionWrite(entry.value(), client_id, seq, op, value) ||
+            !seen.admit(client_id, seq, entry.index)) {
+            return false;
+        }
+        entry = unwrap_arena.make(entry.index, entry.term, op, entry.key(), value);
+        return true;
+    };
+    
+    size_t total = static_cast<size_t>(last_index_ - from + 1);
+    threads = std::max<size_t>(1, std::min(threads, total / ReplayLane::kBatchEntries + 1));
+    stats.threads = threads;
+    
+    if (threads == 1) {
+        forEachEntry([&](LogEntry& entry) {
+            stats.entries++;
+            if (unwrap(entry)) {
+                applyReplayed(store, entry);
+            }
+        });
+    } else {
+        // Lanes follow store shards, so appliers mostly touch disjoint shards
+        std::vector<ReplayLane> lanes(threads);
+        for (auto& lane : lanes) {
+            lane.thread = std::thread(&ReplayLane::run, &lane, std::ref(store));
+        }
+        
+        auto route = [&](LogEntry entry) {
+            ReplayLane& lane = lanes[store.shardOf(entry.key()) % threads];
+            lane.filling.push_back(std::move(entry));
+            if (lane.filling.size() >= ReplayLane::kBatchEntries) {
+                lane.push(std::move(lane.filling));
+                lane.filling.clear();
+            }
+        };
+        LogArena split_arena;
+        KeyValueViews pairs;
+        uint64_t now;
+        std::vector<std::string_view> keys;
+        std::string one;
+        forEachEntry([&](LogEntry& entry) {
+            stats.entries++;
+            if (!unwrap(entry)) {
+                return;
+            }
+            if (entry.op == LogOp::PUT || entry.op == LogOp::PUT_TTL || entry.op == LogOp::DELETE) {
+                route(std::move(entry));
+            } else if (entry.op == LogOp::EXPIRE && decodeExpire(entry.value(), now, keys)) {
+                // Likewise an EXPIRE, into one per key (keyed, so it's
+                // routed): whether a key goes depends on that key alone
+                for (const auto& key : keys) {
+                    one.clear();
+                    encodeExpire(one, now, {std::string(key)});
+                    route(split_arena.make(entry.index, entry.term, LogOp::EXPIRE, key, one));
+                }
+            } else if (entry.op == LogOp::MULTI_PUT && decodeMultiPut(entry.value(), pairs)) {
+                // Nothing reads the store during recovery, so a MULTI_PUT
+                // can be split into per-key PUTs and follow each key's lane
+                for (const auto& [key, value] : pairs) {
+                    route(split_arena.make(entry.index, entry.term, LogOp::PUT, key, value));
+                }
+            }
+        });
+        
+        for (auto& lane : lanes) {
+            if (!lane.filling.empty()) {
+                lane.push(std::move(lane.filling));
+            }
+            {
+                std::lock_guard<std::mutex> lane_lock(lane.mutex);
+                lane.done = true;
+            }
+            lane.cv.notify_all();
+        }
+        for (auto& lane : lanes) {
+            lane.thread.join();
+        }
     }
     
-    return result;
+    LOG_INFO("Replayed " << stats.entries << " log entries after index "
+              << from - 1 << " on " << threads << " thread(s)");
+    return stats;
+}
+
+std::vector<LogEntry> WriteAheadLog::getEntriesFrom(int start_index, size_t max_entries,
+                                                    size_t max_bytes) const {
+    // As getEntry: the cached part is copied under the lock, the part that
+    // fell out of the cache is read from disk after it
+    for (;;) {
+        std::vector<LogEntry> result;
+        std::vector<LogEntry> cached;
+        SegmentRead plan;
+        int end_index;
+        int cached_from;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (start_index < first_log_index_ || start_index > last_index_ || max_entries == 0) {
+                return result;
+            }
+            end_index = last_index_;
+            if (max_entries < static_cast<size_t>(last_index_ - start_index + 1)) {
+                end_index = start_index + static_cast<int>(max_entries) - 1;
+            }
+            
+            cached_from = log_cache_.empty() ? last_index_ + 1 : cache_first_index_;
+            plan.truncations = truncations_;
+            if (start_index < cached_from &&
+                !planRead(start_index, std::min(end_index, cached_from - 1), plan)) {
+                return result;
+            }
+            
+            // Copies share the cached bytes. No more than max_bytes could be
+            // used whatever comes off disk.
+            size_t begin = start_index > cached_from ? static_cast<size_t>(start_index - cached_from) : 0;
+            size_t end = end_index >= cached_from ? static_cast<size_t>(end_index - cached_from + 1) : 0;
+            size_t bytes = 0;
+            for (size_t i = begin; i < end && i < log_cache_.size(); i++) {
+                cached.push_back(log_cache_[i]);
+                bytes += log_cache_[i].payloadBytes();
+                if (bytes > max_bytes) {
+                    break;
+                }
+            }
+        }
+        result.reserve(end_index - start_index + 1);
+        
+        size_t bytes = 0;
+        bool full = false;
+        auto fits = [&](const LogEntry& e) {
+            bytes += e.payloadBytes();
+            full = !result.empty() && bytes > max_bytes;
+            return !full;
+        };
+        
+        if (start_index < cached_from) {
+            readPlanned(plan, start_index, std::min(end_index, cached_from - 1), [&](LogEntry& e) {
+                if (!fits(e)) return false;
+                result.push_back(std::move(e));
+                return true;
+            });
+        }
+        for (size_t i = 0; i < cached.size() && !full && fits(cached[i]); i++) {
+            result.push_back(std::move(cached[i]));
+        }
+        
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (plan.truncations == truncations_) {
+            return result;
+        }
+    }
 }
 
 void WriteAheadLog::saveMetadata(int current_term, int voted_for) {
     std::ofstream out(metadata_filename_);
     if (!out) {
-        std::cerr << "[ERROR] Failed to save metadata\n";
+        LOG_ERROR("Failed to save metadata");
         return;
     }
     
@@ -131,58 +988,148 @@ void WriteAheadLog::loadMetadata(int& current_term, int& voted_for) {
     }
     
     in >> current_term >> voted_for;
-    std::cout << "[INFO] Loaded metadata: term=" << current_term 
-              << ", voted_for=" << voted_for << std::endl;
+    LOG_INFO("Loaded metadata: term=" << current_term 
+              << ", voted_for=" << voted_for);
 }
 
 int WriteAheadLog::size() const {
     std::lock_guard<std::mutex> lock(mutex_);
-    return static_cast<int>(log_cache_.size());
+    return std::max(0, last_index_ - first_log_index_ + 1);
 }
 
 void WriteAheadLog::rebuildCache() {
     std::lock_guard<std::mutex> lock(mutex_);
     log_cache_.clear();
+    cache_bytes_ = 0;
+    segments_.clear();
     
-    std::ifstream in(filename_);
-    if (!in) {
-        // File doesn't exist yet, that's okay
-        return;
+    std::vector<int> segment_starts;
+    if (!loadManifest(segment_starts)) {
+        // No manifest yet: brand new log
+        first_log_index_ = 1;
+        snapshot_term_ = 0;
     }
+    term_runs_.clear();
+    last_index_ = first_log_index_ - 1;
+    last_term_ = snapshot_term_;
+    cache_first_index_ = first_log_index_;
     
-    std::string line;
-    while (std::getline(in, line)) {
-        if (line.empty()) continue;
+    // Only record headers are kept from this pass: the sparse index points
+    // and the tail window that fits in the cache budget
+    for (size_t i = 0; i < segment_starts.size(); i++) {
+        Segment segment;
+        segment.first_index = segment_starts[i];
+        segment.last_index = segment.first_index - 1;
+        segment.path = segmentPath(segment.first_index);
         
-        std::istringstream iss(line);
-        LogEntry entry;
-        iss >> entry.index >> entry.term >> entry.operation >> entry.key >> entry.value;
+        int fd = open(segment.path.c_str(), O_RDWR);
+        if (fd < 0) {
+            LOG_ERROR("WAL segment listed in manifest is missing: "
+                      << segment.path);
+            break;
+        }
+        
+        struct stat st;
+        fstat(fd, &st);
+        size_t file_size = static_cast<size_t>(st.st_size);
+        
+        char header[kFileHeaderSize];
+        if (pread(fd, header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header)) ||
+            !hasValidHeader(header, sizeof(header))) {
+            LOG_ERROR("WAL segment has an unknown format: " << segment.path);
+            close(fd);
+            break;
+        }
+        
+        size_t end = scanSegment(fd, kFileHeaderSize, [&](LogEntry& entry, size_t offset, size_t) {
+            if ((entry.index - segment.first_index) % kIndexInterval == 0) {
+                segment.index_points.push_back(offset);
+            }
+            segment.last_index = entry.index;
+            
+            // Segments may still hold a few entries already covered by a snapshot
+            if (entry.index >= first_log_index_) {
+                last_index_ = entry.index;
+                last_term_ = entry.term;
+                noteTerm(entry.index, entry.term);
+                cacheAppend(entry);
+            }
+            return true;
+        });
+        segment.bytes = end;
+        
+        bool torn = end < file_size;
+        if (torn) {
+            // Torn write from a crash mid-append: drop the partial tail record
+            LOG_WARN("Discarding " << (file_size - end)
+                      << " bytes of torn/corrupt data at the end of " << segment.path);
+            if (ftruncate(fd, static_cast<off_t>(end)) != 0) {
+                LOG_ERROR("Failed to truncate WAL tail: " << strerror(errno));
+            }
+            fdatasync(fd);
+        }
+        close(fd);
+        
+        segments_.push_back(segment);
         
-        log_cache_.push_back(entry);
+        // Anything after a damaged segment can't be trusted to follow on from it
+        if (torn) {
+            break;
+        }
+    }
+    
+    // Strays are judged against the manifest on disk, so it must be current
+    // before any are removed
+    if (segments_.size() != segment_starts.size() && !persistManifest()) {
+        markFailedLocked("can't record dropped segments in its manifest");
+    } else {
+        removeStraySegments();
+    }
+    
+    if (segments_.empty()) {
+        if (!createSegment(first_log_index_)) {
+            markFailedLocked("can't create its first segment");
+        }
+    } else {
+        fd_ = openSegmentFile(segments_.back().path);
+        if (fd_ < 0) {
+            markFailedLocked("can't open its tail segment");
+        }
     }
     
-    std::cout << "[INFO] Loaded " << log_cache_.size() << " entries from WAL\n";
+    LOG_INFO("Loaded " << std::max(0, last_index_ - first_log_index_ + 1)
+              << " entries from WAL (" << segments_.size() << " segments, first index "
+              << first_log_index_ << ", " << log_cache_.size() << " cached)");
 }
 
-void WriteAheadLog::persistCache() {
+void WriteAheadLog::removeStraySegments() {
     // Assumes mutex is already held
-    std::ofstream out(filename_, std::ios::trunc);
-    if (!out) {
-        std::cerr << "[ERROR] Failed to persist WAL cache\n";
+    // Segment files the manifest doesn't know about are leftovers from a
+    // crash between a manifest update and the matching unlink/create
+    DIR* dir = opendir(dir_.c_str());
+    if (!dir) {
         return;
     }
     
-    for (const auto& entry : log_cache_) {
-        out << entry.index << " " 
-            << entry.term << " " 
-            << entry.operation << " " 
-            << entry.key << " " 
-            << entry.value << "\n";
+    struct dirent* dent;
+    while ((dent = readdir(dir)) != nullptr) {
+        std::string name = dent->d_name;
+        if (name.size() < 4 || name.compare(name.size() - 4, 4, ".seg") != 0) {
+            continue;
+        }
+        
+        std::string path = dir_ + "/" + name;
+        bool live = std::any_of(segments_.begin(), segments_.end(),
+                                [&](const Segment& s) { return s.path == path; });
+        if (!live) {
+            LOG_INFO("Removing stray WAL segment " << path);
+            unlink(path.c_str());
+        }
     }
-    
-    out.flush();
+    closedir(dir);
 }
 
+
 // ============================================================================
 // SNAPSHOT INTEGRATION IMPLEMENTATIONS
 // ============================================================================
@@ -190,74 +1137,113 @@ void WriteAheadLog::persistCache() {
 void WriteAheadLog::discardEntriesBefore(int snapshot_index) {
     std::lock_guard<std::mutex> lock(mutex_);
     
-    std::cout << "[INFO] Compacting log: discarding entries up to index " 
-              << snapshot_index << std::endl;
+    LOG_INFO("Compacting log: discarding entries up to index " 
+              << snapshot_index);
     
-    // Find position of snapshot_index in our cache
-    // Remember: log_cache_ uses 0-based indexing, but log entries use 1-based
-    int cache_position = -1;
-    for (size_t i = 0; i < log_cache_.size(); i++) {
-        if (log_cache_[i].index == snapshot_index) {
-            cache_position = i;
-            break;
-        }
+    if (snapshot_index < first_log_index_) {
+        LOG_WARN("Snapshot index " << snapshot_index 
+                  << " is already compacted (first index " << first_log_index_ << ")");
+        return;
     }
     
-    if (cache_position == -1) {
-        std::cout << "[WARN] Snapshot index " << snapshot_index 
-                  << " not found in log cache (might already be compacted)" << std::endl;
-        return;
+    // Remember the boundary term before its entry disappears, so log
+    // matching at first_log_index_ - 1 still works afterwards
+    auto it = std::upper_bound(term_runs_.begin(), term_runs_.end(), snapshot_index,
+                               [](int i, const std::pair<int, int>& run) { return i < run.first; });
+    if (it != term_runs_.begin()) {
+        snapshot_term_ = std::prev(it)->second;
     }
     
-    // Remove all entries up to and including snapshot_index
-    log_cache_.erase(log_cache_.begin(), log_cache_.begin() + cache_position + 1);
+    // Remove all cached entries up to and including snapshot_index
+    while (!log_cache_.empty() && log_cache_.front().index <= snapshot_index) {
+        cache_bytes_ -= cachedSize(log_cache_.front());
+        log_cache_.pop_front();
+        cache_first_index_++;
+    }
+    first_log_index_ = snapshot_index + 1;
+    if (log_cache_.empty()) {
+        cache_first_index_ = std::max(cache_first_index_, first_log_index_);
+    }
+    while (term_runs_.size() > 1 && term_runs_[1].first <= first_log_index_) {
+        term_runs_.erase(term_runs_.begin());
+    }
+    if (last_index_ < first_log_index_) {
+        // Compacted past everything we had (follower behind its snapshot)
+        last_index_ = snapshot_index;
+        last_term_ = snapshot_term_;
+        term_runs_.clear();
+    }
     
-    // Update first_log_index
-    if (!log_cache_.empty()) {
-        first_log_index_ = log_cache_[0].index;
-    } else {
-        first_log_index_ = snapshot_index + 1;
+    // Whole segments that lie entirely below the snapshot can be deleted.
+    // The tail segment always stays: it's the one being appended to.
+    std::vector<Segment> dropped;
+    while (segments_.size() > 1 && segments_.front().last_index <= snapshot_index) {
+        dropped.push_back(segments_.front());
+        segments_.erase(segments_.begin());
     }
     
-    // Persist the compacted log to disk
-    persistCache();
+    // The manifest is the source of truth, so update it before unlinking.
+    // If that fails the old one still describes a sound (longer) log; the
+    // files stay until a later manifest leaves them out and startup clears
+    // them as strays.
+    if (persistManifest()) {
+        for (const auto& segment : dropped) {
+            removeSegmentFile(segment);
+        }
+    } else {
+        LOG_WARN("Keeping " << dropped.size() << " compacted WAL segments until the manifest can be updated");
+    }
     
-    std::cout << "[SUCCESS] Log compacted. First index is now " 
-              << first_log_index_ << ", " << log_cache_.size() 
-              << " entries remaining" << std::endl;
+    LOG_INFO("Log compacted. First index is now " 
+              << first_log_index_ << ", " << std::max(0, last_index_ - first_log_index_ + 1)
+              << " entries remaining, " << dropped.size() << " segments deleted");
 }
 
 int WriteAheadLog::getFirstLogIndex() const {
     std::lock_guard<std::mutex> lock(mutex_);
-    
-    if (log_cache_.empty()) {
-        return first_log_index_;
-    }
-    
-    return log_cache_[0].index;
+    return first_log_index_;
 }
 
 void WriteAheadLog::installSnapshot(int last_included_index, int last_included_term) {
     std::lock_guard<std::mutex> lock(mutex_);
     
-    std::cout << "[INFO] Installing snapshot: last_included_index=" 
+    LOG_INFO("Installing snapshot: last_included_index=" 
               << last_included_index << ", last_included_term=" 
-              << last_included_term << std::endl;
+              << last_included_term);
     
     // Clear all existing log entries
+    truncations_++;
     log_cache_.clear();
+    cache_bytes_ = 0;
+    writer_->flush(stream_);
     
     // Set first log index to the entry after the snapshot
     first_log_index_ = last_included_index + 1;
+    cache_first_index_ = first_log_index_;
+    last_index_ = last_included_index;
+    last_term_ = last_included_term;
+    snapshot_term_ = last_included_term;
+    term_runs_.clear();
     
-    // Persist empty log
-    persistCache();
+    // Start over with a single empty segment (this also rewrites the manifest)
+    std::vector<Segment> dropped;
+    dropped.swap(segments_);
+    if (!createSegment(first_log_index_)) {
+        // The old files stay: the manifest may still list them
+        markFailedLocked("can't start over after a snapshot");
+        return;
+    }
+    for (const auto& segment : dropped) {
+        if (segment.path != segments_.back().path) {
+            removeSegmentFile(segment);
+        }
+    }
     
-    // Save metadata with the snapshot's term
-    // This is CRITICAL for log matching when entries are appended
-    saveMetadata(last_included_term, -1);
+    // snapshot_term_ went into the manifest with the new segment, which is
+    // what log matching at the boundary needs. current_term/voted_for in
+    // meta belong to the server and must not be rolled back here.
     
-    std::cout << "[SUCCESS] Snapshot installed. Next log index will be " 
-              << first_log_index_ << std::endl;
+    LOG_INFO("Snapshot installed. Next log index will be " 
+              << first_log_index_);
 }
 
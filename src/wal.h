@@ -2,45 +2,115 @@
 #include <string>
 #include <fstream>
 #include <vector>
+#include <deque>
+#include <functional>
 #include <mutex>
+#include <memory>
+#include <cstdint>
 #include "store.h"
+#include "wal_writer.h"
+#include "log_entry.h"
 
-struct LogEntry {
-    int index;
-    int term;
-    std::string key;
-    std::string value;
-    std::string operation; // "PUT", "DELETE", etc.
-    
-    LogEntry() : index(-1), term(-1) {}
-    LogEntry(int idx, int t, const std::string& k, const std::string& v, const std::string& op = "PUT")
-        : index(idx), term(t), key(k), value(v), operation(op) {}
+class ClientSessions;
+
+struct WalReplayStats {
+    size_t entries = 0;         // Log entries replayed
+    size_t threads = 1;         // Appliers actually used
 };
 
+/**
+ * WriteAheadLog
+ *
+ * ON-DISK LAYOUT:
+ * The log is a directory of fixed-size segment files plus a MANIFEST:
+ *   <dir>/MANIFEST                 first_log_index + list of live segments
+ *   <dir>/<first index>.seg        one file per segment, oldest first
+ *   <dir>/meta                     current_term / voted_for
+ * Compaction deletes whole segments below the snapshot and truncation only
+ * cuts the tail, so neither rewrites the log. The manifest is replaced
+ * atomically (write temp + rename) and always updated before files are
+ * unlinked; stray segments it doesn't list are removed on startup.
+ *
+ * SEGMENT FORMAT:
+ * File header: "LOGKVWAL" magic + u32 format version
+ * Then one record per entry, all integers little-endian:
+ *   [u32 crc32][u32 payload_len] payload
+ *   payload = [u64 index][u64 term][u8 op][u32 key_len][u32 value_len][key][value]
+ * The CRC covers the payload. Keys and values are raw bytes, so spaces and
+ * newlines survive. A torn or corrupt tail record is dropped on startup.
+ *
+ * All writes go through one long-lived fd owned by a WalWriter, which
+ * group-commits concurrent appends according to WalOptions::sync_mode.
+ *
+ * MEMORY:
+ * Only a tail window of recent entries is kept in memory, capped at
+ * WalOptions::cache_bytes. Cached entries share the arena blocks their
+ * batch was built in (see log_entry.h), so handing them out copies no
+ * key or value bytes. Each segment keeps a sparse index (the file
+ * offset of every 32nd entry), so older entries are read back from disk on
+ * demand with one seek plus a short forward scan. That read happens after
+ * mutex_ is released: the segments it needs are opened under the lock (so
+ * compaction can't unlink them first) and read outside it, and if the log
+ * was truncated in between, the read is done again.
+ */
 class WriteAheadLog {
 public:
-    explicit WriteAheadLog(const std::string& filename);
+    // Logs of one node can share a writer (and so its commit window); by
+    // default the log gets one of its own. The writer's sync mode wins.
+    explicit WriteAheadLog(const std::string& dir,
+                           const WalOptions& options = WalOptions(),
+                           std::shared_ptr<WalWriter> writer = nullptr);
+    ~WriteAheadLog();
+    
+    // Append a log entry (returns once durable per the sync mode). False if
+    // it isn't durable and never will be: a write or sync failed, a new
+    // segment or the manifest listing it couldn't be written, or an earlier
+    // truncateFrom() couldn't cut the file. That's sticky; every later
+    // append fails too, and the entries of the failed batch stay in memory
+    // only, so nothing may acknowledge them.
+    bool appendEntry(const LogEntry& entry);
     
-    // Append a log entry
-    void appendEntry(const LogEntry& entry);
+    // Append consecutive entries with one durability wait for the batch
+    bool appendEntries(const std::vector<LogEntry>& entries);
+    
+    // An append failed (see appendEntry)
+    bool failed() const;
     
     // Get entry at index (1-indexed)
     bool getEntry(int index, LogEntry& entry) const;
     
+    // Get the term of the entry at index without copying it. Also answers
+    // for first_log_index - 1, whose entry only survives in the snapshot.
+    bool getTerm(int index, int& term) const;
+    
+    // Conflict hints for catch-up (see Replicator). termStartIndex is the
+    // first index of the run of equal terms holding index, 0 if index isn't
+    // in the log; lastIndexOfTerm is the last index holding term, 0 if none.
+    int termStartIndex(int index) const;
+    int lastIndexOfTerm(int term) const;
+    
     // Get the last log entry
     bool getLastEntry(LogEntry& entry) const;
     
     // Get last log index and term
     void getLastLogInfo(int& last_index, int& last_term) const;
     
-    // Truncate log from index onwards (for conflict resolution)
+    // Truncate log from index onwards (for conflict resolution). If the
+    // file can't be cut, the log is left as it was and marked failed.
     void truncateFrom(int index);
     
-    // Replay all entries to rebuild state
-    void replay(KVStore& store);
+    // Rebuild state from the entries after after_index (the snapshot's last
+    // index). Entries are split by key across up to `threads` appliers, so
+    // each key still sees its writes in log order. sessions, the client
+    // session table as of after_index, drops retried SESSION writes; it
+    // isn't changed.
+    WalReplayStats replay(KVStore& store, int after_index = 0, size_t threads = 1,
+                          const ClientSessions* sessions = nullptr);
     
-    // Get all entries from start_index onwards
-    std::vector<LogEntry> getEntriesFrom(int start_index) const;
+    // Get entries from start_index onwards, at most max_entries of them and,
+    // past the first, at most max_bytes of keys and values
+    std::vector<LogEntry> getEntriesFrom(int start_index, size_t max_entries = SIZE_MAX,
+                                         size_t max_bytes = SIZE_MAX) const;
     
     // Persist metadata (current_term, voted_for)
     void saveMetadata(int current_term, int voted_for);
@@ -107,16 +177,101 @@ public:
      */
     void installSnapshot(int last_included_index, int last_included_term);
 
+    // Binary record encoding (see format above)
+    static std::string encodeRecord(const LogEntry& entry);
+    
+    // Decode one record from data, its key and value into arena; returns
+    // false if truncated or corrupt
+    static bool decodeRecord(const char* data, size_t available, LogArena& arena,
+                             LogEntry& entry, size_t& consumed);
+
 private:
-    std::string filename_;
+    struct Segment {
+        int first_index;    // Index the segment was started at (also its file name)
+        int last_index;     // Highest index stored; first_index - 1 when empty
+        size_t bytes;       // File size including header
+        std::string path;
+        
+        // File offset of entries first_index, first_index + 32, ...
+        std::vector<size_t> index_points;
+    };
+    
+    std::string dir_;
+    std::string manifest_path_;
     std::string metadata_filename_;
-    mutable std::vector<LogEntry> log_cache_;  // In-memory cache
+    WalOptions options_;
+    std::vector<Segment> segments_;     // Oldest first; back() is the tail
+    int fd_ = -1;                       // Tail segment, written through writer_
+    std::shared_ptr<WalWriter> writer_;
+    WalWriter::Stream stream_ = 0;
+    bool failed_ = false;               // An append wasn't made durable
+    
+    void markFailed();
+    void markFailedLocked(const char* why);
     mutable std::mutex mutex_;
     
+    // Tail window of the log: entries [cache_first_index_, last_index_]
+    std::deque<LogEntry> log_cache_;
+    int cache_first_index_ = 1;
+    size_t cache_bytes_ = 0;
+    
+    int last_index_ = 0;
+    int last_term_ = 0;
+    // Bumped whenever entries are overwritten (truncateFrom, installSnapshot),
+    // so a read made outside the lock can tell it may have seen both logs
+    uint64_t truncations_ = 0;
+    
+    // (first index, term) for each run of equal terms, ascending. Terms only
+    // change at elections, so this stays tiny and answers getTerm in memory.
+    std::vector<std::pair<int, int>> term_runs_;
+    int snapshot_term_ = 0;     // Term of entry first_log_index_ - 1
+    
     // Track the first log index (for log compaction)
-    // After compaction, first index might be > 1
+    // After compaction, first index might be > 1. Persisted in the manifest.
     mutable int first_log_index_ = 1;
     
     void rebuildCache();
-    void persistCache();
+    
+    // Segment/manifest management (all assume mutex_ is held)
+    std::string segmentPath(int first_index) const;
+    static int openSegmentFile(const std::string& path);
+    // False if the segment or the manifest listing it didn't make it to disk
+    bool createSegment(int first_index);
+    bool persistManifest();
+    bool loadManifest(std::vector<int>& segment_starts);
+    void removeStraySegments();
+    static void removeSegmentFile(const Segment& segment);
+    
+    // Walk records from start_offset; fn(entry, offset, size) returns false
+    // to stop before that record. Returns the offset where scanning ended.
+    static size_t scanSegment(int fd, size_t start_offset,
+                              const std::function<bool(LogEntry&, size_t, size_t)>& fn);
+    size_t seekOffset(const Segment& segment, int index) const;
+    
+    // Entries [from, to] to be read from disk: the segments they span,
+    // opened under mutex_ and read without it
+    struct SegmentRead {
+        struct File {
+            int fd;
+            size_t offset;      // Where to start scanning
+        };
+        std::vector<File> files;
+        bool tail = false;          // Includes the tail: flush the writer first
+        uint64_t truncations = 0;   // truncations_ when planned
+        
+        SegmentRead() = default;
+        SegmentRead(const SegmentRead&) = delete;
+        SegmentRead& operator=(const SegmentRead&) = delete;
+        ~SegmentRead();
+    };
+    bool planRead(int from, int to, SegmentRead& plan) const;
+    // fn returns false to stop early. Doesn't need mutex_.
+    void readPlanned(const SegmentRead& plan, int from, int to,
+                     const std::function<bool(LogEntry&)>& fn) const;
+    // Both of the above, with mutex_ held throughout (replay)
+    bool readFromSegments(int from, int to, const std::function<bool(LogEntry&)>& fn) const;
+    // False, the log marked failed, if there's no segment to write it to
+    bool appendLocked(const LogEntry& entry, uint64_t& ticket);
+    void cacheAppend(const LogEntry& entry);
+    void noteTerm(int index, int term);
 };
\ No newline at end of file
@@ -0,0 +1,193 @@
+#include "wal_writer.h"
+#include "log.h"
+#include "metrics.h"
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+WalWriter::WalWriter(const WalOptions& options)
+    : options_(options) {
+    thread_ = std::thread(&WalWriter::run, this);
+}
+
+WalWriter::~WalWriter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+        work_cv_.notify_all();
+    }
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+WalWriter::Stream WalWriter::addStream(int fd) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    StreamState state;
+    state.fd = fd;
+    state.good_bytes = fileSize(fd);
+    streams_.push_back(std::move(state));
+    return streams_.size() - 1;
+}
+
+void WalWriter::removeStream(Stream stream) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    uint64_t target = submitted_;
+    done_cv_.wait(lock, [&]{ return completed_ >= target; });
+    streams_[stream].fd = -1;
+}
+
+uint64_t WalWriter::submit(Stream stream, const std::string& record) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (pending_entries_ == 0) {
+        oldest_pending_ = std::chrono::steady_clock::now();
+    }
+    streams_[stream].pending += record;
+    pending_entries_++;
+
+    uint64_t ticket = ++submitted_;
+    work_cv_.notify_one();
+    return ticket;
+}
+
+bool WalWriter::wait(Stream stream, uint64_t ticket) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [&]{ return completed_ >= ticket; });
+    const StreamState& state = streams_[stream];
+    return !state.failed || ticket <= state.failed_after;
+}
+
+bool WalWriter::flush(Stream stream) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    uint64_t target = submitted_;
+    done_cv_.wait(lock, [&]{ return completed_ >= target; });
+    return !streams_[stream].failed;
+}
+
+bool WalWriter::failed(Stream stream) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return streams_[stream].failed;
+}
+
+void WalWriter::setFd(Stream stream, int fd) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    uint64_t target = submitted_;
+    done_cv_.wait(lock, [&]{ return completed_ >= target; });
+    streams_[stream].fd = fd;
+    streams_[stream].good_bytes = fileSize(fd);
+}
+
+void WalWriter::run() {
+    metrics::Histogram& fsync_latency = metrics::registry().histogram(
+        "logkv_wal_fsync_seconds", "Duration of each WAL group commit fdatasync");
+    metrics::Histogram& batch_records = metrics::registry().histogram(
+        "logkv_wal_group_commit_records", "Records made durable per group commit", {},
+        metrics::Unit::NONE);
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    while (true) {
+        work_cv_.wait(lock, [&]{ return pending_entries_ > 0 || stop_; });
+
+        if (pending_entries_ == 0 && stop_) {
+            break;
+        }
+
+        // In batch mode, let more appenders join until the batch is full or
+        // the oldest record has waited long enough
+        if (options_.sync_mode == WalSyncMode::BATCH && !stop_) {
+            auto deadline = oldest_pending_ + options_.batch_interval;
+            work_cv_.wait_until(lock, deadline, [&]{
+                return pending_entries_ >= options_.batch_entries || stop_;
+            });
+        }
+
+        // Each stream's share of the batch, for its own file. A failed
+        // stream's records are dropped: its waiters get false regardless.
+        struct Share {
+            Stream stream;
+            int fd;
+            uint64_t good_bytes;
+            std::string data;
+            bool ok = true;
+        };
+        std::vector<Share> batch;
+        for (Stream i = 0; i < streams_.size(); i++) {
+            StreamState& stream = streams_[i];
+            if (!stream.pending.empty() && !stream.failed) {
+                batch.push_back(Share{i, stream.fd, stream.good_bytes, std::move(stream.pending)});
+            }
+            stream.pending.clear();
+        }
+        pending_entries_ = 0;
+        uint64_t batch_start = completed_;
+        uint64_t batch_end = submitted_;
+        uint64_t batch_size = batch_end - completed_;
+
+        lock.unlock();
+
+        // Write every stream's file, then sync the ones written
+        for (auto& share : batch) {
+            share.ok = writeAll(share.fd, share.data);
+        }
+        if (options_.sync_mode != WalSyncMode::OS) {
+            for (auto& share : batch) {
+                if (!share.ok) {
+                    continue;
+                }
+                auto sync_start = std::chrono::steady_clock::now();
+                if (fdatasync(share.fd) != 0) {
+                    LOG_ERROR("WAL fdatasync failed: " << strerror(errno));
+                    share.ok = false;
+                }
+                fsync_latency.recordSince(sync_start);
+            }
+        }
+        // A failed share may have left part of a record behind; cut the file
+        // back to where the batch started so a restart reads a clean tail
+        for (const auto& share : batch) {
+            if (!share.ok) {
+                if (ftruncate(share.fd, static_cast<off_t>(share.good_bytes)) != 0 ||
+                    fdatasync(share.fd) != 0) {
+                    LOG_ERROR("WAL could not cut back a failed write: " << strerror(errno));
+                }
+                LOG_ERROR("WAL stream failed; no further appends to it will be acknowledged");
+            }
+        }
+        batch_records.record(batch_size);
+
+        lock.lock();
+        for (const auto& share : batch) {
+            StreamState& stream = streams_[share.stream];
+            if (!share.ok) {
+                stream.failed = true;
+                stream.failed_after = batch_start;
+            } else if (stream.fd == share.fd) {
+                stream.good_bytes = share.good_bytes + share.data.size();
+            }
+        }
+        completed_ = batch_end;
+        done_cv_.notify_all();
+    }
+}
+
+uint64_t WalWriter::fileSize(int fd) {
+    struct stat st;
+    return fd >= 0 && fstat(fd, &st) == 0 ? static_cast<uint64_t>(st.st_size) : 0;
+}
+
+bool WalWriter::writeAll(int fd, const std::string& data) {
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            LOG_ERROR("WAL write failed: " << strerror(errno));
+            return false;
+        }
+        written += static_cast<size_t>(n);
+    }
+    return true;
+}
@@ -0,0 +1,125 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * When the WAL considers an append durable
+ *
+ * - PER_ENTRY: every append returns only after its bytes are fdatasync'ed.
+ *   Concurrent appends still share one write+fdatasync (group commit).
+ * - BATCH: appends linger until batch_entries records are queued or
+ *   batch_interval has passed since the oldest one, then the whole batch
+ *   is written and fdatasync'ed together. Trades latency for throughput.
+ * - OS: records are written but never fdatasync'ed; the page cache decides
+ *   when they hit disk. Fastest, can lose the tail on power failure.
+ */
+enum class WalSyncMode {
+    PER_ENTRY,
+    BATCH,
+    OS
+};
+
+struct WalOptions {
+    WalSyncMode sync_mode = WalSyncMode::PER_ENTRY;
+    size_t batch_entries = 64;
+    std::chrono::microseconds batch_interval{1000};
+    size_t segment_bytes = 64 * 1024 * 1024;  // Roll to a new WAL segment past this size
+    size_t cache_bytes = 64 * 1024 * 1024;    // Memory for cached recent entries
+};
+
+/**
+ * WalWriter
+ *
+ * Group-commit writer that owns the WAL's long-lived file descriptors.
+ *
+ * Appenders hand over an already-encoded record with submit() and get a
+ * ticket back. A single background thread drains everything queued so far
+ * into one write() followed by (depending on the sync mode) one
+ * fdatasync(), then wakes every appender whose ticket is covered.
+ *
+ * STREAMS:
+ * Several logs can share one writer (one per Raft group on a node, see
+ * node.h). Each registers its tail file as a stream; a batch then writes
+ * each stream's records to its own file and syncs every file it touched,
+ * so all the groups' appenders of a batch share one commit window.
+ * Tickets are global and complete in order.
+ *
+ * FAILURE:
+ * A write or fdatasync that fails marks its stream failed for good: the
+ * file is cut back to the end of its last good batch, so no torn record is
+ * left mid-segment, nothing more is written to it, and wait() on any of
+ * its tickets from that batch on returns false. Other streams go on.
+ *
+ * USAGE:
+ *   WalWriter::Stream s = writer.addStream(fd);
+ *   uint64_t ticket = writer.submit(s, record);   // cheap, under caller's lock
+ *   writer.wait(ticket);                          // outside the lock
+ */
+class WalWriter {
+public:
+    using Stream = size_t;
+
+    explicit WalWriter(const WalOptions& options);
+    ~WalWriter();
+
+    WalWriter(const WalWriter&) = delete;
+    WalWriter& operator=(const WalWriter&) = delete;
+
+    // Start writing to fd. Streams are never reused.
+    Stream addStream(int fd);
+    // Flush and forget the stream; the caller still owns (and closes) its fd
+    void removeStream(Stream stream);
+
+    // Queue one encoded record; returns its ticket
+    uint64_t submit(Stream stream, const std::string& record);
+
+    // Block until the record with this ticket is durable per the sync mode;
+    // false if it never will be (the stream failed)
+    bool wait(Stream stream, uint64_t ticket);
+
+    // Block until everything submitted so far is written; false if the
+    // stream failed
+    bool flush(Stream stream);
+
+    bool failed(Stream stream);
+
+    // Point a stream at a different file. Flushes first. The caller must
+    // make sure no submit() to that stream races with this call.
+    void setFd(Stream stream, int fd);
+
+    const WalOptions& options() const { return options_; }
+
+private:
+    struct StreamState {
+        int fd = -1;                    // -1 once removed
+        std::string pending;            // Encoded records not yet written
+        uint64_t good_bytes = 0;        // File size after the last good batch
+        bool failed = false;
+        uint64_t failed_after = 0;      // Tickets past this one of ours failed
+    };
+
+    WalOptions options_;
+
+    std::mutex mutex_;
+    std::condition_variable work_cv_;   // writer thread waits for records
+    std::condition_variable done_cv_;   // appenders wait for their ticket
+
+    std::vector<StreamState> streams_;
+    size_t pending_entries_ = 0;
+    std::chrono::steady_clock::time_point oldest_pending_;
+
+    uint64_t submitted_ = 0;            // Last ticket handed out
+    uint64_t completed_ = 0;            // Last ticket that is durable
+    bool stop_ = false;
+
+    std::thread thread_;
+
+    void run();
+    static bool writeAll(int fd, const std::string& data);
+    static uint64_t fileSize(int fd);
+};